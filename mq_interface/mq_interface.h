@@ -42,6 +42,16 @@ int mqInterface_send(const char *message, int pid);
  */
 int mqInterface_receive(char **msg_ptr);
 
+/**
+ * @brief Get pollable descriptor of message queue
+ * @details The descriptor becomes readable when a message is waiting, so it
+ * can be watched with poll()/epoll() before calling ::mqInterface_receive().
+ *
+ * @return file descriptor or -1 if the backend has no pollable descriptor.
+ * In that case ::mqInterface_receive() doesn't wait and must be polled.
+ */
+int mqInterface_getFd();
+
 /**
  * @brief Destroy message queue
  * @details Removes the association between message queue descriptor and its
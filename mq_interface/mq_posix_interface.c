@@ -64,7 +64,7 @@ int mqInterface_send(const char *message, int pid)
     int ret = 0;
 
     strfmt(&queue_name, "%s-%d", CLIENT_QUEUE_PREFIX, pid);
-    if ((qd_client = mq_open(queue_name, O_WRONLY)) == 1)
+    if ((qd_client = mq_open(queue_name, O_WRONLY)) == (mqd_t)-1)
     {
         LOG(LOG_ERR, "Server: Not able to open client queue");
         ret = errno;
@@ -75,8 +75,8 @@ int mqInterface_send(const char *message, int pid)
     {
         LOG(LOG_ERR, "Server: Not able to send message to client");
         ret = errno;
-        goto out;
     }
+    mq_close(qd_client);
 out:
     free(queue_name);
     if (ret == 0)
@@ -98,6 +98,12 @@ int mqInterface_receive(char **msg_ptr)
     return 0;
 }
 
+int mqInterface_getFd()
+{
+    // on Linux mqd_t is a file descriptor
+    return (int)qd_server;
+}
+
 int mqInterface_destroy()
 {
     if (mq_close(qd_server) == -1)
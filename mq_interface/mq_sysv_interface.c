@@ -2,7 +2,9 @@
  * @file mq_sysv_interface.c
  * @brief A Message Queue interface based on System V lib
  * @details Message queue interface for quick communicate with other processes.
- * This uses System V message queue IPC.
+ * This uses System V message queue IPC. A receiver thread waits in msgrcv()
+ * and hands messages over through an eventfd, so the queue can be watched
+ * with epoll like the POSIX one and an idle process doesn't spin.
  * 
  * @author Pham Ngoc Thang (thangdc94)
  * @bug No known bug
@@ -11,9 +13,14 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
 #include <sys/types.h>
 #include <sys/ipc.h>
 #include <sys/msg.h>
+#include <sys/eventfd.h>
 
 #include "mq_interface.h"
 #include "logutil.h"
@@ -46,9 +53,135 @@
 /** Size of Receive Message Buffer  */
 #define MSG_BUFFER_SIZE 512
 
+/** Time to wait in us before receiving again after an error, so a lasting error doesn't spin */
+#define RECEIVE_RETRY_DELAY 100000
+
+/** Message received by receiver thread */
+typedef struct _ReceivedMsg_t
+{
+    char text[MSG_BUFFER_SIZE]; /**< message content */
+} ReceivedMsg_t;
+
 /** Message Queue id for this process */
 static int g_msqid;
 
+/** Messages handed over by receiver thread, used as a ring buffer */
+static ReceivedMsg_t g_received[MAX_MESSAGES];
+static int g_received_head;  /* index of oldest message */
+static int g_received_count; /* number of messages in ring buffer */
+static pthread_mutex_t g_received_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_received_cond = PTHREAD_COND_INITIALIZER; /* signaled when a slot is freed */
+static int g_stopping; /* receiver thread must stop, protected by g_received_mutex */
+
+/** Counts messages in ring buffer, -1 if receiver thread is not running */
+static int g_event_fd = -1;
+static pthread_t g_receiver;
+
+/**
+ * @brief Receiver thread
+ * @details Wait for messages with a blocking msgrcv() and push them to ring
+ * buffer. A message bigger than buffer is truncated, so it's rejected as not
+ * valid instead of blocking the queue. It stops when the queue is removed.
+ */
+static void *receiver_thread(void *arg)
+{
+    struct
+    {
+        long mtype;
+        char mtext[MSG_BUFFER_SIZE];
+    } rbuf;
+
+    while (1)
+    {
+        uint64_t one = 1;
+        ssize_t len;
+        int slot;
+
+        len = msgrcv(g_msqid, &rbuf, MSG_BUFFER_SIZE - 1, MESSAGE_TYPE, MSG_NOERROR);
+        if (len < 0)
+        {
+            int stopping;
+            if (errno == EIDRM || errno == EINVAL)
+            {
+                break; // queue is removed
+            }
+            if (errno != EINTR)
+            {
+                LOG(LOG_ERR, "Server: msgrcv failed: %s", strerror(errno));
+                usleep(RECEIVE_RETRY_DELAY);
+            }
+            pthread_mutex_lock(&g_received_mutex);
+            stopping = g_stopping;
+            pthread_mutex_unlock(&g_received_mutex);
+            if (stopping)
+            {
+                break;
+            }
+            continue;
+        }
+        rbuf.mtext[len] = '\0';
+
+        // keep messages in kernel queue while ring buffer is full
+        pthread_mutex_lock(&g_received_mutex);
+        while (g_received_count == MAX_MESSAGES && !g_stopping)
+        {
+            pthread_cond_wait(&g_received_cond, &g_received_mutex);
+        }
+        if (g_stopping)
+        {
+            pthread_mutex_unlock(&g_received_mutex);
+            break;
+        }
+        slot = (g_received_head + g_received_count) % MAX_MESSAGES;
+        memcpy(g_received[slot].text, rbuf.mtext, MSG_BUFFER_SIZE);
+        g_received[slot].text[MSG_BUFFER_SIZE - 1] = '\0';
+        g_received_count++;
+        pthread_mutex_unlock(&g_received_mutex);
+
+        if (write(g_event_fd, &one, sizeof(one)) != sizeof(one))
+        {
+            LOG(LOG_ERR, "Server: eventfd write failed: %s", strerror(errno));
+        }
+    }
+    LOG(LOG_DBG, "Receiver thread stopped");
+    return NULL;
+}
+
+/**
+ * @brief Start receiver thread
+ * @details All signals are blocked in receiver thread so they are handled by
+ * main thread.
+ *
+ * @return 0 if OK and -1 if failed
+ */
+static int start_receiver()
+{
+    sigset_t all;
+    sigset_t old;
+    int r;
+
+    // semaphore mode: each read() takes one message and blocks if none
+    g_event_fd = eventfd(0, EFD_SEMAPHORE | EFD_CLOEXEC);
+    if (g_event_fd < 0)
+    {
+        LOG(LOG_ERR, "Server: eventfd failed: %s", strerror(errno));
+        return -1;
+    }
+
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    r = pthread_create(&g_receiver, NULL, receiver_thread, NULL);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (r != 0)
+    {
+        LOG(LOG_ERR, "Server: Cannot start receiver thread: %s", strerror(r));
+        close(g_event_fd);
+        g_event_fd = -1;
+        return -1;
+    }
+    return 0;
+}
+
 int mqInterface_create()
 {
     // Create a new queue with permission if doesn't exist. If already exist just use it
@@ -62,6 +195,10 @@ int mqInterface_create()
         LOG(LOG_ERR, "Server: msgget (server):%s", strerror(errno));
         return -1;
     }
+    if (start_receiver() != 0)
+    {
+        LOG(LOG_WARN, "Server: receive without waiting");
+    }
     LOG(LOG_DBG, "mqInterface_create success msqid_server = %d", g_msqid);
     return 0;
 }
@@ -107,12 +244,36 @@ int mqInterface_send(const char *message, int pid)
 int mqInterface_receive(char **msg_ptr)
 {
     int ret = 0;
+    uint64_t value;
     // Declare message structure for received message.
     struct
     {
         long mtype;
         char mtext[MSG_BUFFER_SIZE];
     } rbuf;
+
+    if (g_event_fd >= 0)
+    {
+        // wait for receiver thread to hand over a message
+        while ((ret = read(g_event_fd, &value, sizeof(value))) < 0 && errno == EINTR)
+        {
+        }
+        if (ret != sizeof(value))
+        {
+            LOG(LOG_ERR, "Server: eventfd read failed: %s", strerror(errno));
+            return -1;
+        }
+        *msg_ptr = (char *)calloc(MSG_BUFFER_SIZE, sizeof(char));
+        pthread_mutex_lock(&g_received_mutex);
+        strcpy(*msg_ptr, g_received[g_received_head].text);
+        g_received_head = (g_received_head + 1) % MAX_MESSAGES;
+        g_received_count--;
+        pthread_cond_signal(&g_received_cond);
+        pthread_mutex_unlock(&g_received_mutex);
+        LOG(LOG_DBG, "mqInterface_receive success");
+        return 0;
+    }
+
     /*
      * Receive an answer of message type 1.
      */
@@ -130,6 +291,12 @@ int mqInterface_receive(char **msg_ptr)
     return 0;
 }
 
+int mqInterface_getFd()
+{
+    // System V queue is not a file descriptor, receiver thread signals eventfd
+    return g_event_fd;
+}
+
 int mqInterface_destroy()
 {
     if (msgctl(g_msqid, IPC_RMID, NULL) == -1)
@@ -137,6 +304,17 @@ int mqInterface_destroy()
         LOG(LOG_ERR, "Message queue could not be deleted");
         return -1;
     }
+    if (g_event_fd >= 0)
+    {
+        // blocked msgrcv() returns EIDRM after queue was removed
+        pthread_mutex_lock(&g_received_mutex);
+        g_stopping = 1;
+        pthread_cond_signal(&g_received_cond);
+        pthread_mutex_unlock(&g_received_mutex);
+        pthread_join(g_receiver, NULL);
+        close(g_event_fd);
+        g_event_fd = -1;
+    }
 
     LOG(LOG_DBG, "Message queue was deleted");
     return 0;
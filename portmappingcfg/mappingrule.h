@@ -30,6 +30,7 @@ typedef struct _MappingRule_t
     char eport[6];             /**< external port */
     char iport[6];             /**< internal port */
     SupportedProtocol_t proto; /**< protocol will be mapped */
+    long ttl;                  /**< lease in seconds, 0 for default ::LEASE_DURATION */
 } MappingRule_t;
 
 /** Generate switch case for ::get_proto_str() */
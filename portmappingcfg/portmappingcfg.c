@@ -18,6 +18,12 @@
 /** Config file path */
 #define PF_CONFIG_FILE "routerupnp_cfg.json"
 
+/** Journal file path, changes made after config file was saved, one per line */
+#define PF_JOURNAL_FILE "routerupnp_cfg.journal"
+
+/** Number of changes in journal file */
+static int g_num_of_changes = 0;
+
 /**
  * @brief create a new Port mapping config file
  * @details create a new port mapping config file with default value 
@@ -37,8 +43,8 @@ static int create_new_configfile()
         cJSON_AddFalseToObject(root, "enable");
         cJSON_AddItemToObject(root, "rules", rules);
         char *str = cJSON_Print(root);
-        cJSON_Delete(rules);
-        cJSON_Delete(root);
+        fprintf(fd, "%s\n", str);
+        cJSON_Delete(root); // rules are deleted with root
         free(str);
         fclose(fd);
         return 0;
@@ -101,6 +107,257 @@ cleanup:
     return content;
 }
 
+/**
+ * @brief Copy a string field of a rule
+ *
+ * @param[in] rule_item rule object
+ * @param[in] name name of field
+ * @param[out] dest destination
+ * @param[in] size size of @p dest
+ * @return 0 if OK and -1 if field is missing, not a string or too long
+ */
+static int parse_field(const cJSON *rule_item, const char *name, char *dest, size_t size)
+{
+    cJSON *field = cJSON_GetObjectItem(rule_item, name);
+    if (!cJSON_IsString(field) || field->valuestring == NULL || strlen(field->valuestring) >= size)
+    {
+        return -1;
+    }
+    strcpy(dest, field->valuestring);
+    return 0;
+}
+
+/**
+ * @brief Check a port number
+ *
+ * @param[in] port port number as string
+ * @return 1 (true) if @p port is a decimal number from 1 to 65535, 0 if not
+ */
+static int is_valid_port(const char *port)
+{
+    if (port[0] == '\0' || strspn(port, "0123456789") != strlen(port))
+    {
+        return 0;
+    }
+    return atol(port) >= 1 && atol(port) <= 65535;
+}
+
+/**
+ * @brief Parse a rule
+ *
+ * @param[in] rule_item rule object
+ * @param[in] need_iport 1 (true) if internal port is required, else it may be missing
+ * @param[out] rule rule
+ * @return 0 if OK and -1 if rule is not valid: a field is missing or a port
+ * is not a decimal number from 1 to 65535
+ */
+static int parse_rule(const cJSON *rule_item, int need_iport, MappingRule_t *rule)
+{
+    char proto[4];
+
+    if (!cJSON_IsObject(rule_item) || parse_field(rule_item, "eport", rule->eport, sizeof(rule->eport)) != 0 ||
+        !is_valid_port(rule->eport) || parse_field(rule_item, "proto", proto, sizeof(proto)) != 0)
+    {
+        return -1;
+    }
+    if (parse_field(rule_item, "iport", rule->iport, sizeof(rule->iport)) != 0)
+    {
+        if (need_iport)
+        {
+            return -1;
+        }
+        rule->iport[0] = '\0';
+    }
+    else if (!is_valid_port(rule->iport))
+    {
+        return -1;
+    }
+    if (strcmp("UDP", proto) == 0)
+    {
+        rule->proto = UDP;
+    }
+    else if (strcmp("TCP", proto) == 0)
+    {
+        rule->proto = TCP;
+    }
+    else
+    {
+        return -1;
+    }
+    cJSON *ttl_json = cJSON_GetObjectItem(rule_item, "ttl");
+    rule->ttl = (cJSON_IsNumber(ttl_json) && ttl_json->valuedouble > 0) ? (long)ttl_json->valuedouble : 0;
+    return 0;
+}
+
+/**
+ * @brief Parse port mapping config
+ *
+ * @param[in] json config object, may be NULL
+ * @param[in] need_iport 1 (true) if rules must have an internal port
+ * @return port mapping config, disabled without rules if @p json is not valid.
+ * If a rule is not valid, config has no rules and ::PortMappingCfg_t::op is
+ * ::PMCFG_OP_INVALID
+ */
+static PortMappingCfg_t parse_config(const cJSON *json, int need_iport)
+{
+    PortMappingCfg_t tmp = {0, 0, NULL, PMCFG_OP_REPLACE};
+    int i;
+
+    if (!cJSON_IsObject(json))
+    {
+        return tmp;
+    }
+    cJSON *enable_json = cJSON_GetObjectItem(json, "enable");
+    if (cJSON_IsBool(enable_json))
+    {
+        tmp.is_enable = cJSON_IsTrue(enable_json);
+    }
+    cJSON *rules = cJSON_GetObjectItem(json, "rules");
+    if (cJSON_IsArray(rules))
+    {
+        int arr_size = cJSON_GetArraySize(rules);
+        MappingRule_t *map = malloc((arr_size > 0 ? arr_size : 1) * sizeof(MappingRule_t));
+        if (map == NULL)
+        {
+            tmp.op = PMCFG_OP_INVALID;
+            return tmp;
+        }
+        for (i = 0; i < arr_size; i++)
+        {
+            if (parse_rule(cJSON_GetArrayItem(rules, i), need_iport, &map[i]) != 0)
+            {
+                free(map);
+                tmp.op = PMCFG_OP_INVALID;
+                return tmp;
+            }
+        }
+        tmp.numofrules = arr_size;
+        tmp.rules = map;
+    }
+    return tmp;
+}
+
+/**
+ * @brief Parse a change of port mapping config
+ * @details Same as ::parse_config() and "op" tells how rules change config.
+ * Rules to remove only need external port and protocol.
+ *
+ * @param[in] json change object, may be NULL
+ * @return change, ::PortMappingCfg_t::op is ::PMCFG_OP_INVALID if @p json is
+ * not an object, "op" is unknown, a rule is not valid or a replace has no
+ * boolean "enable"
+ */
+static PortMappingCfg_t parse_change(const cJSON *json)
+{
+    PortMappingCfg_t tmp;
+    PortMappingOp_t op = PMCFG_OP_REPLACE;
+    cJSON *op_json = cJSON_GetObjectItem(json, "op");
+
+    if (cJSON_IsString(op_json))
+    {
+        if (strcmp(op_json->valuestring, "add") == 0)
+        {
+            op = PMCFG_OP_ADD;
+        }
+        else if (strcmp(op_json->valuestring, "remove") == 0)
+        {
+            op = PMCFG_OP_REMOVE;
+        }
+        else if (strcmp(op_json->valuestring, "replace") != 0)
+        {
+            op = PMCFG_OP_INVALID;
+        }
+    }
+    tmp = parse_config(json, op != PMCFG_OP_REMOVE);
+    if (tmp.op != PMCFG_OP_INVALID)
+    {
+        tmp.op = op;
+    }
+    // a garbled request must not be taken for a request to disable
+    if (!cJSON_IsObject(json) || (tmp.op == PMCFG_OP_REPLACE && !cJSON_IsBool(cJSON_GetObjectItem(json, "enable"))))
+    {
+        free(tmp.rules);
+        tmp.rules = NULL;
+        tmp.numofrules = 0;
+        tmp.op = PMCFG_OP_INVALID;
+    }
+    return tmp;
+}
+
+/**
+ * @brief Create json array of rules
+ *
+ * @param[in] map rules
+ * @param[in] numofrules number of rules
+ * @return json array, to be deleted by cJSON_Delete()
+ */
+static cJSON *create_rules(const MappingRule_t *map, int numofrules)
+{
+    cJSON *rules = cJSON_CreateArray();
+    cJSON *rule_item;
+    int i;
+
+    for (i = 0; i < numofrules; i++)
+    {
+        rule_item = cJSON_CreateObject();
+        cJSON_AddStringToObject(rule_item, "eport", map[i].eport);
+        cJSON_AddStringToObject(rule_item, "iport", map[i].iport);
+        cJSON_AddStringToObject(rule_item, "proto", get_proto_str(map[i].proto));
+        if (map[i].ttl > 0)
+        {
+            cJSON_AddNumberToObject(rule_item, "ttl", map[i].ttl);
+        }
+        cJSON_AddItemToArray(rules, rule_item);
+    }
+    return rules;
+}
+
+/**
+ * @brief Apply changes of journal file to config
+ * @details A line which can't be parsed, such as the last one if we stopped
+ * while writing it, is skipped
+ *
+ * @param[in,out] pm_cfg config read from config file
+ */
+static void replay_journal(PortMappingCfg_t *pm_cfg)
+{
+    char *content = read_file(PF_JOURNAL_FILE);
+    char *line;
+    char *next;
+
+    g_num_of_changes = 0;
+    if (content == NULL)
+    {
+        return;
+    }
+    for (line = content; *line != '\0'; line = next)
+    {
+        next = strchr(line, '\n');
+        if (next != NULL)
+        {
+            *next++ = '\0';
+        }
+        else
+        {
+            next = line + strlen(line);
+        }
+        cJSON *root = cJSON_Parse(line);
+        if (root == NULL)
+        {
+            continue;
+        }
+        PortMappingCfg_t change = parse_change(root);
+        cJSON_Delete(root);
+        if (change.op == PMCFG_OP_ADD || change.op == PMCFG_OP_REMOVE)
+        {
+            PMCFG_applyChange(pm_cfg, &change);
+            g_num_of_changes++;
+        }
+        free(change.rules);
+    }
+    free(content);
+}
+
 PortMappingCfg_t PMCFG_getConfig()
 {
     PortMappingCfg_t tmp;
@@ -108,36 +365,21 @@ PortMappingCfg_t PMCFG_getConfig()
 
     if (content)
     {
-        int i;
         cJSON *root = cJSON_Parse(content);
         free(content);
-        cJSON *enable_json = cJSON_GetObjectItem(root, "enable");
-        if (cJSON_IsBool(enable_json))
+        tmp = parse_config(root, 1);
+        if (!cJSON_IsObject(root) || tmp.op == PMCFG_OP_INVALID)
         {
-            tmp.is_enable = cJSON_IsTrue(enable_json);
+            // a broken file must not be taken for a config without rules
+            free(tmp.rules);
+            tmp.is_enable = 0;
+            tmp.numofrules = 0;
+            tmp.rules = NULL;
+            tmp.op = PMCFG_OP_INVALID;
         }
-        cJSON *rules = cJSON_GetObjectItem(root, "rules");
-        if (cJSON_IsArray(rules))
+        else
         {
-            int arr_size = cJSON_GetArraySize(rules);
-            tmp.numofrules = arr_size;
-            MappingRule_t *map = malloc(arr_size * sizeof(MappingRule_t));
-            cJSON *rule_item;
-            for (i = 0; i < arr_size; i++)
-            {
-                rule_item = cJSON_GetArrayItem(rules, i);
-                strcpy(map[i].eport, (cJSON_GetObjectItem(rule_item, "eport"))->valuestring);
-                strcpy(map[i].iport, (cJSON_GetObjectItem(rule_item, "iport"))->valuestring);
-                if (strcmp("UDP", (cJSON_GetObjectItem(rule_item, "proto"))->valuestring) == 0)
-                {
-                    map[i].proto = UDP;
-                }
-                else
-                {
-                    map[i].proto = TCP;
-                }
-            }
-            tmp.rules = map;
+            replay_journal(&tmp);
         }
         if (root != NULL)
         {
@@ -148,39 +390,152 @@ PortMappingCfg_t PMCFG_getConfig()
     {
         //if file does not exist, create it
         create_new_configfile();
+        remove(PF_JOURNAL_FILE);
+        g_num_of_changes = 0;
         tmp.is_enable = 0;
         tmp.numofrules = 0;
         tmp.rules = NULL;
+        tmp.op = PMCFG_OP_REPLACE;
+    }
+    return tmp;
+}
+
+PortMappingCfg_t PMCFG_parseRequest(const char *content, int *pid)
+{
+    PortMappingCfg_t tmp;
+    cJSON *root = cJSON_Parse(content);
+    cJSON *pid_json = cJSON_GetObjectItem(root, "pid");
+    if (cJSON_IsNumber(pid_json))
+    {
+        *pid = pid_json->valueint;
+    }
+    tmp = parse_change(cJSON_GetObjectItem(root, "data"));
+    if (root != NULL)
+    {
+        cJSON_Delete(root);
     }
     return tmp;
 }
+
 int PMCFG_saveConfig(PortMappingCfg_t *pm_cfg)
 {
-    int i;
     FILE *fd = fopen(PF_CONFIG_FILE, "w");
     if (fd)
     {
         cJSON *root;
-        cJSON *rules;
-        cJSON *rule_item;
         root = cJSON_CreateObject();
-        rules = cJSON_CreateArray();
         cJSON_AddBoolToObject(root, "enable", pm_cfg->is_enable);
-        cJSON_AddItemToObject(root, "rules", rules);
-        MappingRule_t *map = pm_cfg->rules;
-        for (i = 0; i < pm_cfg->numofrules; i++)
-        {
-            rule_item = cJSON_CreateObject();
-            cJSON_AddStringToObject(rule_item, "eport", map[i].eport);
-            cJSON_AddStringToObject(rule_item, "iport", map[i].iport);
-            cJSON_AddStringToObject(rule_item, "proto", get_proto_str(map[i].proto));
-            cJSON_AddItemToArray(rules, rule_item);
-        }
+        cJSON_AddItemToObject(root, "rules", create_rules(pm_cfg->rules, pm_cfg->numofrules));
         char *str = cJSON_Print(root);
         fprintf(fd, "%s\n", str); // save data to file
         cJSON_Delete(root);
         free(str);
         fclose(fd);
+        // changes are in config file now
+        remove(PF_JOURNAL_FILE);
+        g_num_of_changes = 0;
+        return 0;
+    }
+    return -1;
+}
+
+/**
+ * @brief Find a rule
+ *
+ * @param[in] pm_cfg config
+ * @param[in] rule rule to find
+ * @return index of rule with the same external port and protocol, -1 if not found
+ */
+static int find_rule(const PortMappingCfg_t *pm_cfg, const MappingRule_t *rule)
+{
+    int i;
+    for (i = 0; i < pm_cfg->numofrules; i++)
+    {
+        if (pm_cfg->rules[i].proto == rule->proto && strcmp(pm_cfg->rules[i].eport, rule->eport) == 0)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int PMCFG_applyChange(PortMappingCfg_t *pm_cfg, const PortMappingCfg_t *change)
+{
+    MappingRule_t *map;
+    int i;
+    int j;
+
+    switch (change->op)
+    {
+    case PMCFG_OP_REPLACE:
+        map = malloc((change->numofrules > 0 ? change->numofrules : 1) * sizeof(MappingRule_t));
+        if (map == NULL)
+        {
+            return -1;
+        }
+        if (change->numofrules > 0)
+        {
+            memcpy(map, change->rules, change->numofrules * sizeof(MappingRule_t));
+        }
+        free(pm_cfg->rules);
+        pm_cfg->rules = map;
+        pm_cfg->numofrules = change->numofrules;
+        pm_cfg->is_enable = change->is_enable;
+        return 0;
+    case PMCFG_OP_ADD:
+        map = realloc(pm_cfg->rules, (pm_cfg->numofrules + change->numofrules + 1) * sizeof(MappingRule_t));
+        if (map == NULL)
+        {
+            return -1;
+        }
+        pm_cfg->rules = map;
+        for (i = 0; i < change->numofrules; i++)
+        {
+            j = find_rule(pm_cfg, &change->rules[i]);
+            if (j < 0)
+            {
+                j = pm_cfg->numofrules++;
+            }
+            pm_cfg->rules[j] = change->rules[i];
+        }
+        return 0;
+    case PMCFG_OP_REMOVE:
+        for (i = 0; i < change->numofrules; i++)
+        {
+            j = find_rule(pm_cfg, &change->rules[i]);
+            if (j >= 0)
+            {
+                // order of rules doesn't matter, last one fills the hole
+                pm_cfg->rules[j] = pm_cfg->rules[--pm_cfg->numofrules];
+            }
+        }
+        return 0;
+    default:
+        return -1;
+    }
+}
+
+int PMCFG_saveChange(PortMappingCfg_t *pm_cfg, const PortMappingCfg_t *change)
+{
+    FILE *fd;
+
+    if ((change->op != PMCFG_OP_ADD && change->op != PMCFG_OP_REMOVE) || g_num_of_changes >= PMCFG_MAX_CHANGES)
+    {
+        return PMCFG_saveConfig(pm_cfg);
+    }
+    fd = fopen(PF_JOURNAL_FILE, "a");
+    if (fd)
+    {
+        cJSON *root;
+        root = cJSON_CreateObject();
+        cJSON_AddStringToObject(root, "op", change->op == PMCFG_OP_ADD ? "add" : "remove");
+        cJSON_AddItemToObject(root, "rules", create_rules(change->rules, change->numofrules));
+        char *str = cJSON_PrintUnformatted(root);
+        fprintf(fd, "%s\n", str); // one change per line
+        cJSON_Delete(root);
+        free(str);
+        fclose(fd);
+        g_num_of_changes++;
         return 0;
     }
     return -1;
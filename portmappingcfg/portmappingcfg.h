@@ -18,24 +18,55 @@
 /** Default Internal port value for Config */
 #define PM_DEFAUT_IPORT "0"
 
+/** Max number of changes in journal before whole config is saved again */
+#define PMCFG_MAX_CHANGES 64
+
+/** How rules of a request change current config */
+typedef enum _PortMappingOp_t
+{
+    PMCFG_OP_REPLACE, /**< rules are the whole config */
+    PMCFG_OP_ADD,     /**< rules are added, or updated if external port and protocol exist */
+    PMCFG_OP_REMOVE,  /**< rules with the same external port and protocol are removed */
+    PMCFG_OP_INVALID, /**< unknown operation */
+} PortMappingOp_t;
+
 /** Port mapping Config */
 typedef struct _PortMappingCfg_t
 {
     int is_enable;       /**< enable port mapping config for router over UPnP or not */
     int numofrules;      /**< number of rules */
     MappingRule_t *rules; /**< Rules you want to add to router */
+    PortMappingOp_t op;  /**< operation of a request, ::PMCFG_OP_REPLACE for a whole config */
 } PortMappingCfg_t;
 
 /**
  * @brief Get Port mapping config
  * @details Get Port mapping config from storage and create a new one with default
- * value if it doesn't exist.
+ * value if it doesn't exist. Changes saved by ::PMCFG_saveChange() are applied.
  * @warning you need to free() ::PortMappingCfg_t::rules if not NULL after use it
  *
- * @return port mapping config
+ * @return port mapping config, ::PortMappingCfg_t::op is ::PMCFG_OP_REPLACE.
+ * If config file is not a JSON object or one of its rules is not valid, config
+ * is disabled without rules, its op is ::PMCFG_OP_INVALID and file is left as is.
  */
 PortMappingCfg_t PMCFG_getConfig();
 
+/**
+ * @brief Parse request message from client
+ * @details Request has pid of client and a port mapping config in "data",
+ * see README.md. "op" of data tells if rules replace the config or are added
+ * to or removed from it, default is replace.
+ * @warning you need to free() ::PortMappingCfg_t::rules if not NULL after use it
+ *
+ * @param[in] content message from client
+ * @param[out] pid process id of client, unchanged if request has no pid
+ * @return port mapping config. ::PortMappingCfg_t::op is ::PMCFG_OP_INVALID
+ * if request is not JSON, has no "data" object, a replace has no boolean
+ * "enable", "op" is unknown or a rule is not valid: a field is missing, not a
+ * string or too long, or a port is not a decimal number from 1 to 65535.
+ */
+PortMappingCfg_t PMCFG_parseRequest(const char *content, int *pid);
+
 /**
  * @brief Save Port mapping config
  * @details Save Port mapping config to storage and create a new one with default
@@ -46,4 +77,28 @@ PortMappingCfg_t PMCFG_getConfig();
  */
 int PMCFG_saveConfig(PortMappingCfg_t *pm_cfg);
 
+/**
+ * @brief Apply a change to a config
+ * @details Rules are matched by external port and protocol. Enable state of
+ * @p pm_cfg is only changed by ::PMCFG_OP_REPLACE.
+ *
+ * @param[in,out] pm_cfg config to change
+ * @param[in] change request config, its ::PortMappingCfg_t::op tells how
+ * @return 0 if OK and < 0 if failed, @p pm_cfg is unchanged then
+ */
+int PMCFG_applyChange(PortMappingCfg_t *pm_cfg, const PortMappingCfg_t *change);
+
+/**
+ * @brief Save a change of Port mapping config
+ * @details Append an add or remove change to a journal next to the config
+ * file, so saving costs the size of the change and not of the config. After
+ * ::PMCFG_MAX_CHANGES changes, or for a replace, the whole config @p pm_cfg
+ * is saved and the journal is emptied.
+ *
+ * @param[in] pm_cfg config after the change
+ * @param[in] change change applied with ::PMCFG_applyChange()
+ * @return 0 if OK and < 0 if failed
+ */
+int PMCFG_saveChange(PortMappingCfg_t *pm_cfg, const PortMappingCfg_t *change);
+
 #endif //__PORT_MAPPING_CFG_H_
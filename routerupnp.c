@@ -8,33 +8,82 @@
  */
 
 #include <unistd.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <signal.h> /* to handle signal */
 #include <pthread.h>
-#include <cjson/cJSON.h>
 #include <errno.h> /* for error number */
+#include <stdint.h>
+#include <limits.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
+#include <sys/eventfd.h>
 
 #include "mq_interface.h"
 #include "upnp_pf_interface.h"
+#include "upnp_pf_driver.h"
+#include "upnp_pf_soapcodec.h"
 #include "upnp_pf_errcode.h"
 #include "logutil.h"
 #include "portmappingcfg.h"
+#include "spscqueue/spscqueue.h"
 
-/**
- * Schedule timer period in second. If value is 0 no new alarm() is scheduled.
- * This should be the same as ::LEASE_DURATION so the rule will be stored on router
- * until device is removed from network.
- */
-#define SCHEDULE_PERIOD LEASE_DURATION
+/** Delay in seconds before config is applied again when it failed */
+#define REFRESH_RETRY_DELAY 60
+
+/** Max number of events handled by one epoll_wait() */
+#define MAX_EVENTS 4
+
+/** Period in ms to check if ::thread_function() needs to quit */
+#define QUIT_CHECK_PERIOD 200
+
+/** Max number of gateways which limits are logged */
+#define MAX_LOGGED_GATEWAYS 8
+
+/** Max number of accepted requests waiting for the gateway worker */
+#define REQUEST_QUEUE_SIZE 64
+
+/** Max passes in a row which may be cancelled by newer requests, so a steady
+ stream of requests can't keep the router from ever reaching a config */
+#define MAX_SUPERSEDED_PASSES 4
+
+/** Size of a reply message */
+#define REPLY_SIZE 32
 
 /** Request message structure */
 typedef struct _RequestMsg_t
 {
     int pid;               /**< process id of the message */
+    unsigned long id;      /**< id given when request is accepted, sent back in replies */
     PortMappingCfg_t data; /**< data content of the message */
 } RequestMsg_t;
 
+/** Port forwarding driver chosen at startup */
+static const PortForwardDriver_t *g_driver;
+
+/** 1 if config failed to be applied and must be applied again */
+static int g_refresh_pending;
+
+/** Config applied to router, same as config file. Only used by main thread */
+static PortMappingCfg_t g_config;
+
+/** Accepted requests, pushed by ::thread_function() and popped by the event loop */
+static SpscQueue_t g_requests;
+
+/** eventfd which wakes the event loop when a request is pushed */
+static int g_request_fd = -1;
+
+/** 1 when gateways are ready and requests are accepted, set once by main thread */
+static int g_accepting;
+
+/** 1 while the config being applied may be cancelled by a newer request,
+ * set by main thread and read by workers of gateways */
+static int g_cancel_enabled;
+
 /**
  * @brief Parse message request from client
  * @details Parse message request from client to structure ::RequestMsg_t
@@ -45,69 +94,437 @@ typedef struct _RequestMsg_t
 static RequestMsg_t parse_request(const char *content)
 {
     RequestMsg_t tmp;
+    tmp.pid = 0;
+    tmp.id = 0;
+    tmp.data = PMCFG_parseRequest(content, &tmp.pid);
+    return tmp;
+}
+
+/**
+ * @brief Refresh port mapping
+ * @details Update port mapping with current config again, so rules which
+ * failed to be added are added again
+ */
+static void refresh_port_mapping()
+{
+    LOG(LOG_INFO, "Update port mapping with current config");
+    g_refresh_pending = g_driver->updatePortMapping(g_config.rules, g_config.numofrules) != SUCCESS;
+}
+
+/**
+ * @brief Arm schedule timer
+ * @details Start one-shot timer at the next lease renewal, or earlier if
+ * config must be applied again. Timer is stopped if nothing is scheduled.
+ *
+ * @param[in] timer_fd timer descriptor
+ */
+static void arm_timer(int timer_fd)
+{
+    struct itimerspec its;
+    long next = g_driver->getNextRenewal();
+
+    if (g_refresh_pending && (next < 0 || next > REFRESH_RETRY_DELAY))
+    {
+        next = REFRESH_RETRY_DELAY;
+    }
+    memset(&its, 0, sizeof(its));
+    if (next >= 0)
+    {
+        its.it_value.tv_sec = next;
+        its.it_value.tv_nsec = (next == 0); // 0 would stop the timer
+        LOG(LOG_DBG, "Next schedule in %ld seconds", next);
+    }
+    if (timerfd_settime(timer_fd, 0, &its, NULL) != 0)
+    {
+        LOG(LOG_ERR, "timerfd_settime failed: %s", strerror(errno));
+    }
+}
+
+/**
+ * @brief Log current limits of requests to gateways
+ * @details Show how fast each gateway can safely be driven, see
+ * upnp_pf_ratelimit.h
+ */
+static void log_limits()
+{
+    GatewayLimits_t limits[MAX_LOGGED_GATEWAYS];
+    int n = g_driver->getLimits(limits, MAX_LOGGED_GATEWAYS);
+    int i;
+
+    for (i = 0; i < n; i++)
+    {
+        RateLimitStats_t *st = &limits[i].stats;
+        LOG(LOG_INFO, "%s: rate %.1f/%.1f req/s, in flight %d, limit %.1f/%d, latency %lld us (base %lld us), "
+                      "back-off %lld ms, %lu requests, %lu errors",
+            limits[i].controlURL, st->rate, st->max_rate, st->in_flight, st->limit, st->max_limit,
+            st->latency_us, st->base_latency_us, st->backoff_ms, st->num_of_requests, st->num_of_errors);
+    }
+}
+
+/**
+ * @brief Send a reply about a request
+ * @details Reply is "<status> <request id>", such as "Accepted 12" or "OK 12"
+ *
+ * @param[in] status status of request
+ * @param[in] request request
+ */
+static void send_reply(const char *status, const RequestMsg_t *request)
+{
+    char reply[REPLY_SIZE];
+    snprintf(reply, sizeof(reply), "%s %lu", status, request->id);
+    mqInterface_send(reply, request->pid);
+}
+
+/**
+ * @brief Apply a port mapping config
+ * @details Config is not saved, see ::save_requests()
+ *
+ * @param[in] pm_cfg config requested by client
+ * @param[out] quit 1 (true) if port mapping was disabled and we need to stop
+ * @return 0 if OK, -::ERR_CANCELLED if a newer request is waiting and -1 if failed
+ */
+static int apply_config(PortMappingCfg_t *pm_cfg, int *quit)
+{
+    *quit = 0;
+    if (pm_cfg->is_enable)
+    {
+        int r = g_driver->updatePortMapping(pm_cfg->rules, pm_cfg->numofrules);
+        if (r == -ERR_CANCELLED)
+        {
+            return r;
+        }
+        if (r != SUCCESS)
+        {
+            return -1;
+        }
+        g_refresh_pending = 0;
+        return 0;
+    }
+    // remove rule and exit
+    if (g_driver->disablePortMapping() != SUCCESS)
+    {
+        return -1;
+    }
+    *quit = 1;
+    return 0;
+}
+
+/**
+ * @brief Merge requests into one config
+ * @details Requests are applied in order on top of current config. Nothing
+ * before the last replace request matters, so merge starts from it if any.
+ * @warning you need to free() ::PortMappingCfg_t::rules of @p merged
+ *
+ * @param[in] batch requests, oldest first
+ * @param[in] num_of_requests number of requests
+ * @param[out] merged config after all requests
+ * @return 0 if OK and -1 if failed
+ */
+static int merge_requests(RequestMsg_t batch[], int num_of_requests, PortMappingCfg_t *merged)
+{
+    int first = num_of_requests - 1;
     int i;
-    cJSON *root = cJSON_Parse(content);
-    cJSON *pid_json = cJSON_GetObjectItem(root, "pid");
-    if (cJSON_IsNumber(pid_json))
+
+    while (first > 0 && batch[first].data.op != PMCFG_OP_REPLACE)
+    {
+        first--;
+    }
+    memset(merged, 0, sizeof(*merged));
+    merged->op = PMCFG_OP_REPLACE;
+    if (batch[first].data.op != PMCFG_OP_REPLACE && PMCFG_applyChange(merged, &g_config) != 0)
+    {
+        return -1;
+    }
+    for (i = first; i < num_of_requests; i++)
+    {
+        if (PMCFG_applyChange(merged, &batch[i].data) != 0)
+        {
+            free(merged->rules);
+            merged->rules = NULL;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Save applied requests
+ * @details Add and remove requests are appended to journal, so their cost
+ * doesn't grow with the number of rules. A replace request saves the whole
+ * config. Then @p merged becomes current config.
+ *
+ * @param[in] batch requests, oldest first
+ * @param[in] num_of_requests number of requests
+ * @param[in] merged config after all requests, owned by ::g_config then
+ */
+static void save_requests(RequestMsg_t batch[], int num_of_requests, PortMappingCfg_t *merged)
+{
+    int i;
+
+    // a change saved after a whole config is applied on top of it again when
+    // config file is read, that's harmless since the result is the same
+    for (i = 0; i < num_of_requests; i++)
+    {
+        if (PMCFG_saveChange(merged, &batch[i].data) < 0)
+        {
+            LOG(LOG_ERR, "Cannot save config of request %lu", batch[i].id);
+        }
+    }
+    free(g_config.rules);
+    g_config = *merged;
+}
+
+/**
+ * @brief Check if config being applied is superseded
+ * @details Given to driver as ::cancelCheck. Any request waiting in queue
+ * changes the config being applied, so it's better to merge it and start again.
+ *
+ * @param[in] arg not used
+ * @return 1 (true) if a newer request is waiting, 0 if not
+ */
+static int is_superseded(void *arg)
+{
+    (void)arg;
+    return __atomic_load_n(&g_cancel_enabled, __ATOMIC_ACQUIRE) && spscQueue_size(&g_requests) > 0;
+}
+
+/**
+ * @brief Take requests waiting in queue
+ *
+ * @param[out] batch requests taken are appended here
+ * @param[in] num_of_requests number of requests already in @p batch
+ * @return number of requests in @p batch
+ */
+static int take_requests(RequestMsg_t batch[], int num_of_requests)
+{
+    int max = num_of_requests + REQUEST_QUEUE_SIZE;
+    while (num_of_requests < max && spscQueue_pop(&g_requests, &batch[num_of_requests]) == 0)
+    {
+        num_of_requests++;
+    }
+    return num_of_requests;
+}
+
+/**
+ * @brief Handle accepted requests
+ * @details Take every request waiting in queue and merge them on top of
+ * current config, see ::merge_requests(). The result is applied with one
+ * reconcile pass and sent as completion of all of them. A burst of requests
+ * costs the router one pass instead of one per request.
+ * If a newer request arrives while the pass is running, the pass stops at
+ * its next checkpoint and the newer one is applied from the state reached so
+ * far. At most ::MAX_SUPERSEDED_PASSES passes are cancelled in a row, the
+ * next one always runs to the end.
+ *
+ * @return 1 (true) if port mapping was disabled and we need to stop, 0 if not
+ */
+static int handle_requests()
+{
+    static RequestMsg_t batch[(MAX_SUPERSEDED_PASSES + 1) * REQUEST_QUEUE_SIZE];
+    RequestMsg_t *last;
+    PortMappingCfg_t merged;
+    const char *status;
+    int num_of_requests;
+    int num_of_passes = 0;
+    int quit = 0;
+    int r;
+    int i;
+
+    num_of_requests = take_requests(batch, 0);
+    if (num_of_requests == 0)
+    {
+        return 0;
+    }
+
+    do
+    {
+        last = &batch[num_of_requests - 1];
+        LOG(LOG_INFO, "Handle request %lu of %d, %d older requests coalesced",
+            last->id, last->pid, num_of_requests - 1);
+        if (merge_requests(batch, num_of_requests, &merged) != 0)
+        {
+            LOG(LOG_ERR, "Cannot merge requests");
+            r = -1;
+            break;
+        }
+        __atomic_store_n(&g_cancel_enabled, num_of_passes < MAX_SUPERSEDED_PASSES, __ATOMIC_RELEASE);
+        r = apply_config(&merged, &quit);
+        __atomic_store_n(&g_cancel_enabled, 0, __ATOMIC_RELEASE);
+        if (r == -ERR_CANCELLED)
+        {
+            LOG(LOG_INFO, "Request %lu of %d is superseded by a newer request", last->id, last->pid);
+            num_of_requests = take_requests(batch, num_of_requests);
+        }
+        if (r != 0)
+        {
+            free(merged.rules);
+        }
+        num_of_passes++;
+    } while (r == -ERR_CANCELLED);
+
+    if (r == 0)
+    {
+        save_requests(batch, num_of_requests, &merged);
+    }
+    status = r == 0 ? "OK" : "Error";
+    for (i = 0; i < num_of_requests; i++)
+    {
+        send_reply(status, &batch[i]);
+        free(batch[i].data.rules);
+    }
+    return quit;
+}
+
+/**
+ * @brief Reject requests left in queue
+ * @details Used when we stop, so no client waits for a completion forever
+ */
+static void reject_requests()
+{
+    RequestMsg_t request;
+    while (spscQueue_pop(&g_requests, &request) == 0)
+    {
+        send_reply("Error", &request);
+        free(request.data.rules);
+    }
+}
+
+/**
+ * @brief Add a descriptor to epoll instance
+ *
+ * @param[in] epoll_fd epoll descriptor
+ * @param[in] fd descriptor to watch for input
+ * @return 0 if OK and -1 if failed
+ */
+static int watch_fd(int epoll_fd, int fd)
+{
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0)
+    {
+        LOG(LOG_ERR, "epoll_ctl failed: %s", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Run main event loop
+ * @details Wait on accepted requests, schedule timer and shutdown signals with
+ * one epoll instance. This thread is the gateway worker: timer work and
+ * requests run here, never inside a signal handler, while
+ * ::thread_function() keeps receiving and accepting messages.
+ * @warning Signals of @p sigmask must be blocked in all threads so they are
+ * delivered through signalfd.
+ *
+ * @param[in] sigmask signals to handle, SIGUSR1 logs limits and others shutdown
+ * @return 0 if stopped normally and -1 if failed
+ */
+static int run_event_loop(const sigset_t *sigmask)
+{
+    int ret = -1;
+    int quit = 0;
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    int signal_fd = signalfd(-1, sigmask, SFD_NONBLOCK | SFD_CLOEXEC);
+
+    if (epoll_fd < 0 || timer_fd < 0 || signal_fd < 0)
+    {
+        LOG(LOG_ERR, "Cannot create event descriptors: %s", strerror(errno));
+        goto out;
+    }
+    if (watch_fd(epoll_fd, timer_fd) != 0 || watch_fd(epoll_fd, signal_fd) != 0 ||
+        watch_fd(epoll_fd, g_request_fd) != 0)
     {
-        tmp.pid = pid_json->valueint;
+        goto out;
     }
-    PortMappingCfg_t cfg;
-    cJSON *cfg_json = cJSON_GetObjectItem(root, "data");
-    if (cJSON_IsObject(cfg_json))
+    arm_timer(timer_fd);
+
+    while (!quit)
     {
-        cJSON *enable_json = cJSON_GetObjectItem(cfg_json, "enable");
-        if (cJSON_IsBool(enable_json))
+        int i;
+        int requests_ready = 0;
+        struct epoll_event events[MAX_EVENTS];
+        int n = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+        if (n < 0)
         {
-            cfg.is_enable = cJSON_IsTrue(enable_json);
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            LOG(LOG_ERR, "epoll_wait failed: %s", strerror(errno));
+            goto out;
         }
-        cJSON *rules = cJSON_GetObjectItem(cfg_json, "rules");
-        if (cJSON_IsArray(rules))
+
+        for (i = 0; i < n; i++)
         {
-            int arr_size = cJSON_GetArraySize(rules);
-            cfg.numofrules = arr_size;
-            MappingRule_t *map = malloc(arr_size * sizeof(MappingRule_t));
-            cJSON *rule_item;
-            for (i = 0; i < arr_size; i++)
+            int fd = events[i].data.fd;
+            if (fd == signal_fd)
             {
-                rule_item = cJSON_GetArrayItem(rules, i);
-                strcpy(map[i].eport, (cJSON_GetObjectItem(rule_item, "eport"))->valuestring);
-                strcpy(map[i].iport, (cJSON_GetObjectItem(rule_item, "iport"))->valuestring);
-                if (strcmp("UDP", (cJSON_GetObjectItem(rule_item, "proto"))->valuestring) == 0)
+                struct signalfd_siginfo si;
+                if (read(signal_fd, &si, sizeof(si)) != sizeof(si))
                 {
-                    map[i].proto = UDP;
+                    continue;
+                }
+                if (si.ssi_signo == SIGUSR1)
+                {
+                    log_limits();
                 }
                 else
                 {
-                    map[i].proto = TCP;
+                    LOG(LOG_INFO, "Stop by signal: %s", strsignal(si.ssi_signo));
+                    quit = 1;
                 }
             }
-            cfg.rules = map;
+            else if (fd == timer_fd)
+            {
+                uint64_t expirations;
+                if (read(timer_fd, &expirations, sizeof(expirations)) == sizeof(expirations) &&
+                    !quit)
+                {
+                    if (g_refresh_pending)
+                    {
+                        refresh_port_mapping();
+                    }
+                    else
+                    {
+                        g_driver->renewLeases();
+                    }
+                    arm_timer(timer_fd);
+                }
+            }
+            else if (fd == g_request_fd)
+            {
+                uint64_t count;
+                requests_ready = read(g_request_fd, &count, sizeof(count)) == sizeof(count);
+            }
+        }
+
+        // eventfd counter is reset by read, so take all requests now. Requests
+        // pushed meanwhile write eventfd again and come in the next batch
+        if (requests_ready && !quit)
+        {
+            quit = handle_requests();
+            arm_timer(timer_fd); // port mapping was just updated, leases have changed
         }
     }
-    if (root != NULL)
+    ret = 0;
+out:
+    if (signal_fd >= 0)
     {
-        cJSON_Delete(root);
+        close(signal_fd);
     }
-    tmp.data = cfg;
-    return tmp;
-}
-
-/**
- * @brief Timer handler function
- * @details Implement schedule timer using alarm signal
- * 
- * @param signum signal number
- */
-
-static void timer_handler(int signum)
-{
-    LOG(LOG_DBG, "Timer expired by signal: %s", strsignal(signum));
-    LOG(LOG_INFO, "Read config from config file and update port mapping");
-    PortMappingCfg_t pm_cfg = PMCFG_getConfig();
-    upnpPFInterface_updatePortMapping(pm_cfg.rules, pm_cfg.numofrules);
-    free(pm_cfg.rules);
-    alarm(SCHEDULE_PERIOD); // new schedule
+    if (timer_fd >= 0)
+    {
+        close(timer_fd);
+    }
+    if (epoll_fd >= 0)
+    {
+        close(epoll_fd);
+    }
+    return ret;
 }
 
 /* Returns 1 (true) if the mutex is unlocked, which is the
@@ -138,10 +555,53 @@ static int need_quit(pthread_mutex_t *mtx)
 }
 
 
+/**
+ * @brief Accept a request from client
+ * @details Before gateways are ready client is told we are discovering.
+ * Then request gets an id, client is told it's accepted, and request is
+ * queued for the event loop which sends the completion later. If queue is
+ * full client is told to come back later.
+ *
+ * @param[in] request request, its rules are freed or owned by queue
+ */
+static void accept_request(RequestMsg_t *request)
+{
+    static unsigned long next_id = 0;
+
+    if (!__atomic_load_n(&g_accepting, __ATOMIC_ACQUIRE))
+    {
+        mqInterface_send("Discovering", request->pid);
+        free(request->data.rules);
+        return;
+    }
+    request->id = ++next_id;
+    if (request->data.op == PMCFG_OP_INVALID)
+    {
+        LOG(LOG_WARN, "Request is not valid, reject request %lu", request->id);
+        send_reply("Error", request);
+        free(request->data.rules);
+        return;
+    }
+    // this thread is the only producer, so a push after this check can't fail
+    if (spscQueue_size(&g_requests) >= spscQueue_capacity(&g_requests))
+    {
+        LOG(LOG_WARN, "Request queue is full, reject request %lu", request->id);
+        send_reply("Busy", request);
+        free(request->data.rules);
+        return;
+    }
+    // accepted is sent first, so it always comes before the completion
+    send_reply("Accepted", request);
+    spscQueue_push(&g_requests, request);
+    eventfd_write(g_request_fd, 1);
+}
+
 /**
  * @brief Thread function
- * @details Thread function, containing a loop that's infinite except that 
- * it checks for termination with ::need_quit()
+ * @details Receive messages from clients and accept them, see
+ * ::accept_request(). It runs for the whole life of process so clients get an
+ * answer at once, however slow gateways are. Loop is infinite except that it
+ * checks for termination with ::need_quit()
  * @param arg argument passed to thread
  * @return void*
  */
@@ -149,38 +609,255 @@ static void *thread_function(void *arg)
 {
     char *msg_ptr = NULL;
     pthread_mutex_t *mx = arg;
+    struct pollfd pfd;
+    sigset_t sigmask;
+
+    // signals are handled by main thread
+    sigfillset(&sigmask);
+    pthread_sigmask(SIG_BLOCK, &sigmask, NULL);
+
+    pfd.fd = mqInterface_getFd();
+    pfd.events = POLLIN;
     while (!need_quit(mx))
     {
+        // wait for a message but wake up regularly to check quit flag
+        if (pfd.fd >= 0 && poll(&pfd, 1, QUIT_CHECK_PERIOD) <= 0)
+        {
+            continue;
+        }
         if (mqInterface_receive(&msg_ptr) == 0)
         {
             LOG(LOG_INFO, "Receive message %s", msg_ptr);
             RequestMsg_t request = parse_request(msg_ptr);
-            PortMappingCfg_t pm_cfg = request.data;
-
-            free(msg_ptr);
-            mqInterface_send("Discovering", request.pid);
-            free(pm_cfg.rules);
+            accept_request(&request);
+        }
+        else if (pfd.fd < 0)
+        {
+            usleep(QUIT_CHECK_PERIOD * 1000);
         }
+        free(msg_ptr);
+        msg_ptr = NULL;
     }
     LOG(LOG_DBG, "Thread stopped!");
     return NULL;
 }
 
+/**
+ * @brief Print usage
+ *
+ * @param[in] name program name
+ */
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-m minissdpd_socket] [-v seconds] [-n [url=]max_requests] [-r [url=]rate] [-c capacity] [-l latency_us] [-e action:code:count] [driver]\n"
+                    "  -m path    socket of minissdpd, empty to always search with multicast\n"
+                    "  -v s       interval between walks of router table to verify the shadow table,\n"
+                    "             0 to walk it on every update\n"
+                    "  -n [u=]n   max number of requests in flight to gateway with control URL u,\n"
+                    "             or to every other gateway without u. Can be repeated\n"
+                    "  -r [u=]r   max requests per second to gateway with control URL u, or to\n"
+                    "             every other gateway without u, 0 for no limit. Can be repeated\n"
+                    "  -c n       table size of simulated gateway\n"
+                    "  -l us      latency of each call to simulated gateway\n"
+                    "  -e a:c:n   next n calls of action a to simulated gateway fail with UPnP error\n"
+                    "             code c, or time out if c is \"timeout\". Can be repeated\n"
+                    "  driver     \"upnp\" (default) or \"sim\" for the in-process simulated gateway\n",
+            name);
+}
+
+/**
+ * @brief Parse an error injected in simulated gateway
+ * @details Format is action:code:count, e.g. AddPortMapping:718:1
+ *
+ * @param[in] arg option argument
+ * @return 0 if OK and -1 if not valid
+ */
+static int parse_sim_error(const char *arg)
+{
+    char name[64];
+    char code[16];
+    int count;
+    int action;
+
+    if (sscanf(arg, "%63[^:]:%15[^:]:%d", name, code, &count) != 3 || count < 0)
+    {
+        return -1;
+    }
+    action = soapCodec_findAction(name);
+    if (action < 0)
+    {
+        return -1;
+    }
+    pfDriver_injectSimError(action, strcmp(code, "timeout") == 0 ? SIM_TIMEOUT : atoi(code), count);
+    return 0;
+}
+
+/**
+ * @brief Parse a limit of requests to gateways
+ * @details Format is [controlURL=]value, without control URL the limit is the
+ * default of all gateways
+ *
+ * @param[in,out] arg option argument, '=' is replaced by '\\0'
+ * @param[out] url control URL or NULL for the default
+ * @param[out] value limit
+ * @return 0 if OK and -1 if value is not a non-negative number
+ */
+static int parse_limit(char *arg, const char **url, double *value)
+{
+    char *sep = strrchr(arg, '=');
+    char *end;
+
+    *url = NULL;
+    if (sep != NULL)
+    {
+        *sep = '\0';
+        *url = arg;
+        arg = sep + 1;
+    }
+    *value = strtod(arg, &end);
+    return (end != arg && *end == '\0' && *value >= 0) ? 0 : -1;
+}
+
+/**
+ * @brief Parse command line options
+ * @details Options are applied at once. Driver name is the first argument
+ * after options.
+ *
+ * @param[in] argc Argument count
+ * @param[in] argv Argument variables
+ * @return 0 if OK and -1 if an option is not valid
+ */
+static int parse_options(int argc, char *argv[])
+{
+    SimGatewayCfg_t sim_cfg;
+    const char *url;
+    double limit;
+    char *end;
+    long seconds;
+    int opt;
+
+    pfDriver_getSimConfig(&sim_cfg);
+    while ((opt = getopt(argc, argv, "m:v:n:r:c:l:e:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'm':
+            upnpPFInterface_setMinissdpdSocket(optarg[0] != '\0' ? optarg : NULL);
+            break;
+        case 'v':
+            seconds = strtol(optarg, &end, 10);
+            if (end == optarg || *end != '\0' || seconds < 0 || seconds > INT_MAX)
+            {
+                LOG(LOG_ERR, "Invalid verify interval %s", optarg);
+                usage(argv[0]);
+                return -1;
+            }
+            upnpPFInterface_setVerifyInterval((int)seconds);
+            break;
+        case 'n':
+            if (parse_limit(optarg, &url, &limit) != 0 || limit < 1 || limit > INT_MAX ||
+                limit != (int)limit)
+            {
+                LOG(LOG_ERR, "Invalid max number of requests %s", optarg);
+                usage(argv[0]);
+                return -1;
+            }
+            if (upnpPFInterface_setMaxConcurrency(url, (int)limit) != 0)
+            {
+                LOG(LOG_ERR, "Limits are set for too many gateways");
+                return -1;
+            }
+            break;
+        case 'r':
+            if (parse_limit(optarg, &url, &limit) != 0)
+            {
+                LOG(LOG_ERR, "Invalid request rate %s", optarg);
+                usage(argv[0]);
+                return -1;
+            }
+            if (upnpPFInterface_setMaxRate(url, limit) != 0)
+            {
+                LOG(LOG_ERR, "Limits are set for too many gateways");
+                return -1;
+            }
+            break;
+        case 'c':
+            sim_cfg.capacity = atoi(optarg);
+            if (sim_cfg.capacity <= 0)
+            {
+                usage(argv[0]);
+                return -1;
+            }
+            break;
+        case 'l':
+            sim_cfg.latency_us = atoi(optarg);
+            break;
+        case 'e':
+            if (parse_sim_error(optarg) != 0)
+            {
+                LOG(LOG_ERR, "Invalid injected error %s", optarg);
+                usage(argv[0]);
+                return -1;
+            }
+            break;
+        default:
+            usage(argv[0]);
+            return -1;
+        }
+    }
+    pfDriver_setSimConfig(&sim_cfg);
+    g_driver = pfDriver_find(optind < argc ? argv[optind] : NULL);
+    if (g_driver == NULL)
+    {
+        LOG(LOG_ERR, "Unknown port forwarding driver %s", argv[optind]);
+        usage(argv[0]);
+        return -1;
+    }
+    return 0;
+}
+
 /**
  * @brief Main function
- * @details You know it's a main function
+ * @details You know it's a main function. See ::usage() for arguments
  * 
- * @param[in] argc Argument count. We don't use it
- * @param[in] argv Argument variables. We don't use it too 
+ * @param[in] argc Argument count
+ * @param[in] argv Argument variables
  * 
  * @return Error code or 0 if OK
  */
-int main(int argc, char const *argv[])
+int main(int argc, char *argv[])
 {
     pthread_t th;
     pthread_mutex_t mxq; /* mutex used as quit flag */
+    sigset_t sigmask;
+    struct timespec retry_delay = {5, 0};
+    int initialized = 0;
+    int ret = 0;
+
+    /* handle shutdown signals and SIGUSR1 (log limits) in event loop. Block
+     them before any thread is created, so every thread inherits the mask and
+     they are only read from signalfd */
+    sigemptyset(&sigmask);
+    sigaddset(&sigmask, SIGINT);
+    sigaddset(&sigmask, SIGTERM);
+    sigaddset(&sigmask, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &sigmask, NULL);
+
+    if (parse_options(argc, argv) != 0)
+    {
+        return 1;
+    }
 
     mqInterface_create();
+    g_request_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (g_request_fd < 0 || spscQueue_init(&g_requests, REQUEST_QUEUE_SIZE, sizeof(RequestMsg_t)) != 0)
+    {
+        LOG(LOG_ERR, "Cannot create request queue");
+        return 1;
+    }
+
+    // lease renewal jitter must differ between devices behind the same router
+    srandom(time(NULL) ^ getpid());
 
     /* init and lock the mutex before creating the thread.  As long as the
      mutex stays locked, the thread should keep running.  A pointer to the
@@ -190,79 +867,60 @@ int main(int argc, char const *argv[])
     pthread_create(&th, NULL, thread_function, &mxq);
 
     // check config file
-    PortMappingCfg_t pm_cfg = PMCFG_getConfig();
-    if (!pm_cfg.is_enable)
+    g_config = PMCFG_getConfig();
+    if (g_config.op == PMCFG_OP_INVALID)
+    {
+        // port mappings are left on routers until config file is fixed
+        LOG(LOG_ERR, "Config file is not valid. Stop process!");
+        exit(1);
+    }
+    if (!g_config.is_enable)
     {
         LOG(LOG_INFO, "Port mapping is disabled. Stop process!");
-        free(pm_cfg.rules);
+        free(g_config.rules);
         exit(0);
     }
 
-    while (SUCCESS != upnpPFInterface_init())
+    g_driver->setCancelCheck(is_superseded, NULL);
+    while (!initialized)
     {
-        LOG(LOG_WARN, "upnpPFInterface_init() failed. Try again...");
-        sleep(5);
+        initialized = (SUCCESS == g_driver->init());
+        if (!initialized)
+        {
+            LOG(LOG_WARN, "Init of %s driver failed. Try again...", g_driver->name);
+            // signals are blocked, so wait for them instead of sleeping
+            int sig = sigtimedwait(&sigmask, NULL, &retry_delay);
+            if (sig == SIGINT || sig == SIGTERM)
+            {
+                LOG(LOG_INFO, "Receive signal %d before init. Stop process!", sig);
+                break;
+            }
+        }
     }
 
-    /* unlock mxq to tell the thread to terminate, then join the thread */
-    pthread_mutex_unlock(&mxq);
-    pthread_mutex_destroy(&mxq);
-    pthread_join(th, NULL);
+    if (initialized)
+    {
+        // requests received from now on are queued, they are handled after config file
+        __atomic_store_n(&g_accepting, 1, __ATOMIC_RELEASE);
 
-    upnpPFInterface_updatePortMapping(pm_cfg.rules, pm_cfg.numofrules);
-    free(pm_cfg.rules);
+        g_refresh_pending = g_driver->updatePortMapping(g_config.rules, g_config.numofrules) != SUCCESS;
 
-    char *msg_ptr = NULL;
+        ret = run_event_loop(&sigmask);
+    }
 
-    /*
-     * Implement timer using signal SIGALRM
-     */
-    signal(SIGALRM, timer_handler); // setup timer handler
-    alarm(SCHEDULE_PERIOD);
+    /* unlock mxq to tell the thread to terminate, then join the thread */
+    pthread_mutex_unlock(&mxq);
+    pthread_join(th, NULL);
+    pthread_mutex_destroy(&mxq);
+    reject_requests();
+    spscQueue_destroy(&g_requests);
+    close(g_request_fd);
 
-    while (1)
+    if (initialized)
     {
-        if (mqInterface_receive(&msg_ptr) == 0)
-        {
-            LOG(LOG_INFO, "Receive message %s", msg_ptr);
-            RequestMsg_t request = parse_request(msg_ptr);
-            pm_cfg = request.data;
-
-            free(msg_ptr);
-            if (pm_cfg.is_enable)
-            {
-                if (upnpPFInterface_updatePortMapping(pm_cfg.rules, pm_cfg.numofrules) < 0)
-                {
-                    // handle error
-                    mqInterface_send("Error", request.pid);
-                }
-                else
-                {
-                    alarm(SCHEDULE_PERIOD); // reset timer
-                    PMCFG_saveConfig(&pm_cfg);
-                    mqInterface_send("OK", request.pid);
-                }
-            }
-            else
-            {
-                // remove rule and exit
-                if (upnpPFInterface_diablePortMapping() < 0)
-                {
-                    // handle error
-                    mqInterface_send("Error", request.pid);
-                }
-                else
-                {
-                    mqInterface_send("OK", request.pid);
-                    PMCFG_saveConfig(&pm_cfg);
-                    free(pm_cfg.rules);
-                    upnpPFInterface_destroy();
-                    exit(0);
-                }
-            }
-            free(pm_cfg.rules);
-        }
+        g_driver->destroy();
     }
+    free(g_config.rules);
 
-    return 0;
+    return ret == 0 ? 0 : 1;
 }
@@ -0,0 +1,92 @@
+#!/bin/sh
+# Benchmark routerupnp against the local fake IGD.
+#
+# For each number of rules, the fake IGD table is cleared, routerupnp is
+# started with a config of that many rules and stopped once all of them are on
+# the fake IGD. Wall time and SOAP calls per action are reported.
+#
+# routerupnp runs in a temporary directory whose gateway cache only has the
+# fake IGD, so it never discovers nor touches the real router. A run which
+# doesn't use the cache is stopped and reported as failed.
+#
+# Environment: ROUTERUPNP (binary), RULES (list of rule counts),
+# LATENCY (ms per SOAP call), HTTP_PORT (port of fake IGD)
+
+ROUTERUPNP=${ROUTERUPNP:-$(pwd)/../build/bin/routerupnp}
+RULES=${RULES:-"1 10 100 1000"}
+LATENCY=${LATENCY:-2}
+HTTP_PORT=${HTTP_PORT:-5555}
+
+if [ ! -x "$ROUTERUPNP" ]; then
+    echo "$ROUTERUPNP not found, build it with 'make' first" >&2
+    exit 1
+fi
+
+work=$(mktemp -d)
+stats=$work/stats.txt
+./fakeigd -p "$HTTP_PORT" -l "$LATENCY" -c 65535 -f "$stats" >/dev/null &
+igd=$!
+trap 'kill $igd 2>/dev/null; rm -rf "$work"' EXIT
+
+# wait until stats file has line "<name> <value>"
+wait_stat()
+{
+    i=0
+    until grep -q "^$1 $2\$" "$stats" 2>/dev/null; do
+        i=$((i + 1))
+        if [ $i -gt 12000 ]; then
+            echo "timeout waiting for $1 $2" >&2
+            return 1
+        fi
+        sleep 0.01
+    done
+}
+
+# write routerupnp config with $1 TCP rules
+write_config()
+{
+    i=0
+    printf '{"enable":true,"rules":[' >"$work/routerupnp_cfg.json"
+    while [ $i -lt "$1" ]; do
+        [ $i -gt 0 ] && printf ',' >>"$work/routerupnp_cfg.json"
+        printf '{"eport":"%d","iport":"%d","proto":"TCP"}' $((20000 + i)) $((20000 + i)) \
+            >>"$work/routerupnp_cfg.json"
+        i=$((i + 1))
+    done
+    printf ']}\n' >>"$work/routerupnp_cfg.json"
+}
+
+# write gateway cache with only the fake IGD, reached on loopback whose MAC
+# address is our description of entries
+write_gateway_cache()
+{
+    printf '[{"controlURL":"http://127.0.0.1:%d/ctl/IPConn",' "$HTTP_PORT" >"$work/routerupnp_gateway.json"
+    printf '"servicetype":"urn:schemas-upnp-org:service:WANIPConnection:1",' >>"$work/routerupnp_gateway.json"
+    printf '"lanaddr":"127.0.0.1","desc":"000000000000","caps":0}]\n' >>"$work/routerupnp_gateway.json"
+}
+
+wait_stat resets 0 || exit 1
+resets=0
+echo "latency ${LATENCY} ms per SOAP call"
+for n in $RULES; do
+    kill -HUP $igd
+    resets=$((resets + 1))
+    wait_stat resets $resets || exit 1
+    write_config "$n"
+    write_gateway_cache
+
+    start=$(date +%s%3N)
+    (cd "$work" && exec "$ROUTERUPNP") >"$work/routerupnp.log" 2>&1 &
+    pid=$!
+    if ! wait_stat entries "$n" || ! grep -q "Use cached gateway" "$work/routerupnp.log"; then
+        kill $pid
+        tail "$work/routerupnp.log" >&2
+        exit 1
+    fi
+    end=$(date +%s%3N)
+    kill -TERM $pid
+    wait $pid
+
+    echo "== $n rules: $((end - start)) ms"
+    sed -n '/^action/,$p' "$stats" | awk '$2 > 0 || NR == 1'
+done
@@ -0,0 +1,903 @@
+/**
+ * @file fakeigd.c
+ * @brief Local fake Internet Gateway Device
+ * @details Answer SSDP M-SEARCH, serve a root description and implement the
+ * port mapping actions of WANIPConnection:1 from an in-memory table, so the
+ * real miniupnpc and SOAP code paths of routerupnp can be benchmarked
+ * without a router. Every SOAP call is delayed by a configurable latency.
+ *
+ * Number of calls and handling time of each action are written to a stats
+ * file after every call. SIGHUP clears the table and the counters.
+ *
+ * Usage: fakeigd [-p http_port] [-l latency_ms] [-c capacity] [-a address]
+ *                [-f stats_file]
+ *
+ * @author Pham Ngoc Thang (thangdc94)
+ * @bug No known bug
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <time.h>
+#include <ifaddrs.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+/** SSDP multicast address */
+#define SSDP_MCAST_ADDR "239.255.255.250"
+
+/** SSDP port */
+#define SSDP_PORT 1900
+
+/** Default HTTP port */
+#define DEFAULT_HTTP_PORT 5555
+
+/** Default table capacity */
+#define DEFAULT_CAPACITY 128
+
+/** Device UUID */
+#define FAKEIGD_UUID "fa4e16d0-0000-4000-8000-000000000001"
+
+/** External address of fake IGD */
+#define EXTERNAL_ADDRESS "203.0.113.1"
+
+/** Size of HTTP request buffer */
+#define HTTP_BUFFER_SIZE 16384
+
+/** Max size of SOAP response body */
+#define SOAP_BODY_SIZE 4096
+
+/** SOAP actions, in order of ::ACTION_NAMES */
+typedef enum _Action_t
+{
+    ADD_PORT_MAPPING = 0,
+    DELETE_PORT_MAPPING,
+    GET_GENERIC_PORT_MAPPING_ENTRY,
+    GET_SPECIFIC_PORT_MAPPING_ENTRY,
+    GET_STATUS_INFO,
+    GET_EXTERNAL_IP_ADDRESS,
+    OTHER_ACTION,
+    NUM_OF_ACTIONS
+} Action_t;
+
+static const char *ACTION_NAMES[NUM_OF_ACTIONS] = {
+    "AddPortMapping",
+    "DeletePortMapping",
+    "GetGenericPortMappingEntry",
+    "GetSpecificPortMappingEntry",
+    "GetStatusInfo",
+    "GetExternalIPAddress",
+    "Other",
+};
+
+/** Port mapping entry */
+typedef struct _Entry_t
+{
+    int eport;       /**< external port */
+    char proto[4];   /**< protocol */
+    char iport[6];   /**< internal port */
+    char client[40]; /**< internal client */
+    char desc[80];   /**< description */
+    char enabled[2]; /**< enabled flag */
+    time_t expire;   /**< expire time, 0 never */
+} Entry_t;
+
+/** Config of fake IGD */
+typedef struct _FakeIgdCfg_t
+{
+    int http_port;          /**< HTTP port */
+    int latency_ms;         /**< latency of each SOAP call */
+    int capacity;           /**< max number of entries */
+    const char *address;    /**< address in LOCATION, NULL to use address receiving M-SEARCH */
+    const char *stats_file; /**< stats file or NULL */
+} FakeIgdCfg_t;
+
+static FakeIgdCfg_t g_cfg = {DEFAULT_HTTP_PORT, 0, DEFAULT_CAPACITY, NULL, NULL};
+
+static pthread_mutex_t g_mutex = PTHREAD_MUTEX_INITIALIZER;
+static Entry_t *g_entries;
+static int g_size = 0;
+static int g_resets = 0;
+static long g_calls[NUM_OF_ACTIONS];
+static long g_time_us[NUM_OF_ACTIONS];
+
+/**
+ * @brief Get current time in us
+ */
+static long now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000L + ts.tv_nsec / 1000L;
+}
+
+/**
+ * @brief Write stats
+ * @warning Lock must be held
+ *
+ * @param[in] fp output
+ */
+static void print_stats(FILE *fp)
+{
+    int i;
+    fprintf(fp, "entries %d\n", g_size);
+    fprintf(fp, "resets %d\n", g_resets);
+    fprintf(fp, "action calls total_us\n");
+    for (i = 0; i < NUM_OF_ACTIONS; i++)
+    {
+        fprintf(fp, "%s %ld %ld\n", ACTION_NAMES[i], g_calls[i], g_time_us[i]);
+    }
+}
+
+/**
+ * @brief Replace stats file
+ * @details File is renamed into place so readers never see half of it
+ * @warning Lock must be held
+ */
+static void save_stats()
+{
+    char tmp[512];
+    FILE *fp;
+
+    if (g_cfg.stats_file == NULL)
+    {
+        return;
+    }
+    snprintf(tmp, sizeof(tmp), "%s.tmp", g_cfg.stats_file);
+    fp = fopen(tmp, "w");
+    if (fp == NULL)
+    {
+        return;
+    }
+    print_stats(fp);
+    fclose(fp);
+    rename(tmp, g_cfg.stats_file);
+}
+
+/**
+ * @brief Get value of an HTTP header
+ *
+ * @param[in] headers request headers
+ * @param[in] name header name
+ * @param[out] value header value
+ * @param[in] size size of @p value
+ * @return 0 if found and -1 if not
+ */
+static int get_header(const char *headers, const char *name, char *value, int size)
+{
+    const char *p = headers;
+    int len = strlen(name);
+
+    while ((p = strstr(p, "\r\n")) != NULL)
+    {
+        p += 2;
+        if (strncasecmp(p, name, len) == 0 && p[len] == ':')
+        {
+            const char *end = strstr(p, "\r\n");
+            int n;
+            p += len + 1;
+            while (*p == ' ' || *p == '\t')
+            {
+                p++;
+            }
+            n = end != NULL ? end - p : (int)strlen(p);
+            if (n >= size)
+            {
+                n = size - 1;
+            }
+            memcpy(value, p, n);
+            value[n] = '\0';
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Get value of a SOAP argument
+ *
+ * @param[in] body SOAP request
+ * @param[in] name argument name
+ * @param[out] value argument value, empty if not found
+ * @param[in] size size of @p value
+ */
+static void get_arg(const char *body, const char *name, char *value, int size)
+{
+    char tag[64];
+    const char *start;
+    const char *end;
+    int n;
+
+    value[0] = '\0';
+    snprintf(tag, sizeof(tag), "<%s>", name);
+    start = strstr(body, tag);
+    if (start == NULL)
+    {
+        return;
+    }
+    start += strlen(tag);
+    snprintf(tag, sizeof(tag), "</%s>", name);
+    end = strstr(start, tag);
+    if (end == NULL)
+    {
+        return;
+    }
+    n = end - start < size - 1 ? end - start : size - 1;
+    memcpy(value, start, n);
+    value[n] = '\0';
+}
+
+/**
+ * @brief Find an entry
+ * @warning Lock must be held
+ *
+ * @return index of entry or -1 if not found
+ */
+static int find_entry(int eport, const char *proto)
+{
+    int i;
+    for (i = 0; i < g_size; i++)
+    {
+        if (g_entries[i].eport == eport && strcasecmp(g_entries[i].proto, proto) == 0)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Get remaining lease of an entry
+ */
+static long remaining_lease(const Entry_t *entry)
+{
+    long left;
+    if (entry->expire == 0)
+    {
+        return 0;
+    }
+    left = (long)(entry->expire - time(NULL));
+    return left > 0 ? left : 1;
+}
+
+/**
+ * @brief Append arguments of a port mapping entry to a response
+ */
+static int print_entry(char *out, int size, const Entry_t *entry, int with_key)
+{
+    int n = 0;
+    if (with_key)
+    {
+        n = snprintf(out, size,
+                     "<NewRemoteHost></NewRemoteHost>"
+                     "<NewExternalPort>%d</NewExternalPort>"
+                     "<NewProtocol>%s</NewProtocol>",
+                     entry->eport, entry->proto);
+    }
+    n += snprintf(out + n, size - n,
+                  "<NewInternalPort>%s</NewInternalPort>"
+                  "<NewInternalClient>%s</NewInternalClient>"
+                  "<NewEnabled>%s</NewEnabled>"
+                  "<NewPortMappingDescription>%s</NewPortMappingDescription>"
+                  "<NewLeaseDuration>%ld</NewLeaseDuration>",
+                  entry->iport, entry->client, entry->enabled, entry->desc, remaining_lease(entry));
+    return n;
+}
+
+/**
+ * @brief Run a SOAP action
+ * @warning Lock must be held
+ *
+ * @param[in] action action
+ * @param[in] body SOAP request
+ * @param[out] out arguments of response
+ * @param[in] size size of @p out
+ * @return 0 if OK or UPnP error code
+ */
+static int run_action(Action_t action, const char *body, char *out, int size)
+{
+    char eport[6], proto[4], iport[6], client[40], desc[80], enabled[4], lease[16], index[16];
+    int i;
+
+    out[0] = '\0';
+    get_arg(body, "NewExternalPort", eport, sizeof(eport));
+    get_arg(body, "NewProtocol", proto, sizeof(proto));
+    switch (action)
+    {
+    case ADD_PORT_MAPPING:
+        get_arg(body, "NewInternalPort", iport, sizeof(iport));
+        get_arg(body, "NewInternalClient", client, sizeof(client));
+        get_arg(body, "NewEnabled", enabled, sizeof(enabled));
+        get_arg(body, "NewPortMappingDescription", desc, sizeof(desc));
+        get_arg(body, "NewLeaseDuration", lease, sizeof(lease));
+        if (atoi(eport) <= 0 || atoi(eport) > 65535 || atoi(iport) <= 0 || client[0] == '\0' ||
+            (strcasecmp(proto, "TCP") != 0 && strcasecmp(proto, "UDP") != 0))
+        {
+            return 402; // Invalid Args
+        }
+        i = find_entry(atoi(eport), proto);
+        if (i >= 0 && strcmp(g_entries[i].client, client) != 0)
+        {
+            return 718; // ConflictInMappingEntry
+        }
+        if (i < 0)
+        {
+            if (g_size == g_cfg.capacity)
+            {
+                return 728; // NoPortMapsAvailable
+            }
+            i = g_size++;
+        }
+        g_entries[i].eport = atoi(eport);
+        snprintf(g_entries[i].proto, sizeof(g_entries[i].proto), "%s", proto);
+        snprintf(g_entries[i].iport, sizeof(g_entries[i].iport), "%s", iport);
+        snprintf(g_entries[i].client, sizeof(g_entries[i].client), "%s", client);
+        snprintf(g_entries[i].desc, sizeof(g_entries[i].desc), "%s", desc);
+        snprintf(g_entries[i].enabled, sizeof(g_entries[i].enabled), "%s", enabled[0] == '0' ? "0" : "1");
+        g_entries[i].expire = atol(lease) > 0 ? time(NULL) + atol(lease) : 0;
+        return 0;
+
+    case DELETE_PORT_MAPPING:
+        i = find_entry(atoi(eport), proto);
+        if (i < 0)
+        {
+            return 714; // NoSuchEntryInArray
+        }
+        memmove(&g_entries[i], &g_entries[i + 1], (g_size - i - 1) * sizeof(Entry_t));
+        g_size--;
+        return 0;
+
+    case GET_GENERIC_PORT_MAPPING_ENTRY:
+        get_arg(body, "NewPortMappingIndex", index, sizeof(index));
+        i = atoi(index);
+        if (index[0] == '\0' || i < 0 || i >= g_size)
+        {
+            return 713; // SpecifiedArrayIndexInvalid
+        }
+        print_entry(out, size, &g_entries[i], 1);
+        return 0;
+
+    case GET_SPECIFIC_PORT_MAPPING_ENTRY:
+        i = find_entry(atoi(eport), proto);
+        if (i < 0)
+        {
+            return 714; // NoSuchEntryInArray
+        }
+        print_entry(out, size, &g_entries[i], 0);
+        return 0;
+
+    case GET_STATUS_INFO:
+        snprintf(out, size,
+                 "<NewConnectionStatus>Connected</NewConnectionStatus>"
+                 "<NewLastConnectionError>ERROR_NONE</NewLastConnectionError>"
+                 "<NewUptime>1</NewUptime>");
+        return 0;
+
+    case GET_EXTERNAL_IP_ADDRESS:
+        snprintf(out, size, "<NewExternalIPAddress>" EXTERNAL_ADDRESS "</NewExternalIPAddress>");
+        return 0;
+
+    default:
+        return 401; // Invalid Action
+    }
+}
+
+/**
+ * @brief Build root description
+ *
+ * @param[in] host host and port of fake IGD
+ * @param[out] out description
+ * @param[in] size size of @p out
+ * @return size of description
+ */
+static int root_desc(const char *host, char *out, int size)
+{
+    return snprintf(out, size,
+                    "<?xml version=\"1.0\"?>\r\n"
+                    "<root xmlns=\"urn:schemas-upnp-org:device-1-0\">"
+                    "<specVersion><major>1</major><minor>0</minor></specVersion>"
+                    "<device>"
+                    "<deviceType>urn:schemas-upnp-org:device:InternetGatewayDevice:1</deviceType>"
+                    "<friendlyName>fakeigd</friendlyName>"
+                    "<manufacturer>routerupnp</manufacturer>"
+                    "<modelName>fakeigd</modelName>"
+                    "<UDN>uuid:" FAKEIGD_UUID "</UDN>"
+                    "<deviceList><device>"
+                    "<deviceType>urn:schemas-upnp-org:device:WANDevice:1</deviceType>"
+                    "<friendlyName>WANDevice</friendlyName>"
+                    "<UDN>uuid:" FAKEIGD_UUID "-wan</UDN>"
+                    "<serviceList><service>"
+                    "<serviceType>urn:schemas-upnp-org:service:WANCommonInterfaceConfig:1</serviceType>"
+                    "<serviceId>urn:upnp-org:serviceId:WANCommonIFC1</serviceId>"
+                    "<controlURL>/ctl/CmnIfCfg</controlURL>"
+                    "<eventSubURL>/evt/CmnIfCfg</eventSubURL>"
+                    "<SCPDURL>/WANCfg.xml</SCPDURL>"
+                    "</service></serviceList>"
+                    "<deviceList><device>"
+                    "<deviceType>urn:schemas-upnp-org:device:WANConnectionDevice:1</deviceType>"
+                    "<friendlyName>WANConnectionDevice</friendlyName>"
+                    "<UDN>uuid:" FAKEIGD_UUID "-conn</UDN>"
+                    "<serviceList><service>"
+                    "<serviceType>urn:schemas-upnp-org:service:WANIPConnection:1</serviceType>"
+                    "<serviceId>urn:upnp-org:serviceId:WANIPConn1</serviceId>"
+                    "<controlURL>/ctl/IPConn</controlURL>"
+                    "<eventSubURL>/evt/IPConn</eventSubURL>"
+                    "<SCPDURL>/WANIPCn.xml</SCPDURL>"
+                    "</service></serviceList>"
+                    "</device></deviceList>"
+                    "</device></deviceList>"
+                    "<presentationURL>http://%s/</presentationURL>"
+                    "</device></root>\r\n",
+                    host);
+}
+
+/**
+ * @brief Send all data
+ *
+ * @return 0 if OK and -1 if failed
+ */
+static int send_all(int fd, const char *data, int len)
+{
+    while (len > 0)
+    {
+        int n = send(fd, data, len, MSG_NOSIGNAL);
+        if (n <= 0)
+        {
+            return -1;
+        }
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/**
+ * @brief Send an HTTP response
+ *
+ * @return 0 if OK and -1 if failed
+ */
+static int send_response(int fd, const char *status, const char *body, int keep_alive)
+{
+    char header[256];
+    int len = strlen(body);
+    int n = snprintf(header, sizeof(header),
+                     "HTTP/1.1 %s\r\n"
+                     "Content-Type: text/xml; charset=\"utf-8\"\r\n"
+                     "Content-Length: %d\r\n"
+                     "Connection: %s\r\n"
+                     "Server: Linux UPnP/1.1 fakeigd/1.0\r\n"
+                     "\r\n",
+                     status, len, keep_alive ? "keep-alive" : "close");
+    if (send_all(fd, header, n) != 0)
+    {
+        return -1;
+    }
+    return send_all(fd, body, len);
+}
+
+/**
+ * @brief Handle a SOAP request
+ *
+ * @param[in] fd connection
+ * @param[in] headers request headers
+ * @param[in] body request body
+ * @param[in] keep_alive 1 if connection stays open
+ * @return 0 if OK and -1 if failed
+ */
+static int handle_soap(int fd, const char *headers, const char *body, int keep_alive)
+{
+    char soap_action[256] = "";
+    char args[SOAP_BODY_SIZE];
+    char response[SOAP_BODY_SIZE + 1024];
+    char *service;
+    char *name;
+    Action_t action;
+    long start = now_us();
+    int code;
+
+    get_header(headers, "SOAPAction", soap_action, sizeof(soap_action));
+    service = soap_action[0] == '"' ? soap_action + 1 : soap_action;
+    name = strchr(service, '#');
+    if (name == NULL)
+    {
+        return send_response(fd, "400 Bad Request", "", 0);
+    }
+    *name++ = '\0';
+    name[strcspn(name, "\"")] = '\0';
+    for (action = 0; action < OTHER_ACTION; action++)
+    {
+        if (strcmp(name, ACTION_NAMES[action]) == 0)
+        {
+            break;
+        }
+    }
+
+    if (g_cfg.latency_ms > 0)
+    {
+        usleep(g_cfg.latency_ms * 1000);
+    }
+
+    pthread_mutex_lock(&g_mutex);
+    code = run_action(action, body, args, sizeof(args));
+    g_calls[action]++;
+    g_time_us[action] += now_us() - start;
+    save_stats();
+    pthread_mutex_unlock(&g_mutex);
+
+    if (code != 0)
+    {
+        snprintf(response, sizeof(response),
+                 "<?xml version=\"1.0\"?>\r\n"
+                 "<s:Envelope xmlns:s=\"http://schemas.xmlsoap.org/soap/envelope/\" "
+                 "s:encodingStyle=\"http://schemas.xmlsoap.org/soap/encoding/\"><s:Body>"
+                 "<s:Fault><faultcode>s:Client</faultcode><faultstring>UPnPError</faultstring>"
+                 "<detail><UPnPError xmlns=\"urn:schemas-upnp-org:control-1-0\">"
+                 "<errorCode>%d</errorCode><errorDescription>Error %d</errorDescription>"
+                 "</UPnPError></detail></s:Fault></s:Body></s:Envelope>\r\n",
+                 code, code);
+        return send_response(fd, "500 Internal Server Error", response, keep_alive);
+    }
+    snprintf(response, sizeof(response),
+             "<?xml version=\"1.0\"?>\r\n"
+             "<s:Envelope xmlns:s=\"http://schemas.xmlsoap.org/soap/envelope/\" "
+             "s:encodingStyle=\"http://schemas.xmlsoap.org/soap/encoding/\"><s:Body>"
+             "<u:%sResponse xmlns:u=\"%s\">%s</u:%sResponse></s:Body></s:Envelope>\r\n",
+             name, service, args, name);
+    return send_response(fd, "200 OK", response, keep_alive);
+}
+
+/**
+ * @brief Serve one HTTP connection
+ * @details Requests are served until client closes connection or asks to
+ * close it
+ */
+static void *http_thread(void *arg)
+{
+    int fd = (int)(long)arg;
+    char *buf = malloc(HTTP_BUFFER_SIZE + 1);
+    int len = 0;
+
+    while (buf != NULL)
+    {
+        char *end = NULL;
+        char method[8] = "";
+        char path[128] = "";
+        char value[64];
+        int header_len;
+        int body_len = 0;
+        int keep_alive;
+        int r;
+
+        buf[len] = '\0';
+        while ((end = strstr(buf, "\r\n\r\n")) == NULL)
+        {
+            int n = recv(fd, buf + len, HTTP_BUFFER_SIZE - len, 0);
+            if (n <= 0 || len + n >= HTTP_BUFFER_SIZE)
+            {
+                goto done;
+            }
+            len += n;
+            buf[len] = '\0';
+        }
+        header_len = end + 4 - buf;
+        if (get_header(buf, "Content-Length", value, sizeof(value)) == 0)
+        {
+            body_len = atoi(value);
+        }
+        if (body_len < 0 || header_len + body_len > HTTP_BUFFER_SIZE)
+        {
+            break;
+        }
+        while (len < header_len + body_len)
+        {
+            int n = recv(fd, buf + len, header_len + body_len - len, 0);
+            if (n <= 0)
+            {
+                goto done;
+            }
+            len += n;
+        }
+        sscanf(buf, "%7s %127s", method, path);
+        keep_alive = !(get_header(buf, "Connection", value, sizeof(value)) == 0 &&
+                       strcasecmp(value, "close") == 0);
+
+        // keep body in the buffer as a string, the rest of the buffer is moved after use
+        {
+            char saved = buf[header_len + body_len];
+            buf[header_len + body_len] = '\0';
+            buf[header_len - 2] = '\0';
+            if (strcmp(method, "POST") == 0)
+            {
+                r = handle_soap(fd, buf, buf + header_len, keep_alive);
+            }
+            else if (strcmp(method, "GET") == 0 && strcmp(path, "/rootDesc.xml") == 0)
+            {
+                char host[128] = "";
+                char desc[4096];
+                get_header(buf, "Host", host, sizeof(host));
+                root_desc(host, desc, sizeof(desc));
+                r = send_response(fd, "200 OK", desc, keep_alive);
+            }
+            else
+            {
+                r = send_response(fd, "404 Not Found", "", keep_alive);
+            }
+            buf[header_len + body_len] = saved;
+        }
+        if (r != 0 || !keep_alive)
+        {
+            break;
+        }
+        len -= header_len + body_len;
+        memmove(buf, buf + header_len + body_len, len);
+    }
+done:
+    free(buf);
+    close(fd);
+    return NULL;
+}
+
+/**
+ * @brief Accept HTTP connections
+ */
+static void *accept_thread(void *arg)
+{
+    int server = (int)(long)arg;
+    while (1)
+    {
+        pthread_t th;
+        int one = 1;
+        int fd = accept(server, NULL, NULL);
+        if (fd < 0)
+        {
+            continue;
+        }
+        // header and body are sent apart, don't wait for delayed ACK of header
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        if (pthread_create(&th, NULL, http_thread, (void *)(long)fd) != 0)
+        {
+            close(fd);
+            continue;
+        }
+        pthread_detach(th);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Answer M-SEARCH requests
+ * @details LOCATION has the address which received the request, so the
+ * client sees the fake IGD on the interface it searched
+ */
+static void *ssdp_thread(void *arg)
+{
+    int fd = (int)(long)arg;
+    while (1)
+    {
+        char req[1536];
+        char ctrl[256];
+        char st[256] = "";
+        char address[INET_ADDRSTRLEN] = "127.0.0.1";
+        char ans[1024];
+        struct sockaddr_in from;
+        struct iovec iov = {req, sizeof(req) - 1};
+        struct msghdr msg;
+        struct cmsghdr *cmsg;
+        int n;
+
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_name = &from;
+        msg.msg_namelen = sizeof(from);
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = ctrl;
+        msg.msg_controllen = sizeof(ctrl);
+        n = recvmsg(fd, &msg, 0);
+        if (n <= 0)
+        {
+            continue;
+        }
+        req[n] = '\0';
+        if (strncmp(req, "M-SEARCH", 8) != 0 || get_header(req, "ST", st, sizeof(st)) != 0 ||
+            (strstr(st, "InternetGatewayDevice") == NULL && strcmp(st, "ssdp:all") != 0 &&
+             strcmp(st, "upnp:rootdevice") != 0))
+        {
+            continue;
+        }
+        for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg))
+        {
+            if (cmsg->cmsg_level == IPPROTO_IP && cmsg->cmsg_type == IP_PKTINFO)
+            {
+                struct in_pktinfo *info = (struct in_pktinfo *)CMSG_DATA(cmsg);
+                inet_ntop(AF_INET, &info->ipi_spec_dst, address, sizeof(address));
+            }
+        }
+        n = snprintf(ans, sizeof(ans),
+                     "HTTP/1.1 200 OK\r\n"
+                     "CACHE-CONTROL: max-age=120\r\n"
+                     "ST: %s\r\n"
+                     "USN: uuid:" FAKEIGD_UUID "::%s\r\n"
+                     "EXT:\r\n"
+                     "SERVER: Linux UPnP/1.1 fakeigd/1.0\r\n"
+                     "LOCATION: http://%s:%d/rootDesc.xml\r\n"
+                     "\r\n",
+                     st, st, g_cfg.address != NULL ? g_cfg.address : address, g_cfg.http_port);
+        sendto(fd, ans, n, 0, (struct sockaddr *)&from, sizeof(from));
+    }
+    return NULL;
+}
+
+/**
+ * @brief Open SSDP socket
+ * @details Join multicast group on every IPv4 interface
+ *
+ * @return socket or -1 if failed
+ */
+static int open_ssdp()
+{
+    struct sockaddr_in addr;
+    struct ifaddrs *addrs, *iap;
+    int one = 1;
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(SSDP_PORT);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (fd < 0 ||
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) != 0 ||
+        setsockopt(fd, IPPROTO_IP, IP_PKTINFO, &one, sizeof(one)) != 0 ||
+        bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        getifaddrs(&addrs) != 0)
+    {
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        return -1;
+    }
+    for (iap = addrs; iap != NULL; iap = iap->ifa_next)
+    {
+        struct ip_mreq mreq;
+        if (iap->ifa_addr == NULL || iap->ifa_addr->sa_family != AF_INET)
+        {
+            continue;
+        }
+        inet_pton(AF_INET, SSDP_MCAST_ADDR, &mreq.imr_multiaddr);
+        mreq.imr_interface = ((struct sockaddr_in *)iap->ifa_addr)->sin_addr;
+        // may fail on interfaces without multicast, others are still joined
+        setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq));
+    }
+    freeifaddrs(addrs);
+    return fd;
+}
+
+/**
+ * @brief Open HTTP server socket
+ *
+ * @return socket or -1 if failed
+ */
+static int open_http()
+{
+    struct sockaddr_in addr;
+    int one = 1;
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(g_cfg.http_port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (fd < 0 ||
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) != 0 ||
+        bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        listen(fd, 64) != 0)
+    {
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        return -1;
+    }
+    return fd;
+}
+
+int main(int argc, char **argv)
+{
+    pthread_t th;
+    sigset_t sigmask;
+    int http_fd;
+    int ssdp_fd;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "p:l:c:a:f:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'p':
+            g_cfg.http_port = atoi(optarg);
+            break;
+        case 'l':
+            g_cfg.latency_ms = atoi(optarg);
+            break;
+        case 'c':
+            g_cfg.capacity = atoi(optarg);
+            break;
+        case 'a':
+            g_cfg.address = optarg;
+            break;
+        case 'f':
+            g_cfg.stats_file = optarg;
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-p http_port] [-l latency_ms] [-c capacity] "
+                            "[-a address] [-f stats_file]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+    g_entries = malloc((g_cfg.capacity > 0 ? g_cfg.capacity : 1) * sizeof(Entry_t));
+    if (g_entries == NULL)
+    {
+        return 1;
+    }
+
+    // signals are only handled by main thread
+    sigemptyset(&sigmask);
+    sigaddset(&sigmask, SIGHUP);
+    sigaddset(&sigmask, SIGINT);
+    sigaddset(&sigmask, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &sigmask, NULL);
+
+    http_fd = open_http();
+    if (http_fd < 0)
+    {
+        perror("HTTP server");
+        return 1;
+    }
+    ssdp_fd = open_ssdp();
+    if (ssdp_fd < 0)
+    {
+        perror("SSDP");
+        return 1;
+    }
+    pthread_create(&th, NULL, accept_thread, (void *)(long)http_fd);
+    pthread_create(&th, NULL, ssdp_thread, (void *)(long)ssdp_fd);
+    printf("fakeigd: http port %d, latency %d ms, capacity %d\n",
+           g_cfg.http_port, g_cfg.latency_ms, g_cfg.capacity);
+    fflush(stdout);
+
+    pthread_mutex_lock(&g_mutex);
+    save_stats();
+    pthread_mutex_unlock(&g_mutex);
+
+    while (1)
+    {
+        int sig;
+        if (sigwait(&sigmask, &sig) != 0)
+        {
+            continue;
+        }
+        pthread_mutex_lock(&g_mutex);
+        if (sig == SIGHUP)
+        {
+            g_size = 0;
+            g_resets++;
+            memset(g_calls, 0, sizeof(g_calls));
+            memset(g_time_us, 0, sizeof(g_time_us));
+            save_stats();
+            pthread_mutex_unlock(&g_mutex);
+            continue;
+        }
+        print_stats(stdout);
+        pthread_mutex_unlock(&g_mutex);
+        break;
+    }
+    return 0;
+}
@@ -0,0 +1,171 @@
+/**
+ * @file httpstub.c
+ * @brief Local HTTP stand-in server for tests
+ * @details Echo body of each request back, see httpstub.h
+ *
+ * @author Pham Ngoc Thang (thangdc94)
+ * @bug No known bug
+ */
+
+#define _GNU_SOURCE /* for strcasestr() */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "httpstub.h"
+
+/** Argument of a connection thread */
+typedef struct _ConnArg_t
+{
+    HttpStub_t *cfg; /**< server config */
+    int fd;          /**< connection socket */
+} ConnArg_t;
+
+/**
+ * @brief Serve one connection
+ * @details Read requests and echo their body back until client closes or
+ * ::HttpStub_t::close_after requests were served
+ */
+static void *connection_thread(void *arg)
+{
+    ConnArg_t *conn = arg;
+    HttpStub_t *cfg = conn->cfg;
+    char buf[4096] = "";
+    int len = 0;
+    int served = 0;
+
+    while (cfg->close_after == 0 || served < cfg->close_after)
+    {
+        char *end;
+        char *cl;
+        int header_len;
+        int body_len;
+        char response[4096];
+        int n;
+
+        while ((end = strstr(buf, "\r\n\r\n")) == NULL)
+        {
+            n = recv(conn->fd, buf + len, sizeof(buf) - len - 1, 0);
+            if (n <= 0)
+            {
+                goto out;
+            }
+            len += n;
+            buf[len] = '\0';
+        }
+        header_len = end - buf + 4;
+        cl = strcasestr(buf, "Content-Length:");
+        body_len = cl ? atoi(cl + 15) : 0;
+        while (len < header_len + body_len)
+        {
+            n = recv(conn->fd, buf + len, sizeof(buf) - len - 1, 0);
+            if (n <= 0)
+            {
+                goto out;
+            }
+            len += n;
+            buf[len] = '\0';
+        }
+
+        if (cfg->delay_ms > 0)
+        {
+            usleep(cfg->delay_ms * 1000);
+        }
+        if (cfg->chunked)
+        {
+            int half = body_len / 2;
+            n = sprintf(response, "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n"
+                                  "%x\r\n%.*s\r\n%x;ext=1\r\n%.*s\r\n0\r\n\r\n",
+                        half, half, buf + header_len,
+                        body_len - half, body_len - half, buf + header_len + half);
+        }
+        else
+        {
+            n = sprintf(response, "HTTP/1.1 200 OK\r\nContent-Length: %d\r\n\r\n%.*s",
+                        body_len, body_len, buf + header_len);
+        }
+        send(conn->fd, response, n, MSG_NOSIGNAL);
+
+        // keep pipelined bytes for next request
+        memmove(buf, buf + header_len + body_len, len - header_len - body_len);
+        len -= header_len + body_len;
+        buf[len] = '\0';
+        served++;
+        pthread_mutex_lock(&cfg->mutex);
+        cfg->num_of_requests++;
+        pthread_mutex_unlock(&cfg->mutex);
+    }
+out:
+    close(conn->fd);
+    free(conn);
+    return NULL;
+}
+
+/**
+ * @brief Accept connections of stand-in server
+ */
+static void *server_thread(void *arg)
+{
+    HttpStub_t *cfg = arg;
+    while (1)
+    {
+        pthread_t th;
+        ConnArg_t *conn;
+        int fd = accept(cfg->listen_fd, NULL, NULL);
+        if (fd < 0)
+        {
+            break;
+        }
+        pthread_mutex_lock(&cfg->mutex);
+        cfg->num_of_accepts++;
+        pthread_mutex_unlock(&cfg->mutex);
+        conn = malloc(sizeof(ConnArg_t));
+        conn->cfg = cfg;
+        conn->fd = fd;
+        pthread_create(&th, NULL, connection_thread, conn);
+        pthread_detach(th);
+    }
+    return NULL;
+}
+
+int httpStub_start(HttpStub_t *stub)
+{
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+    pthread_t th;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+    stub->listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (stub->listen_fd < 0 ||
+        bind(stub->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        listen(stub->listen_fd, 16) != 0 ||
+        getsockname(stub->listen_fd, (struct sockaddr *)&addr, &addr_len) != 0)
+    {
+        perror("stand-in server");
+        exit(1);
+    }
+    pthread_mutex_init(&stub->mutex, NULL);
+    pthread_create(&th, NULL, server_thread, stub);
+    pthread_detach(th);
+    return ntohs(addr.sin_port);
+}
+
+void httpStub_reset(HttpStub_t *stub, int close_after, int chunked, int delay_ms)
+{
+    pthread_mutex_lock(&stub->mutex);
+    stub->close_after = close_after;
+    stub->chunked = chunked;
+    stub->delay_ms = delay_ms;
+    stub->num_of_accepts = 0;
+    stub->num_of_requests = 0;
+    pthread_mutex_unlock(&stub->mutex);
+}
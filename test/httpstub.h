@@ -0,0 +1,48 @@
+/**
+ * @file httpstub.h
+ * @brief Local HTTP stand-in server for tests
+ * @details Server listens on a random loopback port and echoes the body of
+ * each request back, with a configurable delay, chunked encoding and
+ * connection close, so HTTP clients can be tested without a router.
+ *
+ * @author Pham Ngoc Thang (thangdc94)
+ * @bug No known bug
+ */
+
+#ifndef __HTTP_STUB_H_
+#define __HTTP_STUB_H_
+
+#include <pthread.h>
+
+/** Stand-in server, its behaviour and counters */
+typedef struct _HttpStub_t
+{
+    int listen_fd;        /**< listening socket */
+    int close_after;      /**< close connection after this many requests, 0 never */
+    int chunked;          /**< send chunked responses */
+    int delay_ms;         /**< delay before each response */
+    int num_of_accepts;   /**< number of accepted connections */
+    int num_of_requests;  /**< number of served requests */
+    pthread_mutex_t mutex; /**< protect counters */
+} HttpStub_t;
+
+/**
+ * @brief Start stand-in server on a random local port
+ * @details Test exits if server can't be started
+ *
+ * @param[out] stub server, zeroed before
+ * @return port number
+ */
+int httpStub_start(HttpStub_t *stub);
+
+/**
+ * @brief Reset server behaviour and counters
+ *
+ * @param[in] stub server
+ * @param[in] close_after close connection after this many requests, 0 never
+ * @param[in] chunked 1 to send chunked responses
+ * @param[in] delay_ms delay before each response
+ */
+void httpStub_reset(HttpStub_t *stub, int close_after, int chunked, int delay_ms);
+
+#endif //__HTTP_STUB_H_
@@ -0,0 +1,565 @@
+/**
+ * @file loadgen.c
+ * @brief Load generator for routerupnp message queue
+ * @details Run many client threads, each with its own reply queue, sending
+ * port mapping requests to routerupnp over System V or POSIX message queue
+ * at a target rate. Throughput and request to reply latency percentiles are
+ * reported.
+ *
+ * Requests are scheduled at fixed times, so latency is measured from the time
+ * a request should have been sent. A slow server delays next requests of a
+ * client and this wait is part of their latency.
+ *
+ * Usage: loadgen [-b sysv|posix] [-c clients] [-r rate] [-d seconds]
+ *                [-s rules] [-v] [-t timeout_ms]
+ *
+ * @author Pham Ngoc Thang (thangdc94)
+ * @bug No known bug
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <mqueue.h>
+#include <sys/types.h>
+#include <sys/ipc.h>
+#include <sys/msg.h>
+#include <sys/stat.h>
+
+/** pathname to generate key of System V queues, same as server */
+#define QUEUE_NAME "/tmp"
+
+/** Type of System V message */
+#define MESSAGE_TYPE 1
+
+/** POSIX server queue name */
+#define SERVER_QUEUE_NAME "/routerupnp-server"
+
+/** POSIX client queue name prefix */
+#define CLIENT_QUEUE_PREFIX "/routerupnp-client"
+
+/** Permission for message queue */
+#define QUEUE_PERMISSIONS 0660
+
+/** Max message can be store in client queue */
+#define MAX_MESSAGES 10
+
+/** Max size of a request, server reads up to this size */
+#define MAX_MSG_SIZE 512
+
+/** Size of receive buffer */
+#define MSG_BUFFER_SIZE (MAX_MSG_SIZE + 10)
+
+/**
+ * Max number of System V clients. Key of a client queue is made from the low
+ * 8 bits of client id only, 0 and 1 (server) are not used.
+ */
+#define MAX_SYSV_CLIENTS 254
+
+/** Max number of POSIX clients, client id is made of pid and client index */
+#define MAX_POSIX_CLIENTS 1000
+
+/** First external port of generated rules */
+#define BASE_PORT 30000
+
+/** IPC backend */
+typedef enum _Backend_t
+{
+    SYSV = 0,
+    POSIX
+} Backend_t;
+
+/** Config of load generator */
+typedef struct _LoadCfg_t
+{
+    Backend_t backend; /**< IPC backend */
+    int clients;       /**< number of clients */
+    double rate;       /**< target request rate of all clients, 0 for no limit */
+    int duration;      /**< duration in seconds */
+    int rules;         /**< number of rules per request */
+    int vary;          /**< 1 if each client sends its own rule set */
+    int timeout_ms;    /**< reply timeout */
+} LoadCfg_t;
+
+/** State of a client */
+typedef struct _Client_t
+{
+    int index;            /**< client index */
+    int id;               /**< id sent as pid in requests */
+    int sysv_server;      /**< System V server queue */
+    int sysv_client;      /**< System V reply queue */
+    mqd_t posix_server;   /**< POSIX server queue */
+    mqd_t posix_client;   /**< POSIX reply queue */
+    char request[MSG_BUFFER_SIZE]; /**< request message */
+    long *latencies;      /**< latency of each reply in us */
+    int num_of_latencies; /**< number of replies */
+    int capacity;         /**< size of latencies */
+    int sent;             /**< number of sent requests */
+    int errors;           /**< number of "Error" replies */
+    int timeouts;         /**< number of requests without reply */
+    long last_us;         /**< time of last reply since start */
+    int done;             /**< set when client thread ends */
+} Client_t;
+
+static LoadCfg_t g_cfg = {SYSV, 8, 0, 10, 1, 0, 5000};
+static struct timespec g_start;
+
+/**
+ * @brief Get time in us since start
+ */
+static long elapsed_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec - g_start.tv_sec) * 1000000L + (ts.tv_nsec - g_start.tv_nsec) / 1000L;
+}
+
+/**
+ * @brief Sleep until a time since start
+ */
+static void sleep_until(long us)
+{
+    struct timespec ts = g_start;
+    ts.tv_sec += us / 1000000L;
+    ts.tv_nsec += (us % 1000000L) * 1000L;
+    if (ts.tv_nsec >= 1000000000L)
+    {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000L;
+    }
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+    {
+    }
+}
+
+/**
+ * @brief Build request of a client
+ *
+ * @param[in] client client
+ * @return 0 if OK and -1 if request is too big
+ */
+static int build_request(Client_t *client)
+{
+    int base = BASE_PORT + (g_cfg.vary ? client->index * g_cfg.rules : 0);
+    int n;
+    int i;
+
+    n = snprintf(client->request, MAX_MSG_SIZE, "{\"pid\":%d,\"data\":{\"enable\":true,\"rules\":[",
+                 client->id);
+    for (i = 0; i < g_cfg.rules && n < MAX_MSG_SIZE; i++)
+    {
+        n += snprintf(client->request + n, MAX_MSG_SIZE - n,
+                      "%s{\"eport\":\"%d\",\"iport\":\"%d\",\"proto\":\"%s\"}",
+                      i > 0 ? "," : "", base + i, base + i, i % 2 ? "UDP" : "TCP");
+    }
+    if (n < MAX_MSG_SIZE)
+    {
+        n += snprintf(client->request + n, MAX_MSG_SIZE - n, "]}}");
+    }
+    return n < MAX_MSG_SIZE ? 0 : -1;
+}
+
+/**
+ * @brief Open queues of a client
+ *
+ * @param[in] client client
+ * @return 0 if OK and -1 if failed
+ */
+static int open_client(Client_t *client)
+{
+    if (g_cfg.backend == SYSV)
+    {
+        struct
+        {
+            long mtype;
+            char mtext[MSG_BUFFER_SIZE];
+        } rbuf;
+
+        client->id = (getpid() << 8) | (client->index + 2);
+        client->sysv_server = msgget(ftok(QUEUE_NAME, 1), QUEUE_PERMISSIONS);
+        client->sysv_client = msgget(ftok(QUEUE_NAME, client->id), IPC_CREAT | QUEUE_PERMISSIONS);
+        if (client->sysv_server < 0 || client->sysv_client < 0)
+        {
+            perror("msgget");
+            return -1;
+        }
+        // drop replies left by an old client with same key
+        while (msgrcv(client->sysv_client, &rbuf, MSG_BUFFER_SIZE, 0, IPC_NOWAIT) >= 0)
+        {
+        }
+    }
+    else
+    {
+        char name[64];
+        struct mq_attr attr;
+
+        attr.mq_flags = 0;
+        attr.mq_maxmsg = MAX_MESSAGES;
+        attr.mq_msgsize = MAX_MSG_SIZE;
+        attr.mq_curmsgs = 0;
+        client->id = (getpid() % 2000000) * MAX_POSIX_CLIENTS + client->index;
+        snprintf(name, sizeof(name), "%s-%d", CLIENT_QUEUE_PREFIX, client->id);
+        client->posix_server = mq_open(SERVER_QUEUE_NAME, O_WRONLY);
+        client->posix_client = mq_open(name, O_RDONLY | O_CREAT, QUEUE_PERMISSIONS, &attr);
+        if (client->posix_server == (mqd_t)-1 || client->posix_client == (mqd_t)-1)
+        {
+            perror("mq_open");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Close queues of a client
+ */
+static void close_client(Client_t *client)
+{
+    if (g_cfg.backend == SYSV)
+    {
+        if (client->sysv_client >= 0)
+        {
+            msgctl(client->sysv_client, IPC_RMID, NULL);
+            client->sysv_client = -1;
+        }
+    }
+    else
+    {
+        char name[64];
+        snprintf(name, sizeof(name), "%s-%d", CLIENT_QUEUE_PREFIX, client->id);
+        if (client->posix_client != (mqd_t)-1)
+        {
+            mq_close(client->posix_client);
+            mq_unlink(name);
+            client->posix_client = (mqd_t)-1;
+        }
+        if (client->posix_server != (mqd_t)-1)
+        {
+            mq_close(client->posix_server);
+            client->posix_server = (mqd_t)-1;
+        }
+    }
+}
+
+/**
+ * @brief Check if a reply only says request was accepted
+ * @details Server answers "Accepted <id>" at once and "OK <id>" or
+ * "Error <id>" when request is done
+ *
+ * @param[in] reply reply message
+ * @return 1 (true) if more replies follow and 0 if not
+ */
+static int is_accepted(const char *reply)
+{
+    return strncmp(reply, "Accepted", 8) == 0;
+}
+
+/**
+ * @brief Send request and wait for reply
+ * @details Wait for completion, accepted replies are skipped
+ *
+ * @param[in] client client
+ * @param[out] reply reply message
+ * @return 0 if OK, 1 if no reply in time and -1 if failed
+ */
+static int call(Client_t *client, char *reply)
+{
+    int len = strlen(client->request) + 1;
+
+    if (g_cfg.backend == SYSV)
+    {
+        struct
+        {
+            long mtype;
+            char mtext[MSG_BUFFER_SIZE];
+        } buf;
+
+        buf.mtype = MESSAGE_TYPE;
+        memcpy(buf.mtext, client->request, len);
+        if (msgsnd(client->sysv_server, &buf, len, 0) < 0)
+        {
+            return -1;
+        }
+        // no timeout here, main thread cancels client if reply never comes
+        do
+        {
+            if (msgrcv(client->sysv_client, &buf, MSG_BUFFER_SIZE, MESSAGE_TYPE, 0) < 0)
+            {
+                return -1;
+            }
+            buf.mtext[MSG_BUFFER_SIZE - 1] = '\0';
+        } while (is_accepted(buf.mtext));
+        strcpy(reply, buf.mtext);
+    }
+    else
+    {
+        struct timespec deadline;
+        ssize_t n;
+
+        if (mq_send(client->posix_server, client->request, len, 0) < 0)
+        {
+            return -1;
+        }
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += g_cfg.timeout_ms / 1000;
+        deadline.tv_nsec += (g_cfg.timeout_ms % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L)
+        {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        do
+        {
+            n = mq_timedreceive(client->posix_client, reply, MSG_BUFFER_SIZE, NULL, &deadline);
+            if (n < 0)
+            {
+                return errno == ETIMEDOUT ? 1 : -1;
+            }
+            reply[n] = '\0';
+        } while (is_accepted(reply));
+    }
+    return 0;
+}
+
+/**
+ * @brief Client thread
+ * @details Send requests at scheduled times until end of test. Clients are
+ * shifted in time so requests are spread over the period. Waiting in queue
+ * functions is a cancellation point, so a client without reply is cancelled
+ * by main thread.
+ */
+static void *client_thread(void *arg)
+{
+    Client_t *client = arg;
+    long end = g_cfg.duration * 1000000L;
+    double period = g_cfg.rate > 0 ? g_cfg.clients * 1000000.0 / g_cfg.rate : 0;
+    long k;
+
+    for (k = 0;; k++)
+    {
+        char reply[MSG_BUFFER_SIZE];
+        long scheduled = (long)(period * (k + (double)client->index / g_cfg.clients));
+        int r;
+
+        if (scheduled >= end)
+        {
+            break;
+        }
+        if (period > 0)
+        {
+            sleep_until(scheduled);
+        }
+        else
+        {
+            scheduled = elapsed_us();
+            if (scheduled >= end)
+            {
+                break;
+            }
+        }
+        client->sent++;
+        r = call(client, reply);
+        if (r != 0)
+        {
+            if (r > 0)
+            {
+                client->timeouts++;
+            }
+            else
+            {
+                perror("client");
+            }
+            break;
+        }
+        if (strncmp(reply, "OK", 2) != 0)
+        {
+            client->errors++;
+        }
+        if (client->num_of_latencies == client->capacity)
+        {
+            long *p;
+            client->capacity = client->capacity ? client->capacity * 2 : 1024;
+            p = realloc(client->latencies, client->capacity * sizeof(long));
+            if (p == NULL)
+            {
+                break;
+            }
+            client->latencies = p;
+        }
+        client->last_us = elapsed_us();
+        client->latencies[client->num_of_latencies++] = client->last_us - scheduled;
+    }
+    __sync_fetch_and_add(&client->done, 1);
+    return NULL;
+}
+
+/**
+ * @brief Compare latencies
+ */
+static int compare_long(const void *a, const void *b)
+{
+    long x = *(const long *)a;
+    long y = *(const long *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Get a percentile of sorted latencies
+ */
+static long percentile(const long *sorted, int n, double p)
+{
+    int i = (int)(p * n);
+    if (n == 0)
+    {
+        return 0;
+    }
+    return sorted[i < n ? i : n - 1];
+}
+
+int main(int argc, char **argv)
+{
+    Client_t *clients;
+    pthread_t *threads;
+    long *all;
+    long total = 0;
+    long elapsed = 0;
+    int sent = 0, errors = 0, timeouts = 0;
+    int opt;
+    int i;
+
+    while ((opt = getopt(argc, argv, "b:c:r:d:s:vt:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'b':
+            g_cfg.backend = strcmp(optarg, "posix") == 0 ? POSIX : SYSV;
+            break;
+        case 'c':
+            g_cfg.clients = atoi(optarg);
+            break;
+        case 'r':
+            g_cfg.rate = atof(optarg);
+            break;
+        case 'd':
+            g_cfg.duration = atoi(optarg);
+            break;
+        case 's':
+            g_cfg.rules = atoi(optarg);
+            break;
+        case 'v':
+            g_cfg.vary = 1;
+            break;
+        case 't':
+            g_cfg.timeout_ms = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-b sysv|posix] [-c clients] [-r rate] [-d seconds] "
+                            "[-s rules] [-v] [-t timeout_ms]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+    if (g_cfg.clients <= 0 ||
+        g_cfg.clients > (g_cfg.backend == SYSV ? MAX_SYSV_CLIENTS : MAX_POSIX_CLIENTS))
+    {
+        fprintf(stderr, "Number of clients must be 1..%d with %s queue\n",
+                g_cfg.backend == SYSV ? MAX_SYSV_CLIENTS : MAX_POSIX_CLIENTS,
+                g_cfg.backend == SYSV ? "System V" : "POSIX");
+        return 1;
+    }
+
+    clients = calloc(g_cfg.clients, sizeof(Client_t));
+    threads = calloc(g_cfg.clients, sizeof(pthread_t));
+    if (clients == NULL || threads == NULL)
+    {
+        return 1;
+    }
+    for (i = 0; i < g_cfg.clients; i++)
+    {
+        clients[i].index = i;
+        clients[i].sysv_client = -1;
+        clients[i].posix_server = (mqd_t)-1;
+        clients[i].posix_client = (mqd_t)-1;
+        if (open_client(&clients[i]) != 0 || build_request(&clients[i]) != 0)
+        {
+            if (clients[i].request[0] != '\0')
+            {
+                fprintf(stderr, "Request with %d rules doesn't fit in %d bytes\n", g_cfg.rules, MAX_MSG_SIZE);
+            }
+            for (; i >= 0; i--)
+            {
+                close_client(&clients[i]);
+            }
+            return 1;
+        }
+    }
+    printf("%s queue, %d clients, %d rules per request%s, %d s\n",
+           g_cfg.backend == SYSV ? "System V" : "POSIX", g_cfg.clients, g_cfg.rules,
+           g_cfg.vary ? " (one set per client)" : "", g_cfg.duration);
+    if (g_cfg.rate > 0)
+    {
+        printf("target rate %.0f req/s\n", g_cfg.rate);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &g_start);
+    for (i = 0; i < g_cfg.clients; i++)
+    {
+        pthread_create(&threads[i], NULL, client_thread, &clients[i]);
+    }
+
+    // a client still waiting for a reply after timeout never gets it
+    sleep_until(g_cfg.duration * 1000000L);
+    for (i = 0; i < g_cfg.clients; i++)
+    {
+        while (!__sync_fetch_and_add(&clients[i].done, 0) &&
+               elapsed_us() < g_cfg.duration * 1000000L + g_cfg.timeout_ms * 1000L)
+        {
+            usleep(10000);
+        }
+        if (!__sync_fetch_and_add(&clients[i].done, 0))
+        {
+            pthread_cancel(threads[i]);
+            clients[i].timeouts++;
+        }
+        pthread_join(threads[i], NULL);
+        close_client(&clients[i]);
+        sent += clients[i].sent;
+        errors += clients[i].errors;
+        timeouts += clients[i].timeouts;
+        total += clients[i].num_of_latencies;
+        if (clients[i].last_us > elapsed)
+        {
+            elapsed = clients[i].last_us;
+        }
+    }
+
+    all = malloc((total > 0 ? total : 1) * sizeof(long));
+    if (all == NULL)
+    {
+        return 1;
+    }
+    total = 0;
+    for (i = 0; i < g_cfg.clients; i++)
+    {
+        memcpy(all + total, clients[i].latencies, clients[i].num_of_latencies * sizeof(long));
+        total += clients[i].num_of_latencies;
+        free(clients[i].latencies);
+    }
+    qsort(all, total, sizeof(long), compare_long);
+
+    printf("sent %d, replies %ld (error %d), timeouts %d\n", sent, total, errors, timeouts);
+    printf("throughput %.1f req/s\n", elapsed > 0 ? total * 1000000.0 / elapsed : 0);
+    printf("latency us: p50 %ld, p99 %ld, p999 %ld, max %ld\n",
+           percentile(all, total, 0.5), percentile(all, total, 0.99),
+           percentile(all, total, 0.999), total > 0 ? all[total - 1] : 0);
+
+    free(all);
+    free(clients);
+    free(threads);
+    return timeouts > 0 ? 1 : 0;
+}
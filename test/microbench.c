@@ -0,0 +1,330 @@
+/**
+ * @file microbench.c
+ * @brief Microbenchmarks of CPU hot paths
+ * @details Measure request parsing (::PMCFG_parseRequest(), used by
+ * parse_request() of routerupnp.c), config load and save of portmappingcfg.c
+ * and node churn of llist.c with synthetic inputs from 1 to 10000 rules.
+ *
+ * Each case runs in its own child process, so peak RSS of a case is not
+ * hidden by an earlier bigger one. One JSON object per case is printed on
+ * stdout:
+ *
+ *     {"bench":"parse_request","rules":100,"iterations":2000,
+ *      "ns_per_op":51234,"allocs_per_op":402.0,"bytes_per_op":12345.0,
+ *      "peak_rss_kb":2100}
+ *
+ * Allocations are counted by wrapping malloc(), calloc(), realloc() and
+ * free() of glibc, which also catches allocations made inside libcjson.
+ *
+ * Usage: microbench [-b bench] [-t ms_per_case]
+ *
+ * @author Pham Ngoc Thang (thangdc94)
+ * @bug No known bug
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+#include "portmappingcfg.h"
+#include "llist.h"
+
+/** Default time spent in each case in ms */
+#define DEFAULT_CASE_TIME 200
+
+/** First external port of generated rules */
+#define BASE_PORT 10000
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+static unsigned long g_num_of_allocs;
+static unsigned long g_alloc_bytes;
+
+void *malloc(size_t size)
+{
+    g_num_of_allocs++;
+    g_alloc_bytes += size;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    g_num_of_allocs++;
+    g_alloc_bytes += nmemb * size;
+    return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    g_num_of_allocs++;
+    g_alloc_bytes += size;
+    return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr)
+{
+    __libc_free(ptr);
+}
+
+/** Input of a case */
+typedef struct _BenchInput_t
+{
+    int num_of_rules;        /**< number of rules */
+    char *request;           /**< request message with the rules */
+    PortMappingCfg_t cfg;    /**< config with the rules */
+} BenchInput_t;
+
+/** Function run once per operation */
+typedef void (*benchFunction)(BenchInput_t *input);
+
+/** Benchmark */
+typedef struct _Bench_t
+{
+    const char *name;    /**< name */
+    benchFunction setup; /**< run once before timing, may be NULL */
+    benchFunction run;   /**< one operation */
+} Bench_t;
+
+/**
+ * @brief Parse a request like routerupnp does for each client message
+ */
+static void bench_parse_request(BenchInput_t *input)
+{
+    int pid = 0;
+    PortMappingCfg_t cfg = PMCFG_parseRequest(input->request, &pid);
+    free(cfg.rules);
+}
+
+/**
+ * @brief Write config file read by ::bench_get_config()
+ */
+static void setup_get_config(BenchInput_t *input)
+{
+    PMCFG_saveConfig(&input->cfg);
+}
+
+/**
+ * @brief Load config file
+ */
+static void bench_get_config(BenchInput_t *input)
+{
+    PortMappingCfg_t cfg = PMCFG_getConfig();
+    free(cfg.rules);
+}
+
+/**
+ * @brief Save config file
+ */
+static void bench_save_config(BenchInput_t *input)
+{
+    PMCFG_saveConfig(&input->cfg);
+}
+
+/**
+ * @brief Append all rules to a list, then take them back from head
+ */
+static void bench_llist_churn(BenchInput_t *input)
+{
+    list l;
+    MappingRule_t rule;
+    int i;
+
+    list_new(&l, sizeof(MappingRule_t), NULL);
+    for (i = 0; i < input->num_of_rules; i++)
+    {
+        list_append(&l, &input->cfg.rules[i]);
+    }
+    while (list_size(&l) > 0)
+    {
+        list_head(&l, &rule, TRUE);
+    }
+    list_destroy(&l);
+}
+
+static const Bench_t g_benches[] = {
+    {"parse_request", NULL, bench_parse_request},
+    {"PMCFG_getConfig", setup_get_config, bench_get_config},
+    {"PMCFG_saveConfig", NULL, bench_save_config},
+    {"llist_churn", NULL, bench_llist_churn},
+};
+
+static const int g_sizes[] = {1, 10, 100, 1000, 10000};
+
+/**
+ * @brief Build input of a case
+ *
+ * @param[out] input input
+ * @param[in] num_of_rules number of rules
+ * @return 0 if OK and -1 if failed
+ */
+static int make_input(BenchInput_t *input, int num_of_rules)
+{
+    // a rule is less than 64 bytes in a request
+    size_t size = 64 + num_of_rules * 64;
+    int n;
+    int i;
+
+    input->num_of_rules = num_of_rules;
+    input->cfg.is_enable = 1;
+    input->cfg.numofrules = num_of_rules;
+    input->cfg.rules = malloc(num_of_rules * sizeof(MappingRule_t));
+    input->request = malloc(size);
+    if (input->cfg.rules == NULL || input->request == NULL)
+    {
+        return -1;
+    }
+    n = snprintf(input->request, size, "{\"pid\":%d,\"data\":{\"enable\":true,\"rules\":[", getpid());
+    for (i = 0; i < num_of_rules; i++)
+    {
+        MappingRule_t *rule = &input->cfg.rules[i];
+        snprintf(rule->eport, sizeof(rule->eport), "%d", (BASE_PORT + i) & 0xffff);
+        snprintf(rule->iport, sizeof(rule->iport), "%d", (BASE_PORT + i) & 0xffff);
+        rule->proto = i % 2 ? UDP : TCP;
+        rule->ttl = 0;
+        n += snprintf(input->request + n, size - n, "%s{\"eport\":\"%s\",\"iport\":\"%s\",\"proto\":\"%s\"}",
+                      i > 0 ? "," : "", rule->eport, rule->iport, get_proto_str(rule->proto));
+    }
+    snprintf(input->request + n, size - n, "]}}");
+    return 0;
+}
+
+/**
+ * @brief Get current time in ns
+ */
+static long long now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/**
+ * @brief Run a case and print its result
+ * @details Run in a child process. Number of iterations is chosen from time
+ * of a first run so the case takes about @p case_time_ms.
+ *
+ * @param[in] bench benchmark
+ * @param[in] num_of_rules number of rules
+ * @param[in] case_time_ms time spent in the case
+ * @return 0 if OK and -1 if failed
+ */
+static int run_case(const Bench_t *bench, int num_of_rules, int case_time_ms)
+{
+    BenchInput_t input;
+    struct rusage usage;
+    unsigned long allocs;
+    unsigned long bytes;
+    long long start;
+    long long elapsed;
+    long iterations;
+    long i;
+
+    if (make_input(&input, num_of_rules) != 0)
+    {
+        return -1;
+    }
+    if (bench->setup != NULL)
+    {
+        bench->setup(&input);
+    }
+
+    // warm up and calibrate
+    start = now_ns();
+    bench->run(&input);
+    elapsed = now_ns() - start;
+    iterations = elapsed > 0 ? case_time_ms * 1000000LL / elapsed : 1000000;
+    if (iterations < 1)
+    {
+        iterations = 1;
+    }
+
+    allocs = g_num_of_allocs;
+    bytes = g_alloc_bytes;
+    start = now_ns();
+    for (i = 0; i < iterations; i++)
+    {
+        bench->run(&input);
+    }
+    elapsed = now_ns() - start;
+    allocs = g_num_of_allocs - allocs;
+    bytes = g_alloc_bytes - bytes;
+    getrusage(RUSAGE_SELF, &usage);
+
+    printf("{\"bench\":\"%s\",\"rules\":%d,\"iterations\":%ld,\"ns_per_op\":%lld,"
+           "\"allocs_per_op\":%.1f,\"bytes_per_op\":%.1f,\"peak_rss_kb\":%ld}\n",
+           bench->name, num_of_rules, iterations, elapsed / iterations,
+           (double)allocs / iterations, (double)bytes / iterations, usage.ru_maxrss);
+    fflush(stdout);
+    free(input.request);
+    free(input.cfg.rules);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    const char *only = NULL;
+    int case_time_ms = DEFAULT_CASE_TIME;
+    char dir[] = "/tmp/microbench-XXXXXX";
+    unsigned int b;
+    unsigned int s;
+    int failed = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "b:t:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'b':
+            only = optarg;
+            break;
+        case 't':
+            case_time_ms = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-b bench] [-t ms_per_case]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    // config functions use a file in current directory
+    if (mkdtemp(dir) == NULL || chdir(dir) != 0)
+    {
+        perror("microbench");
+        return 1;
+    }
+    for (b = 0; b < sizeof(g_benches) / sizeof(g_benches[0]); b++)
+    {
+        if (only != NULL && strcmp(only, g_benches[b].name) != 0)
+        {
+            continue;
+        }
+        for (s = 0; s < sizeof(g_sizes) / sizeof(g_sizes[0]); s++)
+        {
+            int status;
+            pid_t pid = fork();
+            if (pid == 0)
+            {
+                _exit(run_case(&g_benches[b], g_sizes[s], case_time_ms) == 0 ? 0 : 1);
+            }
+            if (pid < 0 || waitpid(pid, &status, 0) != pid || !WIFEXITED(status) ||
+                WEXITSTATUS(status) != 0)
+            {
+                fprintf(stderr, "%s with %d rules failed\n", g_benches[b].name, g_sizes[s]);
+                failed = 1;
+            }
+        }
+    }
+    unlink("routerupnp_cfg.json");
+    if (chdir("/") != 0 || rmdir(dir) != 0)
+    {
+        perror("microbench");
+    }
+    return failed;
+}
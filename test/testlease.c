@@ -0,0 +1,110 @@
+/**
+ * @file testlease.c
+ * @brief Application to test lease renewal schedule
+ * @details Check order of lease heap and renewal times, due entries and
+ * stale timers of shadow table.
+ *
+ * @author Pham Ngoc Thang (thangdc94)
+ * @bug No known bug
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "upnp_pf_lease.h"
+#include "upnp_pf_shadow.h"
+#include "testutil.h"
+
+/** Number of timers pushed in random order */
+#define NUM_OF_TIMERS 1000
+
+/** Lease of test entries in seconds */
+#define LEASE 800
+
+/**
+ * @brief Make a TCP rule
+ */
+static MappingRule_t make_rule(int port)
+{
+    MappingRule_t rule;
+    snprintf(rule.eport, sizeof(rule.eport), "%d", port);
+    snprintf(rule.iport, sizeof(rule.iport), "%d", port);
+    rule.proto = TCP;
+    rule.ttl = LEASE;
+    return rule;
+}
+
+int main(int argc, char **argv)
+{
+    LeaseHeap_t heap;
+    LeaseTimer_t timer;
+    ShadowTable_t table;
+    ShadowEntry_t *entry;
+    MappingRule_t rule;
+    MappingRule_t due[4];
+    time_t now;
+    time_t last = 0;
+    int sorted = 1;
+    int in_range = 1;
+    int i;
+    int n;
+
+    leaseHeap_init(&heap);
+    for (i = 0; i < NUM_OF_TIMERS; i++)
+    {
+        timer.when = random() % 100000;
+        timer.eport = i;
+        timer.proto = TCP;
+        leaseHeap_push(&heap, &timer);
+    }
+    expect(heap.size == NUM_OF_TIMERS, "push timers");
+    for (i = 0; leaseHeap_pop(&heap, &timer) == 0; i++)
+    {
+        sorted = sorted && timer.when >= last;
+        last = timer.when;
+    }
+    expect(sorted && i == NUM_OF_TIMERS, "pop timers earliest first");
+    expect(leaseHeap_top(&heap) == NULL, "empty heap");
+    leaseHeap_destroy(&heap);
+
+    shadowTable_init(&table);
+    now = shadowTable_now();
+    for (i = 0; i < 3; i++)
+    {
+        rule = make_rule(8000 + i);
+        shadowTable_put(&table, &rule, "192.168.1.2", LEASE);
+        entry = shadowTable_find(&table, rule.eport, TCP);
+        in_range = in_range && entry->renew <= entry->expire - LEASE / SHADOW_RENEW_DIVISOR &&
+                   entry->renew >= now + LEASE - LEASE / SHADOW_RENEW_DIVISOR - LEASE / SHADOW_RENEW_JITTER_DIVISOR;
+    }
+    expect(in_range, "renewal time with jitter");
+    rule = make_rule(8003);
+    shadowTable_put(&table, &rule, "192.168.1.2", 0);
+    expect(shadowTable_find(&table, "8003", TCP)->renew == 0, "entry without lease is not scheduled");
+
+    expect(shadowTable_popDue(&table, now, due, 4) == 0, "nothing due before renewal time");
+    shadowTable_remove(&table, "8000", TCP);
+    expect(shadowTable_popDue(&table, now + LEASE, due, 4) == 2, "removed entry is not due");
+    expect(shadowTable_nextRenew(&table) == 0, "nothing scheduled after entries are taken");
+
+    entry = shadowTable_find(&table, "8001", TCP);
+    shadowTable_setRenew(&table, entry, now + 10);
+    expect(shadowTable_nextRenew(&table) == now + 10, "schedule retry");
+    rule = make_rule(8001);
+    shadowTable_put(&table, &rule, "192.168.1.2", LEASE);
+    expect(shadowTable_nextRenew(&table) > now + 10, "renewed entry replaces retry");
+    n = shadowTable_popDue(&table, now + LEASE, due, 4);
+    expect(n == 1 && strcmp(due[0].eport, "8001") == 0 && due[0].ttl == LEASE, "take renewed entry once");
+
+    for (i = 0; i < 100; i++)
+    {
+        shadowTable_put(&table, &rule, "192.168.1.2", LEASE);
+    }
+    expect(table.renewals.size <= 2 * table.size + 16 + 1, "stale timers are dropped");
+    shadowTable_clear(&table);
+    expect(shadowTable_nextRenew(&table) == 0, "clear removes timers");
+    shadowTable_destroy(&table);
+
+    return test_summary();
+}
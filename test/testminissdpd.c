@@ -0,0 +1,155 @@
+/**
+ * @file testminissdpd.c
+ * @brief Application to test minissdpd client
+ * @details Run ::minissdpd_getDevices() against a local stand-in server on a
+ * Unix socket and check request encoding, long lengths and split responses.
+ *
+ * @author Pham Ngoc Thang (thangdc94)
+ * @bug No known bug
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "upnp_pf_minissdpd.h"
+#include "testutil.h"
+
+/** Socket path of stand-in server */
+#define SOCKET_PATH "/tmp/testminissdpd.sock"
+
+/** Device type asked by the test */
+#define DEVTYPE "urn:schemas-upnp-org:device:InternetGatewayDevice:"
+
+/** Max number of devices in a test */
+#define MAX_DEVICES 4
+
+static int g_listen_fd;
+static char g_request[256]; /* device type received by server */
+/** Devices answered by stand-in server */
+static const char *g_devices[][3] = {
+    {"http://192.168.1.1:5000/rootDesc.xml",
+     "urn:schemas-upnp-org:device:InternetGatewayDevice:1",
+     "uuid:11111111-2222-3333-4444-555555555555::urn:schemas-upnp-org:device:InternetGatewayDevice:1"},
+    {"http://192.168.1.254:49152/a/very/long/path/to/make/sure/that/lengths/above/one/hundred"
+     "/and/twenty/seven/bytes/are/encoded/on/two/bytes/gatedesc.xml",
+     "urn:schemas-upnp-org:device:InternetGatewayDevice:2",
+     "uuid:66666666-7777-8888-9999-000000000000::urn:schemas-upnp-org:device:InternetGatewayDevice:2"},
+};
+
+/**
+ * @brief Write a length encoded string
+ *
+ * @param[out] p output buffer
+ * @param[in] str string
+ * @return number of written bytes
+ */
+static int put_string(unsigned char *p, const char *str)
+{
+    int len = strlen(str);
+    int n = 0;
+    if (len >= 128)
+    {
+        p[n++] = (len >> 7) | 0x80;
+    }
+    p[n++] = len & 0x7f;
+    memcpy(p + n, str, len);
+    return n + len;
+}
+
+/**
+ * @brief Serve one request
+ * @details Answer all devices, the response is sent in small pieces
+ */
+static void *server_thread(void *arg)
+{
+    int num_of_devices = *(int *)arg;
+    unsigned char buf[2048];
+    int len = 0;
+    int i;
+    int fd = accept(g_listen_fd, NULL, NULL);
+    int n;
+
+    if (fd < 0)
+    {
+        return NULL;
+    }
+    n = recv(fd, buf, sizeof(buf), 0);
+    if (n >= 2 && buf[0] == 1 && !(buf[1] & 0x80) && buf[1] == n - 2)
+    {
+        memcpy(g_request, buf + 2, n - 2);
+        g_request[n - 2] = '\0';
+    }
+
+    buf[len++] = num_of_devices;
+    for (i = 0; i < num_of_devices; i++)
+    {
+        len += put_string(buf + len, g_devices[i][0]);
+        len += put_string(buf + len, g_devices[i][1]);
+        len += put_string(buf + len, g_devices[i][2]);
+    }
+    for (i = 0; i < len; i += 50)
+    {
+        send(fd, buf + i, (len - i < 50) ? len - i : 50, MSG_NOSIGNAL);
+        usleep(1000);
+    }
+    close(fd);
+    return NULL;
+}
+
+/**
+ * @brief Ask stand-in server which answers some devices
+ *
+ * @param[in] num_of_devices number of devices answered
+ * @param[out] urls description URLs
+ * @return result of ::minissdpd_getDevices()
+ */
+static int query(int num_of_devices, char urls[][MINISSDPD_MAX_URL_SIZE])
+{
+    pthread_t thread;
+    int n;
+    pthread_create(&thread, NULL, server_thread, &num_of_devices);
+    n = minissdpd_getDevices(SOCKET_PATH, DEVTYPE, 1000, urls, MAX_DEVICES);
+    pthread_join(thread, NULL);
+    return n;
+}
+
+int main(int argc, char **argv)
+{
+    struct sockaddr_un addr;
+    char urls[MAX_DEVICES][MINISSDPD_MAX_URL_SIZE];
+    int n;
+
+    unlink(SOCKET_PATH);
+    expect(minissdpd_getDevices(SOCKET_PATH, DEVTYPE, 100, urls, MAX_DEVICES) == -1,
+           "no answer when minissdpd is not running");
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, SOCKET_PATH);
+    g_listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (g_listen_fd < 0 || bind(g_listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        listen(g_listen_fd, 1) != 0)
+    {
+        perror("stand-in server");
+        return 1;
+    }
+
+    n = query(2, urls);
+    expect(strcmp(g_request, DEVTYPE) == 0, "request carries device type");
+    expect(n == 2, "all devices returned");
+    expect(n == 2 && strcmp(urls[0], g_devices[0][0]) == 0, "first URL");
+    expect(n == 2 && strcmp(urls[1], g_devices[1][0]) == 0, "long URL with two bytes length");
+
+    n = query(0, urls);
+    expect(n == 0, "empty device list");
+
+    close(g_listen_fd);
+    unlink(SOCKET_PATH);
+
+    return test_summary();
+}
@@ -0,0 +1,240 @@
+/**
+ * @file testnatpmp.c
+ * @brief Application to test NAT-PMP client
+ * @details Run NAT-PMP requests against a local UDP stand-in server and check
+ * encoding, retransmission, port reassignment and error results. Check the
+ * set of internal ports used to find rules which would replace each other.
+ *
+ * @author Pham Ngoc Thang (thangdc94)
+ * @bug No known bug
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include "upnp_pf_natpmp.h"
+#include "testutil.h"
+
+/** Number of mappings in latency test */
+#define NUM_OF_MAPPINGS 100
+
+/** Lifetime granted by stand-in server */
+#define MAX_LIFETIME 3600
+
+/** External port already used on stand-in server */
+#define BUSY_PORT 9000
+
+/** External port refused by stand-in server */
+#define REFUSED_PORT 22
+
+/** Behaviour of stand-in server */
+typedef struct _ServerCfg_t
+{
+    int fd;               /**< server socket */
+    int stop;             /**< stop server */
+    int drop;             /**< number of requests to drop */
+    int num_of_requests;  /**< number of received requests */
+    int last_eport;       /**< suggested external port of last request */
+    pthread_mutex_t mutex; /**< protect fields */
+} ServerCfg_t;
+
+static ServerCfg_t g_server;
+/**
+ * @brief Build answer of a request
+ *
+ * @param[in] req request
+ * @param[in] len size of request
+ * @param[out] ans answer
+ * @return size of answer or 0 if request is ignored
+ */
+static int answer(const unsigned char *req, int len, unsigned char *ans)
+{
+    int eport;
+    unsigned long lifetime;
+
+    memset(ans, 0, 16);
+    ans[1] = req[1] + 128;
+    ans[7] = 42; // epoch
+    if (req[1] == 0 && len == 2)
+    {
+        ans[8] = 203;
+        ans[9] = 0;
+        ans[10] = 113;
+        ans[11] = 7;
+        return 12;
+    }
+    if ((req[1] != 1 && req[1] != 2) || len != 12)
+    {
+        return 0;
+    }
+    eport = (req[6] << 8) | req[7];
+    lifetime = ((unsigned long)req[8] << 24) | (req[9] << 16) | (req[10] << 8) | req[11];
+    g_server.last_eport = eport;
+    memcpy(ans + 8, req + 4, 2); // internal port
+    if (eport == REFUSED_PORT)
+    {
+        ans[3] = 2; // not authorized
+        return 16;
+    }
+    if (eport == BUSY_PORT)
+    {
+        eport++;
+    }
+    if (lifetime > MAX_LIFETIME)
+    {
+        lifetime = MAX_LIFETIME;
+    }
+    ans[10] = eport >> 8;
+    ans[11] = eport & 0xff;
+    ans[12] = lifetime >> 24;
+    ans[13] = lifetime >> 16;
+    ans[14] = lifetime >> 8;
+    ans[15] = lifetime;
+    return 16;
+}
+
+/**
+ * @brief Serve requests until stopped
+ */
+static void *server_thread(void *arg)
+{
+    while (!g_server.stop)
+    {
+        unsigned char req[64];
+        unsigned char ans[16];
+        struct sockaddr_in from;
+        socklen_t from_len = sizeof(from);
+        struct pollfd pfd;
+        int n;
+
+        pfd.fd = g_server.fd;
+        pfd.events = POLLIN;
+        if (poll(&pfd, 1, 50) <= 0)
+        {
+            continue;
+        }
+        n = recvfrom(g_server.fd, req, sizeof(req), 0, (struct sockaddr *)&from, &from_len);
+        if (n < 2 || req[0] != 0)
+        {
+            continue;
+        }
+        pthread_mutex_lock(&g_server.mutex);
+        g_server.num_of_requests++;
+        if (g_server.drop > 0)
+        {
+            g_server.drop--;
+            n = 0;
+        }
+        else
+        {
+            n = answer(req, n, ans);
+        }
+        pthread_mutex_unlock(&g_server.mutex);
+        if (n > 0)
+        {
+            sendto(g_server.fd, ans, n, 0, (struct sockaddr *)&from, from_len);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Get current time in us
+ */
+static long now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000L + ts.tv_nsec / 1000L;
+}
+
+int main(int argc, char **argv)
+{
+    NatPmp_t np;
+    NatPmpPorts_t ports;
+    pthread_t thread;
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+    char extip[16] = "";
+    int mapped_eport = 0;
+    long lifetime = 0;
+    long start;
+    int i;
+    int r;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    g_server.fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (g_server.fd < 0 || bind(g_server.fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        getsockname(g_server.fd, (struct sockaddr *)&addr, &addr_len) != 0)
+    {
+        perror("stand-in server");
+        return 1;
+    }
+    pthread_mutex_init(&g_server.mutex, NULL);
+    pthread_create(&thread, NULL, server_thread, NULL);
+
+    expect(natpmp_init(&np, "127.0.0.1", ntohs(addr.sin_port)) == 0, "init gateway");
+    expect(strcmp(np.lanaddr, "127.0.0.1") == 0, "local address towards gateway");
+
+    r = natpmp_getExternalAddress(&np, extip);
+    expect(r == NATPMP_SUCCESS && strcmp(extip, "203.0.113.7") == 0, "external address");
+
+    r = natpmp_map(&np, 1, 80, 8080, 86400, &mapped_eport, &lifetime);
+    expect(r == NATPMP_SUCCESS && mapped_eport == 8080, "map TCP port");
+    expect(lifetime == MAX_LIFETIME, "lifetime given by gateway");
+
+    g_server.drop = 1;
+    g_server.num_of_requests = 0;
+    r = natpmp_map(&np, 0, 53, 5353, 86400, &mapped_eport, NULL);
+    expect(r == NATPMP_SUCCESS && g_server.num_of_requests == 2, "request sent again when answer is lost");
+
+    r = natpmp_map(&np, 1, 81, BUSY_PORT, 86400, &mapped_eport, NULL);
+    expect(r == NATPMP_SUCCESS && mapped_eport == BUSY_PORT + 1, "gateway gives another external port");
+
+    r = natpmp_map(&np, 1, 80, 8080, 0, NULL, NULL);
+    expect(r == NATPMP_SUCCESS && g_server.last_eport == 0, "delete sends no external port");
+    r = natpmp_map(&np, 0, 0, 0, 0, NULL, NULL);
+    expect(r == NATPMP_SUCCESS, "delete all mappings");
+
+    r = natpmp_map(&np, 1, 22, REFUSED_PORT, 86400, NULL, NULL);
+    expect(r == NATPMP_NOT_AUTHORIZED, "result code of refused mapping");
+
+    memset(&ports, 0, sizeof(ports));
+    expect(natpmp_addPort(&ports, 1, 80) && natpmp_hasPort(&ports, 1, 80), "add internal port to set");
+    expect(!natpmp_addPort(&ports, 1, 80), "rule with same internal port and protocol is a conflict");
+    expect(natpmp_addPort(&ports, 0, 80) && !natpmp_hasPort(&ports, 1, 81), "other protocol or port is no conflict");
+    expect(!natpmp_addPort(&ports, 1, 0) && !natpmp_addPort(&ports, 1, 65536), "port which is not valid");
+
+    start = now_us();
+    for (i = 0; i < NUM_OF_MAPPINGS; i++)
+    {
+        if (natpmp_map(&np, 1, 10000 + i, 10000 + i, 86400, NULL, NULL) != NATPMP_SUCCESS)
+        {
+            break;
+        }
+    }
+    expect(i == NUM_OF_MAPPINGS, "many mappings");
+    printf("INFO: %ld us per mapping\n", (now_us() - start) / NUM_OF_MAPPINGS);
+
+    g_server.stop = 1;
+    pthread_join(thread, NULL);
+    close(g_server.fd);
+
+    // nobody listens on the port anymore
+    np.max_tries = 2;
+    start = now_us();
+    r = natpmp_getExternalAddress(&np, extip);
+    expect(r == NATPMP_TIMEOUT, "no answer when gateway doesn't speak NAT-PMP");
+    expect(now_us() - start < NATPMP_INITIAL_TIMEOUT * 3 * 1000L, "give up after max tries");
+
+    return test_summary();
+}
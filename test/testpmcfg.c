@@ -0,0 +1,195 @@
+/**
+ * @file testpmcfg.c
+ * @brief Application to test port mapping config changes
+ * @details Check parsing of request operations and ports, add/remove/replace
+ * of rules, that changes saved to journal are read back and compacted, and
+ * that a config file which is not valid is an error.
+ *
+ * @author Pham Ngoc Thang (thangdc94)
+ * @bug No known bug
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "portmappingcfg.h"
+#include "testutil.h"
+
+/**
+ * @brief Find a rule in config
+ *
+ * @param[in] cfg config
+ * @param[in] eport external port
+ * @param[in] proto protocol
+ * @return rule or NULL if not found
+ */
+static MappingRule_t *find(PortMappingCfg_t *cfg, const char *eport, SupportedProtocol_t proto)
+{
+    int i;
+    for (i = 0; i < cfg->numofrules; i++)
+    {
+        if (cfg->rules[i].proto == proto && strcmp(cfg->rules[i].eport, eport) == 0)
+        {
+            return &cfg->rules[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Count changes in journal
+ *
+ * @return number of lines of journal file, 0 if there is none
+ */
+static int count_changes()
+{
+    FILE *file = fopen("routerupnp_cfg.journal", "r");
+    int count = 0;
+    int c;
+    if (file == NULL)
+    {
+        return 0;
+    }
+    while ((c = fgetc(file)) != EOF)
+    {
+        count += c == '\n';
+    }
+    fclose(file);
+    return count;
+}
+
+/**
+ * @brief Parse data of a request
+ *
+ * @param[in] data json of "data"
+ * @return change
+ */
+static PortMappingCfg_t parse(const char *data)
+{
+    char request[512];
+    int pid = 0;
+    snprintf(request, sizeof(request), "{\"pid\": 1, \"data\": %s}", data);
+    return PMCFG_parseRequest(request, &pid);
+}
+
+int main(int argc, char **argv)
+{
+    char dir[] = "/tmp/testpmcfgXXXXXX";
+    PortMappingCfg_t cfg;
+    PortMappingCfg_t change;
+    MappingRule_t *rule;
+    FILE *file;
+    int i;
+
+    if (mkdtemp(dir) == NULL || chdir(dir) != 0)
+    {
+        perror("temp dir");
+        return 1;
+    }
+
+    change = parse("{\"enable\": true, \"rules\": []}");
+    expect(change.op == PMCFG_OP_REPLACE, "request without op replaces config");
+    free(change.rules);
+    change = parse("{\"rules\": []}");
+    expect(change.op == PMCFG_OP_INVALID, "replace without enable is invalid");
+    change = PMCFG_parseRequest("garbage{", &i);
+    expect(change.op == PMCFG_OP_INVALID, "request which is not JSON is invalid");
+    change = PMCFG_parseRequest("{\"pid\": 1}", &i);
+    expect(change.op == PMCFG_OP_INVALID, "request without data is invalid");
+    change = parse("{\"op\": \"move\", \"rules\": []}");
+    expect(change.op == PMCFG_OP_INVALID, "unknown op is invalid");
+    free(change.rules);
+    change = parse("{\"op\": \"remove\", \"rules\": [{\"eport\": \"80\", \"proto\": \"TCP\"}]}");
+    expect(change.op == PMCFG_OP_REMOVE && change.numofrules == 1, "remove rule only needs eport and proto");
+    free(change.rules);
+    change = parse("{\"op\": \"add\", \"rules\": [{\"eport\": \"80\", \"proto\": \"TCP\"}]}");
+    expect(change.op == PMCFG_OP_INVALID && change.rules == NULL, "rule to add needs iport");
+    change = parse("{\"op\": \"add\", \"rules\": [{\"eport\": \"8000000\", \"iport\": \"80\", "
+                   "\"proto\": \"TCP\"}]}");
+    expect(change.op == PMCFG_OP_INVALID, "too long port is invalid");
+    change = parse("{\"op\": \"add\", \"rules\": [{\"eport\": 80, \"iport\": \"80\", \"proto\": \"TCP\"}]}");
+    expect(change.op == PMCFG_OP_INVALID, "port which is not a string is invalid");
+    change = parse("{\"op\": \"add\", \"rules\": [{\"eport\": \"80\", \"iport\": \"80\", \"proto\": \"SCTP\"}]}");
+    expect(change.op == PMCFG_OP_INVALID, "unknown protocol is invalid");
+    change = parse("{\"op\": \"add\", \"rules\": [{\"eport\": \"70000\", \"iport\": \"80\", \"proto\": \"TCP\"}]}");
+    expect(change.op == PMCFG_OP_INVALID, "port above 65535 is invalid");
+    change = parse("{\"op\": \"add\", \"rules\": [{\"eport\": \"80\", \"iport\": \"0\", \"proto\": \"TCP\"}]}");
+    expect(change.op == PMCFG_OP_INVALID, "port 0 is invalid");
+    change = parse("{\"op\": \"add\", \"rules\": [{\"eport\": \"8a\", \"iport\": \"80\", \"proto\": \"TCP\"}]}");
+    expect(change.op == PMCFG_OP_INVALID, "port which is not decimal is invalid");
+    change = parse("{\"op\": \"remove\", \"rules\": [{\"eport\": \"\", \"proto\": \"TCP\"}]}");
+    expect(change.op == PMCFG_OP_INVALID, "empty port is invalid");
+
+    cfg = PMCFG_getConfig();
+    change = parse("{\"op\": \"replace\", \"enable\": true, \"rules\": ["
+                   "{\"eport\": \"1000\", \"iport\": \"1000\", \"proto\": \"TCP\"},"
+                   "{\"eport\": \"2000\", \"iport\": \"2000\", \"proto\": \"UDP\"}]}");
+    expect(PMCFG_applyChange(&cfg, &change) == 0 && cfg.is_enable && cfg.numofrules == 2, "replace");
+    PMCFG_saveChange(&cfg, &change);
+    free(change.rules);
+
+    change = parse("{\"op\": \"add\", \"rules\": ["
+                   "{\"eport\": \"1000\", \"iport\": \"1001\", \"proto\": \"TCP\"},"
+                   "{\"eport\": \"1000\", \"iport\": \"1000\", \"proto\": \"UDP\"}]}");
+    expect(change.op == PMCFG_OP_ADD, "parse add");
+    PMCFG_applyChange(&cfg, &change);
+    rule = find(&cfg, "1000", TCP);
+    expect(cfg.numofrules == 3 && rule != NULL && strcmp(rule->iport, "1001") == 0,
+           "add updates rule with same external port and protocol");
+    expect(cfg.is_enable, "add keeps enable");
+    PMCFG_saveChange(&cfg, &change);
+    free(change.rules);
+
+    change = parse("{\"op\": \"remove\", \"rules\": ["
+                   "{\"eport\": \"2000\", \"iport\": \"2000\", \"proto\": \"UDP\"},"
+                   "{\"eport\": \"3000\", \"iport\": \"3000\", \"proto\": \"UDP\"}]}");
+    expect(change.op == PMCFG_OP_REMOVE, "parse remove");
+    PMCFG_applyChange(&cfg, &change);
+    expect(cfg.numofrules == 2 && find(&cfg, "2000", UDP) == NULL, "remove");
+    PMCFG_saveChange(&cfg, &change);
+    free(change.rules);
+    expect(count_changes() == 2, "changes are saved to journal");
+    free(cfg.rules);
+
+    cfg = PMCFG_getConfig();
+    rule = find(&cfg, "1000", TCP);
+    expect(cfg.is_enable && cfg.numofrules == 2 && rule != NULL && strcmp(rule->iport, "1001") == 0 &&
+               find(&cfg, "1000", UDP) != NULL,
+           "journal is applied when config is read");
+
+    for (i = 0; i < 3 * PMCFG_MAX_CHANGES; i++)
+    {
+        change = parse("{\"op\": \"add\", \"rules\": ["
+                       "{\"eport\": \"4000\", \"iport\": \"4000\", \"proto\": \"TCP\"}]}");
+        PMCFG_applyChange(&cfg, &change);
+        PMCFG_saveChange(&cfg, &change);
+        free(change.rules);
+    }
+    expect(count_changes() <= PMCFG_MAX_CHANGES, "journal is compacted into config file");
+    free(cfg.rules);
+    cfg = PMCFG_getConfig();
+    expect(cfg.numofrules == 3 && find(&cfg, "4000", TCP) != NULL, "compacted config");
+    free(cfg.rules);
+
+    file = fopen("routerupnp_cfg.json", "w");
+    fprintf(file, "{\"enable\": true, \"rules\": [{\"eport\": \"99999\", \"iport\": \"80\", \"proto\": \"TCP\"}]}\n");
+    fclose(file);
+    cfg = PMCFG_getConfig();
+    expect(cfg.op == PMCFG_OP_INVALID && !cfg.is_enable && cfg.numofrules == 0,
+           "config file with a rule which is not valid is an error");
+    file = fopen("routerupnp_cfg.json", "w");
+    fprintf(file, "{\"enable\": true, \"rules\": [\n");
+    fclose(file);
+    cfg = PMCFG_getConfig();
+    expect(cfg.op == PMCFG_OP_INVALID && !cfg.is_enable, "config file which is not JSON is an error");
+    expect(access("routerupnp_cfg.json", F_OK) == 0, "config file which is not valid is kept");
+
+    unlink("routerupnp_cfg.json");
+    unlink("routerupnp_cfg.journal");
+    chdir("/");
+    rmdir(dir);
+
+    return test_summary();
+}
@@ -108,15 +108,20 @@ int main(int argc, char **argv)
             free(request_msg);
         }
 
-        // receive response from server
-        memset(in_buffer, 0, strlen(in_buffer));
-        if (mq_receive(qd_client, in_buffer, MSG_BUFFER_SIZE, NULL) == -1)
+        // receive responses from server until request is done
+        do
         {
-            perror("Client: mq_receive");
-            exit(1);
-        }
-        // display token received from server
-        printf("Client: Token received from server: %s\n\n", in_buffer);
+            ssize_t n = mq_receive(qd_client, in_buffer, MSG_BUFFER_SIZE, NULL);
+            if (n == -1)
+            {
+                perror("Client: mq_receive");
+                exit(1);
+            }
+            in_buffer[n] = '\0';
+            // display token received from server
+            printf("Client: Token received from server: %s\n", in_buffer);
+        } while (strncmp(in_buffer, "Accepted", 8) == 0);
+        printf("\n");
 
         printf("Ask for a token (Press ): ");
     }
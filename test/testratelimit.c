@@ -0,0 +1,139 @@
+/**
+ * @file testratelimit.c
+ * @brief Application to test adaptive rate limiter
+ * @details Check token bucket rate, concurrency limit, additive increase,
+ * multiplicative decrease on errors and latency, and back-off.
+ *
+ * @author Pham Ngoc Thang (thangdc94)
+ * @bug No known bug
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "upnp_pf_ratelimit.h"
+#include "testutil.h"
+
+/** Rate of token bucket test */
+#define RATE 50
+
+/** Burst of token bucket test */
+#define BURST 5
+
+/** Number of requests of token bucket test */
+#define NUM_OF_REQUESTS 30
+
+/** Max requests in flight of concurrency test */
+#define MAX_LIMIT 4
+
+/** Number of threads of concurrency test */
+#define NUM_OF_THREADS 8
+
+static int g_in_flight = 0;
+static int g_max_in_flight = 0;
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @brief Get current time in ms
+ */
+static long now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+}
+
+/**
+ * @brief Send requests of 2 ms and count requests in flight
+ *
+ * @param[in] arg pointer to ::RateLimiter_t
+ */
+static void *client(void *arg)
+{
+    RateLimiter_t *rl = arg;
+    int i;
+    for (i = 0; i < 20; i++)
+    {
+        long long start = rateLimiter_acquire(rl);
+        pthread_mutex_lock(&g_lock);
+        if (++g_in_flight > g_max_in_flight)
+        {
+            g_max_in_flight = g_in_flight;
+        }
+        pthread_mutex_unlock(&g_lock);
+        usleep(2000);
+        pthread_mutex_lock(&g_lock);
+        g_in_flight--;
+        pthread_mutex_unlock(&g_lock);
+        rateLimiter_release(rl, start, 0);
+    }
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    RateLimiter_t rl;
+    RateLimitStats_t stats;
+    pthread_t threads[NUM_OF_THREADS];
+    long long start;
+    long begin;
+    long elapsed;
+    double limit;
+    int i;
+
+    rateLimiter_init(&rl, RATE, BURST, 1);
+    begin = now_ms();
+    for (i = 0; i < NUM_OF_REQUESTS; i++)
+    {
+        rateLimiter_release(&rl, rateLimiter_acquire(&rl), 0);
+    }
+    elapsed = now_ms() - begin;
+    expect(elapsed >= (NUM_OF_REQUESTS - BURST) * 1000L / RATE - 20, "token bucket paces requests");
+    expect(elapsed < (NUM_OF_REQUESTS - BURST) * 1000L / RATE + 200, "token bucket lets burst through");
+    rateLimiter_destroy(&rl);
+
+    rateLimiter_init(&rl, 0, 1, MAX_LIMIT);
+    for (i = 0; i < NUM_OF_THREADS; i++)
+    {
+        pthread_create(&threads[i], NULL, client, &rl);
+    }
+    for (i = 0; i < NUM_OF_THREADS; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    rateLimiter_getStats(&rl, &stats);
+    expect(g_max_in_flight <= MAX_LIMIT, "requests in flight stay under limit");
+    expect(g_max_in_flight > 1 && stats.limit > 1, "limit grows while latency is flat");
+    expect(stats.num_of_requests == NUM_OF_THREADS * 20 && stats.in_flight == 0, "count requests");
+
+    limit = stats.limit;
+    usleep(200000); // limit is decreased at most once per round trip
+    start = rateLimiter_acquire(&rl);
+    rateLimiter_release(&rl, start - 100000, 0);
+    rateLimiter_getStats(&rl, &stats);
+    expect(stats.limit <= limit / 2 + 0.01, "limit is halved when latency grows");
+    rateLimiter_destroy(&rl);
+
+    rateLimiter_init(&rl, RATE, BURST, MAX_LIMIT);
+    rl.limit = MAX_LIMIT;
+    start = rateLimiter_acquire(&rl);
+    rateLimiter_release(&rl, start, 1);
+    rateLimiter_getStats(&rl, &stats);
+    expect(stats.limit == MAX_LIMIT / 2 && stats.rate == RATE / 2, "limit and rate are halved on error");
+    expect(stats.backoff_ms >= RATE_LIMIT_BACKOFF_BASE / 2 - 1 && stats.backoff_ms <= RATE_LIMIT_BACKOFF_BASE,
+           "back-off with jitter");
+    begin = now_ms();
+    start = rateLimiter_acquire(&rl);
+    expect(now_ms() - begin >= RATE_LIMIT_BACKOFF_BASE / 2 - 1, "request waits for back-off");
+    rateLimiter_release(&rl, start, 1);
+    rateLimiter_getStats(&rl, &stats);
+    expect(stats.backoff_ms >= RATE_LIMIT_BACKOFF_BASE - 5 && stats.num_of_errors == 2,
+           "back-off grows after another error");
+    rateLimiter_destroy(&rl);
+
+    return test_summary();
+}
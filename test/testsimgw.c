@@ -0,0 +1,128 @@
+/**
+ * @file testsimgw.c
+ * @brief Application to test simulated gateway
+ * @details Check table capacity, conflicts, injected errors, timeouts and
+ * IGDv2 actions of the in-memory simulated gateway.
+ *
+ * @author Pham Ngoc Thang (thangdc94)
+ * @bug No known bug
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "upnp_pf_simgw.h"
+#include "testutil.h"
+
+/** Table capacity of simulated gateway */
+#define CAPACITY 4
+
+/** Time of a call which times out in ms */
+#define TIMEOUT_MS 50
+
+/**
+ * @brief Get current time in us
+ */
+static long now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000L + ts.tv_nsec / 1000L;
+}
+
+/**
+ * @brief Count entries listed by GetListOfPortMappings
+ */
+static void count_entry(const SoapPortMapping_t *entry, void *arg)
+{
+    (*(int *)arg)++;
+}
+
+int main(int argc, char **argv)
+{
+    SimGatewayCfg_t cfg = {CAPACITY, 0, TIMEOUT_MS, 1};
+    SimGateway_t sim;
+    char extPort[6], intClient[40], intPort[6], protocol[4], desc[80], duration[16];
+    char extip[16] = "";
+    char port[6];
+    int listed = 0;
+    int count = 0;
+    long start;
+    int i;
+    int r;
+
+    expect(simGateway_init(&sim, &cfg) == 0, "init simulated gateway");
+
+    for (i = 0; i < CAPACITY; i++)
+    {
+        snprintf(port, sizeof(port), "%d", 8000 + i);
+        if (simGateway_addPortMapping(&sim, port, port, "192.168.1.2", "test", "TCP", "3600") != 0)
+        {
+            break;
+        }
+    }
+    expect(i == CAPACITY, "fill table");
+    r = simGateway_addPortMapping(&sim, "9000", "9000", "192.168.1.2", "test", "TCP", "3600");
+    expect(r == 728, "728 when table is full");
+    r = simGateway_addPortMapping(&sim, "8000", "80", "192.168.1.2", "renew", "TCP", "3600");
+    expect(r == 0, "same client can update its entry");
+    r = simGateway_addPortMapping(&sim, "8001", "8001", "192.168.1.3", "test", "TCP", "3600");
+    expect(r == 718, "718 when port is mapped to another client");
+
+    r = simGateway_getGenericPortMappingEntry(&sim, "0", extPort, intClient, intPort, protocol, desc, duration);
+    expect(r == 0 && strcmp(extPort, "8000") == 0 && strcmp(intPort, "80") == 0 &&
+               strcmp(desc, "renew") == 0 && atoi(duration) > 3500,
+           "generic entry");
+    r = simGateway_getGenericPortMappingEntry(&sim, "4", extPort, intClient, intPort, protocol, desc, duration);
+    expect(r == 713, "713 after last entry");
+
+    r = simGateway_deletePortMapping(&sim, "8003", "UDP");
+    expect(r == 714, "714 when entry doesn't exist");
+    r = simGateway_deletePortMapping(&sim, "8000", "TCP");
+    expect(r == 0 && sim.size == CAPACITY - 1, "delete entry");
+    r = simGateway_getGenericPortMappingEntry(&sim, "0", extPort, intClient, intPort, protocol, desc, duration);
+    expect(r == 0 && strcmp(extPort, "8001") == 0, "indexes shift after delete");
+
+    r = simGateway_getListOfPortMappings(&sim, "8000", "8002", "TCP", "10", count_entry, &listed, &count);
+    expect(r == 0 && count == 2 && listed == 2, "list entries in range");
+    r = simGateway_deletePortMappingRange(&sim, "8000", "8002", "TCP", "0", "192.168.1.2");
+    expect(r == 0 && sim.size == 1, "delete range");
+    r = simGateway_deletePortMappingRange(&sim, "8000", "8002", "TCP", "0", "192.168.1.2");
+    expect(r == 730, "730 when nothing in range");
+    simGateway_addPortMapping(&sim, "8004", "8004", "192.168.1.3", "test", "TCP", "3600");
+    simGateway_addPortMapping(&sim, "8005", "8005", "192.168.1.2", "test", "TCP", "3600");
+    r = simGateway_deletePortMappingRange(&sim, "8004", "8005", "TCP", "0", "192.168.1.2");
+    expect(r == 0 && sim.size == 2, "delete range without manage only deletes entries of caller");
+    r = simGateway_deletePortMappingRange(&sim, "8004", "8005", "TCP", "0", "192.168.1.2");
+    expect(r == 730, "730 when range only has entries of other clients");
+    r = simGateway_deletePortMappingRange(&sim, "8004", "8005", "TCP", "1", "192.168.1.2");
+    expect(r == 0 && sim.size == 1, "delete range with manage deletes entries of all clients");
+
+    simGateway_injectError(&sim, SOAP_ADD_PORT_MAPPING, 501, 2);
+    r = simGateway_addPortMapping(&sim, "8000", "8000", "192.168.1.2", "test", "TCP", "3600");
+    expect(r == 501, "injected error");
+    r = simGateway_addPortMapping(&sim, "8000", "8000", "192.168.1.2", "test", "TCP", "3600");
+    expect(r == 501, "injected error for given number of calls");
+    r = simGateway_addPortMapping(&sim, "8000", "8000", "192.168.1.2", "test", "TCP", "3600");
+    expect(r == 0, "call succeeds after injected errors");
+
+    simGateway_injectError(&sim, SOAP_GET_EXTERNAL_IP_ADDRESS, SIM_TIMEOUT, 1);
+    start = now_us();
+    r = simGateway_getExternalIPAddress(&sim, extip);
+    expect(r == UPNPCOMMAND_HTTP_ERROR && now_us() - start >= TIMEOUT_MS * 1000L, "injected timeout");
+    r = simGateway_getExternalIPAddress(&sim, extip);
+    expect(r == 0 && strcmp(extip, "203.0.113.1") == 0, "external address");
+
+    expect(simGateway_getNumOfCalls(&sim, SOAP_ADD_PORT_MAPPING) == CAPACITY + 8, "count calls");
+    simGateway_destroy(&sim);
+
+    cfg.igdv2 = 0;
+    simGateway_init(&sim, &cfg);
+    r = simGateway_deletePortMappingRange(&sim, "8000", "8002", "TCP", "0", "192.168.1.2");
+    expect(r == 401, "IGDv1 gateway has no DeletePortMappingRange");
+    simGateway_destroy(&sim);
+
+    return test_summary();
+}
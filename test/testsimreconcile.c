@@ -0,0 +1,145 @@
+/**
+ * @file testsimreconcile.c
+ * @brief Application to test reconcile against the simulated gateway
+ * @details Drive ::upnpPFInterface_updatePortMapping() through the "sim"
+ * driver with injected 501, 606, 713, 718 and timeout errors and check retries,
+ * shadow table and table of gateway from the number of SOAP calls. Check
+ * that limits set for the control URL of gateway only apply to it.
+ *
+ * @author Pham Ngoc Thang (thangdc94)
+ * @bug No known bug
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "upnp_pf_driver.h"
+#include "upnp_pf_simgw.h"
+#include "upnp_pf_shadow.h"
+#include "upnp_pf_errcode.h"
+#include "testutil.h"
+
+/** Number of rules used by tests */
+#define NUM_OF_RULES 5
+
+/** Time of a call which times out in ms, short so test is fast */
+#define TIMEOUT_MS 50
+
+static const PortForwardDriver_t *g_driver;
+static SimGateway_t *g_sim;
+static int g_adds;  /* AddPortMapping calls until last update */
+static int g_gets;  /* GetGenericPortMappingEntry calls until last update */
+
+/**
+ * @brief Update port mapping with the first rules
+ * @details Number of calls of each action made by the update are saved in
+ * @p adds and @p gets
+ *
+ * @param[in] rules rules
+ * @param[in] num_of_rules number of rules to update
+ * @param[out] adds AddPortMapping calls of update
+ * @param[out] gets GetGenericPortMappingEntry calls of update
+ * @return result of update
+ */
+static int update(MappingRule_t rules[], int num_of_rules, int *adds, int *gets)
+{
+    int r = g_driver->updatePortMapping(rules, num_of_rules);
+    int n = simGateway_getNumOfCalls(g_sim, SOAP_ADD_PORT_MAPPING);
+    *adds = n - g_adds;
+    g_adds = n;
+    n = simGateway_getNumOfCalls(g_sim, SOAP_GET_GENERIC_PORT_MAPPING_ENTRY);
+    *gets = n - g_gets;
+    g_gets = n;
+    return r;
+}
+
+int main(int argc, char **argv)
+{
+    SimGatewayCfg_t cfg;
+    MappingRule_t rules[NUM_OF_RULES];
+    GatewayLimits_t limits;
+    int adds, gets;
+    int r;
+    int i;
+
+    for (i = 0; i < NUM_OF_RULES; i++)
+    {
+        sprintf(rules[i].eport, "%d", 1000 + i);
+        sprintf(rules[i].iport, "%d", 2000 + i);
+        rules[i].proto = i % 2 ? UDP : TCP;
+        rules[i].ttl = 0;
+    }
+
+    // no rate limit, injected overload would slow down the calls which follow
+    upnpPFInterface_setMaxRate(NULL, 0);
+    g_driver = pfDriver_find("sim");
+    pfDriver_getSimConfig(&cfg);
+    cfg.latency_us = 0;
+    cfg.timeout_ms = TIMEOUT_MS;
+    cfg.igdv2 = 0; // enumerate with GetGenericPortMappingEntry
+    pfDriver_setSimConfig(&cfg);
+    // first enumeration of gateway times out once
+    pfDriver_injectSimError(SOAP_GET_GENERIC_PORT_MAPPING_ENTRY, SIM_TIMEOUT, 1);
+    expect(g_driver != NULL && g_driver->init() == SUCCESS, "init sim driver");
+    g_sim = pfDriver_getSimGateway();
+
+    r = update(rules, 3, &adds, &gets);
+    expect(r == SUCCESS && g_sim->size == 3, "add rules to empty gateway");
+    expect(gets == 2 && adds == 3, "entry which timed out is read again");
+
+    r = update(rules, 3, &adds, &gets);
+    expect(r == SUCCESS && gets == 0 && adds == 0, "nothing is sent when shadow table is up to date");
+
+    simGateway_injectError(g_sim, SOAP_ADD_PORT_MAPPING, 718, 1);
+    r = update(rules, 4, &adds, &gets);
+    expect(r == SUCCESS && g_sim->size == 4, "conflict is solved by retry");
+    expect(adds == 2 && gets == 4, "retry verifies shadow table and only adds the missing rule");
+
+    upnpPFInterface_setVerifyInterval(0);
+    simGateway_injectError(g_sim, SOAP_GET_GENERIC_PORT_MAPPING_ENTRY, 501, 2);
+    r = update(rules, 4, &adds, &gets);
+    expect(r == SUCCESS && adds == 0 && gets == 2 + 5, "entry which failed is read again");
+
+    simGateway_injectError(g_sim, SOAP_GET_GENERIC_PORT_MAPPING_ENTRY, 713, 1);
+    r = update(rules, 4, &adds, &gets);
+    expect(r == SUCCESS && gets == 1 && adds == 4, "713 ends enumeration, missing rules are added again");
+    expect(g_sim->size == 4, "rules added again overwrite their entry");
+
+    simGateway_injectError(g_sim, SOAP_GET_GENERIC_PORT_MAPPING_ENTRY, 606, 100);
+    r = update(rules, 4, &adds, &gets);
+    expect(r != SUCCESS && adds == 0, "give up when enumeration keeps failing");
+    simGateway_injectError(g_sim, SOAP_GET_GENERIC_PORT_MAPPING_ENTRY, 0, 0);
+    upnpPFInterface_setVerifyInterval(SHADOW_VERIFY_INTERVAL);
+    r = update(rules, 4, &adds, &gets);
+    expect(r == SUCCESS && adds == 0 && gets == 5, "shadow table is verified again after failed enumeration");
+
+    simGateway_injectError(g_sim, SOAP_ADD_PORT_MAPPING, SIM_TIMEOUT, 2);
+    r = update(rules, NUM_OF_RULES, &adds, &gets);
+    expect(r != SUCCESS && g_sim->size == 4, "update fails when add times out again after retry");
+    expect(adds == 2 && gets == 5, "add which timed out is tried once more after verify");
+
+    r = update(rules, NUM_OF_RULES, &adds, &gets);
+    expect(r == SUCCESS && g_sim->size == NUM_OF_RULES, "next update adds rule which timed out");
+    expect(adds == 1 && gets == 5, "failed add invalidates shadow table");
+
+    r = update(rules, 2, &adds, &gets);
+    expect(r == SUCCESS && g_sim->size == 2, "rules which are not requested are removed");
+
+    upnpPFInterface_setMaxConcurrency("http://192.168.1.1:5000/ctl/IPConn", 1);
+    upnpPFInterface_setMaxRate("sim://gateway", 20);
+    g_driver->getLimits(&limits, 1);
+    expect(limits.stats.max_rate == 20 && limits.stats.max_limit == 4, "limits of one gateway");
+    g_driver->destroy();
+    g_driver->init();
+    g_sim = pfDriver_getSimGateway();
+    g_driver->getLimits(&limits, 1);
+    expect(limits.stats.max_rate == 20, "gateway found again keeps its limits");
+    upnpPFInterface_setMaxRate(NULL, 0);
+    g_driver->getLimits(&limits, 1);
+    expect(limits.stats.max_rate == 20, "default doesn't replace limits of gateway");
+
+    g_driver->destroy();
+
+    return test_summary();
+}
@@ -0,0 +1,94 @@
+/**
+ * @file testsoapcodec.c
+ * @brief Application to test SOAP envelope templates and response scanner
+ *
+ * @author Pham Ngoc Thang (thangdc94)
+ * @bug No known bug
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "upnp_pf_soapcodec.h"
+#include "testutil.h"
+
+/** Service type used by tests */
+#define SERVICE_TYPE "urn:schemas-upnp-org:service:WANIPConnection:2"
+
+/**
+ * @brief Main function
+ * @details You know it's a main function
+ *
+ * @param[in] argc Argument count. We don't use it
+ * @param[in] argv Argument variables. We don't use it too
+ *
+ * @return 0 if all tests passed and 1 if not
+ */
+int main(int argc, char **argv)
+{
+    SoapCodec_t codec;
+    char buf[1024];
+    char small[64];
+    char value[16];
+    int len;
+    const char *v;
+    const char *v_end;
+    const char *const values[] = {"", "8080", "TCP", "80", "192.168.1.2", "1", "desc", "3600"};
+    const char *expected =
+        "<?xml version=\"1.0\"?>\r\n"
+        "<s:Envelope xmlns:s=\"http://schemas.xmlsoap.org/soap/envelope/\" "
+        "s:encodingStyle=\"http://schemas.xmlsoap.org/soap/encoding/\"><s:Body>"
+        "<u:AddPortMapping xmlns:u=\"" SERVICE_TYPE "\">"
+        "<NewRemoteHost></NewRemoteHost><NewExternalPort>8080</NewExternalPort>"
+        "<NewProtocol>TCP</NewProtocol><NewInternalPort>80</NewInternalPort>"
+        "<NewInternalClient>192.168.1.2</NewInternalClient><NewEnabled>1</NewEnabled>"
+        "<NewPortMappingDescription>desc</NewPortMappingDescription>"
+        "<NewLeaseDuration>3600</NewLeaseDuration>"
+        "</u:AddPortMapping></s:Body></s:Envelope>\r\n";
+    const char *response =
+        "<s:Envelope><s:Body><u:GetGenericPortMappingEntryResponse xmlns:u=\"x\">"
+        "<NewRemoteHost/><NewExternalPort>12345</NewExternalPort>"
+        "<NewInternalClient>10.0.0.1</NewInternalClient>"
+        "</u:GetGenericPortMappingEntryResponse></s:Body></s:Envelope>";
+    const char *fault =
+        "<s:Envelope><s:Body><s:Fault><detail><UPnPError>"
+        "<errorCode>713</errorCode><errorDescription>SpecifiedArrayIndexInvalid</errorDescription>"
+        "</UPnPError></detail></s:Fault></s:Body></s:Envelope>";
+    char escaped[] = "&lt;p:A&gt;1 &amp; 2&lt;/p:A&gt;";
+    char *end;
+
+    expect(soapCodec_init(&codec, SERVICE_TYPE) == 0, "compile templates");
+    expect(strcmp(soapCodec_soapAction(&codec, SOAP_ADD_PORT_MAPPING),
+                  SERVICE_TYPE "#AddPortMapping") == 0, "SOAPAction header value");
+
+    len = soapCodec_fill(&codec, SOAP_ADD_PORT_MAPPING, values, buf, sizeof(buf));
+    expect(len == (int)strlen(expected) && strcmp(buf, expected) == 0, "fill AddPortMapping envelope");
+    expect(soapCodec_fill(&codec, SOAP_ADD_PORT_MAPPING, values, small, sizeof(small)) == -1,
+           "reject too small buffer");
+    len = soapCodec_fill(&codec, SOAP_GET_EXTERNAL_IP_ADDRESS, NULL, buf, sizeof(buf));
+    expect(len > 0 && strstr(buf, "<u:GetExternalIPAddress xmlns:u=\"" SERVICE_TYPE "\">"
+                                  "</u:GetExternalIPAddress>") != NULL, "fill action without arguments");
+
+    soapCodec_copyValue(response, response + strlen(response), "NewExternalPort", value, sizeof(value));
+    expect(strcmp(value, "12345") == 0, "read element value");
+    soapCodec_copyValue(response, response + strlen(response), "NewExternalPort", value, 4);
+    expect(strcmp(value, "123") == 0, "truncate long value");
+    expect(soapCodec_findElement(response, response + strlen(response), "NewRemoteHost",
+                                 &v, &v_end) == 0 && v == v_end, "empty element");
+    expect(soapCodec_findElement(response, response + strlen(response), "NewProtocol",
+                                 &v, &v_end) == -1, "missing element");
+    expect(soapCodec_findElement(response, response + strlen(response),
+                                 "GetGenericPortMappingEntryResponse", &v, &v_end) == 0 &&
+           strncmp(v, "<NewRemoteHost/>", 16) == 0 &&
+           strncmp(v_end, "</u:GetGenericPortMappingEntryResponse>", 39) == 0,
+           "element with namespace prefix");
+    expect(soapCodec_getErrorCode(fault, fault + strlen(fault)) == 713, "UPnP error code");
+    expect(soapCodec_getErrorCode(response, response + strlen(response)) == 0, "no error code");
+
+    end = soapCodec_unescape(escaped, escaped + strlen(escaped));
+    *end = '\0';
+    expect(strcmp(escaped, "<p:A>1 & 2</p:A>") == 0, "unescape in place");
+
+    soapCodec_destroy(&codec);
+    return test_summary();
+}
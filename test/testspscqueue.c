@@ -0,0 +1,93 @@
+/**
+ * @file testspscqueue.c
+ * @brief Application to test lock-free request queue
+ * @details Check full and empty queue, wrap around of indexes, and that a
+ * consumer thread gets every element of a producer thread once and in order.
+ *
+ * @author Pham Ngoc Thang (thangdc94)
+ * @bug No known bug
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "spscqueue/spscqueue.h"
+#include "testutil.h"
+
+/** Capacity of queue, small so producer often finds it full */
+#define CAPACITY 8
+
+/** Number of elements passed between threads */
+#define NUM_OF_ELEMENTS 1000000
+
+/** Element with more than one word, so torn copies are noticed */
+typedef struct _Elem_t
+{
+    unsigned long seq;   /**< sequence number */
+    unsigned long check; /**< ~seq */
+} Elem_t;
+
+static SpscQueue_t g_queue;
+/**
+ * @brief Push elements in order, spin while queue is full
+ */
+static void *producer(void *arg)
+{
+    unsigned long i;
+    for (i = 0; i < NUM_OF_ELEMENTS; i++)
+    {
+        Elem_t elem = {i, ~i};
+        while (spscQueue_push(&g_queue, &elem) != 0)
+        {
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    pthread_t th;
+    Elem_t elem;
+    unsigned long expected = 0;
+    int in_order = 1;
+    int i;
+
+    expect(spscQueue_init(&g_queue, 5, sizeof(Elem_t)) == 0 && spscQueue_capacity(&g_queue) == 8,
+           "capacity is rounded up to a power of 2");
+    expect(spscQueue_pop(&g_queue, &elem) != 0, "pop from empty queue fails");
+    for (i = 0; i < 8; i++)
+    {
+        elem.seq = i;
+        spscQueue_push(&g_queue, &elem);
+    }
+    elem.seq = 8;
+    expect(spscQueue_push(&g_queue, &elem) != 0 && spscQueue_size(&g_queue) == 8, "push to full queue fails");
+    expect(spscQueue_pop(&g_queue, &elem) == 0 && elem.seq == 0, "pop oldest element");
+    expect(spscQueue_push(&g_queue, &elem) == 0, "popped slot is reused");
+    spscQueue_destroy(&g_queue);
+
+    spscQueue_init(&g_queue, CAPACITY, sizeof(Elem_t));
+    // start near wrap around of indexes
+    g_queue.head = g_queue.tail = g_queue.cached_head = g_queue.cached_tail = 0U - 3;
+    pthread_create(&th, NULL, producer, NULL);
+    while (expected < NUM_OF_ELEMENTS)
+    {
+        if (spscQueue_pop(&g_queue, &elem) != 0)
+        {
+            sched_yield();
+            continue;
+        }
+        in_order = in_order && elem.seq == expected && elem.check == ~expected;
+        expected++;
+    }
+    pthread_join(th, NULL);
+    expect(in_order, "consumer gets every element once and in order");
+    expect(spscQueue_size(&g_queue) == 0, "queue is empty at the end");
+    spscQueue_destroy(&g_queue);
+
+    return test_summary();
+}
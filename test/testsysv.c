@@ -144,13 +144,17 @@ int main(int argc, char **argv)
         {
             printf("Message: \"%s\" Sent\n", sbuf.mtext);
         }
-        // receive response from server
-        if (msgrcv(msqid_client, &rbuf, MSG_BUFFER_SIZE, MESSAGE_TYPE, 0) < 0)
+        // receive responses from server until request is done
+        do
         {
-            perror("Client: msgrcv");
-            exit(1);
-        }
-        // display token received from server
-        printf("Client: Token received from server: %s\n\n", rbuf.mtext);
+            if (msgrcv(msqid_client, &rbuf, MSG_BUFFER_SIZE, MESSAGE_TYPE, 0) < 0)
+            {
+                perror("Client: msgrcv");
+                exit(1);
+            }
+            // display token received from server
+            printf("Client: Token received from server: %s\n", rbuf.mtext);
+        } while (strncmp(rbuf.mtext, "Accepted", 8) == 0);
+        printf("\n");
     }
 }
\ No newline at end of file
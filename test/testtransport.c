@@ -0,0 +1,127 @@
+/**
+ * @file testtransport.c
+ * @brief Application to test keep-alive SOAP transport
+ * @details Run ::SoapTransport_t against a local HTTP stand-in server and check
+ * that connections are reused, reconnected when the peer closes them and
+ * that chunked responses are decoded.
+ *
+ * @author Pham Ngoc Thang (thangdc94)
+ * @bug No known bug
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "upnp_pf_transport.h"
+#include "httpstub.h"
+#include "testutil.h"
+
+/** Number of requests sent by each test */
+#define NUM_OF_REQUESTS 10
+
+/** Number of client threads in concurrency test */
+#define NUM_OF_THREADS 4
+
+static HttpStub_t g_server;
+static SoapTransport_t g_transport;
+
+/**
+ * @brief Send requests and check echoed responses
+ *
+ * @param[in] count number of requests
+ * @return number of successful requests
+ */
+static int send_requests(int count)
+{
+    int i;
+    int ok = 0;
+    for (i = 0; i < count; i++)
+    {
+        char body[64];
+        char *response;
+        int response_len;
+        int status;
+        int len = sprintf(body, "<request id=\"%d\"/>", i);
+        if (soapTransport_post(&g_transport, "urn:test#Echo", body, len,
+                               &response, &response_len, &status) == 0)
+        {
+            if (status == 200 && response_len == len && memcmp(response, body, len) == 0)
+            {
+                ok++;
+            }
+            free(response);
+        }
+    }
+    return ok;
+}
+
+/**
+ * @brief Client thread of concurrency test
+ */
+static void *client_thread(void *arg)
+{
+    int *ok = arg;
+    *ok = send_requests(NUM_OF_REQUESTS);
+    return NULL;
+}
+
+/**
+ * @brief Main function
+ * @details You know it's a main function
+ *
+ * @param[in] argc Argument count. We don't use it
+ * @param[in] argv Argument variables. We don't use it too
+ *
+ * @return 0 if all tests passed and 1 if not
+ */
+int main(int argc, char **argv)
+{
+    char url[64];
+    int port = httpStub_start(&g_server);
+    int ok;
+    int i;
+    pthread_t threads[NUM_OF_THREADS];
+    int results[NUM_OF_THREADS];
+
+    snprintf(url, sizeof(url), "http://127.0.0.1:%d/ctl/IPConn", port);
+    expect(soapTransport_init(&g_transport, url, 1) == 0, "parse control URL");
+    expect(strcmp(g_transport.path, "/ctl/IPConn") == 0, "URL path");
+
+    httpStub_reset(&g_server, 0, 0, 0);
+    ok = send_requests(NUM_OF_REQUESTS);
+    expect(ok == NUM_OF_REQUESTS, "all requests answered on keep-alive connection");
+    expect(g_server.num_of_accepts == 1, "one TCP connection for all requests");
+
+    soapTransport_destroy(&g_transport);
+    soapTransport_init(&g_transport, url, 1);
+    httpStub_reset(&g_server, 3, 0, 0);
+    ok = send_requests(NUM_OF_REQUESTS);
+    expect(ok == NUM_OF_REQUESTS, "all requests answered when peer closes connections");
+    expect(g_server.num_of_accepts == (NUM_OF_REQUESTS + 2) / 3, "reconnect only when peer closed connection");
+
+    httpStub_reset(&g_server, 0, 1, 0);
+    ok = send_requests(NUM_OF_REQUESTS);
+    expect(ok == NUM_OF_REQUESTS, "chunked responses decoded");
+
+    soapTransport_destroy(&g_transport);
+    soapTransport_init(&g_transport, url, NUM_OF_THREADS);
+    httpStub_reset(&g_server, 0, 0, 5);
+    for (i = 0; i < NUM_OF_THREADS; i++)
+    {
+        pthread_create(&threads[i], NULL, client_thread, &results[i]);
+    }
+    ok = 0;
+    for (i = 0; i < NUM_OF_THREADS; i++)
+    {
+        pthread_join(threads[i], NULL);
+        ok += results[i];
+    }
+    expect(ok == NUM_OF_THREADS * NUM_OF_REQUESTS, "concurrent requests answered");
+    expect(g_server.num_of_accepts <= NUM_OF_THREADS, "connections bounded by pool size");
+    soapTransport_destroy(&g_transport);
+
+    return test_summary();
+}
@@ -0,0 +1,45 @@
+/**
+ * @file testutil.h
+ * @brief Helpers shared by test applications
+ * @details Each test prints one PASS or FAIL line per check and a summary at
+ * the end. Exit code is 0 only if every check passed.
+ *
+ * @author Pham Ngoc Thang (thangdc94)
+ * @bug No known bug
+ */
+
+#ifndef __TEST_UTIL_H_
+#define __TEST_UTIL_H_
+
+#include <stdio.h>
+
+/** 1 if a check failed */
+static int g_failed = 0;
+
+/**
+ * @brief Print test result
+ *
+ * @param[in] cond test passed if true
+ * @param[in] what test name
+ */
+static void expect(int cond, const char *what)
+{
+    printf("%s: %s\n", cond ? "PASS" : "FAIL", what);
+    if (!cond)
+    {
+        g_failed = 1;
+    }
+}
+
+/**
+ * @brief Print summary of test
+ *
+ * @return exit code of test, 0 if every check passed
+ */
+static int test_summary()
+{
+    printf("%s\n", g_failed ? "FAILED" : "ALL PASSED");
+    return g_failed;
+}
+
+#endif //__TEST_UTIL_H_
@@ -0,0 +1,162 @@
+/**
+ * @file upnp_pf_cache.c
+ * @brief Implement discovery cache of gateway
+ * @details Cache file is stored in JSON format next to config file.
+ *
+ * @author Pham Ngoc Thang (thangdc94)
+ * @bug No known bug
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <cjson/cJSON.h>
+
+#include "upnp_pf_cache.h"
+#include "logutil.h"
+
+/** Cache file path */
+#define GATEWAY_CACHE_FILE "routerupnp_gateway.json"
+
+/** Max size of cache file */
+#define MAX_CACHE_SIZE 8192
+
+/**
+ * @brief Copy a string item of a JSON object
+ *
+ * @param[in] root JSON object
+ * @param[in] name item name
+ * @param[out] dst destination buffer
+ * @param[in] size size of destination buffer
+ * @return 0 if OK and -1 if item is missing, empty or too long
+ */
+static int copy_string_item(const cJSON *root, const char *name, char *dst, size_t size)
+{
+    cJSON *item = cJSON_GetObjectItem(root, name);
+    if (!cJSON_IsString(item) || item->valuestring[0] == '\0' ||
+        strlen(item->valuestring) >= size)
+    {
+        return -1;
+    }
+    strcpy(dst, item->valuestring);
+    return 0;
+}
+
+/**
+ * @brief Copy service type of a gateway
+ * @details Service type is empty for gateways which only speak NAT-PMP
+ *
+ * @param[in] item JSON object
+ * @param[out] cache gateway
+ * @return 0 if OK and -1 if item is missing or too long
+ */
+static int copy_servicetype(const cJSON *item, GatewayCache_t *cache)
+{
+    cJSON *servicetype = cJSON_GetObjectItem(item, "servicetype");
+    if (cJSON_IsString(servicetype) && servicetype->valuestring[0] == '\0')
+    {
+        cache->servicetype[0] = '\0';
+        return 0;
+    }
+    return copy_string_item(item, "servicetype", cache->servicetype, sizeof(cache->servicetype));
+}
+
+/**
+ * @brief Read a gateway from a JSON object
+ *
+ * @param[in] item JSON object
+ * @param[out] cache gateway
+ * @return 0 if OK and -1 if object is not valid
+ */
+static int read_gateway(const cJSON *item, GatewayCache_t *cache)
+{
+    cJSON *caps = cJSON_GetObjectItem(item, "caps");
+    if (copy_string_item(item, "controlURL", cache->controlURL, sizeof(cache->controlURL)) != 0 ||
+        copy_servicetype(item, cache) != 0 ||
+        copy_string_item(item, "lanaddr", cache->lanaddr, sizeof(cache->lanaddr)) != 0 ||
+        copy_string_item(item, "desc", cache->desc, sizeof(cache->desc)) != 0 ||
+        !cJSON_IsNumber(caps))
+    {
+        return -1;
+    }
+    cache->caps = caps->valueint;
+    return 0;
+}
+
+int gatewayCache_load(GatewayCache_t caches[], int max)
+{
+    int count = 0;
+    char content[MAX_CACHE_SIZE];
+    size_t len;
+    cJSON *root;
+    cJSON *item;
+    FILE *fd = fopen(GATEWAY_CACHE_FILE, "rb");
+
+    if (fd == NULL)
+    {
+        return -1;
+    }
+    len = fread(content, sizeof(char), sizeof(content) - 1, fd);
+    fclose(fd);
+    content[len] = '\0';
+
+    root = cJSON_Parse(content);
+    if (root == NULL)
+    {
+        return -1;
+    }
+    if (cJSON_IsArray(root))
+    {
+        cJSON_ArrayForEach(item, root)
+        {
+            if (count == max || read_gateway(item, &caches[count]) != 0)
+            {
+                count = -1;
+                break;
+            }
+            count++;
+        }
+    }
+    else if (max > 0 && read_gateway(root, &caches[0]) == 0)
+    {
+        // written by a version which only knew one gateway
+        count = 1;
+    }
+    cJSON_Delete(root);
+    return count > 0 ? count : -1;
+}
+
+int gatewayCache_save(const GatewayCache_t caches[], int num_of_caches)
+{
+    int i;
+    char *str;
+    cJSON *root;
+    FILE *fd = fopen(GATEWAY_CACHE_FILE, "w");
+    if (fd == NULL)
+    {
+        LOG(LOG_WARN, "Cannot write %s", GATEWAY_CACHE_FILE);
+        return -1;
+    }
+    root = cJSON_CreateArray();
+    for (i = 0; i < num_of_caches; i++)
+    {
+        cJSON *item = cJSON_CreateObject();
+        cJSON_AddStringToObject(item, "controlURL", caches[i].controlURL);
+        cJSON_AddStringToObject(item, "servicetype", caches[i].servicetype);
+        cJSON_AddStringToObject(item, "lanaddr", caches[i].lanaddr);
+        cJSON_AddStringToObject(item, "desc", caches[i].desc);
+        cJSON_AddNumberToObject(item, "caps", caches[i].caps);
+        cJSON_AddItemToArray(root, item);
+    }
+    str = cJSON_Print(root);
+    fprintf(fd, "%s\n", str);
+    cJSON_Delete(root);
+    free(str);
+    fclose(fd);
+    return 0;
+}
+
+void gatewayCache_remove()
+{
+    remove(GATEWAY_CACHE_FILE);
+}
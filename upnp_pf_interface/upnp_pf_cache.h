@@ -0,0 +1,48 @@
+/**
+ * @file upnp_pf_cache.h
+ * @brief Discovery cache of gateway
+ * @details Keep result of gateway discovery on disk so the daemon can talk to
+ * the same gateways after a restart without SSDP discovery.
+ *
+ * @author Pham Ngoc Thang (thangdc94)
+ * @bug No known bug
+ */
+
+#ifndef __UPNP_PF_CACHE_H_
+#define __UPNP_PF_CACHE_H_
+
+/** Discovered gateway */
+typedef struct _GatewayCache_t
+{
+    char controlURL[256];  /**< control URL of WAN connection service */
+    char servicetype[128]; /**< service type of WAN connection service, empty for NAT-PMP only */
+    char lanaddr[64];      /**< my ip address on the LAN */
+    char desc[13];         /**< description of our port mapping entries */
+    int caps;              /**< capabilities of gateway */
+} GatewayCache_t;
+
+/**
+ * @brief Load gateways from cache file
+ *
+ * @param[out] caches cached gateways
+ * @param[in] max max number of gateways
+ * @return number of gateways or -1 if cache doesn't exist or is not valid
+ */
+int gatewayCache_load(GatewayCache_t caches[], int max);
+
+/**
+ * @brief Save gateways to cache file
+ *
+ * @param[in] caches gateways
+ * @param[in] num_of_caches number of gateways
+ * @return 0 if OK and -1 if failed
+ */
+int gatewayCache_save(const GatewayCache_t caches[], int num_of_caches);
+
+/**
+ * @brief Remove cache file
+ * @details Called when a cached gateway doesn't answer anymore
+ */
+void gatewayCache_remove();
+
+#endif //__UPNP_PF_CACHE_H_
@@ -0,0 +1,616 @@
+/**
+ * @file upnp_pf_discover.c
+ * @brief Implement discovery of Internet Gateway Device
+ * @details Devices known by minissdpd are checked first and M-SEARCH is only
+ * sent if none of them is a connected IGD. All IGDs answering are returned. One UDP socket is opened per
+ * interface address. Each new description URL is checked by its own thread,
+ * so a slow or dead device doesn't delay the others.
+ *
+ * @author Pham Ngoc Thang (thangdc94)
+ * @bug No known bug
+ */
+
+#define _GNU_SOURCE /* for strcasestr() */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <poll.h>
+#include <time.h>
+#include <ifaddrs.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+
+#include "upnp_pf_discover.h"
+#include "upnp_pf_minissdpd.h"
+#include "logutil.h"
+#include "netutil/netutil.h"
+
+/** SSDP port */
+#define SSDP_PORT 1900
+
+/** SSDP multicast address for IPv4 */
+#define SSDP_MCAST_ADDR "239.255.255.250"
+
+/** SSDP link-local multicast address for IPv6 */
+#define SSDP_MCAST_ADDR6 "ff02::c"
+
+/** Device type we search for. IGDv2 devices answer it too */
+#define SEARCH_TARGET "urn:schemas-upnp-org:device:InternetGatewayDevice:1"
+
+/** Device types asked to minissdpd, IGDv1 and IGDv2 */
+#define SEARCH_TARGET_PREFIX "urn:schemas-upnp-org:device:InternetGatewayDevice:"
+
+/** Max time to wait for minissdpd in ms */
+#define MINISSDPD_TIMEOUT 100
+
+/** Max number of interface addresses we search on */
+#define MAX_SOCKETS 16
+
+/** Max number of description URLs checked by one discovery */
+#define MAX_CANDIDATES 16
+
+/** Max size of a description URL */
+#define MAX_URL_SIZE 256
+
+/** M-SEARCH is sent again after this time in ms if nobody answered */
+#define RESEND_PERIOD 250
+
+/** Result of checking a description URL */
+typedef enum _IGDState_t
+{
+    IGD_NONE = 0,          /**< not an IGD we can use */
+    IGD_CONNECTED = 1,     /**< IGD connected to internet */
+    IGD_NOT_CONNECTED = 2, /**< IGD not connected (yet) */
+} IGDState_t;
+
+/**
+ * State of one discovery shared with checker threads. Checker threads are
+ * detached and can outlive ::upnpDiscover_findIGDs(), so it's freed by the
+ * last user.
+ */
+typedef struct _DiscoverCtx_t
+{
+    pthread_mutex_t mutex;  /**< protect all fields */
+    int refcount;           /**< number of users */
+    int event_fd;           /**< signaled when a checker finished */
+    int done;               /**< discovery returned, results are not needed */
+    int max;                /**< max number of IGDs kept */
+    int num_of_igds;        /**< number of IGDs found */
+    int num_of_connected;   /**< number of connected IGDs found */
+    DiscoveredIGD_t *igds;  /**< IGDs found */
+} DiscoverCtx_t;
+
+/** Argument of a checker thread */
+typedef struct _Candidate_t
+{
+    DiscoverCtx_t *ctx;     /**< discovery */
+    char url[MAX_URL_SIZE]; /**< description URL */
+} Candidate_t;
+
+/**
+ * @brief Release discovery state
+ *
+ * @param[in] ctx discovery state
+ */
+static void release_ctx(DiscoverCtx_t *ctx)
+{
+    int refcount;
+    pthread_mutex_lock(&ctx->mutex);
+    refcount = --ctx->refcount;
+    pthread_mutex_unlock(&ctx->mutex);
+    if (refcount == 0)
+    {
+        int i;
+        for (i = 0; i < ctx->num_of_igds; i++)
+        {
+            FreeUPNPUrls(&ctx->igds[i].urls);
+        }
+        free(ctx->igds);
+        close(ctx->event_fd);
+        pthread_mutex_destroy(&ctx->mutex);
+        free(ctx);
+    }
+}
+
+/**
+ * @brief Check a description URL
+ * @details Download and parse device description, then ask the IGD if it's
+ * connected. Every IGD found is kept, once per control URL.
+ */
+static void *checker_thread(void *arg)
+{
+    Candidate_t *candidate = arg;
+    DiscoverCtx_t *ctx = candidate->ctx;
+    IGDState_t state = IGD_NONE;
+    struct UPNPUrls urls;
+    struct IGDdatas data;
+    char lanaddr[64] = "";
+    uint64_t one = 1;
+
+    memset(&urls, 0, sizeof(urls));
+    memset(&data, 0, sizeof(data));
+    if (UPNP_GetIGDFromUrl(candidate->url, &urls, &data, lanaddr, sizeof(lanaddr)) &&
+        strcmp(data.first.servicetype, "") != 0)
+    {
+        // description of our entries is MAC address of LAN interface
+        char *mac = getmac_from_ip(lanaddr);
+        if (mac != NULL)
+        {
+            state = UPNPIGD_IsConnected(&urls, &data) ? IGD_CONNECTED : IGD_NOT_CONNECTED;
+            free(mac);
+        }
+    }
+    LOG(LOG_DBG, "[desc]: %s | state: %d", candidate->url, state);
+
+    pthread_mutex_lock(&ctx->mutex);
+    if (!ctx->done && state != IGD_NONE && ctx->num_of_igds < ctx->max)
+    {
+        int i;
+        // a device may be found on several interfaces
+        for (i = 0; i < ctx->num_of_igds; i++)
+        {
+            if (strcmp(ctx->igds[i].urls.controlURL, urls.controlURL) == 0)
+            {
+                break;
+            }
+        }
+        if (i == ctx->num_of_igds)
+        {
+            DiscoveredIGD_t *igd = &ctx->igds[ctx->num_of_igds++];
+            igd->urls = urls;
+            igd->data = data;
+            strcpy(igd->lanaddr, lanaddr);
+            igd->connected = (state == IGD_CONNECTED);
+            ctx->num_of_connected += igd->connected;
+            memset(&urls, 0, sizeof(urls));
+        }
+    }
+    FreeUPNPUrls(&urls);
+    pthread_mutex_unlock(&ctx->mutex);
+
+    if (write(ctx->event_fd, &one, sizeof(one)) != sizeof(one))
+    {
+        LOG(LOG_WARN, "Cannot signal discovery");
+    }
+    release_ctx(ctx);
+    free(candidate);
+    return NULL;
+}
+
+/**
+ * @brief Start checker thread of a description URL
+ * @details All signals are blocked in checker thread so they are handled by
+ * main thread.
+ *
+ * @param[in] ctx discovery state
+ * @param[in] url description URL
+ * @return 0 if OK and -1 if failed
+ */
+static int start_checker(DiscoverCtx_t *ctx, const char *url)
+{
+    pthread_t th;
+    pthread_attr_t attr;
+    sigset_t all;
+    sigset_t old;
+    int r;
+    Candidate_t *candidate = malloc(sizeof(Candidate_t));
+
+    if (candidate == NULL)
+    {
+        return -1;
+    }
+    candidate->ctx = ctx;
+    strcpy(candidate->url, url);
+    pthread_mutex_lock(&ctx->mutex);
+    ctx->refcount++;
+    pthread_mutex_unlock(&ctx->mutex);
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    r = pthread_create(&th, &attr, checker_thread, candidate);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    pthread_attr_destroy(&attr);
+    if (r != 0)
+    {
+        free(candidate);
+        release_ctx(ctx);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Open a search socket on an interface address
+ *
+ * @param[in] ifa interface address
+ * @param[out] dest multicast destination for this socket
+ * @param[out] dest_len size of @p dest
+ * @return socket or -1 if address is not used for search
+ */
+static int open_search_socket(const struct ifaddrs *ifa, struct sockaddr_storage *dest,
+                              socklen_t *dest_len)
+{
+    int fd = -1;
+    int ttl = 2;
+    struct sockaddr_storage local;
+    socklen_t local_len;
+
+    memset(&local, 0, sizeof(local));
+    memset(dest, 0, sizeof(*dest));
+    if (ifa->ifa_addr->sa_family == AF_INET)
+    {
+        struct sockaddr_in *sin = (struct sockaddr_in *)dest;
+        struct in_addr ifaddr = ((struct sockaddr_in *)ifa->ifa_addr)->sin_addr;
+
+        memcpy(&local, ifa->ifa_addr, sizeof(struct sockaddr_in));
+        ((struct sockaddr_in *)&local)->sin_port = 0;
+        local_len = sizeof(struct sockaddr_in);
+        sin->sin_family = AF_INET;
+        sin->sin_port = htons(SSDP_PORT);
+        inet_pton(AF_INET, SSDP_MCAST_ADDR, &sin->sin_addr);
+        *dest_len = sizeof(struct sockaddr_in);
+
+        fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0 ||
+            setsockopt(fd, IPPROTO_IP, IP_MULTICAST_IF, &ifaddr, sizeof(ifaddr)) != 0 ||
+            setsockopt(fd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl)) != 0)
+        {
+            goto fail;
+        }
+    }
+    else if (ifa->ifa_addr->sa_family == AF_INET6)
+    {
+        struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)dest;
+        struct sockaddr_in6 *addr6 = (struct sockaddr_in6 *)ifa->ifa_addr;
+        unsigned int ifindex = if_nametoindex(ifa->ifa_name);
+
+        // IGDs answer on link-local scope
+        if (!IN6_IS_ADDR_LINKLOCAL(&addr6->sin6_addr) || ifindex == 0)
+        {
+            return -1;
+        }
+        memcpy(&local, addr6, sizeof(struct sockaddr_in6));
+        ((struct sockaddr_in6 *)&local)->sin6_port = 0;
+        ((struct sockaddr_in6 *)&local)->sin6_scope_id = ifindex;
+        local_len = sizeof(struct sockaddr_in6);
+        sin6->sin6_family = AF_INET6;
+        sin6->sin6_port = htons(SSDP_PORT);
+        sin6->sin6_scope_id = ifindex;
+        inet_pton(AF_INET6, SSDP_MCAST_ADDR6, &sin6->sin6_addr);
+        *dest_len = sizeof(struct sockaddr_in6);
+
+        fd = socket(AF_INET6, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0 ||
+            setsockopt(fd, IPPROTO_IPV6, IPV6_MULTICAST_IF, &ifindex, sizeof(ifindex)) != 0 ||
+            setsockopt(fd, IPPROTO_IPV6, IPV6_MULTICAST_HOPS, &ttl, sizeof(ttl)) != 0)
+        {
+            goto fail;
+        }
+    }
+    else
+    {
+        return -1;
+    }
+
+    if (bind(fd, (struct sockaddr *)&local, local_len) != 0)
+    {
+        goto fail;
+    }
+    return fd;
+fail:
+    LOG(LOG_DBG, "Cannot search on %s", ifa->ifa_name);
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+    return -1;
+}
+
+/**
+ * @brief Send M-SEARCH request
+ *
+ * @param[in] fd search socket
+ * @param[in] dest multicast destination
+ * @param[in] dest_len size of @p dest
+ */
+static void send_search(int fd, const struct sockaddr_storage *dest, socklen_t dest_len)
+{
+    char request[256];
+    int len = snprintf(request, sizeof(request),
+                       "M-SEARCH * HTTP/1.1\r\n"
+                       "HOST: %s:%d\r\n"
+                       "ST: " SEARCH_TARGET "\r\n"
+                       "MAN: \"ssdp:discover\"\r\n"
+                       "MX: 1\r\n"
+                       "\r\n",
+                       dest->ss_family == AF_INET6 ? "[" SSDP_MCAST_ADDR6 "]" : SSDP_MCAST_ADDR,
+                       SSDP_PORT);
+    if (sendto(fd, request, len, 0, (const struct sockaddr *)dest, dest_len) != len)
+    {
+        LOG(LOG_DBG, "M-SEARCH not sent");
+    }
+}
+
+/**
+ * @brief Get description URL from SSDP response
+ *
+ * @param[in,out] response response, null terminated. It's modified.
+ * @return description URL or NULL if not found
+ */
+static char *get_location(char *response)
+{
+    char *location = strcasestr(response, "\r\nLOCATION:");
+    char *end;
+    if (location == NULL)
+    {
+        return NULL;
+    }
+    location += strlen("\r\nLOCATION:");
+    location += strspn(location, " \t");
+    end = location + strcspn(location, "\r\n");
+    *end = '\0';
+    if (end == location || end - location >= MAX_URL_SIZE)
+    {
+        return NULL;
+    }
+    return location;
+}
+
+/**
+ * @brief Get current time in ms
+ *
+ * @return monotonic time in ms
+ */
+static long now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+}
+
+/**
+ * @brief Start checking a description URL if it's new
+ *
+ * @param[in] ctx discovery state
+ * @param[in,out] candidates description URLs already checked
+ * @param[in,out] num_of_candidates number of @p candidates
+ * @param[in] url description URL
+ */
+static void add_candidate(DiscoverCtx_t *ctx, char candidates[][MAX_URL_SIZE],
+                          int *num_of_candidates, const char *url)
+{
+    int i;
+    // a device answers on every interface and for every search
+    for (i = 0; i < *num_of_candidates; i++)
+    {
+        if (strcmp(candidates[i], url) == 0)
+        {
+            return;
+        }
+    }
+    if (*num_of_candidates < MAX_CANDIDATES && start_checker(ctx, url) == 0)
+    {
+        strcpy(candidates[(*num_of_candidates)++], url);
+    }
+}
+
+/**
+ * @brief Open search sockets and send M-SEARCH
+ * @details One socket is opened on every up interface address
+ *
+ * @param[out] fds poll entries of sockets
+ * @param[out] dests multicast destination of each socket
+ * @param[out] dest_lens size of each destination
+ * @return number of sockets
+ */
+static int start_search(struct pollfd fds[], struct sockaddr_storage dests[], socklen_t dest_lens[])
+{
+    int num_of_fds = 0;
+    struct ifaddrs *addrs;
+    struct ifaddrs *ifa;
+
+    if (getifaddrs(&addrs) != 0)
+    {
+        return 0;
+    }
+    for (ifa = addrs; ifa != NULL && num_of_fds < MAX_SOCKETS; ifa = ifa->ifa_next)
+    {
+        int fd;
+        if (ifa->ifa_addr == NULL || !(ifa->ifa_flags & IFF_UP) ||
+            !(ifa->ifa_flags & IFF_MULTICAST) || (ifa->ifa_flags & IFF_LOOPBACK))
+        {
+            continue;
+        }
+        fd = open_search_socket(ifa, &dests[num_of_fds], &dest_lens[num_of_fds]);
+        if (fd >= 0)
+        {
+            LOG(LOG_DBG, "Search on %s (%s)", ifa->ifa_name,
+                ifa->ifa_addr->sa_family == AF_INET6 ? "IPv6" : "IPv4");
+            fds[num_of_fds].fd = fd;
+            fds[num_of_fds].events = POLLIN;
+            send_search(fd, &dests[num_of_fds], dest_lens[num_of_fds]);
+            num_of_fds++;
+        }
+    }
+    freeifaddrs(addrs);
+    return num_of_fds;
+}
+
+/**
+ * @brief Compare IGDs, connected ones first
+ * @details Compare function for qsort()
+ */
+static int compare_igd(const void *a, const void *b)
+{
+    return ((const DiscoveredIGD_t *)b)->connected - ((const DiscoveredIGD_t *)a)->connected;
+}
+
+int upnpDiscover_findIGDs(int timeout, const char *minissdpdsock, DiscoveredIGD_t igds[], int max)
+{
+    int i;
+    int result;
+    int num_of_fds = 0;
+    int num_of_candidates = 0;
+    int num_of_checked = 0;
+    int searching = 0;
+    long search_start = 0;
+    int resent = 0;
+    long start = now_ms();
+    struct pollfd fds[MAX_SOCKETS + 1];
+    struct sockaddr_storage dests[MAX_SOCKETS];
+    socklen_t dest_lens[MAX_SOCKETS];
+    char candidates[MAX_CANDIDATES][MAX_URL_SIZE];
+    DiscoverCtx_t *ctx = calloc(1, sizeof(DiscoverCtx_t));
+
+    if (ctx == NULL)
+    {
+        return 0;
+    }
+    ctx->refcount = 1;
+    ctx->max = max;
+    pthread_mutex_init(&ctx->mutex, NULL);
+    ctx->igds = calloc(max, sizeof(DiscoveredIGD_t));
+    ctx->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (ctx->igds == NULL || ctx->event_fd < 0)
+    {
+        release_ctx(ctx);
+        return 0;
+    }
+    fds[0].fd = ctx->event_fd;
+    fds[0].events = POLLIN;
+
+    // devices known by minissdpd are checked first
+    if (minissdpdsock != NULL)
+    {
+        char known[MAX_CANDIDATES][MINISSDPD_MAX_URL_SIZE];
+        int n = minissdpd_getDevices(minissdpdsock, SEARCH_TARGET_PREFIX, MINISSDPD_TIMEOUT,
+                                     known, MAX_CANDIDATES);
+        for (i = 0; i < n; i++)
+        {
+            add_candidate(ctx, candidates, &num_of_candidates, known[i]);
+        }
+        LOG(LOG_DBG, "minissdpd knows %d device(s)", n > 0 ? n : 0);
+    }
+
+    while (1)
+    {
+        int wait = timeout - (int)(now_ms() - start);
+        int num_of_igds;
+        int num_of_connected;
+
+        pthread_mutex_lock(&ctx->mutex);
+        num_of_igds = ctx->num_of_igds;
+        num_of_connected = ctx->num_of_connected;
+        pthread_mutex_unlock(&ctx->mutex);
+        if (num_of_igds == max || wait <= 0)
+        {
+            break;
+        }
+
+        if (!searching && num_of_checked == num_of_candidates)
+        {
+            // minissdpd knows all announced devices, trust it if it knows a connected IGD
+            if (num_of_connected > 0)
+            {
+                break;
+            }
+            num_of_fds = start_search(fds + 1, dests, dest_lens);
+            search_start = now_ms();
+            searching = 1;
+        }
+        else if (searching)
+        {
+            long elapsed = now_ms() - search_start;
+            // other gateways had time to answer and every device was checked
+            if (num_of_igds > 0 && num_of_checked == num_of_candidates &&
+                elapsed >= RESEND_PERIOD * 2)
+            {
+                break;
+            }
+            if (!resent && num_of_candidates == num_of_checked && num_of_igds == 0)
+            {
+                if (elapsed >= RESEND_PERIOD)
+                {
+                    // UDP may be lost, search once more
+                    for (i = 0; i < num_of_fds; i++)
+                    {
+                        send_search(fds[i + 1].fd, &dests[i], dest_lens[i]);
+                    }
+                    resent = 1;
+                }
+                else if (RESEND_PERIOD - elapsed < wait)
+                {
+                    wait = RESEND_PERIOD - elapsed;
+                }
+            }
+            else if (num_of_igds > 0 && RESEND_PERIOD * 2 - elapsed > 0 &&
+                     RESEND_PERIOD * 2 - elapsed < wait)
+            {
+                wait = RESEND_PERIOD * 2 - elapsed;
+            }
+        }
+
+        if (poll(fds, num_of_fds + 1, wait) <= 0)
+        {
+            continue;
+        }
+        if (fds[0].revents & POLLIN)
+        {
+            uint64_t count;
+            if (read(ctx->event_fd, &count, sizeof(count)) == sizeof(count))
+            {
+                num_of_checked += (int)count;
+            }
+        }
+        for (i = 1; i <= num_of_fds; i++)
+        {
+            char response[1536];
+            char *location;
+            int n;
+
+            if (!(fds[i].revents & POLLIN))
+            {
+                continue;
+            }
+            n = recv(fds[i].fd, response, sizeof(response) - 1, 0);
+            if (n <= 0)
+            {
+                continue;
+            }
+            response[n] = '\0';
+            location = get_location(response);
+            if (location != NULL)
+            {
+                add_candidate(ctx, candidates, &num_of_candidates, location);
+            }
+        }
+    }
+
+    for (i = 1; i <= num_of_fds; i++)
+    {
+        close(fds[i].fd);
+    }
+
+    // hand over results, checkers still running will drop theirs
+    pthread_mutex_lock(&ctx->mutex);
+    ctx->done = 1;
+    result = ctx->num_of_igds;
+    memcpy(igds, ctx->igds, result * sizeof(DiscoveredIGD_t));
+    ctx->num_of_igds = 0;
+    pthread_mutex_unlock(&ctx->mutex);
+    release_ctx(ctx);
+    qsort(igds, result, sizeof(DiscoveredIGD_t), compare_igd);
+
+    LOG(LOG_INFO, "Discovery found %d IGD(s) in %d device(s) in %ld ms",
+        result, num_of_candidates, now_ms() - start);
+    return result;
+}
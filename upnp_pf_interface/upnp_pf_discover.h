@@ -0,0 +1,45 @@
+/**
+ * @file upnp_pf_discover.h
+ * @brief Discovery of Internet Gateway Device
+ * @details Ask minissdpd for known devices first. If it isn't running or
+ * knows no connected IGD, send SSDP M-SEARCH on every up interface over IPv4
+ * and IPv6 at the same time and check description URLs of answering devices
+ * in parallel.
+ * Several gateways may be found, e.g. in double-NAT or multi-WAN networks.
+ *
+ * @author Pham Ngoc Thang (thangdc94)
+ * @bug No known bug
+ */
+
+#ifndef __UPNP_PF_DISCOVER_H_
+#define __UPNP_PF_DISCOVER_H_
+
+#include <miniupnpc/miniupnpc.h>
+
+/** Internet Gateway Device found by discovery */
+typedef struct _DiscoveredIGD_t
+{
+    struct UPNPUrls urls; /**< URLs of IGD */
+    struct IGDdatas data; /**< description of IGD */
+    char lanaddr[64];     /**< my ip address towards IGD */
+    int connected;        /**< 1 if IGD is connected to internet */
+} DiscoveredIGD_t;
+
+/**
+ * @brief Find Internet Gateway Devices
+ * @details Return all IGDs answering within @p timeout ms, connected ones
+ * first. Discovery returns earlier once every device which answered has been
+ * checked.
+ * @warning You need to call FreeUPNPUrls() on ::DiscoveredIGD_t::urls of
+ * every returned IGD
+ *
+ * @param[in] timeout max time to wait in ms
+ * @param[in] minissdpdsock socket path of minissdpd or NULL to only use
+ * multicast
+ * @param[out] igds IGDs found
+ * @param[in] max max number of IGDs
+ * @return number of IGDs found
+ */
+int upnpDiscover_findIGDs(int timeout, const char *minissdpdsock, DiscoveredIGD_t igds[], int max);
+
+#endif //__UPNP_PF_DISCOVER_H_
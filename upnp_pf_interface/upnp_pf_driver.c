@@ -0,0 +1,132 @@
+/**
+ * @file upnp_pf_driver.c
+ * @brief Implement port forwarding drivers
+ * @details Both drivers use the reconcile code of upnp_pf_interface.c, the
+ * "sim" driver only replaces gateways found on network by a simulated one.
+ *
+ * @author Pham Ngoc Thang (thangdc94)
+ * @bug No known bug
+ */
+
+#include <string.h>
+
+#include "upnp_pf_driver.h"
+#include "upnp_pf_interface.h"
+#include "upnp_pf_errcode.h"
+
+/** Default table capacity of simulated gateway */
+#define SIM_DEFAULT_CAPACITY 1024
+
+/** Default latency of simulated gateway in us, a round trip on a LAN */
+#define SIM_DEFAULT_LATENCY 2000
+
+/** Default time of a call which times out in ms */
+#define SIM_DEFAULT_TIMEOUT 3000
+
+static SimGatewayCfg_t g_sim_cfg = {SIM_DEFAULT_CAPACITY, SIM_DEFAULT_LATENCY, SIM_DEFAULT_TIMEOUT, 1};
+static SimGateway_t g_sim;
+static int g_sim_error_code[SOAP_NUM_OF_ACTIONS];  /* error injected on init */
+static int g_sim_error_count[SOAP_NUM_OF_ACTIONS]; /* number of failed calls injected on init */
+
+/**
+ * @brief Init "sim" driver
+ *
+ * @return 0 if OK and -1 if error
+ */
+static int sim_init()
+{
+    int i;
+
+    simGateway_destroy(&g_sim);
+    if (simGateway_init(&g_sim, &g_sim_cfg) != 0)
+    {
+        return -1;
+    }
+    for (i = 0; i < SOAP_NUM_OF_ACTIONS; i++)
+    {
+        if (g_sim_error_count[i] > 0)
+        {
+            simGateway_injectError(&g_sim, i, g_sim_error_code[i], g_sim_error_count[i]);
+        }
+    }
+    return upnpPFInterface_initSimulated(&g_sim);
+}
+
+/**
+ * @brief Destroy "sim" driver
+ *
+ * @return 0 if OK and -1 if error
+ */
+static int sim_destroy()
+{
+    upnpPFInterface_destroy();
+    simGateway_destroy(&g_sim);
+    return SUCCESS;
+}
+
+static const PortForwardDriver_t g_drivers[] = {
+    {
+        "upnp",
+        upnpPFInterface_init,
+        upnpPFInterface_destroy,
+        upnpPFInterface_addPortMapping,
+        upnpPFInterface_diablePortMapping,
+        upnpPFInterface_updatePortMapping,
+        upnpPFInterface_removePortMapping,
+        upnpPFInterface_getNextRenewal,
+        upnpPFInterface_renewLeases,
+        upnpPFInterface_getLimits,
+        upnpPFInterface_setCancelCheck,
+    },
+    {
+        "sim",
+        sim_init,
+        sim_destroy,
+        upnpPFInterface_addPortMapping,
+        upnpPFInterface_diablePortMapping,
+        upnpPFInterface_updatePortMapping,
+        upnpPFInterface_removePortMapping,
+        upnpPFInterface_getNextRenewal,
+        upnpPFInterface_renewLeases,
+        upnpPFInterface_getLimits,
+        upnpPFInterface_setCancelCheck,
+    },
+};
+
+const PortForwardDriver_t *pfDriver_find(const char *name)
+{
+    unsigned int i;
+    if (name == NULL)
+    {
+        name = PF_DRIVER_DEFAULT;
+    }
+    for (i = 0; i < sizeof(g_drivers) / sizeof(g_drivers[0]); i++)
+    {
+        if (strcmp(g_drivers[i].name, name) == 0)
+        {
+            return &g_drivers[i];
+        }
+    }
+    return NULL;
+}
+
+void pfDriver_setSimConfig(const SimGatewayCfg_t *cfg)
+{
+    g_sim_cfg = *cfg;
+}
+
+void pfDriver_getSimConfig(SimGatewayCfg_t *cfg)
+{
+    *cfg = g_sim_cfg;
+}
+
+void pfDriver_injectSimError(SoapAction_t action, int code, int count)
+{
+    g_sim_error_code[action] = code;
+    g_sim_error_count[action] = count;
+}
+
+SimGateway_t *pfDriver_getSimGateway()
+{
+    return &g_sim;
+}
@@ -0,0 +1,83 @@
+/**
+ * @file upnp_pf_driver.h
+ * @brief Port forwarding drivers
+ * @details The daemon calls port forwarding functions through a driver, so
+ * the same code runs against real gateways or an in-process simulated gateway
+ * for benchmarks and load tests.
+ *
+ * @author Pham Ngoc Thang (thangdc94)
+ * @bug No known bug
+ */
+
+#ifndef __UPNP_PF_DRIVER_H_
+#define __UPNP_PF_DRIVER_H_
+
+#include "mappingrule.h"
+#include "upnp_pf_simgw.h"
+#include "upnp_pf_interface.h"
+
+/** Name of default driver */
+#define PF_DRIVER_DEFAULT "upnp"
+
+/** Port forwarding driver, functions are the same as upnp_pf_interface.h */
+typedef struct _PortForwardDriver_t
+{
+    const char *name; /**< driver name */
+    int (*init)();    /**< see ::upnpPFInterface_init() */
+    int (*destroy)(); /**< see ::upnpPFInterface_destroy() */
+    int (*addPortMapping)(MappingRule_t rules[], int num_of_rules);            /**< see ::upnpPFInterface_addPortMapping() */
+    int (*disablePortMapping)();                                               /**< see ::upnpPFInterface_diablePortMapping() */
+    int (*updatePortMapping)(MappingRule_t rules[], int num_of_rules);         /**< see ::upnpPFInterface_updatePortMapping() */
+    int (*removePortMapping)(const char *eport, SupportedProtocol_t proto);    /**< see ::upnpPFInterface_removePortMapping() */
+    long (*getNextRenewal)();                                                  /**< see ::upnpPFInterface_getNextRenewal() */
+    int (*renewLeases)();                                                      /**< see ::upnpPFInterface_renewLeases() */
+    int (*getLimits)(GatewayLimits_t limits[], int max_limits);                /**< see ::upnpPFInterface_getLimits() */
+    void (*setCancelCheck)(cancelCheck check, void *arg);                      /**< see ::upnpPFInterface_setCancelCheck() */
+} PortForwardDriver_t;
+
+/**
+ * @brief Find a driver by name
+ * @details Known drivers are "upnp" for gateways found on network and "sim"
+ * for the in-process simulated gateway
+ *
+ * @param[in] name driver name or NULL for ::PF_DRIVER_DEFAULT
+ * @return driver or NULL if not found
+ */
+const PortForwardDriver_t *pfDriver_find(const char *name);
+
+/**
+ * @brief Set config of simulated gateway
+ * @details Used by "sim" driver on next init. Default config is used if
+ * this is never called.
+ *
+ * @param[in] cfg config
+ */
+void pfDriver_setSimConfig(const SimGatewayCfg_t *cfg);
+
+/**
+ * @brief Get config of simulated gateway
+ *
+ * @param[out] cfg config used by "sim" driver on next init
+ */
+void pfDriver_getSimConfig(SimGatewayCfg_t *cfg);
+
+/**
+ * @brief Inject an error in simulated gateway
+ * @details Error is injected on next init of "sim" driver, see
+ * ::simGateway_injectError()
+ *
+ * @param[in] action action
+ * @param[in] code UPnP error code or ::SIM_TIMEOUT
+ * @param[in] count number of failed calls
+ */
+void pfDriver_injectSimError(SoapAction_t action, int code, int count);
+
+/**
+ * @brief Get simulated gateway of "sim" driver
+ * @details Used to inject errors and read counters
+ *
+ * @return simulated gateway, valid between init and destroy of "sim" driver
+ */
+SimGateway_t *pfDriver_getSimGateway();
+
+#endif //__UPNP_PF_DRIVER_H_
@@ -17,7 +17,9 @@
     X(20, ERR_ROLLBACK, "Rollback after error failed") \
     X(40, ERR_TIMEOUT, "Connection timed out")         \
     X(50, ERR_NO_INIT, "Initial parameter is not set") \
-    X(60, ERR_PORT_CONFLICT, "Port has been already in used")
+    X(60, ERR_PORT_CONFLICT, "Port has been already in used") \
+    X(70, ERR_CANCELLED, "Cancelled by a newer request") \
+    X(80, ERR_NO_MEMORY, "Not enough memory")
 
 /** Generate enum */
 #define ERROR_ENUM(ID, NAME, TEXT) NAME = ID,
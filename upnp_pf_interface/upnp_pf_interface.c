@@ -19,6 +19,16 @@
 #include "logutil.h"
 #include "upnp_pf_interface.h"
 #include "upnp_pf_errcode.h"
+#include "upnp_pf_shadow.h"
+#include "upnp_pf_workpool.h"
+#include "upnp_pf_transport.h"
+#include "upnp_pf_soap.h"
+#include "upnp_pf_cache.h"
+#include "upnp_pf_discover.h"
+#include "upnp_pf_minissdpd.h"
+#include "upnp_pf_natpmp.h"
+#include "upnp_pf_simgw.h"
+#include "upnp_pf_ratelimit.h"
 #include "netutil/netutil.h"
 
 #ifdef LOG_LEVEL
@@ -32,322 +42,2000 @@
 /** Convert int to string */
 #define STRINGIFY(x) VAL(x)
 
-/** lease duration in string */
-#define LEASE_DURATION_STR STRINGIFY(LEASE_DURATION)
-
 /** Max number of times operation will be retried when error occured */
 #define MAX_RETRY_ON_ERR 5
 
-static struct UPNPUrls g_urls;
-static struct IGDdatas g_data;
-static char g_lanaddr[64]; /* my ip address on the LAN */
-static char g_desc[13];
+/** Max number of entries returned by one GetListOfPortMappings call */
+#define LIST_PAGE_SIZE 1000
+
+/** page size in string */
+#define LIST_PAGE_SIZE_STR STRINGIFY(LIST_PAGE_SIZE)
+
+/** Max time in ms to wait for a connected IGD during discovery */
+#define DISCOVER_TIMEOUT 2000
+
+/** Number of tries of NAT-PMP request when probing a gateway */
+#define NATPMP_PROBE_TRIES 2
+
+/** My ip address on the LAN of simulated gateway */
+#define SIM_LANADDR "192.168.1.2"
+
+/** Description of our entries on simulated gateway */
+#define SIM_DESC "02000000aa01"
+
+/** Max number of gateways managed at the same time */
+#define MAX_GATEWAYS 8
+
+/** Default max number of UPnP requests sent to gateway at the same time */
+#define MAX_CONCURRENCY_DEFAULT 4
+
+/** Default max number of requests per second sent to a gateway */
+#define MAX_RATE_DEFAULT 100
+
+/** Number of requests which can be sent at once to a gateway after a pause */
+#define RATE_BURST 10
+
+/** Result of a request which was not sent because the update was cancelled */
+#define REQUEST_CANCELLED (-ERR_CANCELLED)
+
+/** Optional actions supported by gateway */
+typedef enum _GatewayCapability_t
+{
+    CAP_LIST_PORT_MAPPINGS = 1 << 0,        /**< GetListOfPortMappings (IGDv2) */
+    CAP_DELETE_PORT_MAPPING_RANGE = 1 << 1, /**< DeletePortMappingRange (IGDv2) */
+    CAP_NATPMP = 1 << 2,                    /**< NAT-PMP, used instead of SOAP */
+} GatewayCapability_t;
+
+/** Contiguous span of external ports for one protocol */
+typedef struct _PortRange_t
+{
+    int start;                 /**< first external port */
+    int end;                   /**< last external port */
+    SupportedProtocol_t proto; /**< protocol */
+} PortRange_t;
+
+/** State of one gateway. Each gateway is reconciled on its own worker */
+typedef struct _Gateway_t
+{
+    struct UPNPUrls urls;      /**< URLs of gateway */
+    struct IGDdatas data;      /**< description of gateway */
+    char lanaddr[64];          /**< my ip address towards gateway */
+    char desc[13];             /**< description of our entries, MAC address of LAN interface */
+    ShadowTable_t shadow;      /**< shadow copy of our entries on gateway */
+    int caps;                  /**< bit mask of ::GatewayCapability_t */
+    SoapTransport_t transport; /**< keep-alive connections to control URL */
+    SoapCodec_t codec;         /**< envelope templates of WAN connection service */
+    NatPmp_t natpmp;           /**< NAT-PMP server, used if gateway has ::CAP_NATPMP */
+    SimGateway_t *sim;         /**< simulated gateway used instead of SOAP, NULL for real gateway */
+    RateLimiter_t limiter;     /**< pace of requests to gateway */
+    int max_concurrency;       /**< max number of requests in flight to gateway */
+    double max_rate;           /**< max requests per second to gateway, 0 for no limit */
+} Gateway_t;
+
+/** Limits of requests set for one gateway, they replace the default ones */
+typedef struct _GatewayLimitCfg_t
+{
+    char controlURL[128]; /**< control URL of gateway */
+    int max_concurrency;  /**< max number of requests in flight, 0 for default */
+    double max_rate;      /**< max requests per second, 0 for no limit and -1 for default */
+} GatewayLimitCfg_t;
+
+/** Job to add a port forwarding rule */
+typedef struct _AddJob_t
+{
+    MappingRule_t rule; /**< rule to add */
+    long lease;         /**< lease given by gateway */
+    int conflict;       /**< 1 (true) if rule would replace another NAT-PMP mapping, it's not sent */
+} AddJob_t;
+
+/** Rules passed to jobs run on every gateway */
+typedef struct _RuleSet_t
+{
+    MappingRule_t *rules; /**< array of rules */
+    int num_of_rules;     /**< size of rule array */
+} RuleSet_t;
+
+static Gateway_t g_gateways[MAX_GATEWAYS];
+static int g_num_of_gateways;
+static int g_verify_interval = SHADOW_VERIFY_INTERVAL;
+static const char *g_minissdpd_socket = MINISSDPD_SOCKET_DEFAULT;
+static int g_max_concurrency = MAX_CONCURRENCY_DEFAULT;
+static double g_max_rate = MAX_RATE_DEFAULT;
+static GatewayLimitCfg_t g_limit_cfgs[MAX_GATEWAYS];
+static int g_num_of_limit_cfgs;
+static cancelCheck g_cancel_check;
+static void *g_cancel_arg;
+static int g_cancellable; /* 1 while an update which can be cancelled runs */
 
 /* Function Prototypes */
+static int get_gateway_caps(const char *servicetype);
+static int add_port_mappings(Gateway_t *gw, MappingRule_t rules[], int num_of_rules);
+static int run_on_gateways(workJob fn, void *arg);
+static void apply_limits(Gateway_t *gw);
+
+/**
+ * @brief Release resources of a gateway
+ *
+ * @param[in] gw gateway
+ */
+static void close_gateway(Gateway_t *gw)
+{
+    FreeUPNPUrls(&gw->urls);
+    soapTransport_destroy(&gw->transport);
+    soapCodec_destroy(&gw->codec);
+    shadowTable_destroy(&gw->shadow);
+    rateLimiter_destroy(&gw->limiter);
+    memset(gw, 0, sizeof(Gateway_t));
+}
+
+/**
+ * @brief Release resources of all gateways
+ */
+static void close_gateways()
+{
+    int i;
+    for (i = 0; i < g_num_of_gateways; i++)
+    {
+        close_gateway(&g_gateways[i]);
+    }
+    g_num_of_gateways = 0;
+}
+
+/**
+ * @brief Get host of an URL
+ *
+ * @param[in] url URL such as http://192.168.1.1:5000/ctl/IPConn
+ * @param[out] host host
+ * @param[in] size size of @p host
+ * @return 0 if OK and -1 if URL is not valid
+ */
+static int get_url_host(const char *url, char *host, size_t size)
+{
+    const char *begin = strstr(url, "://");
+    size_t len;
+    if (begin == NULL)
+    {
+        return -1;
+    }
+    begin += 3;
+    len = strcspn(begin, ":/");
+    if (len == 0 || len >= size)
+    {
+        return -1;
+    }
+    memcpy(host, begin, len);
+    host[len] = '\0';
+    return 0;
+}
+
+/**
+ * @brief Convert NAT-PMP result to UPnP error code
+ * @details Failures are handled the same way whatever the protocol
+ *
+ * @param[in] r ::NatPmpResult_t
+ * @return UPnP error code
+ */
+static int natpmp_to_upnp_error(int r)
+{
+    switch (r)
+    {
+    case NATPMP_SUCCESS:
+        return UPNPCOMMAND_SUCCESS;
+    case NATPMP_NOT_AUTHORIZED:
+        return 606; // Action not authorized
+    case NATPMP_OUT_OF_RESOURCES:
+        return 728; // NoPortMapsAvailable
+    case NATPMP_UNSUPPORTED_VERSION:
+    case NATPMP_UNSUPPORTED_OPCODE:
+        return 602; // Optional Action Not Implemented
+    default:
+        return 501; // Action Failed
+    }
+}
+
+/**
+ * @brief Open connections to a gateway
+ * @details Control URL and service type must be set. NAT-PMP is used
+ * instead of SOAP if gateway has ::CAP_NATPMP.
+ *
+ * @param[in] gw gateway
+ * @return 0 if OK and -1 if failed
+ */
+static int open_gateway(Gateway_t *gw)
+{
+    apply_limits(gw);
+    if (gw->caps & CAP_NATPMP)
+    {
+        char host[64];
+        if (get_url_host(gw->urls.controlURL, host, sizeof(host)) != 0 ||
+            natpmp_init(&gw->natpmp, host, NATPMP_PORT) != 0)
+        {
+            return -1;
+        }
+        return 0;
+    }
+    if (soapTransport_init(&gw->transport, gw->urls.controlURL, gw->max_concurrency) != 0 ||
+        soapCodec_init(&gw->codec, gw->data.first.servicetype) != 0)
+    {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Init rate limiter of a gateway
+ * @details Call once for each used slot of gateways, before ::close_gateway()
+ *
+ * @param[in] gw gateway
+ */
+static void init_limiter(Gateway_t *gw)
+{
+    rateLimiter_init(&gw->limiter, g_max_rate, RATE_BURST, g_max_concurrency);
+    gw->max_concurrency = g_max_concurrency;
+    gw->max_rate = g_max_rate;
+}
+
+/**
+ * @brief Find limits set for a gateway
+ *
+ * @param[in] controlURL control URL of gateway
+ * @param[in] create 1 to add limits if there are none
+ * @return limits or NULL if not found or there is no room to add them
+ */
+static GatewayLimitCfg_t *find_limit_cfg(const char *controlURL, int create)
+{
+    GatewayLimitCfg_t *cfg;
+    int i;
+    for (i = 0; i < g_num_of_limit_cfgs; i++)
+    {
+        if (strcmp(g_limit_cfgs[i].controlURL, controlURL) == 0)
+        {
+            return &g_limit_cfgs[i];
+        }
+    }
+    if (!create || g_num_of_limit_cfgs == MAX_GATEWAYS ||
+        strlen(controlURL) >= sizeof(g_limit_cfgs[0].controlURL))
+    {
+        return NULL;
+    }
+    cfg = &g_limit_cfgs[g_num_of_limit_cfgs++];
+    strcpy(cfg->controlURL, controlURL);
+    cfg->max_concurrency = 0;
+    cfg->max_rate = -1;
+    return cfg;
+}
+
+/**
+ * @brief Apply limits of requests to a gateway
+ * @details Limits set for its control URL are used, default ones if there
+ * are none. Call once control URL of gateway is known and after
+ * ::init_limiter().
+ *
+ * @param[in] gw gateway
+ */
+static void apply_limits(Gateway_t *gw)
+{
+    GatewayLimitCfg_t *cfg = find_limit_cfg(gw->urls.controlURL, 0);
+    gw->max_concurrency = (cfg != NULL && cfg->max_concurrency > 0) ? cfg->max_concurrency : g_max_concurrency;
+    gw->max_rate = (cfg != NULL && cfg->max_rate >= 0) ? cfg->max_rate : g_max_rate;
+    rateLimiter_setLimits(&gw->limiter, gw->max_rate, gw->max_concurrency);
+    soapTransport_setPoolSize(&gw->transport, gw->max_concurrency);
+}
+
+/**
+ * @brief Check if a result means gateway is overloaded
+ * @details No answer, a broken answer or Action Failed are taken as signs of
+ * overload. Other errors are answers to the request itself.
+ *
+ * @param[in] r result of UPnP command
+ * @return 1 (true) if gateway may be overloaded and 0 if not
+ */
+static int is_overloaded(int r)
+{
+    return r == UPNPCOMMAND_HTTP_ERROR || r == UPNPCOMMAND_INVALID_RESPONSE ||
+           r == UPNPCOMMAND_UNKNOWN_ERROR || r == 501 /* Action Failed */;
+}
+
+/**
+ * @brief End a request to a gateway
+ * @details Report result to rate limiter of gateway
+ *
+ * @param[in] gw gateway
+ * @param[in] start value returned by ::rateLimiter_acquire()
+ * @param[in] r result of UPnP command
+ * @return @p r
+ */
+static int gw_done(Gateway_t *gw, long long start, int r)
+{
+    rateLimiter_release(&gw->limiter, start, is_overloaded(r));
+    return r;
+}
+
+/**
+ * @brief AddPortMapping on a gateway
+ * @details Action is answered by simulated gateway or sent with SOAP, see
+ * ::upnpSoap_addPortMapping(). Like all requests to a gateway it waits for
+ * the rate limiter of gateway first.
+ */
+static int gw_addPortMapping(Gateway_t *gw, const char *extPort, const char *inPort,
+                             const char *inClient, const char *desc, const char *proto,
+                             const char *leaseDuration)
+{
+    long long start = rateLimiter_acquire(&gw->limiter);
+    if (gw->sim != NULL)
+    {
+        return gw_done(gw, start, simGateway_addPortMapping(gw->sim, extPort, inPort, inClient,
+                                                            desc, proto, leaseDuration));
+    }
+    return gw_done(gw, start, upnpSoap_addPortMapping(&gw->transport, &gw->codec, extPort, inPort,
+                                                      inClient, desc, proto, leaseDuration));
+}
+
+/**
+ * @brief DeletePortMapping on a gateway
+ */
+static int gw_deletePortMapping(Gateway_t *gw, const char *extPort, const char *proto)
+{
+    long long start = rateLimiter_acquire(&gw->limiter);
+    if (gw->sim != NULL)
+    {
+        return gw_done(gw, start, simGateway_deletePortMapping(gw->sim, extPort, proto));
+    }
+    return gw_done(gw, start, upnpSoap_deletePortMapping(&gw->transport, &gw->codec, extPort, proto));
+}
+
+/**
+ * @brief DeletePortMappingRange on a gateway
+ */
+static int gw_deletePortMappingRange(Gateway_t *gw, const char *startPort, const char *endPort,
+                                     const char *proto, const char *manage)
+{
+    long long start = rateLimiter_acquire(&gw->limiter);
+    if (gw->sim != NULL)
+    {
+        return gw_done(gw, start, simGateway_deletePortMappingRange(gw->sim, startPort, endPort,
+                                                                    proto, manage, gw->lanaddr));
+    }
+    return gw_done(gw, start, upnpSoap_deletePortMappingRange(&gw->transport, &gw->codec,
+                                                              startPort, endPort, proto, manage));
+}
+
+/**
+ * @brief GetGenericPortMappingEntry on a gateway
+ */
+static int gw_getGenericPortMappingEntry(Gateway_t *gw, const char *index, char *extPort,
+                                         char *intClient, char *intPort, char *protocol,
+                                         char *desc, char *duration)
+{
+    long long start = rateLimiter_acquire(&gw->limiter);
+    if (gw->sim != NULL)
+    {
+        return gw_done(gw, start, simGateway_getGenericPortMappingEntry(gw->sim, index, extPort, intClient,
+                                                                        intPort, protocol, desc, duration));
+    }
+    return gw_done(gw, start, upnpSoap_getGenericPortMappingEntry(&gw->transport, &gw->codec, index, extPort,
+                                                                  intClient, intPort, protocol, desc, duration));
+}
+
+/**
+ * @brief GetListOfPortMappings on a gateway
+ */
+static int gw_getListOfPortMappings(Gateway_t *gw, const char *startPort, const char *endPort,
+                                    const char *proto, const char *numberOfPorts,
+                                    portMappingHandler handler, void *arg, int *count)
+{
+    long long start = rateLimiter_acquire(&gw->limiter);
+    if (gw->sim != NULL)
+    {
+        return gw_done(gw, start, simGateway_getListOfPortMappings(gw->sim, startPort, endPort, proto,
+                                                                   numberOfPorts, handler, arg, count));
+    }
+    return gw_done(gw, start, upnpSoap_getListOfPortMappings(&gw->transport, &gw->codec, startPort, endPort,
+                                                             proto, numberOfPorts, handler, arg, count));
+}
+
+/**
+ * @brief GetExternalIPAddress on a gateway
+ */
+static int gw_getExternalIPAddress(Gateway_t *gw, char *extIpAdd)
+{
+    long long start = rateLimiter_acquire(&gw->limiter);
+    if (gw->sim != NULL)
+    {
+        return gw_done(gw, start, simGateway_getExternalIPAddress(gw->sim, extIpAdd));
+    }
+    return gw_done(gw, start, upnpSoap_getExternalIPAddress(&gw->transport, &gw->codec, extIpAdd));
+}
+
+/**
+ * @brief NAT-PMP mapping request to a gateway
+ * @details See ::natpmp_map()
+ *
+ * @return ::NatPmpResult_t
+ */
+static int gw_natpmpMap(Gateway_t *gw, int tcp, int iport, int eport, long lifetime,
+                        int *mapped_eport, long *mapped_lifetime)
+{
+    long long start = rateLimiter_acquire(&gw->limiter);
+    int r = natpmp_map(&gw->natpmp, tcp, iport, eport, lifetime, mapped_eport, mapped_lifetime);
+    rateLimiter_release(&gw->limiter, start, r == NATPMP_TIMEOUT);
+    return r;
+}
+
+/**
+ * @brief NAT-PMP external address request to a gateway
+ * @details See ::natpmp_getExternalAddress()
+ *
+ * @return ::NatPmpResult_t
+ */
+static int gw_natpmpGetExternalAddress(Gateway_t *gw, char *extip)
+{
+    long long start = rateLimiter_acquire(&gw->limiter);
+    int r = natpmp_getExternalAddress(&gw->natpmp, extip);
+    rateLimiter_release(&gw->limiter, start, r == NATPMP_TIMEOUT);
+    return r;
+}
+
+/**
+ * @brief Cancellation checkpoint
+ * @details Thread safe, called by workers of gateways
+ *
+ * @return 1 (true) if running update is outdated and must stop, 0 if not
+ */
+static int is_cancelled()
+{
+    return g_cancellable && g_cancel_check != NULL && g_cancel_check(g_cancel_arg);
+}
+
+/**
+ * @brief Job function to check a cached gateway
+ * @details Check that gateway still answers with one GetExternalIPAddress call
+ *
+ * @param[in] job pointer to ::Gateway_t
+ * @param[in] arg not used
+ * @return 0 if OK and -1 if gateway doesn't answer
+ */
+static int check_gateway_job(void *job, void *arg)
+{
+    Gateway_t *gw = job;
+    char ext_ip[40];
+    int r;
+    if (gw->caps & CAP_NATPMP)
+    {
+        r = natpmp_to_upnp_error(gw_natpmpGetExternalAddress(gw, ext_ip));
+    }
+    else
+    {
+        r = gw_getExternalIPAddress(gw, ext_ip);
+    }
+    if (r != UPNPCOMMAND_SUCCESS)
+    {
+        LOG(LOG_INFO, "Cached gateway %s doesn't answer: %d (%s)",
+            gw->urls.controlURL, r, strupnperror(r));
+        return -1;
+    }
+    LOG(LOG_INFO, "Use cached gateway %s, external ip address %s", gw->urls.controlURL, ext_ip);
+    return 0;
+}
+
+/**
+ * @brief Use gateways from discovery cache
+ * @details Load gateways found by last discovery and check that they still
+ * answer. Gateways are checked in parallel. Cache is removed if one check
+ * fails, so a new discovery also finds gateways which replaced it.
+ *
+ * @return 0 if OK and -1 if full discovery is needed
+ */
+static int init_from_cache()
+{
+    GatewayCache_t caches[MAX_GATEWAYS];
+    int results[MAX_GATEWAYS];
+    int num_of_caches;
+    int i;
+
+    num_of_caches = gatewayCache_load(caches, MAX_GATEWAYS);
+    if (num_of_caches <= 0)
+    {
+        return -1;
+    }
+
+    for (i = 0; i < num_of_caches; i++)
+    {
+        Gateway_t *gw = &g_gateways[g_num_of_gateways++];
+        init_limiter(gw);
+        // our LAN address may have changed since cache was saved
+        char *desc = getmac_from_ip(caches[i].lanaddr);
+        if (desc == NULL || strcmp(desc, caches[i].desc) != 0)
+        {
+            LOG(LOG_INFO, "Cached gateway is not reachable from %s anymore", caches[i].lanaddr);
+            free(desc);
+            break;
+        }
+        free(desc);
+        gw->urls.controlURL = strdup(caches[i].controlURL);
+        strcpy(gw->data.first.servicetype, caches[i].servicetype);
+        strcpy(gw->lanaddr, caches[i].lanaddr);
+        strcpy(gw->desc, caches[i].desc);
+        gw->caps = caches[i].caps;
+        if (gw->urls.controlURL == NULL || open_gateway(gw) != 0)
+        {
+            break;
+        }
+    }
+    if (i == num_of_caches)
+    {
+        int ok = 1;
+        workPool_run(g_gateways, g_num_of_gateways, sizeof(Gateway_t), check_gateway_job, NULL,
+                     g_num_of_gateways, results);
+        for (i = 0; i < g_num_of_gateways; i++)
+        {
+            ok = ok && (results[i] == 0);
+        }
+        if (ok)
+        {
+            return 0;
+        }
+    }
+
+    close_gateways();
+    gatewayCache_remove();
+    return -1;
+}
+
+/**
+ * @brief Save gateways to discovery cache
+ */
+static void save_to_cache()
+{
+    GatewayCache_t caches[MAX_GATEWAYS];
+    int num_of_caches = 0;
+    int i;
+    for (i = 0; i < g_num_of_gateways; i++)
+    {
+        Gateway_t *gw = &g_gateways[i];
+        GatewayCache_t *cache = &caches[num_of_caches];
+        if (strlen(gw->urls.controlURL) >= sizeof(cache->controlURL) ||
+            strlen(gw->data.first.servicetype) >= sizeof(cache->servicetype))
+        {
+            continue;
+        }
+        strcpy(cache->controlURL, gw->urls.controlURL);
+        strcpy(cache->servicetype, gw->data.first.servicetype);
+        strcpy(cache->lanaddr, gw->lanaddr);
+        strcpy(cache->desc, gw->desc);
+        cache->caps = gw->caps;
+        num_of_caches++;
+    }
+    gatewayCache_save(caches, num_of_caches);
+}
+
+/**
+ * @brief Job function to check if a gateway speaks NAT-PMP
+ * @details Gateway gets ::CAP_NATPMP if it answers a NAT-PMP request. Only
+ * gateways without UPnP are probed: an IGD which also speaks NAT-PMP keeps
+ * SOAP, which can list our mappings, so mappings added by SOAP before are
+ * not left behind.
+ *
+ * @param[in] job pointer to ::Gateway_t
+ * @param[in] arg not used
+ * @return 0
+ */
+static int probe_natpmp_job(void *job, void *arg)
+{
+    Gateway_t *gw = job;
+    NatPmp_t np;
+    char host[64];
+    char ext_ip[16];
+    char *desc;
+
+    if (gw->data.first.servicetype[0] != '\0')
+    {
+        return 0;
+    }
+    if (get_url_host(gw->urls.controlURL, host, sizeof(host)) != 0 ||
+        natpmp_init(&np, host, NATPMP_PORT) != 0)
+    {
+        return 0;
+    }
+    np.max_tries = NATPMP_PROBE_TRIES;
+    if (natpmp_getExternalAddress(&np, ext_ip) != NATPMP_SUCCESS)
+    {
+        return 0;
+    }
+    np.max_tries = NATPMP_MAX_TRIES;
+
+    if (gw->lanaddr[0] == '\0')
+    {
+        // use MAC Address as Description
+        desc = getmac_from_ip(np.lanaddr);
+        if (desc == NULL)
+        {
+            return 0;
+        }
+        strcpy(gw->lanaddr, np.lanaddr);
+        strcpy(gw->desc, desc);
+        free(desc);
+    }
+    gw->natpmp = np;
+    gw->caps = CAP_NATPMP;
+    LOG(LOG_INFO, "Gateway %s speaks NAT-PMP, external ip address %s", host, ext_ip);
+    return 0;
+}
+
+/**
+ * @brief Add default gateway to gateways
+ * @details It's added at the end of gateways if UPnP didn't find it, so it
+ * can be probed for NAT-PMP
+ */
+static void add_default_gateway()
+{
+    int i;
+    char host[64];
+    char *ip = get_default_gateway();
+    Gateway_t *gw;
+
+    if (ip == NULL || g_num_of_gateways == MAX_GATEWAYS)
+    {
+        free(ip);
+        return;
+    }
+    for (i = 0; i < g_num_of_gateways; i++)
+    {
+        if (get_url_host(g_gateways[i].urls.controlURL, host, sizeof(host)) == 0 &&
+            strcmp(host, ip) == 0)
+        {
+            free(ip);
+            return;
+        }
+    }
+    gw = &g_gateways[g_num_of_gateways];
+    gw->urls.controlURL = malloc(strlen("natpmp://") + strlen(ip) + 1);
+    if (gw->urls.controlURL != NULL)
+    {
+        sprintf(gw->urls.controlURL, "natpmp://%s", ip);
+        init_limiter(gw);
+        apply_limits(gw);
+        g_num_of_gateways++;
+    }
+    free(ip);
+}
 
 int upnpPFInterface_init()
 {
-    struct UPNPDev *devlist = 0;
-    int error = 0;
-    int ipv6 = 0; // not use IPv6
-    int i;
-    char *desc;
+    int i;
+    int num_of_igds;
+    DiscoveredIGD_t igds[MAX_GATEWAYS];
+
+    // entries of previous gateways are not valid anymore
+    close_gateways();
+
+    if (init_from_cache() == 0)
+    {
+        return SUCCESS;
+    }
+
+    LOG(LOG_INFO, "UPnP Discovering ...");
+
+    // discovery devices in network
+    num_of_igds = upnpDiscover_findIGDs(DISCOVER_TIMEOUT, g_minissdpd_socket, igds, MAX_GATEWAYS);
+    for (i = 0; i < num_of_igds; i++)
+    {
+        Gateway_t *gw = &g_gateways[g_num_of_gateways];
+        char *desc;
+
+        LOG(LOG_DBG, "Found %s IGD : %s, local LAN ip address : %s",
+            igds[i].connected ? "valid" : "a (not connected?)", igds[i].urls.controlURL, igds[i].lanaddr);
+        init_limiter(gw);
+        gw->urls = igds[i].urls;
+        gw->data = igds[i].data;
+        strcpy(gw->lanaddr, igds[i].lanaddr);
+        gw->caps = get_gateway_caps(gw->data.first.servicetype);
+
+        // use MAC Address as Description
+        desc = getmac_from_ip(gw->lanaddr);
+        if (desc == NULL || open_gateway(gw) != 0)
+        {
+            LOG(LOG_ERR, "Cannot use IGD %s from %s", gw->urls.controlURL, gw->lanaddr);
+            free(desc);
+            close_gateway(gw);
+            continue;
+        }
+        strcpy(gw->desc, desc);
+        free(desc);
+        g_num_of_gateways++;
+    }
+
+    // default gateway uses NAT-PMP if it doesn't speak UPnP
+    add_default_gateway();
+    run_on_gateways(probe_natpmp_job, NULL);
+    if (g_num_of_gateways > 0 && g_gateways[g_num_of_gateways - 1].caps == 0 &&
+        g_gateways[g_num_of_gateways - 1].data.first.servicetype[0] == '\0')
+    {
+        // default gateway doesn't speak NAT-PMP nor UPnP
+        close_gateway(&g_gateways[--g_num_of_gateways]);
+    }
+
+    if (g_num_of_gateways == 0)
+    {
+        LOG(LOG_ERR, "No valid UPnP Internet Gateway Device found");
+        return -1;
+    }
+    save_to_cache();
+    return SUCCESS;
+}
+
+int upnpPFInterface_initSimulated(SimGateway_t *sim)
+{
+    Gateway_t *gw = &g_gateways[0];
+
+    close_gateways();
+    gw->urls.controlURL = strdup("sim://gateway");
+    if (gw->urls.controlURL == NULL)
+    {
+        return -1;
+    }
+    strcpy(gw->data.first.servicetype, sim->cfg.igdv2 ? "urn:schemas-upnp-org:service:WANIPConnection:2"
+                                                      : "urn:schemas-upnp-org:service:WANIPConnection:1");
+    strcpy(gw->lanaddr, SIM_LANADDR);
+    strcpy(gw->desc, SIM_DESC);
+    gw->caps = get_gateway_caps(gw->data.first.servicetype);
+    gw->sim = sim;
+    init_limiter(gw);
+    apply_limits(gw);
+    g_num_of_gateways = 1;
+    LOG(LOG_INFO, "Use simulated gateway, capacity %d, latency %d us",
+        sim->cfg.capacity, sim->cfg.latency_us);
+    return SUCCESS;
+}
+
+/**
+ * @brief Get protocol from string
+ * @details Convert protocol string returned by router to ::SupportedProtocol_t
+ *
+ * @param[in] str protocol string
+ * @param[out] proto protocol
+ * @return 0 if OK and -1 if protocol is not supported
+ */
+static int get_proto_from_str(const char *str, SupportedProtocol_t *proto)
+{
+    if (strcmp(str, "UDP") == 0)
+    {
+        *proto = UDP;
+    }
+    else if (strcmp(str, "TCP") == 0)
+    {
+        *proto = TCP;
+    }
+    else
+    {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Get capabilities of gateway
+ * @details Detect optional actions supported by gateway from its service type
+ *
+ * @param[in] servicetype service type of WAN connection service
+ * @return bit mask of ::GatewayCapability_t
+ */
+static int get_gateway_caps(const char *servicetype)
+{
+    int caps = 0;
+    if (strstr(servicetype, "WANIPConnection:2") != NULL)
+    {
+        caps |= CAP_LIST_PORT_MAPPINGS | CAP_DELETE_PORT_MAPPING_RANGE;
+    }
+    return caps;
+}
+
+/**
+ * @brief Check if an error means action is not supported by gateway
+ *
+ * @param[in] r error code returned by UPnP command
+ * @return 1 (true) if action is not supported and 0 if not
+ */
+static int is_action_unsupported(int r)
+{
+    return r == 401 /* Invalid Action */ || r == 602 /* Optional Action Not Implemented */;
+}
+
+/**
+ * @brief Load an entry of port listing into shadow table
+ * @details Handler of ::upnpSoap_getListOfPortMappings()
+ *
+ * @param[in] pm port mapping entry
+ * @param[in] arg pointer to ::Gateway_t
+ */
+static void on_port_mapping_listed(const SoapPortMapping_t *pm, void *arg)
+{
+    Gateway_t *gw = arg;
+    LOG(LOG_DBG, "%s %5s->%s:%-5s '%s' %s",
+        pm->protocol, pm->extPort, pm->intClient, pm->intPort, pm->desc, pm->duration);
+
+    // only care about our port mapping rules
+    if (strcmp(pm->desc, gw->desc) == 0)
+    {
+        MappingRule_t rule;
+        if (get_proto_from_str(pm->protocol, &rule.proto) == 0)
+        {
+            strcpy(rule.eport, pm->extPort);
+            strcpy(rule.iport, pm->intPort);
+            rule.ttl = 0; // unknown, set by next reconcile
+            shadowTable_put(&gw->shadow, &rule, pm->intClient, strtol(pm->duration, NULL, 10));
+        }
+    }
+}
+
+/**
+ * @brief Load entries of a port range into shadow table
+ * @details Get port mapping entries in range [@p start, @p end] using
+ * GetListOfPortMappings (IGDv2). If the range holds more entries than one page
+ * it's split in halves, so entries are not missed whatever order router
+ * returns them in. Entries of a full page are loaded again by the halves.
+ *
+ * @param[in] gw gateway
+ * @param[in] proto protocol string
+ * @param[in] start first external port of range
+ * @param[in] end last external port of range
+ * @return 0 if OK or error code if failed
+ */
+static int load_port_mapping_range(Gateway_t *gw, const char *proto, int start, int end)
+{
+    int r;
+    int retry_count = 0;
+    int count = 0;
+    char start_port[6];
+    char end_port[6];
+
+    snprintf(start_port, sizeof(start_port), "%d", start);
+    snprintf(end_port, sizeof(end_port), "%d", end);
+    do
+    {
+        if (is_cancelled())
+        {
+            return -ERR_CANCELLED;
+        }
+        r = gw_getListOfPortMappings(gw, start_port, end_port, proto, LIST_PAGE_SIZE_STR,
+                                     on_port_mapping_listed, gw, &count);
+        if (r == 730) // PortMappingNotFound, range is empty
+        {
+            return SUCCESS;
+        }
+        if (r != UPNPCOMMAND_SUCCESS)
+        {
+            if (is_action_unsupported(r) || retry_count == MAX_RETRY_ON_ERR)
+            {
+                LOG(LOG_ERR, "GetListOfPortMappings(%s, %s, %s) returned %d (%s)",
+                    start_port, end_port, proto, r, strupnperror(r));
+                return is_action_unsupported(r) ? -r : -ERR_RETRY;
+            }
+            retry_count++;
+            LOG(LOG_WARN, "GetListOfPortMappings(%s, %s, %s) returned %d (%s). Retrying...",
+                start_port, end_port, proto, r, strupnperror(r));
+        }
+    } while (r != UPNPCOMMAND_SUCCESS);
+
+    if (count >= LIST_PAGE_SIZE && start < end)
+    {
+        // page is full, there may be more entries in this range
+        int mid = start + (end - start) / 2;
+        r = load_port_mapping_range(gw, proto, start, mid);
+        if (r == SUCCESS)
+        {
+            r = load_port_mapping_range(gw, proto, mid + 1, end);
+        }
+        return r;
+    }
+    return SUCCESS;
+}
+
+/**
+ * @brief Load entries into shadow table using bulk enumeration
+ * @details Get all port mapping entries with a few GetListOfPortMappings calls
+ *
+ * @param[in] gw gateway
+ * @return 0 if OK or error code if failed
+ */
+static int load_port_mapping_list(Gateway_t *gw)
+{
+    int r = load_port_mapping_range(gw, get_proto_str(TCP), 0, 65535);
+    if (r == SUCCESS)
+    {
+        r = load_port_mapping_range(gw, get_proto_str(UDP), 0, 65535);
+    }
+    return r;
+}
+
+/**
+ * @brief Load entries into shadow table one by one
+ * @details Walk through port mapping table of router by index and load entries
+ * which have description matches ours into shadow table
+ *
+ * @param[in] gw gateway
+ * @return 0 if OK or error code if failed
+ */
+static int load_port_mapping_entries(Gateway_t *gw)
+{
+    int r = 0;
+    int retry_count = 0;
+
+    int i = 0;
+    char index[6];      /* Port Mapping index */
+    char intClient[40]; /* Internal Client IP */
+    char intPort[6];    /* Internal Port Mapping */
+    char extPort[6];    /* External Port Mapping */
+    char protocol[4];   /* Protocol */
+    char desc[80];      /* Port Mapping Description */
+    char duration[16];  /* Expired Duration of this entry map */
+
+    LOG(LOG_DBG, " i protocol exPort->inAddr:inPort description leaseTime");
+    do
+    {
+        if (is_cancelled())
+        {
+            return -ERR_CANCELLED;
+        }
+        snprintf(index, 6, "%d", i);
+        duration[0] = '\0';
+        desc[0] = '\0';
+        extPort[0] = '\0';
+        intPort[0] = '\0';
+        intClient[0] = '\0';
+        r = gw_getGenericPortMappingEntry(gw,
+                                          index,
+                                          extPort, intClient, intPort,
+                                          protocol, desc, duration);
+
+        if (r == 0)
+        {
+            LOG(LOG_DBG, "%2d %s %5s->%s:%-5s '%s' %s",
+                i, protocol, extPort, intClient, intPort,
+                desc, duration);
+
+            // only care about our port mapping rules
+            if (strcmp(desc, gw->desc) == 0)
+            {
+                MappingRule_t rule;
+                if (get_proto_from_str(protocol, &rule.proto) == 0)
+                {
+                    strcpy(rule.eport, extPort);
+                    strcpy(rule.iport, intPort);
+                    rule.ttl = 0; // unknown, set by next reconcile
+                    shadowTable_put(&gw->shadow, &rule, intClient, strtol(duration, NULL, 10));
+                }
+            }
+        }
+        else
+        {
+            // try again with the same index entry if r != 713 (SpecifiedArrayIndexInvalid)
+            if (r != 713)
+            {
+                if (retry_count == MAX_RETRY_ON_ERR)
+                {
+                    LOG(LOG_ERR, "GetGenericPortMappingEntry() returned %d (%s)", r, strupnperror(r));
+                    return -ERR_RETRY;
+                }
+                retry_count++;
+                LOG(LOG_WARN, "GetGenericPortMappingEntry() returned %d (%s). Retrying...", r, strupnperror(r));
+                r = 0;
+                continue; // skips i++
+            }
+            else
+            {
+                LOG(LOG_DBG, "GetGenericPortMappingEntry() done");
+            }
+        }
+        i++;
+    } while (r == 0);
+    return SUCCESS;
+}
+
+/**
+ * @brief Delete all NAT-PMP mappings of this client
+ * @details RFC 6886 section 3.4: internal port 0 and lifetime 0, for UDP and TCP
+ *
+ * @param[in] gw gateway with ::CAP_NATPMP
+ * @return 0 if OK or error code if failed
+ */
+static int natpmp_delete_all(Gateway_t *gw)
+{
+    int r = natpmp_to_upnp_error(gw_natpmpMap(gw, 0, 0, 0, 0, NULL, NULL));
+    int r_tcp = natpmp_to_upnp_error(gw_natpmpMap(gw, 1, 0, 0, 0, NULL, NULL));
+    return r != SUCCESS ? r : r_tcp;
+}
+
+/**
+ * @brief Verify shadow table
+ * @details Reload our entries from router into shadow table. Bulk enumeration
+ * is used when gateway supports it, otherwise entries are read one by one.
+ * NAT-PMP can't list mappings, so shadow table is the only copy there. Its
+ * first verification deletes all our mappings, so the empty table is right
+ * and mappings of a previous run don't stay until their lease ends.
+ *
+ * @param[in] gw gateway
+ * @return 0 if OK or error code if failed
+ */
+static int verify_shadow_table(Gateway_t *gw)
+{
+    int r;
+
+    if (gw->caps & CAP_NATPMP)
+    {
+        if (gw->shadow.verified == 0)
+        {
+            r = natpmp_delete_all(gw);
+            if (r != SUCCESS)
+            {
+                LOG(LOG_ERR, "NAT-PMP delete of all mappings failed with code %d (%s)", r, strupnperror(r));
+                return r;
+            }
+        }
+        shadowTable_setVerified(&gw->shadow);
+        return SUCCESS;
+    }
+    shadowTable_clear(&gw->shadow);
+    if (gw->caps & CAP_LIST_PORT_MAPPINGS)
+    {
+        r = load_port_mapping_list(gw);
+        if (r != SUCCESS && is_action_unsupported(-r))
+        {
+            LOG(LOG_WARN, "GetListOfPortMappings is not supported. Fall back to GetGenericPortMappingEntry");
+            gw->caps &= ~CAP_LIST_PORT_MAPPINGS;
+            shadowTable_clear(&gw->shadow);
+            r = load_port_mapping_entries(gw);
+        }
+    }
+    else
+    {
+        r = load_port_mapping_entries(gw);
+    }
+
+    if (r != SUCCESS)
+    {
+        return r;
+    }
+    shadowTable_setVerified(&gw->shadow);
+    LOG(LOG_DBG, "Shadow table of %s verified with %d entries", gw->urls.controlURL, gw->shadow.size);
+    return SUCCESS;
+}
+
+/**
+ * @brief Get lease to request for a rule
+ *
+ * @param[in] rule rule
+ * @return lease in seconds
+ */
+static long get_lease(const MappingRule_t *rule)
+{
+    if (rule->ttl <= 0)
+    {
+        return LEASE_DURATION;
+    }
+    if (rule->ttl < LEASE_MIN_DURATION)
+    {
+        return LEASE_MIN_DURATION;
+    }
+    return rule->ttl < LEASE_MAX_DURATION ? rule->ttl : LEASE_MAX_DURATION;
+}
+
+/**
+ * @brief Check if a shadow entry satisfies a rule
+ * @details Entry satisfies a rule if it maps the same ports and protocol to our
+ * LAN address, its lease does not need to be renewed yet and is not longer
+ * than the lease of the rule.
+ *
+ * @param[in] gw gateway
+ * @param[in] entry entry of shadow table
+ * @param[in] rule requested rule
+ * @return 1 (true) if entry satisfies the rule and 0 if not
+ */
+static int is_entry_up_to_date(const Gateway_t *gw, const ShadowEntry_t *entry, const MappingRule_t *rule)
+{
+    time_t now = shadowTable_now();
+    return (strcmp(entry->rule.iport, rule->iport) == 0) &&
+           (strcmp(entry->intClient, gw->lanaddr) == 0) &&
+           (entry->expire == 0 || (entry->renew > now && entry->expire - now <= get_lease(rule)));
+}
+
+/**
+ * @brief Compare two rules by protocol then external port
+ * @details Compare function for qsort()
+ */
+static int compare_rule(const void *a, const void *b)
+{
+    const MappingRule_t *ra = (const MappingRule_t *)a;
+    const MappingRule_t *rb = (const MappingRule_t *)b;
+    if (ra->proto != rb->proto)
+    {
+        return (int)ra->proto - (int)rb->proto;
+    }
+    return atoi(ra->eport) - atoi(rb->eport);
+}
+
+/**
+ * @brief Check if an entry can be removed by a range delete
+ * @details DeletePortMappingRange without manage flag only removes entries
+ * mapped to our own LAN address
+ *
+ * @param[in] gw gateway
+ * @param[in] rule rule to remove
+ * @return 1 (true) if rule can be part of a range and 0 if not
+ */
+static int is_range_removable(Gateway_t *gw, const MappingRule_t *rule)
+{
+    ShadowEntry_t *entry = shadowTable_find(&gw->shadow, rule->eport, rule->proto);
+    return (entry != NULL) && (strcmp(entry->intClient, gw->lanaddr) == 0);
+}
+
+/**
+ * @brief Plan removal of stale rules
+ * @details Group stale rules into contiguous spans of external ports for one
+ * protocol, so each span can be removed by one request
+ *
+ * @param[in] gw gateway
+ * @param[in,out] rules array of stale rules, it will be sorted
+ * @param[in] num_of_rules size of rule array
+ * @param[out] ranges array of port ranges, must be able to hold @p num_of_rules ranges
+ * @return number of ranges
+ */
+static int plan_removal(Gateway_t *gw, MappingRule_t rules[], int num_of_rules, PortRange_t ranges[])
+{
+    int i;
+    int num_of_ranges = 0;
+    int last_removable = 0;
+
+    qsort(rules, num_of_rules, sizeof(MappingRule_t), compare_rule);
+    for (i = 0; i < num_of_rules; i++)
+    {
+        int port = atoi(rules[i].eport);
+        int removable = is_range_removable(gw, &rules[i]);
+        if (num_of_ranges > 0 && removable && last_removable &&
+            (gw->caps & CAP_DELETE_PORT_MAPPING_RANGE) &&
+            ranges[num_of_ranges - 1].proto == rules[i].proto &&
+            ranges[num_of_ranges - 1].end + 1 == port)
+        {
+            ranges[num_of_ranges - 1].end = port;
+        }
+        else if (num_of_ranges == 0 || ranges[num_of_ranges - 1].proto != rules[i].proto ||
+                 ranges[num_of_ranges - 1].end != port) // skip duplicated rule
+        {
+            ranges[num_of_ranges].start = port;
+            ranges[num_of_ranges].end = port;
+            ranges[num_of_ranges].proto = rules[i].proto;
+            num_of_ranges++;
+        }
+        last_removable = removable;
+    }
+    return num_of_ranges;
+}
+
+/**
+ * @brief Remove one port forwarding rule
+ * @details NAT-PMP deletes a mapping by internal port, which is taken from
+ * shadow table
+ *
+ * @param[in] gw gateway
+ * @param[in] eport external port
+ * @param[in] proto protocol
+ * @return result of UPnP command
+ */
+static int delete_rule(Gateway_t *gw, const char *eport, SupportedProtocol_t proto)
+{
+    if (gw->caps & CAP_NATPMP)
+    {
+        ShadowEntry_t *entry = shadowTable_find(&gw->shadow, eport, proto);
+        if (entry == NULL)
+        {
+            return 714; // NoSuchEntryInArray
+        }
+        return natpmp_to_upnp_error(gw_natpmpMap(gw, proto == TCP, atoi(entry->rule.iport),
+                                               0, 0, NULL, NULL));
+    }
+    return gw_deletePortMapping(gw, eport, get_proto_str(proto));
+}
+
+/**
+ * @brief Job function to remove a range of port forwarding rules
+ * @details Remove a range with one DeletePortMappingRange request or a single
+ * rule with DeletePortMapping. It's run by worker threads so it only sends
+ * the request.
+ *
+ * @param[in] job pointer to ::PortRange_t
+ * @param[in] arg pointer to ::Gateway_t
+ * @return result of UPnP command
+ */
+static int remove_range_job(void *job, void *arg)
+{
+    PortRange_t *range = job;
+    Gateway_t *gw = arg;
+    char start_port[6];
+    char end_port[6];
+    const char *str_proto = get_proto_str(range->proto);
+
+    if (is_cancelled())
+    {
+        return REQUEST_CANCELLED;
+    }
+    snprintf(start_port, sizeof(start_port), "%d", range->start);
+    if (range->end > range->start)
+    {
+        snprintf(end_port, sizeof(end_port), "%d", range->end);
+        return gw_deletePortMappingRange(gw, start_port, end_port, str_proto, "0" /* manage */);
+    }
+    return delete_rule(gw, start_port, range->proto);
+}
+
+/**
+ * @brief Handle result of a DeletePortMapping request
+ * @details Log result and update shadow table
+ *
+ * @param[in] gw gateway
+ * @param[in] eport external port
+ * @param[in] proto protocol
+ * @param[in] r result of UPnP command
+ * @return 0 if OK or error code if failed
+ */
+static int on_port_mapping_removed(Gateway_t *gw, const char *eport, SupportedProtocol_t proto, int r)
+{
+    const char *str_proto = get_proto_str(proto);
+    if (r != UPNPCOMMAND_SUCCESS)
+    {
+        LOG(LOG_ERR, "UPNP_DeletePortMapping(%s, %s) failed with code : %d (%s)", eport, str_proto, r, strupnperror(r));
+        if (r == 714) // NoSuchEntryInArray, entry has already gone
+        {
+            shadowTable_remove(&gw->shadow, eport, proto);
+        }
+        shadowTable_invalidate(&gw->shadow);
+        return -2;
+    }
+    LOG(LOG_INFO, "UPNP_DeletePortMapping(%s, %s) success", eport, str_proto);
+    shadowTable_remove(&gw->shadow, eport, proto);
+    return SUCCESS;
+}
+
+/**
+ * @brief Handle result of a DeletePortMappingRange request
+ * @details Log result and update shadow table
+ *
+ * @param[in] gw gateway
+ * @param[in] range port range
+ * @param[in] r result of UPnP command
+ * @return 0 if OK or error code if range need to be removed one by one
+ */
+static int on_port_mapping_range_removed(Gateway_t *gw, const PortRange_t *range, int r)
+{
+    int port;
+    char eport[6];
+    const char *str_proto = get_proto_str(range->proto);
+
+    if (r == UPNPCOMMAND_SUCCESS || r == 730 /* PortMappingNotFound */)
+    {
+        LOG(LOG_INFO, "UPNP_DeletePortMappingRange(%d, %d, %s) success", range->start, range->end, str_proto);
+        for (port = range->start; port <= range->end; port++)
+        {
+            snprintf(eport, sizeof(eport), "%d", port);
+            shadowTable_remove(&gw->shadow, eport, range->proto);
+        }
+        if (r != UPNPCOMMAND_SUCCESS)
+        {
+            // entries have already gone
+            shadowTable_invalidate(&gw->shadow);
+        }
+        return SUCCESS;
+    }
+    LOG(LOG_WARN, "UPNP_DeletePortMappingRange(%d, %d, %s) failed with code : %d (%s). Remove one by one",
+        range->start, range->end, str_proto, r, strupnperror(r));
+    if (is_action_unsupported(r) || r == 606 /* Action not authorized */)
+    {
+        gw->caps &= ~CAP_DELETE_PORT_MAPPING_RANGE;
+    }
+    return -2;
+}
+
+/**
+ * @brief Remove stale port forwarding rules
+ * @details Remove rules in O(ranges) requests using ::plan_removal().
+ * Requests are sent in parallel by the worker pool.
+ *
+ * @param[in] gw gateway
+ * @param[in] list_remove linked list of ::MappingRule_t to remove
+ * @return 0 if OK or error code if failed
+ */
+static int remove_port_mappings(Gateway_t *gw, list *list_remove)
+{
+    int i = 0;
+    int num_of_ranges;
+    int num_of_retries = 0;
+    int ret = SUCCESS;
+    int num_of_rules = list_size(list_remove);
+    MappingRule_t *rules;
+    PortRange_t *ranges;
+    int *results;
+    listNode *node;
+    char eport[6];
+
+    if (num_of_rules == 0)
+    {
+        return SUCCESS;
+    }
+
+    rules = malloc(num_of_rules * sizeof(MappingRule_t));
+    ranges = malloc(num_of_rules * sizeof(PortRange_t));
+    results = malloc(num_of_rules * sizeof(int));
+    if (rules == NULL || ranges == NULL || results == NULL)
+    {
+        // entries stay in shadow table for next update
+        LOG(LOG_ERR, "Remove %d rules: out of memory", num_of_rules);
+        free(results);
+        free(ranges);
+        free(rules);
+        return -ERR_NO_MEMORY;
+    }
+    for (node = list_remove->head; node != NULL; node = node->next)
+    {
+        rules[i++] = *(MappingRule_t *)node->data;
+    }
+
+    num_of_ranges = plan_removal(gw, rules, num_of_rules, ranges);
+    LOG(LOG_DBG, "Remove %d rules in %d ranges", num_of_rules, num_of_ranges);
+    workPool_run(ranges, num_of_ranges, sizeof(PortRange_t), remove_range_job, gw,
+                 gw->max_concurrency, results);
+
+    // ranges which failed are removed one by one in a second round
+    for (i = 0; i < num_of_ranges; i++)
+    {
+        if (results[i] == REQUEST_CANCELLED)
+        {
+            ret = -ERR_CANCELLED; // entries stay in shadow table for next update
+            continue;
+        }
+        if (ranges[i].end > ranges[i].start)
+        {
+            if (on_port_mapping_range_removed(gw, &ranges[i], results[i]) != SUCCESS)
+            {
+                int port;
+                for (port = ranges[i].start; port <= ranges[i].end; port++)
+                {
+                    snprintf(rules[num_of_retries].eport, sizeof(rules[num_of_retries].eport), "%d", port);
+                    rules[num_of_retries].proto = ranges[i].proto;
+                    num_of_retries++;
+                }
+            }
+        }
+        else
+        {
+            snprintf(eport, sizeof(eport), "%d", ranges[i].start);
+            if (on_port_mapping_removed(gw, eport, ranges[i].proto, results[i]) != SUCCESS)
+            {
+                ret = -2;
+            }
+        }
+    }
+
+    for (i = 0; i < num_of_retries; i++)
+    {
+        ranges[i].start = ranges[i].end = atoi(rules[i].eport);
+        ranges[i].proto = rules[i].proto;
+    }
+    workPool_run(ranges, num_of_retries, sizeof(PortRange_t), remove_range_job, gw,
+                 gw->max_concurrency, results);
+    for (i = 0; i < num_of_retries; i++)
+    {
+        if (results[i] == REQUEST_CANCELLED)
+        {
+            ret = -ERR_CANCELLED;
+        }
+        else if (on_port_mapping_removed(gw, rules[i].eport, rules[i].proto, results[i]) != SUCCESS)
+        {
+            ret = -2;
+        }
+    }
+
+    free(results);
+    free(ranges);
+    free(rules);
+    return ret;
+}
+
+/**
+ * @brief Reconcile port mapping rules
+ * @details Compute difference between shadow table and requested rules then
+ * remove and add only what is needed
+ *
+ * @param[in] gw gateway
+ * @param[in] rules array of Rule to add
+ * @param[in] num_of_rules size of rule array
+ * @param[out] verified 1 if shadow table was verified with router during this call
+ * @return 0 if OK or error code if failed
+ */
+static int reconcile(Gateway_t *gw, MappingRule_t rules[], int num_of_rules, int *verified)
+{
+    int r = SUCCESS;
+    int r_add;
+    int i;
+    int num_of_add = 0;
+
+    list list_remove;
+    MappingRule_t *rules_add;
+    char *keep;
+
+    *verified = 0;
+    if (shadowTable_needVerify(&gw->shadow, g_verify_interval))
+    {
+        r = verify_shadow_table(gw);
+        if (r != SUCCESS)
+        {
+            return r;
+        }
+        *verified = 1;
+    }
+
+    // We don't need free function because we don't use malloc anywhere in our struct.
+    list_new(&list_remove, sizeof(MappingRule_t), NULL /*freeFunction*/);
+    rules_add = malloc((num_of_rules + 1) * sizeof(MappingRule_t));
+    keep = calloc(gw->shadow.size + 1, sizeof(char));
+    if (rules_add == NULL || keep == NULL)
+    {
+        LOG(LOG_ERR, "Reconcile port mapping on %s: out of memory", gw->urls.controlURL);
+        free(rules_add);
+        free(keep);
+        list_destroy(&list_remove);
+        return -ERR_NO_MEMORY;
+    }
+
+    // compute difference between shadow table and requested rules
+    for (i = 0; i < num_of_rules; i++)
+    {
+        ShadowEntry_t *entry = shadowTable_find(&gw->shadow, rules[i].eport, rules[i].proto);
+        if (entry != NULL)
+        {
+            keep[entry - gw->shadow.entries] = 1;
+            if (is_entry_up_to_date(gw, entry, &rules[i]))
+            {
+                entry->rule.ttl = rules[i].ttl; // used by next renewal
+                continue;
+            }
+            if (strcmp(entry->rule.iport, rules[i].iport) != 0 ||
+                strcmp(entry->intClient, gw->lanaddr) != 0)
+            {
+                // same external port but mapped to another target
+                list_append(&list_remove, &entry->rule);
+            }
+            // otherwise only lease need to be renewed. AddPortMapping will overwrite it
+        }
+        rules_add[num_of_add++] = rules[i];
+    }
+    for (i = 0; i < gw->shadow.size; i++)
+    {
+        if (!keep[i])
+        {
+            list_append(&list_remove, &gw->shadow.entries[i].rule);
+        }
+    }
+    free(keep);
+
+    LOG(LOG_INFO, "Reconcile port mapping on %s: %d to remove, %d to add, %d up to date",
+        gw->urls.controlURL, list_size(&list_remove), num_of_add, num_of_rules - num_of_add);
+
+    // remove old rules, rules are added even if some of them are still there
+    r = remove_port_mappings(gw, &list_remove);
+
+    r_add = add_port_mappings(gw, rules_add, num_of_add);
+    if (r_add == -ERR_NO_MEMORY)
+    {
+        r = r_add;
+    }
+    else if (r_add != SUCCESS)
+    {
+        //@todo rollback
+        r = -2;
+    }
+
+    free(rules_add);
+    list_destroy(&list_remove);
+    return r;
+}
+
+/**
+ * @brief Add a port forwarding rule with NAT-PMP
+ * @details Gateway may give another external port than the requested one,
+ * such mapping is deleted and reported as a conflict
+ *
+ * @param[in] gw gateway
+ * @param[in,out] job rule to add, lease given by gateway is saved in it
+ * @return result of UPnP command
+ */
+static int add_rule_natpmp(Gateway_t *gw, AddJob_t *job)
+{
+    int tcp = (job->rule.proto == TCP);
+    int iport = atoi(job->rule.iport);
+    int mapped_eport;
+    int r = gw_natpmpMap(gw, tcp, iport, atoi(job->rule.eport), get_lease(&job->rule),
+                       &mapped_eport, &job->lease);
+    if (r != NATPMP_SUCCESS)
+    {
+        return natpmp_to_upnp_error(r);
+    }
+    if (mapped_eport != atoi(job->rule.eport))
+    {
+        gw_natpmpMap(gw, tcp, iport, 0, 0, NULL, NULL);
+        return 718; // ConflictInMappingEntry
+    }
+    return UPNPCOMMAND_SUCCESS;
+}
+
+/**
+ * @brief Job function to add a port forwarding rule
+ * @details It's run by worker threads so it only sends the request.
+ *
+ * @param[in] job pointer to ::AddJob_t
+ * @param[in] arg pointer to ::Gateway_t
+ * @return result of UPnP command
+ */
+static int add_rule_job(void *job, void *arg)
+{
+    AddJob_t *add = job;
+    Gateway_t *gw = arg;
+    char lease[12];
+    if (add->conflict)
+    {
+        return 718; // ConflictInMappingEntry
+    }
+    if (is_cancelled())
+    {
+        return REQUEST_CANCELLED;
+    }
+    if (gw->caps & CAP_NATPMP)
+    {
+        return add_rule_natpmp(gw, add);
+    }
+    add->lease = get_lease(&add->rule);
+    snprintf(lease, sizeof(lease), "%ld", add->lease);
+    return gw_addPortMapping(gw, add->rule.eport, add->rule.iport, gw->lanaddr, gw->desc,
+                             get_proto_str(add->rule.proto), lease);
+}
+
+/**
+ * @brief Find rules which would replace another mapping on a NAT-PMP gateway
+ * @details NAT-PMP keys mappings by internal port and protocol, so a rule
+ * with the same ones as an earlier rule of @p jobs, or as an entry of shadow
+ * table with another external port, would replace that mapping. Such rules
+ * are logged and marked as conflict.
+ *
+ * @param[in] gw gateway with ::CAP_NATPMP
+ * @param[in,out] jobs rules to add
+ * @param[in] num_of_jobs size of job array
+ * @return 0 if OK or -::ERR_NO_MEMORY
+ */
+static int find_natpmp_conflicts(Gateway_t *gw, AddJob_t jobs[], int num_of_jobs)
+{
+    NatPmpPorts_t *ports = calloc(2, sizeof(NatPmpPorts_t)); // [0] for shadow table, [1] for jobs
+    int i;
+
+    if (ports == NULL)
+    {
+        return -ERR_NO_MEMORY;
+    }
+    for (i = 0; i < gw->shadow.size; i++)
+    {
+        MappingRule_t *rule = &gw->shadow.entries[i].rule;
+        natpmp_addPort(&ports[0], rule->proto == TCP, atoi(rule->iport));
+    }
+    for (i = 0; i < num_of_jobs; i++)
+    {
+        MappingRule_t *rule = &jobs[i].rule;
+        int tcp = (rule->proto == TCP);
+        int iport = atoi(rule->iport);
+        // entry of the rule itself is renewed or replaced, it's no conflict
+        ShadowEntry_t *entry = shadowTable_find(&gw->shadow, rule->eport, rule->proto);
+        int own = (entry != NULL && strcmp(entry->rule.iport, rule->iport) == 0);
+
+        jobs[i].conflict = !natpmp_addPort(&ports[1], tcp, iport) || (!own && natpmp_hasPort(&ports[0], tcp, iport));
+        if (jobs[i].conflict)
+        {
+            LOG(LOG_ERR, "NAT-PMP mapping %s->%s %s is not added, another rule has internal port %s",
+                rule->eport, rule->iport, get_proto_str(rule->proto), rule->iport);
+        }
+    }
+    free(ports);
+    return SUCCESS;
+}
+
+/**
+ * @brief Add port forwarding rules on a gateway
+ * @details Requests are sent in parallel by the worker pool. On a NAT-PMP
+ * gateway, rules which would replace another mapping are not sent, see
+ * ::find_natpmp_conflicts()
+ *
+ * @param[in] gw gateway
+ * @param[in] rules array of Rule to add
+ * @param[in] num_of_rules size of rule array
+ * @return 0 if OK or error code of the first failed rule in array order
+ */
+static int add_port_mappings(Gateway_t *gw, MappingRule_t rules[], int num_of_rules)
+{
+    const char *str_proto;
+    int i, r;
+    int ret = SUCCESS;
+    int *results;
+    AddJob_t *jobs;
 
-    unsigned char ttl = 2; /* defaulting to 2 */
-    LOG(LOG_INFO, "UPnP Discovering ...");
+    if (num_of_rules <= 0)
+    {
+        return SUCCESS;
+    }
 
-    // discovery device in network
-    if ((devlist = upnpDiscover(2000, NULL /* multicastif */,
-                                NULL /* minissdpdsock */,
-                                UPNP_LOCAL_PORT_ANY, ipv6, ttl, &error)))
+    results = malloc(num_of_rules * sizeof(int));
+    jobs = malloc(num_of_rules * sizeof(AddJob_t));
+    if (results == NULL || jobs == NULL)
+    {
+        // rules are still missing from shadow table so next update adds them
+        LOG(LOG_ERR, "Add %d rules: out of memory", num_of_rules);
+        free(jobs);
+        free(results);
+        return -ERR_NO_MEMORY;
+    }
+    for (i = 0; i < num_of_rules; i++)
+    {
+        jobs[i].rule = rules[i];
+        jobs[i].conflict = 0;
+    }
+    if ((gw->caps & CAP_NATPMP) && find_natpmp_conflicts(gw, jobs, num_of_rules) != SUCCESS)
     {
-        struct UPNPDev *device;
+        LOG(LOG_ERR, "Add %d rules: out of memory", num_of_rules);
+        free(jobs);
+        free(results);
+        return -ERR_NO_MEMORY;
+    }
+    workPool_run(jobs, num_of_rules, sizeof(AddJob_t), add_rule_job, gw,
+                 gw->max_concurrency, results);
 
-        LOG(LOG_INFO, "List of UPNP devices found on the network :");
-        for (device = devlist; device; device = device->pNext)
+    // handle results in the original order
+    for (i = 0; i < num_of_rules; i++)
+    {
+        r = results[i];
+        str_proto = get_proto_str(rules[i].proto);
+        if (r == REQUEST_CANCELLED)
         {
-            printf("\n");
-            LOG(LOG_INFO, "[desc]: %s | [st]: %s", device->descURL, device->st);
-            if (UPNP_GetIGDFromUrl(device->descURL, &g_urls, &g_data, g_lanaddr, sizeof(g_lanaddr)) || (i = UPNP_GetValidIGD(devlist, &g_urls, &g_data, g_lanaddr, sizeof(g_lanaddr))))
+            // not sent, rule is still missing from shadow table so next update adds it
+            if (ret == SUCCESS)
             {
-                switch (i)
-                {
-                case 1:
-                    LOG(LOG_DBG, "Found valid IGD : %s", g_urls.controlURL);
-                    break;
-                case 2:
-                    LOG(LOG_DBG, "Found a (not connected?) IGD : %s", g_urls.controlURL);
-                    LOG(LOG_DBG, "Trying to continue anyway");
-                    break;
-                case 3:
-                    LOG(LOG_DBG, "UPnP device found. Is it an IGD ? : %s", g_urls.controlURL);
-                    LOG(LOG_DBG, "Trying to continue anyway");
-                    break;
-                default:
-                    LOG(LOG_DBG, "Found device (igd ?) : %s", g_urls.controlURL);
-                    LOG(LOG_DBG, "Trying to continue anyway");
-                }
-
-                if ((strcmp(g_lanaddr, "") == 0) || (strcmp(g_data.first.servicetype, "") == 0))
-                {
-                    LOG(LOG_WARN, "Not a valid UPnP Internet Gateway Device");
-                    continue;
-                }
-                else
-                {
-                    LOG(LOG_DBG, "Local LAN ip address : %s", g_lanaddr);
-                    
-                    // use MAC Address as Description
-                    desc = getmac_from_ip(g_lanaddr);
-                    strcpy(g_desc, desc);
-                    free(desc);
-                    break;
-                }
+                ret = -ERR_CANCELLED;
             }
-            else
+            continue;
+        }
+        if (jobs[i].conflict)
+        {
+            // not sent and already logged, shadow table is still right
+            if (ret == SUCCESS)
             {
-                LOG(LOG_WARN, "Not a valid UPnP Internet Gateway Device");
-                continue;
+                ret = -r;
             }
+            continue;
         }
-
-        // free device list
-        freeUPNPDevlist(devlist);
-        devlist = 0;
-        if ((strcmp(g_lanaddr, "") == 0) || (strcmp(g_data.first.servicetype, "") == 0))
+        if (r != UPNPCOMMAND_SUCCESS)
         {
-            LOG(LOG_ERR, "No valid UPnP Internet Gateway Device found");
-            return -1;
+            LOG(LOG_ERR, "AddPortMapping(%s, %s, %s, %s) failed with code %d (%s)",
+                rules[i].eport, rules[i].iport, gw->lanaddr, str_proto, r, strupnperror(r));
+            shadowTable_invalidate(&gw->shadow);
+            if (ret == SUCCESS)
+            {
+                ret = -r;
+            }
+            continue;
         }
+        LOG(LOG_INFO, "AddPortMapping(%s, %s, %s, %s) success", rules[i].eport, rules[i].iport, gw->lanaddr, str_proto);
+        shadowTable_put(&gw->shadow, &rules[i], gw->lanaddr, jobs[i].lease);
     }
-    else
+    free(jobs);
+    free(results);
+    return ret;
+}
+
+/**
+ * @brief Run a job on every gateway
+ * @details Each gateway has its own worker, so a slow or unreachable gateway
+ * doesn't delay the others
+ *
+ * @param[in] fn job function called with a ::Gateway_t
+ * @param[in] arg argument of @p fn
+ * @return 0 if OK or result of the first failed gateway
+ */
+static int run_on_gateways(workJob fn, void *arg)
+{
+    int results[MAX_GATEWAYS];
+    int i;
+
+    workPool_run(g_gateways, g_num_of_gateways, sizeof(Gateway_t), fn, arg,
+                 g_num_of_gateways, results);
+    for (i = 0; i < g_num_of_gateways; i++)
     {
-        LOG(LOG_ERR, "No IGD UPnP Device found on the network");
-        return -1;
+        if (results[i] != SUCCESS)
+        {
+            return results[i];
+        }
     }
     return SUCCESS;
 }
 
-static bool remove_rule(void *data)
+/**
+ * @brief Job function to add rules on a gateway
+ *
+ * @param[in] job pointer to ::Gateway_t
+ * @param[in] arg pointer to ::RuleSet_t
+ * @return 0 if OK or error code if failed
+ */
+static int add_job(void *job, void *arg)
 {
-    MappingRule_t *node = (MappingRule_t *)data;
-    upnpPFInterface_removePortMapping(node->eport, node->proto);
-    return TRUE;
+    RuleSet_t *set = arg;
+    return add_port_mappings(job, set->rules, set->num_of_rules);
 }
 
 int upnpPFInterface_addPortMapping(MappingRule_t rules[], int num_of_rules)
 {
-    const char *str_proto;
-    int i, r;
-    for (i = 0; i < num_of_rules; i++)
+    RuleSet_t set = {rules, num_of_rules};
+    return run_on_gateways(add_job, &set);
+}
+
+/**
+ * @brief Job function to remove all our rules from a gateway
+ *
+ * @param[in] job pointer to ::Gateway_t
+ * @param[in] arg not used
+ * @return 0 if OK or error code if failed
+ */
+static int disable_job(void *job, void *arg)
+{
+    Gateway_t *gw = job;
+    int i;
+    int r;
+    list list_remove;
+
+    if (gw->caps & CAP_NATPMP)
     {
-        str_proto = get_proto_str(rules[i].proto);
-        r = UPNP_AddPortMapping(g_urls.controlURL, g_data.first.servicetype,
-                                rules[i].eport, rules[i].iport, g_lanaddr, g_desc,
-                                str_proto, 0, LEASE_DURATION_STR);
-        if (r != UPNPCOMMAND_SUCCESS)
+        // shadow table may miss mappings of a previous run
+        r = natpmp_delete_all(gw);
+        if (r == SUCCESS)
         {
-            LOG(LOG_ERR, "AddPortMapping(%s, %s, %s, %s) failed with code %d (%s)",
-                rules[i].eport, rules[i].iport, g_lanaddr, str_proto, r, strupnperror(r));
-            return -r;
+            shadowTable_clear(&gw->shadow);
         }
-        LOG(LOG_INFO, "AddPortMapping(%s, %s, %s, %s) success", rules[i].eport, rules[i].iport, g_lanaddr, str_proto);
+        return r;
     }
-    return SUCCESS;
+    if (shadowTable_needVerify(&gw->shadow, g_verify_interval))
+    {
+        r = verify_shadow_table(gw);
+        if (r != SUCCESS)
+        {
+            return r;
+        }
+    }
+
+    // copy entries first, removing modifies the shadow table
+    // We don't need free function because we don't use malloc anywhere in our struct.
+    list_new(&list_remove, sizeof(MappingRule_t), NULL /*freeFunction*/);
+    for (i = 0; i < gw->shadow.size; i++)
+    {
+        list_append(&list_remove, &gw->shadow.entries[i].rule);
+    }
+    r = remove_port_mappings(gw, &list_remove);
+    list_destroy(&list_remove);
+    return r;
 }
 
 int upnpPFInterface_diablePortMapping()
 {
-    int r = 0;
-    int retry_count = 0;
+    return run_on_gateways(disable_job, NULL);
+}
 
-    int i = 0;
-    char index[6];      /* Port Mapping index */
-    char intClient[40]; /* Internal Client IP */
-    char intPort[6];    /* Internal Port Mapping */
-    char extPort[6];    /* External Port Mapping */
-    char protocol[4];   /* Protocol */
-    char desc[80];      /* Port Mapping Description */
-    char duration[16];  /* Expired Duration of this entry map */
+/**
+ * @brief Job function to reconcile rules on a gateway
+ *
+ * @param[in] job pointer to ::Gateway_t
+ * @param[in] arg pointer to ::RuleSet_t
+ * @return 0 if OK or error code if failed
+ */
+static int update_job(void *job, void *arg)
+{
+    Gateway_t *gw = job;
+    RuleSet_t *set = arg;
+    int verified;
+    int r = reconcile(gw, set->rules, set->num_of_rules, &verified);
+    if (r != SUCCESS && r != -ERR_NO_MEMORY && !verified && !is_cancelled())
+    {
+        // error may be caused by a shadow table which is out of sync with router
+        LOG(LOG_WARN, "Reconcile failed with unverified shadow table. Verify and try again...");
+        shadowTable_invalidate(&gw->shadow);
+        r = reconcile(gw, set->rules, set->num_of_rules, &verified);
+    }
+    return r;
+}
 
-    LOG(LOG_DBG, " i protocol exPort->inAddr:inPort description leaseTime");
-    do
+int upnpPFInterface_updatePortMapping(MappingRule_t rules[], int num_of_rules)
+{
+    // rules are only read, all gateways share them
+    RuleSet_t set = {rules, num_of_rules};
+    int r;
+
+    g_cancellable = 1;
+    r = run_on_gateways(update_job, &set);
+    if (r != SUCCESS && is_cancelled())
     {
-        snprintf(index, 6, "%d", i);
-        duration[0] = '\0';
-        desc[0] = '\0';
-        extPort[0] = '\0';
-        intPort[0] = '\0';
-        intClient[0] = '\0';
-        r = UPNP_GetGenericPortMappingEntry(g_urls.controlURL,
-                                            g_data.first.servicetype,
-                                            index,
-                                            extPort, intClient, intPort,
-                                            protocol, desc, NULL /*enabled*/,
-                                            NULL /* Remote Host */, duration);
+        LOG(LOG_INFO, "Update is cancelled by a newer request");
+        r = -ERR_CANCELLED;
+    }
+    g_cancellable = 0;
+    return r;
+}
 
-        if (r == 0)
+long upnpPFInterface_getNextRenewal()
+{
+    long next = -1;
+    time_t now = shadowTable_now();
+    int i;
+
+    for (i = 0; i < g_num_of_gateways; i++)
+    {
+        time_t when = shadowTable_nextRenew(&g_gateways[i].shadow);
+        if (when != 0 && (next < 0 || when - now < next))
         {
-            LOG(LOG_DBG, "%2d %s %5s->%s:%-5s '%s' %s",
-                i, protocol, extPort, intClient, intPort,
-                desc, duration);
+            next = (when > now) ? when - now : 0;
+        }
+    }
+    return next;
+}
 
-            // check old port mapping rule
-            if (strcmp(desc, g_desc) == 0)
-            {
-                // remove rule
+/**
+ * @brief Job function to renew leases close to expiry on a gateway
+ *
+ * @param[in] job pointer to ::Gateway_t
+ * @param[in] arg not used
+ * @return 0 if OK or error code if failed
+ */
+static int renew_job(void *job, void *arg)
+{
+    Gateway_t *gw = job;
+    time_t now = shadowTable_now();
+    MappingRule_t *rules = malloc((gw->shadow.size + 1) * sizeof(MappingRule_t));
+    int num_of_rules;
+    int r = SUCCESS;
+    int i;
 
-                if (strcmp(protocol, "UDP") == 0)
-                {
-                    upnpPFInterface_removePortMapping(extPort, UDP);
-                }
-                else
-                {
-                    upnpPFInterface_removePortMapping(extPort, TCP);
-                }
-            }
-        }
-        else
+    if (rules == NULL)
+    {
+        // leases stay due, they are renewed by next call
+        LOG(LOG_ERR, "Renew leases on %s: out of memory", gw->urls.controlURL);
+        return -ERR_NO_MEMORY;
+    }
+    num_of_rules = shadowTable_popDue(&gw->shadow, now, rules, gw->shadow.size);
+    if (num_of_rules > 0)
+    {
+        LOG(LOG_INFO, "Renew %d leases on %s", num_of_rules, gw->urls.controlURL);
+        r = add_port_mappings(gw, rules, num_of_rules);
+        for (i = 0; i < num_of_rules; i++)
         {
-            // try again with the same index entry if r != 713 (SpecifiedArrayIndexInvalid)
-            if (r != 713)
-            {
-                if (retry_count == MAX_RETRY_ON_ERR)
-                {
-                    LOG(LOG_ERR, "GetGenericPortMappingEntry() returned %d (%s)", r, strupnperror(r));
-                    return -ERR_RETRY;
-                }
-                retry_count++;
-                i--;
-                LOG(LOG_WARN, "GetGenericPortMappingEntry() returned %d (%s). Retrying...", r, strupnperror(r));
-                r = 0;
-                continue;
-            }
-            else
+            // renewed entries have been scheduled again by shadow table
+            ShadowEntry_t *entry = shadowTable_find(&gw->shadow, rules[i].eport, rules[i].proto);
+            if (entry != NULL && entry->renew == 0)
             {
-                LOG(LOG_DBG, "GetGenericPortMappingEntry() done");
+                shadowTable_setRenew(&gw->shadow, entry, now + LEASE_RETRY_DELAY);
             }
         }
-        i++;
-    } while (r == 0);
-    return SUCCESS;
+    }
+    free(rules);
+    return r;
 }
 
-int upnpPFInterface_updatePortMapping(MappingRule_t rules[], int num_of_rules)
+int upnpPFInterface_renewLeases()
 {
-    int r = 0;
-    int retry_count = 0;
-
-    list list_remove;
+    return run_on_gateways(renew_job, NULL);
+}
 
-    int i = 0;
-    char index[6];      /* Port Mapping index */
-    char intClient[40]; /* Internal Client IP */
-    char intPort[6];    /* Internal Port Mapping */
-    char extPort[6];    /* External Port Mapping */
-    char protocol[4];   /* Protocol */
-    char desc[80];      /* Port Mapping Description */
-    char duration[16];  /* Expired Duration of this entry map */
+/**
+ * @brief Job function to remove one rule from a gateway
+ *
+ * @param[in] job pointer to ::Gateway_t
+ * @param[in] arg pointer to ::MappingRule_t, only external port and protocol are used
+ * @return 0 if OK or error code if failed
+ */
+static int remove_job(void *job, void *arg)
+{
+    Gateway_t *gw = job;
+    MappingRule_t *rule = arg;
+    int r = delete_rule(gw, rule->eport, rule->proto);
+    return on_port_mapping_removed(gw, rule->eport, rule->proto, r);
+}
 
-    // create a linked list.
-    // We don't need free function because we don't use malloc anywhere in our struct.
-    list_new(&list_remove, sizeof(MappingRule_t), NULL /*freeFunction*/);
+int upnpPFInterface_removePortMapping(const char *eport, SupportedProtocol_t proto)
+{
+    MappingRule_t rule;
+    snprintf(rule.eport, sizeof(rule.eport), "%s", eport);
+    rule.proto = proto;
+    return run_on_gateways(remove_job, &rule);
+}
 
-    LOG(LOG_DBG, " i protocol exPort->inAddr:inPort description leaseTime");
-    do
-    {
-        snprintf(index, 6, "%d", i);
-        duration[0] = '\0';
-        desc[0] = '\0';
-        extPort[0] = '\0';
-        intPort[0] = '\0';
-        intClient[0] = '\0';
-        r = UPNP_GetGenericPortMappingEntry(g_urls.controlURL,
-                                            g_data.first.servicetype,
-                                            index,
-                                            extPort, intClient, intPort,
-                                            protocol, desc, NULL /*enabled*/,
-                                            NULL /* Remote Host */, duration);
+void upnpPFInterface_setVerifyInterval(int seconds)
+{
+    g_verify_interval = seconds;
+}
 
-        if (r == 0)
-        {
-            LOG(LOG_DBG, "%2d %s %5s->%s:%-5s '%s' %s",
-                i, protocol, extPort, intClient, intPort,
-                desc, duration);
+int upnpPFInterface_setMaxConcurrency(const char *controlURL, int max_requests)
+{
+    GatewayLimitCfg_t *cfg;
+    int i;
 
-            // check old port mapping rule
-            if (strcmp(desc, g_desc) == 0)
-            {
-                MappingRule_t rmnode;
-                strcpy(rmnode.eport, extPort);
-                strcpy(rmnode.iport, intPort);
-                if (strcmp(protocol, "UDP") == 0)
-                {
-                    rmnode.proto = UDP;
-                }
-                else if (strcmp(protocol, "TCP") == 0)
-                {
-                    rmnode.proto = TCP;
-                }
-                // add to linked list
-                list_append(&list_remove, &rmnode);
-            }
-        }
-        else
+    max_requests = (max_requests > 0) ? max_requests : 1;
+    if (controlURL == NULL)
+    {
+        g_max_concurrency = max_requests;
+    }
+    else
+    {
+        cfg = find_limit_cfg(controlURL, 1);
+        if (cfg == NULL)
         {
-            // try again with the same index entry if r != 713 (SpecifiedArrayIndexInvalid)
-            if (r != 713)
-            {
-                if (retry_count == MAX_RETRY_ON_ERR)
-                {
-                    LOG(LOG_ERR, "GetGenericPortMappingEntry() returned %d (%s)", r, strupnperror(r));
-                    return -ERR_RETRY;
-                }
-                retry_count++;
-                i--;
-                LOG(LOG_WARN, "GetGenericPortMappingEntry() returned %d (%s). Retrying...", r, strupnperror(r));
-                r = 0;
-                continue;
-            }
-            else
-            {
-                LOG(LOG_DBG, "GetGenericPortMappingEntry() done");
-            }
+            return -1;
         }
-        i++;
-    } while (r == 0);
+        cfg->max_concurrency = max_requests;
+    }
+    for (i = 0; i < g_num_of_gateways; i++)
+    {
+        apply_limits(&g_gateways[i]);
+    }
+    return SUCCESS;
+}
 
-    // iterate over the linked list to remove old rules
-    list_for_each(&list_remove, remove_rule);
+int upnpPFInterface_setMaxRate(const char *controlURL, double requests_per_second)
+{
+    GatewayLimitCfg_t *cfg;
+    int i;
 
-    if (upnpPFInterface_addPortMapping(rules, num_of_rules) != SUCCESS)
+    requests_per_second = (requests_per_second > 0) ? requests_per_second : 0;
+    if (controlURL == NULL)
     {
-        //@todo rollback
-        list_destroy(&list_remove);
-        return -2;
+        g_max_rate = requests_per_second;
+    }
+    else
+    {
+        cfg = find_limit_cfg(controlURL, 1);
+        if (cfg == NULL)
+        {
+            return -1;
+        }
+        cfg->max_rate = requests_per_second;
+    }
+    for (i = 0; i < g_num_of_gateways; i++)
+    {
+        apply_limits(&g_gateways[i]);
     }
-
-    list_destroy(&list_remove);
     return SUCCESS;
 }
 
-int upnpPFInterface_removePortMapping(const char *eport, SupportedProtocol_t proto)
+int upnpPFInterface_getLimits(GatewayLimits_t limits[], int max_limits)
 {
-    int r;
-    const char *str_proto = get_proto_str(proto);
-    r = UPNP_DeletePortMapping(g_urls.controlURL, g_data.first.servicetype, eport, str_proto, NULL);
-    if (r != UPNPCOMMAND_SUCCESS)
+    int i;
+    for (i = 0; i < g_num_of_gateways && i < max_limits; i++)
     {
-        LOG(LOG_ERR, "UPNP_DeletePortMapping(%s, %s) failed with code : %d (%s)", eport, str_proto, r, strupnperror(r));
-        return -2;
+        snprintf(limits[i].controlURL, sizeof(limits[i].controlURL), "%s", g_gateways[i].urls.controlURL);
+        rateLimiter_getStats(&g_gateways[i].limiter, &limits[i].stats);
     }
-    LOG(LOG_INFO, "UPNP_DeletePortMapping(%s, %s) success", eport, str_proto);
+    return i;
+}
 
-    return SUCCESS;
+void upnpPFInterface_setCancelCheck(cancelCheck check, void *arg)
+{
+    g_cancel_check = check;
+    g_cancel_arg = arg;
+}
+
+void upnpPFInterface_setMinissdpdSocket(const char *socketpath)
+{
+    g_minissdpd_socket = socketpath;
 }
 
 int upnpPFInterface_destroy()
 {
-    FreeUPNPUrls(&g_urls);
+    close_gateways();
     return SUCCESS;
-}
\ No newline at end of file
+}
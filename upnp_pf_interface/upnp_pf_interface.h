@@ -11,6 +11,7 @@
 #define __UPNP_PF_INTERFACE_H
 
 #include "mappingrule.h"
+#include "upnp_pf_ratelimit.h"
 
 /** 
  * Expired Duration for Port Mapping in seconds. 
@@ -21,16 +22,58 @@
  */
 #define LEASE_DURATION 86400 // 1 day
 
+/** Min lease in seconds of a rule with a ttl, shorter ones are raised to it */
+#define LEASE_MIN_DURATION 30
+
+/** Max lease in seconds of a rule with a ttl, longer ones are cut to it */
+#define LEASE_MAX_DURATION 604800 // 1 week
+
+/** Delay in seconds before a failed renewal is tried again */
+#define LEASE_RETRY_DELAY 60
+
+/**
+ * @brief Check if work in progress is outdated
+ * @details Called at checkpoints of ::upnpPFInterface_updatePortMapping(),
+ * from worker threads
+ *
+ * @param[in] arg user argument
+ * @return 1 (true) if a newer request supersedes the current one, 0 if not
+ */
+typedef int (*cancelCheck)(void *arg);
+
+/** Current limits of requests to a gateway */
+typedef struct _GatewayLimits_t
+{
+    char controlURL[128];   /**< control URL of gateway */
+    RateLimitStats_t stats; /**< limits of its rate limiter */
+} GatewayLimits_t;
+
 /**
  * @brief Init for UPnP Interface
  * @details Discovery Device and setup some useful variables
- * for this API. 
+ * for this API. All Internet Gateway Devices found are managed, rules are
+ * applied to each of them by its own worker. Gateways which answer NAT-PMP,
+ * including the default gateway, are driven with it instead of SOAP.
  * @warning Need to call ::upnpPFInterface_destroy()
  * 
  * @return 0 if OK and -1 if error
  */
 int upnpPFInterface_init();
 
+struct _SimGateway_t;
+
+/**
+ * @brief Init for UPnP Interface with a simulated gateway
+ * @details Same as ::upnpPFInterface_init() but all requests go to @p sim
+ * instead of gateways found on network
+ * @warning Need to call ::upnpPFInterface_destroy(). @p sim must stay valid
+ * until then
+ *
+ * @param[in] sim simulated gateway, see upnp_pf_simgw.h
+ * @return 0 if OK and -1 if error
+ */
+int upnpPFInterface_initSimulated(struct _SimGateway_t *sim);
+
 /**
  * @brief Destroy UPnP Interface
  * @details free memory of ::upnpPFInterface_init() to prevent memory leak
@@ -41,11 +84,12 @@ int upnpPFInterface_destroy();
 
 /**
  * @brief Add port forwarding rules
- * @details Add port forwarding rules on Router using UPnP
+ * @details Add port forwarding rules on Router using UPnP. Requests are sent
+ * in parallel, see ::upnpPFInterface_setMaxConcurrency()
  * 
  * @param[in] rules array of Rule to add
  * @param[in] num_of_rules size of rule array
- * @return 0 if OK or error code if failed
+ * @return 0 if OK or error code of the first failed rule in array order
  */
 int upnpPFInterface_addPortMapping(MappingRule_t rules[], int num_of_rules);
 
@@ -59,15 +103,41 @@ int upnpPFInterface_diablePortMapping();
 
 /**
  * @brief Update port forwarding rules
- * @details Remove old port mapping rule forwarding rules on Router using UPnP.
- * Check port conflict and add port mapping rule
- * 
+ * @details Compare port mapping rules on Router with the requested rules.
+ * Only stale rules are removed and only missing rules, rules which lease
+ * need to be renewed or is longer than their new ttl are added, so nothing is
+ * written if Router is up to date.
+ * Enumeration of router table and the add and remove loops stop at the next
+ * checkpoint when cancel check set by ::upnpPFInterface_setCancelCheck()
+ * says so. Rules added or removed until then stay in shadow table, so the
+ * next update only does what is left.
+ *
  * @param[in] rules array of Rule to add
  * @param[in] num_of_rules size of rule array
- * @return 0 if OK or error code if failed
+ * @return 0 if OK, -::ERR_CANCELLED if stopped by cancel check or error code
+ * if failed
  */
 int upnpPFInterface_updatePortMapping(MappingRule_t rules[], int num_of_rules);
 
+/**
+ * @brief Get time until next lease renewal
+ * @details Each rule is scheduled for renewal on its own from the lease given
+ * by gateway, see ::MappingRule_t::ttl
+ *
+ * @return seconds until ::upnpPFInterface_renewLeases() need to be called,
+ * 0 if it's already late, or -1 if no rule has a lease
+ */
+long upnpPFInterface_getNextRenewal();
+
+/**
+ * @brief Renew leases close to expiry
+ * @details Only rules which renewal time has come are added again. Rules
+ * which fail are tried again after ::LEASE_RETRY_DELAY seconds.
+ *
+ * @return 0 if OK or error code of the first failed gateway
+ */
+int upnpPFInterface_renewLeases();
+
 /**
  * @brief Remove a port forwarding rule
  * @details Remove a port forwarding rule on Router using UPnP
@@ -78,4 +148,74 @@ int upnpPFInterface_updatePortMapping(MappingRule_t rules[], int num_of_rules);
  */
 int upnpPFInterface_removePortMapping(const char *eport, SupportedProtocol_t proto);
 
+/**
+ * @brief Set shadow table verification interval
+ * @details Our entries on Router are cached in a shadow table which is updated
+ * by our own add and delete calls. The whole Router table is only walked again
+ * after this interval or when an error suggests the copy has drifted.
+ *
+ * @param[in] seconds verification interval in seconds, 0 to verify on every call
+ */
+void upnpPFInterface_setVerifyInterval(int seconds);
+
+/**
+ * @brief Set max number of concurrent requests to gateway
+ * @details Independent AddPortMapping and DeletePortMapping requests are sent
+ * in parallel by a pool of at most this many worker threads. The number of
+ * requests in flight to a gateway starts at 1 and grows up to this value
+ * while gateway latency stays flat.
+ * A gateway keeps the limit set for its control URL, also when it is found
+ * again by a later init. Other gateways use the default limit.
+ *
+ * @param[in] controlURL control URL of gateway as given by
+ * ::upnpPFInterface_getLimits(), NULL to set the default limit
+ * @param[in] max_requests max number of requests in flight, 1 to send them one by one
+ * @return 0 if OK and -1 if limits are already set for too many gateways
+ */
+int upnpPFInterface_setMaxConcurrency(const char *controlURL, int max_requests);
+
+/**
+ * @brief Set max request rate to gateway
+ * @details Requests to each gateway are paced by a token bucket. The rate
+ * starts at this value, is halved when gateway fails to answer and grows back
+ * while it answers. Default is 100 requests per second. Like
+ * ::upnpPFInterface_setMaxConcurrency() it's set for one gateway or as default.
+ *
+ * @param[in] controlURL control URL of gateway, NULL to set the default rate
+ * @param[in] requests_per_second max requests per second, 0 for no limit
+ * @return 0 if OK and -1 if limits are already set for too many gateways
+ */
+int upnpPFInterface_setMaxRate(const char *controlURL, double requests_per_second);
+
+/**
+ * @brief Set cancel check of updates
+ * @details Only ::upnpPFInterface_updatePortMapping() can be cancelled,
+ * removing all rules and lease renewals always run to the end
+ *
+ * @param[in] check called at checkpoints, NULL to never cancel
+ * @param[in] arg user argument of @p check
+ */
+void upnpPFInterface_setCancelCheck(cancelCheck check, void *arg);
+
+/**
+ * @brief Get current limits of requests to gateways
+ * @details Show how fast each gateway can safely be driven, see
+ * upnp_pf_ratelimit.h
+ *
+ * @param[out] limits array of limits
+ * @param[in] max_limits size of @p limits
+ * @return number of gateways written to @p limits
+ */
+int upnpPFInterface_getLimits(GatewayLimits_t limits[], int max_limits);
+
+/**
+ * @brief Set socket path of minissdpd
+ * @details Devices known by minissdpd are checked before searching the
+ * network with multicast. Default path is ::MINISSDPD_SOCKET_DEFAULT.
+ * @warning @p socketpath is not copied and must stay valid
+ *
+ * @param[in] socketpath socket path or NULL to always search with multicast
+ */
+void upnpPFInterface_setMinissdpdSocket(const char *socketpath);
+
 #endif //__UPNP_PF_INTERFACE_H
@@ -0,0 +1,111 @@
+/**
+ * @file upnp_pf_lease.c
+ * @brief Implement lease renewal schedule
+ * @details Binary min-heap stored in a growing array
+ *
+ * @author Pham Ngoc Thang (thangdc94)
+ * @bug No known bug
+ */
+
+#include <stdlib.h>
+
+#include "upnp_pf_lease.h"
+
+/** Initial capacity of lease heap */
+#define LEASE_HEAP_INIT_CAPACITY 16
+
+/**
+ * @brief Swap two timers
+ */
+static void swap(LeaseTimer_t *a, LeaseTimer_t *b)
+{
+    LeaseTimer_t tmp = *a;
+    *a = *b;
+    *b = tmp;
+}
+
+void leaseHeap_init(LeaseHeap_t *heap)
+{
+    heap->timers = NULL;
+    heap->size = 0;
+    heap->capacity = 0;
+}
+
+void leaseHeap_destroy(LeaseHeap_t *heap)
+{
+    free(heap->timers);
+    leaseHeap_init(heap);
+}
+
+void leaseHeap_clear(LeaseHeap_t *heap)
+{
+    heap->size = 0;
+}
+
+int leaseHeap_push(LeaseHeap_t *heap, const LeaseTimer_t *timer)
+{
+    int i;
+    if (heap->size == heap->capacity)
+    {
+        int capacity = heap->capacity ? heap->capacity * 2 : LEASE_HEAP_INIT_CAPACITY;
+        LeaseTimer_t *timers = realloc(heap->timers, capacity * sizeof(LeaseTimer_t));
+        if (timers == NULL)
+        {
+            return -1;
+        }
+        heap->timers = timers;
+        heap->capacity = capacity;
+    }
+
+    // sift up
+    i = heap->size++;
+    heap->timers[i] = *timer;
+    while (i > 0 && heap->timers[(i - 1) / 2].when > heap->timers[i].when)
+    {
+        swap(&heap->timers[(i - 1) / 2], &heap->timers[i]);
+        i = (i - 1) / 2;
+    }
+    return 0;
+}
+
+const LeaseTimer_t *leaseHeap_top(const LeaseHeap_t *heap)
+{
+    return heap->size > 0 ? &heap->timers[0] : NULL;
+}
+
+int leaseHeap_pop(LeaseHeap_t *heap, LeaseTimer_t *timer)
+{
+    int i = 0;
+    if (heap->size == 0)
+    {
+        return -1;
+    }
+    if (timer != NULL)
+    {
+        *timer = heap->timers[0];
+    }
+    heap->timers[0] = heap->timers[--heap->size];
+
+    // sift down
+    for (;;)
+    {
+        int smallest = i;
+        int left = 2 * i + 1;
+        int right = left + 1;
+        if (left < heap->size && heap->timers[left].when < heap->timers[smallest].when)
+        {
+            smallest = left;
+        }
+        if (right < heap->size && heap->timers[right].when < heap->timers[smallest].when)
+        {
+            smallest = right;
+        }
+        if (smallest == i)
+        {
+            break;
+        }
+        swap(&heap->timers[i], &heap->timers[smallest]);
+        i = smallest;
+    }
+    return 0;
+}
@@ -0,0 +1,88 @@
+/**
+ * @file upnp_pf_lease.h
+ * @brief Lease renewal schedule
+ * @details Min-heap of renewal deadlines of port mapping entries, so the
+ * daemon can sleep until the next entry needs to be renewed instead of waking
+ * up regularly and walking every rule.
+ * This is not thread safe
+ *
+ * @author Pham Ngoc Thang (thangdc94)
+ * @bug No known bug
+ */
+
+#ifndef __UPNP_PF_LEASE_H_
+#define __UPNP_PF_LEASE_H_
+
+#include <time.h>
+
+#include "mappingrule.h"
+
+/** A renewal deadline */
+typedef struct _LeaseTimer_t
+{
+    time_t when;               /**< monotonic time when entry must be renewed */
+    int eport;                 /**< external port of entry */
+    SupportedProtocol_t proto; /**< protocol of entry */
+} LeaseTimer_t;
+
+/** Min-heap of renewal deadlines, earliest first */
+typedef struct _LeaseHeap_t
+{
+    LeaseTimer_t *timers; /**< binary heap ordered by ::LeaseTimer_t::when */
+    int size;             /**< number of timers */
+    int capacity;         /**< allocated number of timers */
+} LeaseHeap_t;
+
+/**
+ * @brief Init lease heap
+ * @warning Need to call ::leaseHeap_destroy()
+ *
+ * @param[out] heap lease heap
+ */
+void leaseHeap_init(LeaseHeap_t *heap);
+
+/**
+ * @brief Destroy lease heap
+ * @details free memory of ::leaseHeap_init()
+ *
+ * @param[in] heap lease heap
+ */
+void leaseHeap_destroy(LeaseHeap_t *heap);
+
+/**
+ * @brief Remove all timers
+ *
+ * @param[in] heap lease heap
+ */
+void leaseHeap_clear(LeaseHeap_t *heap);
+
+/**
+ * @brief Add a timer
+ * @details Timers are never updated in place. A caller which reschedules an
+ * entry pushes a new timer and drops the old one when it's popped.
+ *
+ * @param[in] heap lease heap
+ * @param[in] timer timer to add
+ * @return 0 if OK and -1 if failed
+ */
+int leaseHeap_push(LeaseHeap_t *heap, const LeaseTimer_t *timer);
+
+/**
+ * @brief Get earliest timer
+ *
+ * @param[in] heap lease heap
+ * @return earliest timer or NULL if heap is empty. Pointer is only valid until
+ * the heap is modified.
+ */
+const LeaseTimer_t *leaseHeap_top(const LeaseHeap_t *heap);
+
+/**
+ * @brief Remove earliest timer
+ *
+ * @param[in] heap lease heap
+ * @param[out] timer removed timer, may be NULL
+ * @return 0 if OK and -1 if heap is empty
+ */
+int leaseHeap_pop(LeaseHeap_t *heap, LeaseTimer_t *timer);
+
+#endif //__UPNP_PF_LEASE_H_
@@ -0,0 +1,232 @@
+/**
+ * @file upnp_pf_minissdpd.c
+ * @brief Implement client of minissdpd
+ * @details Request is a type byte followed by a length encoded device type.
+ * Response is a device count byte followed by length encoded URL, type and
+ * USN of each device. Lengths are written 7 bits per byte, most significant
+ * first, with high bit set on all bytes but the last.
+ *
+ * @author Pham Ngoc Thang (thangdc94)
+ * @bug No known bug
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "upnp_pf_minissdpd.h"
+#include "logutil.h"
+
+/** Request devices matching a type */
+#define MINISSDPD_REQUEST_BY_TYPE 1
+
+/** Max size of a response */
+#define MAX_RESPONSE_SIZE 16384
+
+/**
+ * @brief Encode a length
+ *
+ * @param[in] n length
+ * @param[out] p output buffer, 5 bytes at most are written
+ * @return number of written bytes
+ */
+static int encode_length(unsigned int n, unsigned char *p)
+{
+    int len = 0;
+    int shift;
+    for (shift = 28; shift > 0; shift -= 7)
+    {
+        if (n >= (1u << shift))
+        {
+            p[len++] = ((n >> shift) & 0x7f) | 0x80;
+        }
+    }
+    p[len++] = n & 0x7f;
+    return len;
+}
+
+/**
+ * @brief Decode a length
+ *
+ * @param[in,out] p current position, moved after the length
+ * @param[in] end end of buffer
+ * @param[out] n length
+ * @return 0 if OK and -1 if buffer ends before length
+ */
+static int decode_length(const unsigned char **p, const unsigned char *end, unsigned int *n)
+{
+    *n = 0;
+    while (*p < end)
+    {
+        unsigned char c = *(*p)++;
+        *n = (*n << 7) | (c & 0x7f);
+        if (!(c & 0x80))
+        {
+            return 0;
+        }
+        if (*n >= (1u << 25))
+        {
+            return -1;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Read next length encoded string
+ *
+ * @param[in,out] p current position, moved after the string
+ * @param[in] end end of buffer
+ * @param[out] str start of string, not null terminated
+ * @param[out] len length of string
+ * @return 0 if OK and -1 if buffer ends before string
+ */
+static int read_string(const unsigned char **p, const unsigned char *end,
+                       const unsigned char **str, unsigned int *len)
+{
+    if (decode_length(p, end, len) != 0 || (unsigned int)(end - *p) < *len)
+    {
+        return -1;
+    }
+    *str = *p;
+    *p += *len;
+    return 0;
+}
+
+/**
+ * @brief Get current time in ms
+ *
+ * @return monotonic time in ms
+ */
+static long now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+}
+
+/**
+ * @brief Check if a response is complete
+ *
+ * @param[in] buf response
+ * @param[in] len size of response
+ * @return 1 (true) if all devices are in @p buf and 0 if not
+ */
+static int is_complete(const unsigned char *buf, int len)
+{
+    const unsigned char *p = buf + 1;
+    const unsigned char *end = buf + len;
+    int i;
+    if (len < 1)
+    {
+        return 0;
+    }
+    for (i = 0; i < buf[0] * 3; i++)
+    {
+        const unsigned char *str;
+        unsigned int n;
+        if (read_string(&p, end, &str, &n) != 0)
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int minissdpd_getDevices(const char *socketpath, const char *devtype, int timeout,
+                         char urls[][MINISSDPD_MAX_URL_SIZE], int max)
+{
+    int fd;
+    int i;
+    int len = 0;
+    int count = -1;
+    long deadline = now_ms() + timeout;
+    unsigned char request[256];
+    unsigned char *response = NULL;
+    const unsigned char *p;
+    unsigned int devtype_len = strlen(devtype);
+    struct sockaddr_un addr;
+
+    if (socketpath == NULL || strlen(socketpath) >= sizeof(addr.sun_path) ||
+        devtype_len + 6 > sizeof(request))
+    {
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socketpath);
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+    {
+        LOG(LOG_DBG, "minissdpd is not running on %s", socketpath);
+        goto out;
+    }
+
+    request[0] = MINISSDPD_REQUEST_BY_TYPE;
+    len = 1 + encode_length(devtype_len, request + 1);
+    memcpy(request + len, devtype, devtype_len);
+    len += devtype_len;
+    if (send(fd, request, len, MSG_NOSIGNAL) != len)
+    {
+        goto out;
+    }
+
+    // response has no length, read until all devices are received
+    response = malloc(MAX_RESPONSE_SIZE);
+    if (response == NULL)
+    {
+        goto out;
+    }
+    len = 0;
+    while (!is_complete(response, len))
+    {
+        int n;
+        struct pollfd pfd;
+        int wait = (int)(deadline - now_ms());
+        pfd.fd = fd;
+        pfd.events = POLLIN;
+        if (wait <= 0 || poll(&pfd, 1, wait) <= 0 || len == MAX_RESPONSE_SIZE)
+        {
+            LOG(LOG_WARN, "No complete answer from minissdpd");
+            goto out;
+        }
+        n = recv(fd, response + len, MAX_RESPONSE_SIZE - len, 0);
+        if (n <= 0)
+        {
+            goto out;
+        }
+        len += n;
+    }
+
+    count = 0;
+    p = response + 1;
+    for (i = 0; i < response[0]; i++)
+    {
+        const unsigned char *url;
+        const unsigned char *str;
+        unsigned int url_len;
+        unsigned int n;
+        read_string(&p, response + len, &url, &url_len); // location
+        read_string(&p, response + len, &str, &n);       // device type
+        read_string(&p, response + len, &str, &n);       // USN
+        if (count < max && url_len > 0 && url_len < MINISSDPD_MAX_URL_SIZE)
+        {
+            memcpy(urls[count], url, url_len);
+            urls[count][url_len] = '\0';
+            count++;
+        }
+    }
+out:
+    free(response);
+    close(fd);
+    return count;
+}
@@ -0,0 +1,35 @@
+/**
+ * @file upnp_pf_minissdpd.h
+ * @brief Client of minissdpd
+ * @details minissdpd listens to SSDP announcements and keeps a list of devices
+ * on the network. It's asked through a Unix socket, so devices are known
+ * without sending M-SEARCH and waiting for answers.
+ *
+ * @author Pham Ngoc Thang (thangdc94)
+ * @bug No known bug
+ */
+
+#ifndef __UPNP_PF_MINISSDPD_H_
+#define __UPNP_PF_MINISSDPD_H_
+
+/** Default socket path of minissdpd */
+#define MINISSDPD_SOCKET_DEFAULT "/var/run/minissdpd.sock"
+
+/** Max size of a description URL returned by ::minissdpd_getDevices() */
+#define MINISSDPD_MAX_URL_SIZE 256
+
+/**
+ * @brief Get devices known by minissdpd
+ * @details Ask minissdpd for devices whose type starts with @p devtype
+ *
+ * @param[in] socketpath socket path of minissdpd
+ * @param[in] devtype device type or prefix of it
+ * @param[in] timeout max time to wait for answer in ms
+ * @param[out] urls description URLs of devices
+ * @param[in] max max number of URLs
+ * @return number of devices or -1 if minissdpd didn't answer
+ */
+int minissdpd_getDevices(const char *socketpath, const char *devtype, int timeout,
+                         char urls[][MINISSDPD_MAX_URL_SIZE], int max);
+
+#endif //__UPNP_PF_MINISSDPD_H_
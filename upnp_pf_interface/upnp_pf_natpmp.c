@@ -0,0 +1,242 @@
+/**
+ * @file upnp_pf_natpmp.c
+ * @brief Implement NAT-PMP client
+ * @details Requests are retransmitted with doubling timeout until an answer
+ * with the expected opcode arrives. Answers come back to the source port of
+ * the request, so each request has its own connected UDP socket.
+ *
+ * @author Pham Ngoc Thang (thangdc94)
+ * @bug No known bug
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include "upnp_pf_natpmp.h"
+#include "logutil.h"
+
+/** Protocol version of NAT-PMP */
+#define NATPMP_VERSION 0
+
+/** Opcode to get external address */
+#define OPCODE_EXTERNAL_ADDRESS 0
+
+/** Opcode to map a UDP port */
+#define OPCODE_MAP_UDP 1
+
+/** Opcode to map a TCP port */
+#define OPCODE_MAP_TCP 2
+
+/** Answer opcode is request opcode plus this */
+#define OPCODE_ANSWER 128
+
+/** Size of a map request */
+#define MAP_REQUEST_SIZE 12
+
+/** Size of an external address answer */
+#define EXTERNAL_ADDRESS_ANSWER_SIZE 12
+
+/** Size of a map answer */
+#define MAP_ANSWER_SIZE 16
+
+/**
+ * @brief Read a 16 bits big endian value
+ */
+static uint16_t get16(const unsigned char *p)
+{
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+/**
+ * @brief Read a 32 bits big endian value
+ */
+static uint32_t get32(const unsigned char *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+/**
+ * @brief Write a 16 bits big endian value
+ */
+static void put16(unsigned char *p, uint16_t v)
+{
+    p[0] = v >> 8;
+    p[1] = v & 0xff;
+}
+
+/**
+ * @brief Write a 32 bits big endian value
+ */
+static void put32(unsigned char *p, uint32_t v)
+{
+    put16(p, v >> 16);
+    put16(p + 2, v & 0xffff);
+}
+
+/**
+ * @brief Send a request and wait for its answer
+ *
+ * @param[in] np gateway
+ * @param[in] request request
+ * @param[in] request_len size of request
+ * @param[out] answer answer
+ * @param[in] answer_len expected size of answer
+ * @return ::NatPmpResult_t
+ */
+static int transact(const NatPmp_t *np, const unsigned char *request, int request_len,
+                    unsigned char *answer, int answer_len)
+{
+    int fd;
+    int try;
+    int timeout = NATPMP_INITIAL_TIMEOUT;
+    int ret = NATPMP_TIMEOUT;
+
+    fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+    {
+        return NATPMP_TIMEOUT;
+    }
+    if (connect(fd, (const struct sockaddr *)&np->addr, sizeof(np->addr)) != 0)
+    {
+        close(fd);
+        return NATPMP_TIMEOUT;
+    }
+
+    for (try = 0; try < np->max_tries && ret == NATPMP_TIMEOUT; try++, timeout *= 2)
+    {
+        struct pollfd pfd;
+        pfd.fd = fd;
+        pfd.events = POLLIN;
+        if (send(fd, request, request_len, 0) != request_len)
+        {
+            break;
+        }
+        // ignore answers of other requests, e.g. late answer of a previous try
+        while (poll(&pfd, 1, timeout) > 0)
+        {
+            int n = recv(fd, answer, answer_len, 0);
+            if (n >= 4 && answer[0] == NATPMP_VERSION &&
+                answer[1] == request[1] + OPCODE_ANSWER)
+            {
+                ret = get16(answer + 2);
+                if (ret == NATPMP_SUCCESS && n < answer_len)
+                {
+                    ret = NATPMP_UNSUPPORTED_VERSION;
+                }
+                break;
+            }
+            if (n < 0)
+            {
+                // ICMP port unreachable, gateway doesn't speak NAT-PMP
+                try = np->max_tries;
+                break;
+            }
+        }
+    }
+    close(fd);
+    return ret;
+}
+
+int natpmp_init(NatPmp_t *np, const char *gateway, int port)
+{
+    int fd;
+    struct sockaddr_in local;
+    socklen_t local_len = sizeof(local);
+
+    memset(np, 0, sizeof(NatPmp_t));
+    np->addr.sin_family = AF_INET;
+    np->addr.sin_port = htons(port);
+    np->max_tries = NATPMP_MAX_TRIES;
+    if (inet_pton(AF_INET, gateway, &np->addr.sin_addr) != 1)
+    {
+        return -1;
+    }
+
+    // connecting a UDP socket sends nothing but tells which address is used
+    fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    if (connect(fd, (struct sockaddr *)&np->addr, sizeof(np->addr)) != 0 ||
+        getsockname(fd, (struct sockaddr *)&local, &local_len) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    close(fd);
+    inet_ntop(AF_INET, &local.sin_addr, np->lanaddr, sizeof(np->lanaddr));
+    return 0;
+}
+
+int natpmp_getExternalAddress(const NatPmp_t *np, char *extip)
+{
+    unsigned char request[2] = {NATPMP_VERSION, OPCODE_EXTERNAL_ADDRESS};
+    unsigned char answer[EXTERNAL_ADDRESS_ANSWER_SIZE];
+    int r = transact(np, request, sizeof(request), answer, sizeof(answer));
+    if (r == NATPMP_SUCCESS)
+    {
+        inet_ntop(AF_INET, answer + 8, extip, 16);
+    }
+    return r;
+}
+
+int natpmp_map(const NatPmp_t *np, int tcp, int iport, int eport, long lifetime,
+               int *mapped_eport, long *mapped_lifetime)
+{
+    unsigned char request[MAP_REQUEST_SIZE];
+    unsigned char answer[MAP_ANSWER_SIZE];
+    int r;
+
+    request[0] = NATPMP_VERSION;
+    request[1] = tcp ? OPCODE_MAP_TCP : OPCODE_MAP_UDP;
+    put16(request + 2, 0); // reserved
+    put16(request + 4, iport);
+    put16(request + 6, lifetime > 0 ? eport : 0);
+    put32(request + 8, lifetime);
+    r = transact(np, request, sizeof(request), answer, sizeof(answer));
+    if (r == NATPMP_SUCCESS)
+    {
+        if (get16(answer + 8) != iport)
+        {
+            return NATPMP_UNSUPPORTED_VERSION;
+        }
+        if (mapped_eport != NULL)
+        {
+            *mapped_eport = get16(answer + 10);
+        }
+        if (mapped_lifetime != NULL)
+        {
+            *mapped_lifetime = get32(answer + 12);
+        }
+    }
+    else
+    {
+        LOG(LOG_DBG, "NAT-PMP map %s %d->%d returned %d", tcp ? "TCP" : "UDP", eport, iport, r);
+    }
+    return r;
+}
+
+int natpmp_addPort(NatPmpPorts_t *ports, int tcp, int iport)
+{
+    if (iport <= 0 || iport > 65535 || natpmp_hasPort(ports, tcp, iport))
+    {
+        return 0;
+    }
+    ports->bits[tcp ? 1 : 0][iport / 8] |= 1 << (iport % 8);
+    return 1;
+}
+
+int natpmp_hasPort(const NatPmpPorts_t *ports, int tcp, int iport)
+{
+    if (iport <= 0 || iport > 65535)
+    {
+        return 0;
+    }
+    return (ports->bits[tcp ? 1 : 0][iport / 8] >> (iport % 8)) & 1;
+}
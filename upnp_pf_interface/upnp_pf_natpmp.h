@@ -0,0 +1,114 @@
+/**
+ * @file upnp_pf_natpmp.h
+ * @brief NAT-PMP client
+ * @details NAT Port Mapping Protocol (RFC 6886). A mapping is one small UDP
+ * request and answer to port 5351 of the gateway, without HTTP or XML. Each
+ * request uses its own socket, so requests may be sent from several threads
+ * at the same time.
+ *
+ * @author Pham Ngoc Thang (thangdc94)
+ * @bug No known bug
+ */
+
+#ifndef __UPNP_PF_NATPMP_H_
+#define __UPNP_PF_NATPMP_H_
+
+#include <netinet/in.h>
+
+/** NAT-PMP server port of gateway */
+#define NATPMP_PORT 5351
+
+/** First retransmission timeout in ms, doubled after each try */
+#define NATPMP_INITIAL_TIMEOUT 250
+
+/** Default number of tries of a request */
+#define NATPMP_MAX_TRIES 4
+
+/** Result codes of NAT-PMP */
+typedef enum _NatPmpResult_t
+{
+    NATPMP_TIMEOUT = -1,            /**< no answer from gateway */
+    NATPMP_SUCCESS = 0,             /**< success */
+    NATPMP_UNSUPPORTED_VERSION = 1, /**< unsupported version */
+    NATPMP_NOT_AUTHORIZED = 2,      /**< not authorized or refused */
+    NATPMP_NETWORK_FAILURE = 3,     /**< gateway has no external address */
+    NATPMP_OUT_OF_RESOURCES = 4,    /**< no more mapping can be created */
+    NATPMP_UNSUPPORTED_OPCODE = 5,  /**< unsupported opcode */
+} NatPmpResult_t;
+
+/**
+ * Set of internal ports and protocols. NAT-PMP keys a mapping by them, so two
+ * mappings with the same internal port and protocol replace each other on
+ * the gateway. A zeroed set is empty.
+ */
+typedef struct _NatPmpPorts_t
+{
+    unsigned char bits[2][65536 / 8]; /**< one bit per port, [0] for UDP and [1] for TCP */
+} NatPmpPorts_t;
+
+/** NAT-PMP gateway */
+typedef struct _NatPmp_t
+{
+    struct sockaddr_in addr; /**< address of NAT-PMP server */
+    char lanaddr[16];        /**< my ip address towards gateway */
+    int max_tries;           /**< number of tries of a request */
+} NatPmp_t;
+
+/**
+ * @brief Init NAT-PMP gateway
+ *
+ * @param[out] np gateway
+ * @param[in] gateway ipv4 address of gateway
+ * @param[in] port server port, ::NATPMP_PORT except in tests
+ * @return 0 if OK and -1 if address is not valid or not routable
+ */
+int natpmp_init(NatPmp_t *np, const char *gateway, int port);
+
+/**
+ * @brief Get external address of gateway
+ * @details Also used to check that gateway speaks NAT-PMP
+ *
+ * @param[in] np gateway
+ * @param[out] extip external ip address, at least 16 bytes
+ * @return ::NatPmpResult_t
+ */
+int natpmp_getExternalAddress(const NatPmp_t *np, char *extip);
+
+/**
+ * @brief Create, renew or delete a mapping
+ * @details Mapping is deleted when @p lifetime is 0. All mappings of this
+ * client for the protocol are deleted when @p iport is 0 too.
+ *
+ * @param[in] np gateway
+ * @param[in] tcp 1 for TCP and 0 for UDP
+ * @param[in] iport internal port
+ * @param[in] eport suggested external port
+ * @param[in] lifetime requested lifetime in seconds
+ * @param[out] mapped_eport external port given by gateway, may be NULL
+ * @param[out] mapped_lifetime lifetime given by gateway, may be NULL
+ * @return ::NatPmpResult_t
+ */
+int natpmp_map(const NatPmp_t *np, int tcp, int iport, int eport, long lifetime,
+               int *mapped_eport, long *mapped_lifetime);
+
+/**
+ * @brief Add an internal port to a set
+ *
+ * @param[in,out] ports set of internal ports
+ * @param[in] tcp 1 for TCP and 0 for UDP
+ * @param[in] iport internal port
+ * @return 1 (true) if it's added, 0 if it's already in set or not a valid port
+ */
+int natpmp_addPort(NatPmpPorts_t *ports, int tcp, int iport);
+
+/**
+ * @brief Check if an internal port is in a set
+ *
+ * @param[in] ports set of internal ports
+ * @param[in] tcp 1 for TCP and 0 for UDP
+ * @param[in] iport internal port
+ * @return 1 (true) if it's in set, 0 if not
+ */
+int natpmp_hasPort(const NatPmpPorts_t *ports, int tcp, int iport);
+
+#endif //__UPNP_PF_NATPMP_H_
@@ -0,0 +1,254 @@
+/**
+ * @file upnp_pf_ratelimit.c
+ * @brief Implement adaptive rate limiter of requests to a gateway
+ * @details Waiting requests sleep on a condition variable with a monotonic
+ * clock, they are woken when a request is done or at the time the next token
+ * or the end of back-off is due.
+ *
+ * @author Pham Ngoc Thang (thangdc94)
+ * @bug No known bug
+ */
+
+#include <stdlib.h>
+#include <time.h>
+
+#include "upnp_pf_ratelimit.h"
+
+/**
+ * @brief Get monotonic time in us
+ */
+static long long now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+/**
+ * @brief Add tokens earned since last refill
+ *
+ * @param[in] rl rate limiter
+ * @param[in] now current time in us
+ */
+static void refill(RateLimiter_t *rl, long long now)
+{
+    if (rl->max_rate > 0)
+    {
+        rl->tokens += (now - rl->refilled) * rl->rate / 1000000.0;
+        if (rl->tokens > rl->burst)
+        {
+            rl->tokens = rl->burst;
+        }
+    }
+    rl->refilled = now;
+}
+
+/**
+ * @brief Halve concurrency limit and optionally rate
+ * @details At most once per round trip, so replies of requests sent before
+ * the decrease don't decrease it again
+ *
+ * @param[in] rl rate limiter
+ * @param[in] now current time in us
+ * @param[in] with_rate 1 to also halve the rate
+ */
+static void decrease(RateLimiter_t *rl, long long now, int with_rate)
+{
+    if (now - rl->decreased < rl->latency)
+    {
+        return;
+    }
+    rl->decreased = now;
+    rl->limit = (rl->limit / 2 > 1) ? rl->limit / 2 : 1;
+    if (with_rate && rl->max_rate > 0)
+    {
+        rl->rate = (rl->rate / 2 > RATE_LIMIT_MIN_RATE) ? rl->rate / 2 : RATE_LIMIT_MIN_RATE;
+    }
+}
+
+/**
+ * @brief Grow concurrency limit by one per round trip and rate by one per second
+ *
+ * @param[in] rl rate limiter
+ */
+static void increase(RateLimiter_t *rl)
+{
+    rl->limit += 1 / rl->limit;
+    if (rl->limit > rl->max_limit)
+    {
+        rl->limit = rl->max_limit;
+    }
+    if (rl->max_rate > 0)
+    {
+        rl->rate += 1 / rl->rate;
+        if (rl->rate > rl->max_rate)
+        {
+            rl->rate = rl->max_rate;
+        }
+    }
+}
+
+int rateLimiter_init(RateLimiter_t *rl, double max_rate, int burst, int max_limit)
+{
+    pthread_condattr_t attr;
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    if (pthread_cond_init(&rl->cond, &attr) != 0)
+    {
+        pthread_condattr_destroy(&attr);
+        return -1;
+    }
+    pthread_condattr_destroy(&attr);
+    pthread_mutex_init(&rl->lock, NULL);
+
+    rl->max_rate = max_rate;
+    rl->rate = max_rate;
+    rl->burst = (burst > 0) ? burst : 1;
+    rl->tokens = rl->burst;
+    rl->refilled = now_us();
+    rl->max_limit = (max_limit > 0) ? max_limit : 1;
+    rl->limit = 1;
+    rl->in_flight = 0;
+    rl->latency = 0;
+    rl->base_latency = 0;
+    rl->decreased = 0;
+    rl->failures = 0;
+    rl->backoff_until = 0;
+    rl->num_of_requests = 0;
+    rl->num_of_errors = 0;
+    return 0;
+}
+
+void rateLimiter_destroy(RateLimiter_t *rl)
+{
+    pthread_cond_destroy(&rl->cond);
+    pthread_mutex_destroy(&rl->lock);
+}
+
+void rateLimiter_setLimits(RateLimiter_t *rl, double max_rate, int max_limit)
+{
+    pthread_mutex_lock(&rl->lock);
+    refill(rl, now_us());
+    if (rl->max_rate <= 0 || rl->rate > max_rate)
+    {
+        rl->rate = max_rate;
+    }
+    rl->max_rate = max_rate;
+    rl->max_limit = (max_limit > 0) ? max_limit : 1;
+    if (rl->limit > rl->max_limit)
+    {
+        rl->limit = rl->max_limit;
+    }
+    pthread_cond_broadcast(&rl->cond);
+    pthread_mutex_unlock(&rl->lock);
+}
+
+long long rateLimiter_acquire(RateLimiter_t *rl)
+{
+    long long now;
+
+    pthread_mutex_lock(&rl->lock);
+    for (;;)
+    {
+        long long wake = 0;
+        struct timespec ts;
+
+        now = now_us();
+        refill(rl, now);
+        if (now < rl->backoff_until)
+        {
+            wake = rl->backoff_until;
+        }
+        else if (rl->in_flight >= (int)rl->limit)
+        {
+            pthread_cond_wait(&rl->cond, &rl->lock);
+            continue;
+        }
+        else if (rl->max_rate > 0 && rl->tokens < 1)
+        {
+            wake = now + (long long)((1 - rl->tokens) * 1000000.0 / rl->rate) + 1;
+        }
+        else
+        {
+            break;
+        }
+        ts.tv_sec = wake / 1000000;
+        ts.tv_nsec = (wake % 1000000) * 1000;
+        pthread_cond_timedwait(&rl->cond, &rl->lock, &ts);
+    }
+    if (rl->max_rate > 0)
+    {
+        rl->tokens -= 1;
+    }
+    rl->in_flight++;
+    rl->num_of_requests++;
+    pthread_mutex_unlock(&rl->lock);
+    return now;
+}
+
+void rateLimiter_release(RateLimiter_t *rl, long long start, int failed)
+{
+    long long now = now_us();
+    long long sample = now - start;
+
+    pthread_mutex_lock(&rl->lock);
+    rl->in_flight--;
+    if (failed)
+    {
+        int shift = (rl->failures < 16) ? rl->failures : 16;
+        long long backoff = (long long)RATE_LIMIT_BACKOFF_BASE << shift;
+        if (backoff > RATE_LIMIT_BACKOFF_MAX)
+        {
+            backoff = RATE_LIMIT_BACKOFF_MAX;
+        }
+        // jitter, so requests waiting together are not sent together again
+        backoff = backoff / 2 + random() % (backoff / 2 + 1);
+        rl->failures++;
+        rl->num_of_errors++;
+        rl->backoff_until = now + backoff * 1000;
+        decrease(rl, now, 1);
+    }
+    else
+    {
+        rl->failures = 0;
+        rl->latency = rl->latency ? (7 * rl->latency + sample) / 8 : sample;
+        if (rl->base_latency == 0 || sample < rl->base_latency)
+        {
+            rl->base_latency = sample;
+        }
+        else
+        {
+            // follow a path which became slower for good
+            rl->base_latency += (sample - rl->base_latency) / 256;
+        }
+        if (sample > rl->base_latency * RATE_LIMIT_LATENCY_TOLERANCE + RATE_LIMIT_LATENCY_SLACK)
+        {
+            decrease(rl, now, 0);
+        }
+        else
+        {
+            increase(rl);
+        }
+    }
+    pthread_cond_broadcast(&rl->cond);
+    pthread_mutex_unlock(&rl->lock);
+}
+
+void rateLimiter_getStats(RateLimiter_t *rl, RateLimitStats_t *stats)
+{
+    long long now = now_us();
+
+    pthread_mutex_lock(&rl->lock);
+    stats->rate = rl->max_rate > 0 ? rl->rate : 0;
+    stats->max_rate = rl->max_rate;
+    stats->limit = rl->limit;
+    stats->max_limit = rl->max_limit;
+    stats->in_flight = rl->in_flight;
+    stats->latency_us = rl->latency;
+    stats->base_latency_us = rl->base_latency;
+    stats->backoff_ms = (rl->backoff_until > now) ? (rl->backoff_until - now) / 1000 : 0;
+    stats->num_of_requests = rl->num_of_requests;
+    stats->num_of_errors = rl->num_of_errors;
+    pthread_mutex_unlock(&rl->lock);
+}
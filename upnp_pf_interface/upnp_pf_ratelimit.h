@@ -0,0 +1,133 @@
+/**
+ * @file upnp_pf_ratelimit.h
+ * @brief Adaptive rate limiter of requests to a gateway
+ * @details Consumer routers stop answering when they get bursts of requests.
+ * Requests to a gateway take a token from a token bucket and a slot of an
+ * AIMD (additive increase, multiplicative decrease) concurrency limit:
+ *   - while latency stays close to the lowest latency seen, the limit grows
+ *     by one request per round trip and the rate by one request per second
+ *   - when latency grows, requests are queueing on gateway and the limit is
+ *     halved
+ *   - on errors and timeouts the limit and the rate are halved and requests
+ *     wait an exponential back-off with jitter
+ * This is thread safe
+ *
+ * @author Pham Ngoc Thang (thangdc94)
+ * @bug No known bug
+ */
+
+#ifndef __UPNP_PF_RATELIMIT_H_
+#define __UPNP_PF_RATELIMIT_H_
+
+#include <pthread.h>
+
+/** Lowest request rate per second after decreases */
+#define RATE_LIMIT_MIN_RATE 1.0
+
+/** Latency above this times the lowest latency means requests are queueing */
+#define RATE_LIMIT_LATENCY_TOLERANCE 2
+
+/** Latency in us always tolerated above the lowest latency, hides jitter of fast gateways */
+#define RATE_LIMIT_LATENCY_SLACK 1000
+
+/** First back-off in ms after an error */
+#define RATE_LIMIT_BACKOFF_BASE 100
+
+/** Max back-off in ms */
+#define RATE_LIMIT_BACKOFF_MAX 10000
+
+/** Rate limiter of one gateway */
+typedef struct _RateLimiter_t
+{
+    pthread_mutex_t lock;        /**< protect all fields */
+    pthread_cond_t cond;         /**< signaled when a request is done */
+    double max_rate;             /**< max requests per second, 0 for no limit */
+    double rate;                 /**< current requests per second */
+    double burst;                /**< size of token bucket */
+    double tokens;               /**< tokens in bucket */
+    long long refilled;          /**< time of last refill in us */
+    int max_limit;               /**< max requests in flight */
+    double limit;                /**< current max requests in flight */
+    int in_flight;               /**< requests in flight */
+    long long latency;           /**< smoothed latency in us */
+    long long base_latency;      /**< lowest latency in us, slowly follows latency up */
+    long long decreased;         /**< time of last decrease in us */
+    int failures;                /**< number of errors in a row */
+    long long backoff_until;     /**< no request is sent before this time in us */
+    unsigned long num_of_requests; /**< number of requests */
+    unsigned long num_of_errors;   /**< number of errors and timeouts */
+} RateLimiter_t;
+
+/** Current limits of a rate limiter */
+typedef struct _RateLimitStats_t
+{
+    double rate;                 /**< current requests per second, 0 for no limit */
+    double max_rate;             /**< max requests per second, 0 for no limit */
+    double limit;                /**< current max requests in flight */
+    int max_limit;               /**< max requests in flight */
+    int in_flight;               /**< requests in flight */
+    long long latency_us;        /**< smoothed latency */
+    long long base_latency_us;   /**< lowest latency */
+    long long backoff_ms;        /**< remaining back-off */
+    unsigned long num_of_requests; /**< number of requests */
+    unsigned long num_of_errors;   /**< number of errors and timeouts */
+} RateLimitStats_t;
+
+/**
+ * @brief Init rate limiter
+ * @details Limiter starts with full rate and one request in flight
+ * @warning Need to call ::rateLimiter_destroy()
+ *
+ * @param[out] rl rate limiter
+ * @param[in] max_rate max requests per second, 0 for no limit
+ * @param[in] burst number of requests which can be sent at once after a pause
+ * @param[in] max_limit max requests in flight
+ * @return 0 if OK and -1 if failed
+ */
+int rateLimiter_init(RateLimiter_t *rl, double max_rate, int burst, int max_limit);
+
+/**
+ * @brief Destroy rate limiter
+ *
+ * @param[in] rl rate limiter
+ */
+void rateLimiter_destroy(RateLimiter_t *rl);
+
+/**
+ * @brief Change max rate and max requests in flight
+ *
+ * @param[in] rl rate limiter
+ * @param[in] max_rate max requests per second, 0 for no limit
+ * @param[in] max_limit max requests in flight
+ */
+void rateLimiter_setLimits(RateLimiter_t *rl, double max_rate, int max_limit);
+
+/**
+ * @brief Wait until a request can be sent
+ * @details Wait for back-off, a free slot and a token
+ * @warning Need to call ::rateLimiter_release() when request is done
+ *
+ * @param[in] rl rate limiter
+ * @return time in us when request starts, pass it to ::rateLimiter_release()
+ */
+long long rateLimiter_acquire(RateLimiter_t *rl);
+
+/**
+ * @brief Report end of a request
+ * @details Adapt limits to latency and result of request
+ *
+ * @param[in] rl rate limiter
+ * @param[in] start value returned by ::rateLimiter_acquire()
+ * @param[in] failed 1 if gateway didn't answer or failed because it's overloaded, 0 if not
+ */
+void rateLimiter_release(RateLimiter_t *rl, long long start, int failed);
+
+/**
+ * @brief Get current limits
+ *
+ * @param[in] rl rate limiter
+ * @param[out] stats current limits
+ */
+void rateLimiter_getStats(RateLimiter_t *rl, RateLimitStats_t *stats);
+
+#endif //__UPNP_PF_RATELIMIT_H_
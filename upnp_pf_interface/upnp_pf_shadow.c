@@ -0,0 +1,268 @@
+/**
+ * @file upnp_pf_shadow.c
+ * @brief Implement shadow copy of Router Port Mapping table
+ * @details Entries are kept in an array sorted by (protocol, external port)
+ * so lookups are done with binary search.
+ *
+ * @author Pham Ngoc Thang (thangdc94)
+ * @bug No known bug
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "upnp_pf_shadow.h"
+
+/** Initial capacity of shadow table */
+#define SHADOW_INIT_CAPACITY 16
+
+/**
+ * @brief Compare an entry with a key
+ * @details Order by protocol first, then by external port number
+ *
+ * @param[in] entry shadow entry
+ * @param[in] port external port number
+ * @param[in] proto protocol
+ * @return < 0, 0 or > 0 if entry is less than, equal or greater than the key
+ */
+static int compare_key(const ShadowEntry_t *entry, int port, SupportedProtocol_t proto)
+{
+    if (entry->rule.proto != proto)
+    {
+        return (int)entry->rule.proto - (int)proto;
+    }
+    return atoi(entry->rule.eport) - port;
+}
+
+/**
+ * @brief Search position of a key
+ * @details Binary search position of a key in the sorted array
+ *
+ * @param[in] table shadow table
+ * @param[in] port external port number
+ * @param[in] proto protocol
+ * @param[out] found 1 if key is in the table and 0 if not
+ * @return index of the entry if found or index where it should be inserted
+ */
+static int search(ShadowTable_t *table, int port, SupportedProtocol_t proto, int *found)
+{
+    int low = 0;
+    int high = table->size - 1;
+    while (low <= high)
+    {
+        int mid = (low + high) / 2;
+        int cmp = compare_key(&table->entries[mid], port, proto);
+        if (cmp == 0)
+        {
+            *found = 1;
+            return mid;
+        }
+        if (cmp < 0)
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid - 1;
+        }
+    }
+    *found = 0;
+    return low;
+}
+
+/**
+ * @brief Find entry of a renewal timer
+ *
+ * @param[in] table shadow table
+ * @param[in] timer renewal timer
+ * @return entry or NULL if entry was removed or rescheduled since timer was added
+ */
+static ShadowEntry_t *timer_entry(ShadowTable_t *table, const LeaseTimer_t *timer)
+{
+    int found;
+    int pos = search(table, timer->eport, timer->proto, &found);
+    if (!found || table->entries[pos].renew != timer->when)
+    {
+        return NULL;
+    }
+    return &table->entries[pos];
+}
+
+/**
+ * @brief Add renewal timer of an entry
+ * @details Heap is rebuilt from entries when it holds too many stale timers
+ *
+ * @param[in] table shadow table
+ * @param[in] entry entry with a renewal time
+ * @return 0 if OK and -1 if failed
+ */
+static int schedule_renew(ShadowTable_t *table, const ShadowEntry_t *entry)
+{
+    LeaseTimer_t timer;
+    int i;
+
+    if (table->renewals.size > 2 * table->size + SHADOW_INIT_CAPACITY)
+    {
+        leaseHeap_clear(&table->renewals);
+        for (i = 0; i < table->size; i++)
+        {
+            if (table->entries[i].renew != 0 && &table->entries[i] != entry)
+            {
+                timer.when = table->entries[i].renew;
+                timer.eport = atoi(table->entries[i].rule.eport);
+                timer.proto = table->entries[i].rule.proto;
+                leaseHeap_push(&table->renewals, &timer);
+            }
+        }
+    }
+    timer.when = entry->renew;
+    timer.eport = atoi(entry->rule.eport);
+    timer.proto = entry->rule.proto;
+    return leaseHeap_push(&table->renewals, &timer);
+}
+
+time_t shadowTable_now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
+}
+
+void shadowTable_init(ShadowTable_t *table)
+{
+    table->entries = NULL;
+    table->size = 0;
+    table->capacity = 0;
+    table->is_valid = 0;
+    table->verified = 0;
+    leaseHeap_init(&table->renewals);
+}
+
+void shadowTable_destroy(ShadowTable_t *table)
+{
+    free(table->entries);
+    leaseHeap_destroy(&table->renewals);
+    shadowTable_init(table);
+}
+
+void shadowTable_clear(ShadowTable_t *table)
+{
+    table->size = 0;
+    table->is_valid = 0;
+    leaseHeap_clear(&table->renewals);
+}
+
+void shadowTable_setVerified(ShadowTable_t *table)
+{
+    table->is_valid = 1;
+    table->verified = shadowTable_now();
+}
+
+void shadowTable_invalidate(ShadowTable_t *table)
+{
+    table->is_valid = 0;
+}
+
+int shadowTable_needVerify(ShadowTable_t *table, int interval)
+{
+    return !table->is_valid || (shadowTable_now() - table->verified >= interval);
+}
+
+ShadowEntry_t *shadowTable_find(ShadowTable_t *table, const char *eport, SupportedProtocol_t proto)
+{
+    int found;
+    int pos = search(table, atoi(eport), proto, &found);
+    return found ? &table->entries[pos] : NULL;
+}
+
+int shadowTable_put(ShadowTable_t *table, const MappingRule_t *rule, const char *intClient, long lease)
+{
+    int found;
+    int pos = search(table, atoi(rule->eport), rule->proto, &found);
+    if (!found)
+    {
+        if (table->size == table->capacity)
+        {
+            int capacity = table->capacity ? table->capacity * 2 : SHADOW_INIT_CAPACITY;
+            ShadowEntry_t *entries = realloc(table->entries, capacity * sizeof(ShadowEntry_t));
+            if (entries == NULL)
+            {
+                return -1;
+            }
+            table->entries = entries;
+            table->capacity = capacity;
+        }
+        memmove(&table->entries[pos + 1], &table->entries[pos],
+                (table->size - pos) * sizeof(ShadowEntry_t));
+        table->size++;
+    }
+    ShadowEntry_t *entry = &table->entries[pos];
+    entry->rule = *rule;
+    strncpy(entry->intClient, intClient, sizeof(entry->intClient) - 1);
+    entry->intClient[sizeof(entry->intClient) - 1] = '\0';
+    entry->expire = 0;
+    entry->renew = 0;
+    if (lease > 0)
+    {
+        time_t now = shadowTable_now();
+        entry->expire = now + lease;
+        entry->renew = entry->expire - lease / SHADOW_RENEW_DIVISOR -
+                       random() % (lease / SHADOW_RENEW_JITTER_DIVISOR + 1);
+        if (entry->renew <= now)
+        {
+            entry->renew = now + 1;
+        }
+        return schedule_renew(table, entry);
+    }
+    return 0;
+}
+
+void shadowTable_remove(ShadowTable_t *table, const char *eport, SupportedProtocol_t proto)
+{
+    int found;
+    int pos = search(table, atoi(eport), proto, &found);
+    if (found)
+    {
+        memmove(&table->entries[pos], &table->entries[pos + 1],
+                (table->size - pos - 1) * sizeof(ShadowEntry_t));
+        table->size--;
+    }
+}
+
+time_t shadowTable_nextRenew(ShadowTable_t *table)
+{
+    const LeaseTimer_t *timer;
+    while ((timer = leaseHeap_top(&table->renewals)) != NULL)
+    {
+        if (timer_entry(table, timer) != NULL)
+        {
+            return timer->when;
+        }
+        leaseHeap_pop(&table->renewals, NULL); // stale
+    }
+    return 0;
+}
+
+int shadowTable_popDue(ShadowTable_t *table, time_t now, MappingRule_t rules[], int max_rules)
+{
+    const LeaseTimer_t *timer;
+    int num_of_rules = 0;
+    while (num_of_rules < max_rules && (timer = leaseHeap_top(&table->renewals)) != NULL &&
+           timer->when <= now)
+    {
+        ShadowEntry_t *entry = timer_entry(table, timer);
+        leaseHeap_pop(&table->renewals, NULL);
+        if (entry != NULL)
+        {
+            entry->renew = 0;
+            rules[num_of_rules++] = entry->rule;
+        }
+    }
+    return num_of_rules;
+}
+
+int shadowTable_setRenew(ShadowTable_t *table, ShadowEntry_t *entry, time_t when)
+{
+    entry->renew = when;
+    return schedule_renew(table, entry);
+}
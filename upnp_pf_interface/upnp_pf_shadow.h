@@ -0,0 +1,181 @@
+/**
+ * @file upnp_pf_shadow.h
+ * @brief Shadow copy of Router Port Mapping table
+ * @details Keep an in-memory copy of our port mapping entries on Router so
+ * we don't need to walk the whole Router table for every request.
+ * This is not thread safe
+ *
+ * @author Pham Ngoc Thang (thangdc94)
+ * @bug No known bug
+ */
+
+#ifndef __UPNP_PF_SHADOW_H_
+#define __UPNP_PF_SHADOW_H_
+
+#include <time.h>
+
+#include "mappingrule.h"
+#include "upnp_pf_lease.h"
+
+/** Default interval in seconds between two full verifications of shadow table */
+#define SHADOW_VERIFY_INTERVAL 3600 // 1 hour
+
+/** An entry is renewed when 1/SHADOW_RENEW_DIVISOR of its lease is left */
+#define SHADOW_RENEW_DIVISOR 4
+
+/** Entries are renewed earlier by a random time up to 1/SHADOW_RENEW_JITTER_DIVISOR of their lease */
+#define SHADOW_RENEW_JITTER_DIVISOR 8
+
+/** An entry of shadow table */
+typedef struct _ShadowEntry_t
+{
+    MappingRule_t rule; /**< external port, internal port and protocol */
+    char intClient[40]; /**< internal client ip address */
+    time_t expire;      /**< monotonic time when lease expires, 0 means never expire */
+    time_t renew;       /**< monotonic time when lease must be renewed, 0 if not scheduled */
+} ShadowEntry_t;
+
+/** Shadow table keyed by (external port, protocol) */
+typedef struct _ShadowTable_t
+{
+    ShadowEntry_t *entries; /**< entries sorted by protocol then external port */
+    int size;               /**< number of entries */
+    int capacity;           /**< allocated number of entries */
+    int is_valid;           /**< 1 if table is in sync with Router, 0 if it need to be verified */
+    time_t verified;        /**< monotonic time of last full verification */
+    LeaseHeap_t renewals;   /**< renewal deadlines, timers of removed or rescheduled entries are dropped when popped */
+} ShadowTable_t;
+
+/**
+ * @brief Get monotonic time
+ * @details Get current time in seconds from a clock which is not affected by
+ * system time changes
+ *
+ * @return current monotonic time in seconds
+ */
+time_t shadowTable_now();
+
+/**
+ * @brief Init shadow table
+ * @details Init an empty shadow table. It is invalid until it has been verified.
+ * @warning Need to call ::shadowTable_destroy()
+ *
+ * @param[out] table shadow table
+ */
+void shadowTable_init(ShadowTable_t *table);
+
+/**
+ * @brief Destroy shadow table
+ * @details free memory of ::shadowTable_init()
+ *
+ * @param[in] table shadow table
+ */
+void shadowTable_destroy(ShadowTable_t *table);
+
+/**
+ * @brief Remove all entries
+ * @details Remove all entries before loading a fresh copy from Router
+ *
+ * @param[in] table shadow table
+ */
+void shadowTable_clear(ShadowTable_t *table);
+
+/**
+ * @brief Mark shadow table as verified
+ * @details Call after all entries of Router have been loaded into table
+ *
+ * @param[in] table shadow table
+ */
+void shadowTable_setVerified(ShadowTable_t *table);
+
+/**
+ * @brief Mark shadow table as drifted
+ * @details Call when an error suggests the copy is not in sync with Router.
+ * Table will be verified again before next use.
+ *
+ * @param[in] table shadow table
+ */
+void shadowTable_invalidate(ShadowTable_t *table);
+
+/**
+ * @brief Check if shadow table need to be verified
+ * @details Check if shadow table is invalid or it was verified too long ago
+ *
+ * @param[in] table shadow table
+ * @param[in] interval verification interval in seconds
+ * @return 1 (true) if full verification is needed and 0 if not
+ */
+int shadowTable_needVerify(ShadowTable_t *table, int interval);
+
+/**
+ * @brief Find an entry
+ * @details Find an entry by its external port and protocol
+ *
+ * @param[in] table shadow table
+ * @param[in] eport external port
+ * @param[in] proto protocol
+ * @return pointer to entry or NULL if not found. Pointer is only valid until
+ * the table is modified.
+ */
+ShadowEntry_t *shadowTable_find(ShadowTable_t *table, const char *eport, SupportedProtocol_t proto);
+
+/**
+ * @brief Add or replace an entry
+ * @details Add an entry or replace the entry which has the same external port
+ * and protocol. An entry with a lease is scheduled for renewal when
+ * 1/::SHADOW_RENEW_DIVISOR of its lease is left, minus a random jitter so
+ * entries added together are not renewed together.
+ *
+ * @param[in] table shadow table
+ * @param[in] rule mapping rule
+ * @param[in] intClient internal client ip address
+ * @param[in] lease lease duration in seconds, 0 means never expire
+ * @return 0 if OK and -1 if failed
+ */
+int shadowTable_put(ShadowTable_t *table, const MappingRule_t *rule, const char *intClient, long lease);
+
+/**
+ * @brief Remove an entry
+ * @details Remove an entry by its external port and protocol
+ *
+ * @param[in] table shadow table
+ * @param[in] eport external port
+ * @param[in] proto protocol
+ */
+void shadowTable_remove(ShadowTable_t *table, const char *eport, SupportedProtocol_t proto);
+
+/**
+ * @brief Get time of next renewal
+ *
+ * @param[in] table shadow table
+ * @return monotonic time when the first entry must be renewed or 0 if no entry
+ * is scheduled
+ */
+time_t shadowTable_nextRenew(ShadowTable_t *table);
+
+/**
+ * @brief Take entries which must be renewed
+ * @details Unschedule entries which renewal time is up to @p now and copy
+ * their rules. They are scheduled again by ::shadowTable_put() once renewed or
+ * by ::shadowTable_setRenew() to retry.
+ *
+ * @param[in] table shadow table
+ * @param[in] now current monotonic time
+ * @param[out] rules array of rules, must be able to hold @p max_rules rules
+ * @param[in] max_rules max number of rules to take
+ * @return number of rules
+ */
+int shadowTable_popDue(ShadowTable_t *table, time_t now, MappingRule_t rules[], int max_rules);
+
+/**
+ * @brief Schedule renewal of an entry
+ * @details Replace renewal time of an entry, e.g. to retry a failed renewal
+ *
+ * @param[in] table shadow table
+ * @param[in] entry entry of @p table
+ * @param[in] when monotonic time of renewal
+ * @return 0 if OK and -1 if failed
+ */
+int shadowTable_setRenew(ShadowTable_t *table, ShadowEntry_t *entry, time_t when);
+
+#endif //__UPNP_PF_SHADOW_H_
@@ -0,0 +1,325 @@
+/**
+ * @file upnp_pf_simgw.c
+ * @brief Implement in-memory simulated gateway
+ * @details Entries are kept in insertion order like most IGDs do, so
+ * GetGenericPortMappingEntry indexes shift when an entry is deleted. Latency
+ * is spent outside of the lock, so concurrent calls overlap like requests on
+ * a real network.
+ *
+ * @author Pham Ngoc Thang (thangdc94)
+ * @bug No known bug
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "upnp_pf_simgw.h"
+
+/** External address answered by simulated gateway */
+#define SIM_EXTERNAL_ADDRESS "203.0.113.1"
+
+/**
+ * @brief Start a call
+ * @details Count the call, spend latency and take injected error if any
+ *
+ * @param[in] sim simulated gateway
+ * @param[in] action action
+ * @return 0 if call goes on or error code
+ */
+static int begin_call(SimGateway_t *sim, SoapAction_t action)
+{
+    int code = 0;
+
+    pthread_mutex_lock(&sim->mutex);
+    sim->num_of_calls[action]++;
+    if (sim->error_count[action] > 0)
+    {
+        sim->error_count[action]--;
+        code = sim->error_code[action];
+    }
+    pthread_mutex_unlock(&sim->mutex);
+
+    if (sim->cfg.latency_us > 0)
+    {
+        usleep(sim->cfg.latency_us);
+    }
+    if (code == SIM_TIMEOUT)
+    {
+        usleep(sim->cfg.timeout_ms * 1000);
+        return UPNPCOMMAND_HTTP_ERROR;
+    }
+    return code;
+}
+
+/**
+ * @brief Find an entry
+ * @warning Lock must be held
+ *
+ * @param[in] sim simulated gateway
+ * @param[in] eport external port
+ * @param[in] proto protocol
+ * @return index of entry or -1 if not found
+ */
+static int find_entry(const SimGateway_t *sim, int eport, const char *proto)
+{
+    int i;
+    for (i = 0; i < sim->size; i++)
+    {
+        if (sim->entries[i].eport == eport && strcmp(sim->entries[i].proto, proto) == 0)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Remove an entry and keep order of the others
+ * @warning Lock must be held
+ *
+ * @param[in] sim simulated gateway
+ * @param[in] i index of entry
+ */
+static void remove_entry(SimGateway_t *sim, int i)
+{
+    memmove(&sim->entries[i], &sim->entries[i + 1], (sim->size - i - 1) * sizeof(SimEntry_t));
+    sim->size--;
+}
+
+/**
+ * @brief Get remaining lease of an entry
+ *
+ * @param[in] entry entry
+ * @return remaining lease in seconds, 0 if entry never expires
+ */
+static long remaining_lease(const SimEntry_t *entry)
+{
+    long left;
+    if (entry->expire == 0)
+    {
+        return 0;
+    }
+    left = (long)(entry->expire - time(NULL));
+    return left > 0 ? left : 1;
+}
+
+int simGateway_init(SimGateway_t *sim, const SimGatewayCfg_t *cfg)
+{
+    memset(sim, 0, sizeof(SimGateway_t));
+    sim->cfg = *cfg;
+    sim->entries = malloc((cfg->capacity > 0 ? cfg->capacity : 1) * sizeof(SimEntry_t));
+    if (sim->entries == NULL)
+    {
+        return -1;
+    }
+    pthread_mutex_init(&sim->mutex, NULL);
+    return 0;
+}
+
+void simGateway_destroy(SimGateway_t *sim)
+{
+    if (sim->entries == NULL)
+    {
+        return;
+    }
+    free(sim->entries);
+    sim->entries = NULL;
+    pthread_mutex_destroy(&sim->mutex);
+}
+
+void simGateway_injectError(SimGateway_t *sim, SoapAction_t action, int code, int count)
+{
+    pthread_mutex_lock(&sim->mutex);
+    sim->error_code[action] = code;
+    sim->error_count[action] = count;
+    pthread_mutex_unlock(&sim->mutex);
+}
+
+int simGateway_getNumOfCalls(SimGateway_t *sim, SoapAction_t action)
+{
+    int n;
+    pthread_mutex_lock(&sim->mutex);
+    n = sim->num_of_calls[action];
+    pthread_mutex_unlock(&sim->mutex);
+    return n;
+}
+
+int simGateway_addPortMapping(SimGateway_t *sim, const char *extPort, const char *inPort,
+                              const char *inClient, const char *desc, const char *proto,
+                              const char *leaseDuration)
+{
+    int i;
+    long lease = strtol(leaseDuration, NULL, 10);
+    int r = begin_call(sim, SOAP_ADD_PORT_MAPPING);
+    if (r != 0)
+    {
+        return r;
+    }
+
+    pthread_mutex_lock(&sim->mutex);
+    i = find_entry(sim, atoi(extPort), proto);
+    if (i >= 0 && strcmp(sim->entries[i].client, inClient) != 0)
+    {
+        r = 718; // ConflictInMappingEntry
+    }
+    else if (i < 0 && sim->size == sim->cfg.capacity)
+    {
+        r = 728; // NoPortMapsAvailable
+    }
+    else
+    {
+        SimEntry_t *entry;
+        if (i < 0)
+        {
+            i = sim->size++;
+        }
+        entry = &sim->entries[i];
+        entry->eport = atoi(extPort);
+        snprintf(entry->proto, sizeof(entry->proto), "%s", proto);
+        snprintf(entry->iport, sizeof(entry->iport), "%s", inPort);
+        snprintf(entry->client, sizeof(entry->client), "%s", inClient);
+        snprintf(entry->desc, sizeof(entry->desc), "%s", desc);
+        entry->expire = lease > 0 ? time(NULL) + lease : 0;
+    }
+    pthread_mutex_unlock(&sim->mutex);
+    return r;
+}
+
+int simGateway_deletePortMapping(SimGateway_t *sim, const char *extPort, const char *proto)
+{
+    int i;
+    int r = begin_call(sim, SOAP_DELETE_PORT_MAPPING);
+    if (r != 0)
+    {
+        return r;
+    }
+
+    pthread_mutex_lock(&sim->mutex);
+    i = find_entry(sim, atoi(extPort), proto);
+    if (i < 0)
+    {
+        r = 714; // NoSuchEntryInArray
+    }
+    else
+    {
+        remove_entry(sim, i);
+    }
+    pthread_mutex_unlock(&sim->mutex);
+    return r;
+}
+
+int simGateway_deletePortMappingRange(SimGateway_t *sim, const char *startPort, const char *endPort,
+                                      const char *proto, const char *manage, const char *caller)
+{
+    int i;
+    int start = atoi(startPort);
+    int end = atoi(endPort);
+    int all_clients = (strcmp(manage, "1") == 0);
+    int removed = 0;
+    int r = begin_call(sim, SOAP_DELETE_PORT_MAPPING_RANGE);
+    if (r != 0)
+    {
+        return r;
+    }
+    if (!sim->cfg.igdv2)
+    {
+        return 401; // Invalid Action
+    }
+
+    pthread_mutex_lock(&sim->mutex);
+    for (i = sim->size - 1; i >= 0; i--)
+    {
+        if (sim->entries[i].eport >= start && sim->entries[i].eport <= end &&
+            strcmp(sim->entries[i].proto, proto) == 0 &&
+            (all_clients || strcmp(sim->entries[i].client, caller) == 0))
+        {
+            remove_entry(sim, i);
+            removed++;
+        }
+    }
+    pthread_mutex_unlock(&sim->mutex);
+    return removed > 0 ? UPNPCOMMAND_SUCCESS : 730; // PortMappingNotFound
+}
+
+int simGateway_getGenericPortMappingEntry(SimGateway_t *sim, const char *index, char *extPort,
+                                          char *intClient, char *intPort, char *protocol,
+                                          char *desc, char *duration)
+{
+    int i = atoi(index);
+    int r = begin_call(sim, SOAP_GET_GENERIC_PORT_MAPPING_ENTRY);
+    if (r != 0)
+    {
+        return r;
+    }
+
+    pthread_mutex_lock(&sim->mutex);
+    if (i < 0 || i >= sim->size)
+    {
+        r = 713; // SpecifiedArrayIndexInvalid
+    }
+    else
+    {
+        const SimEntry_t *entry = &sim->entries[i];
+        snprintf(extPort, 6, "%d", entry->eport);
+        strcpy(intClient, entry->client);
+        strcpy(intPort, entry->iport);
+        strcpy(protocol, entry->proto);
+        strcpy(desc, entry->desc);
+        snprintf(duration, 16, "%ld", remaining_lease(entry));
+    }
+    pthread_mutex_unlock(&sim->mutex);
+    return r;
+}
+
+int simGateway_getListOfPortMappings(SimGateway_t *sim, const char *startPort, const char *endPort,
+                                     const char *proto, const char *numberOfPorts,
+                                     portMappingHandler handler, void *arg, int *count)
+{
+    int i;
+    int start = atoi(startPort);
+    int end = atoi(endPort);
+    int max = atoi(numberOfPorts);
+    SoapPortMapping_t pm;
+    int r = begin_call(sim, SOAP_GET_LIST_OF_PORT_MAPPINGS);
+    if (r != 0)
+    {
+        return r;
+    }
+    if (!sim->cfg.igdv2)
+    {
+        return 401; // Invalid Action
+    }
+
+    *count = 0;
+    pthread_mutex_lock(&sim->mutex);
+    for (i = 0; i < sim->size && *count < max; i++)
+    {
+        const SimEntry_t *entry = &sim->entries[i];
+        if (entry->eport < start || entry->eport > end || strcmp(entry->proto, proto) != 0)
+        {
+            continue;
+        }
+        snprintf(pm.extPort, sizeof(pm.extPort), "%d", entry->eport);
+        strcpy(pm.intClient, entry->client);
+        strcpy(pm.intPort, entry->iport);
+        strcpy(pm.protocol, entry->proto);
+        strcpy(pm.desc, entry->desc);
+        snprintf(pm.duration, sizeof(pm.duration), "%ld", remaining_lease(entry));
+        handler(&pm, arg);
+        (*count)++;
+    }
+    pthread_mutex_unlock(&sim->mutex);
+    return *count > 0 ? UPNPCOMMAND_SUCCESS : 730; // PortMappingNotFound
+}
+
+int simGateway_getExternalIPAddress(SimGateway_t *sim, char *extIpAdd)
+{
+    int r = begin_call(sim, SOAP_GET_EXTERNAL_IP_ADDRESS);
+    if (r == 0)
+    {
+        strcpy(extIpAdd, SIM_EXTERNAL_ADDRESS);
+    }
+    return r;
+}
@@ -0,0 +1,135 @@
+/**
+ * @file upnp_pf_simgw.h
+ * @brief In-memory simulated gateway
+ * @details Answer the port mapping actions of WAN connection service from an
+ * in-memory table, like a UPnP IGD would, with a configurable table capacity,
+ * per-call latency and injected errors. It's used to measure reconcile cost
+ * and retry behaviour without a real router. Simulated gateway is thread safe.
+ *
+ * @author Pham Ngoc Thang (thangdc94)
+ * @bug No known bug
+ */
+
+#ifndef __UPNP_PF_SIMGW_H_
+#define __UPNP_PF_SIMGW_H_
+
+#include <pthread.h>
+#include <time.h>
+
+#include "upnp_pf_soap.h"
+
+/** Injected error which makes a call time out */
+#define SIM_TIMEOUT 1
+
+/** Entry of simulated port mapping table */
+typedef struct _SimEntry_t
+{
+    int eport;          /**< external port */
+    char proto[4];      /**< protocol */
+    char iport[6];      /**< internal port */
+    char client[40];    /**< internal client ip address */
+    char desc[80];      /**< port mapping description */
+    time_t expire;      /**< expire time, 0 never */
+} SimEntry_t;
+
+/** Config of simulated gateway */
+typedef struct _SimGatewayCfg_t
+{
+    int capacity;   /**< max number of entries */
+    int latency_us; /**< time spent by each call in us */
+    int timeout_ms; /**< time spent by a call which times out in ms */
+    int igdv2;      /**< 1 to support IGDv2 actions */
+} SimGatewayCfg_t;
+
+/** Simulated gateway */
+typedef struct _SimGateway_t
+{
+    SimGatewayCfg_t cfg;                      /**< config */
+    SimEntry_t *entries;                      /**< port mapping table */
+    int size;                                 /**< number of entries */
+    int error_code[SOAP_NUM_OF_ACTIONS];      /**< error injected in each action */
+    int error_count[SOAP_NUM_OF_ACTIONS];     /**< number of calls which still fail */
+    int num_of_calls[SOAP_NUM_OF_ACTIONS];    /**< number of calls of each action */
+    pthread_mutex_t mutex;                    /**< protect all fields */
+} SimGateway_t;
+
+/**
+ * @brief Init simulated gateway
+ * @warning Need to call ::simGateway_destroy()
+ *
+ * @param[out] sim simulated gateway
+ * @param[in] cfg config
+ * @return 0 if OK and -1 if failed
+ */
+int simGateway_init(SimGateway_t *sim, const SimGatewayCfg_t *cfg);
+
+/**
+ * @brief Destroy simulated gateway
+ *
+ * @param[in] sim simulated gateway
+ */
+void simGateway_destroy(SimGateway_t *sim);
+
+/**
+ * @brief Inject an error
+ * @details The next @p count calls of @p action fail with @p code
+ *
+ * @param[in] sim simulated gateway
+ * @param[in] action action
+ * @param[in] code UPnP error code or ::SIM_TIMEOUT
+ * @param[in] count number of failed calls
+ */
+void simGateway_injectError(SimGateway_t *sim, SoapAction_t action, int code, int count);
+
+/**
+ * @brief Get number of calls of an action
+ *
+ * @param[in] sim simulated gateway
+ * @param[in] action action
+ * @return number of calls since init
+ */
+int simGateway_getNumOfCalls(SimGateway_t *sim, SoapAction_t action);
+
+/**
+ * @brief AddPortMapping
+ * @details Fail with 718 if external port is mapped to another client and
+ * with 728 if table is full
+ */
+int simGateway_addPortMapping(SimGateway_t *sim, const char *extPort, const char *inPort,
+                              const char *inClient, const char *desc, const char *proto,
+                              const char *leaseDuration);
+
+/**
+ * @brief DeletePortMapping
+ */
+int simGateway_deletePortMapping(SimGateway_t *sim, const char *extPort, const char *proto);
+
+/**
+ * @brief DeletePortMappingRange (IGDv2)
+ * @details Unless @p manage is "1", only entries of @p caller are deleted,
+ * like a gateway which only lets a control point delete its own mappings
+ * @param[in] caller ip address of control point which sends the request
+ */
+int simGateway_deletePortMappingRange(SimGateway_t *sim, const char *startPort, const char *endPort,
+                                      const char *proto, const char *manage, const char *caller);
+
+/**
+ * @brief GetGenericPortMappingEntry
+ */
+int simGateway_getGenericPortMappingEntry(SimGateway_t *sim, const char *index, char *extPort,
+                                          char *intClient, char *intPort, char *protocol,
+                                          char *desc, char *duration);
+
+/**
+ * @brief GetListOfPortMappings (IGDv2)
+ */
+int simGateway_getListOfPortMappings(SimGateway_t *sim, const char *startPort, const char *endPort,
+                                     const char *proto, const char *numberOfPorts,
+                                     portMappingHandler handler, void *arg, int *count);
+
+/**
+ * @brief GetExternalIPAddress
+ */
+int simGateway_getExternalIPAddress(SimGateway_t *sim, char *extIpAdd);
+
+#endif //__UPNP_PF_SIMGW_H_
@@ -0,0 +1,257 @@
+/**
+ * @file upnp_pf_soap.c
+ * @brief Implement SOAP commands of WAN connection service
+ * @details Fill SOAP envelopes from precompiled templates, send them with
+ * ::soapTransport_post() and read response fields in place.
+ *
+ * @author Pham Ngoc Thang (thangdc94)
+ * @bug No known bug
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "upnp_pf_soap.h"
+#include "logutil.h"
+
+/** Size of envelope buffer, values of our actions are short */
+#define ENVELOPE_SIZE 2048
+
+/**
+ * @brief Send a SOAP action
+ * @details Fill envelope of @p action with its argument values and post it
+ *
+ * @param[in] transport transport to control URL
+ * @param[in] codec envelope templates
+ * @param[in] action action
+ * @param[in] values argument values
+ * @param[out] response_len size of response body
+ * @param[out] status HTTP status code
+ * @return response body or NULL if failed
+ * @warning You need to free() returned response after use it
+ */
+static char *soap_call(SoapTransport_t *transport, const SoapCodec_t *codec, SoapAction_t action,
+                       const char *const values[], int *response_len, int *status)
+{
+    char body[ENVELOPE_SIZE];
+    char *response = NULL;
+    int len = soapCodec_fill(codec, action, values, body, sizeof(body));
+    if (len < 0)
+    {
+        return NULL;
+    }
+    if (soapTransport_post(transport, soapCodec_soapAction(codec, action), body, len,
+                           &response, response_len, status) != 0)
+    {
+        response = NULL;
+    }
+    return response;
+}
+
+/**
+ * @brief Get result of a SOAP action
+ * @details Check UPnP error code and HTTP status of response
+ *
+ * @param[in] response response body
+ * @param[in] response_len size of response body
+ * @param[in] status HTTP status code
+ * @return UPNPCOMMAND_SUCCESS or error code
+ */
+static int get_result(const char *response, int response_len, int status)
+{
+    int error_code = soapCodec_getErrorCode(response, response + response_len);
+    if (error_code != 0)
+    {
+        return error_code;
+    }
+    if (status != 200)
+    {
+        return UPNPCOMMAND_UNKNOWN_ERROR;
+    }
+    return UPNPCOMMAND_SUCCESS;
+}
+
+/**
+ * @brief Run a SOAP action without output arguments
+ *
+ * @param[in] transport transport to control URL
+ * @param[in] codec envelope templates
+ * @param[in] action action
+ * @param[in] values argument values
+ * @return UPNPCOMMAND_SUCCESS or error code
+ */
+static int soap_command(SoapTransport_t *transport, const SoapCodec_t *codec, SoapAction_t action,
+                        const char *const values[])
+{
+    int r;
+    int len;
+    int status;
+    char *response = soap_call(transport, codec, action, values, &len, &status);
+    if (response == NULL)
+    {
+        return UPNPCOMMAND_HTTP_ERROR;
+    }
+    r = get_result(response, len, status);
+    free(response);
+    return r;
+}
+
+/**
+ * @brief Get port listing from GetListOfPortMappings response
+ * @details Find content of NewPortListing element. It is sent either as a
+ * CDATA section or as escaped XML, which is unescaped in place.
+ *
+ * @param[in,out] response response body
+ * @param[in] response_len size of response body
+ * @param[out] listing_end end of listing
+ * @return start of listing or NULL if not found
+ */
+static char *get_port_listing(char *response, int response_len, char **listing_end)
+{
+    const char *value;
+    const char *value_end;
+    char *begin;
+    char *end;
+
+    if (soapCodec_findElement(response, response + response_len, "NewPortListing",
+                              &value, &value_end) != 0)
+    {
+        return NULL;
+    }
+    // value points into response, which is writable
+    begin = (char *)value;
+    end = (char *)value_end;
+    if (end - begin >= 12 && strncmp(begin, "<![CDATA[", 9) == 0 && strncmp(end - 3, "]]>", 3) == 0)
+    {
+        *listing_end = end - 3;
+        return begin + 9;
+    }
+    *listing_end = soapCodec_unescape(begin, end);
+    return begin;
+}
+
+int upnpSoap_addPortMapping(SoapTransport_t *transport, const SoapCodec_t *codec,
+                            const char *extPort, const char *inPort, const char *inClient,
+                            const char *desc, const char *proto, const char *leaseDuration)
+{
+    const char *const values[] = {"", extPort, proto, inPort, inClient, "1", desc, leaseDuration};
+    return soap_command(transport, codec, SOAP_ADD_PORT_MAPPING, values);
+}
+
+int upnpSoap_deletePortMapping(SoapTransport_t *transport, const SoapCodec_t *codec,
+                               const char *extPort, const char *proto)
+{
+    const char *const values[] = {"", extPort, proto};
+    return soap_command(transport, codec, SOAP_DELETE_PORT_MAPPING, values);
+}
+
+int upnpSoap_deletePortMappingRange(SoapTransport_t *transport, const SoapCodec_t *codec,
+                                    const char *startPort, const char *endPort,
+                                    const char *proto, const char *manage)
+{
+    const char *const values[] = {startPort, endPort, proto, manage};
+    return soap_command(transport, codec, SOAP_DELETE_PORT_MAPPING_RANGE, values);
+}
+
+int upnpSoap_getGenericPortMappingEntry(SoapTransport_t *transport, const SoapCodec_t *codec,
+                                        const char *index, char *extPort, char *intClient,
+                                        char *intPort, char *protocol, char *desc, char *duration)
+{
+    int r;
+    int len;
+    int status;
+    const char *const values[] = {index};
+    char *response = soap_call(transport, codec, SOAP_GET_GENERIC_PORT_MAPPING_ENTRY, values,
+                               &len, &status);
+    if (response == NULL)
+    {
+        return UPNPCOMMAND_HTTP_ERROR;
+    }
+    r = get_result(response, len, status);
+    if (r == UPNPCOMMAND_SUCCESS)
+    {
+        const char *end = response + len;
+        soapCodec_copyValue(response, end, "NewExternalPort", extPort, 6);
+        soapCodec_copyValue(response, end, "NewInternalClient", intClient, 40);
+        soapCodec_copyValue(response, end, "NewInternalPort", intPort, 6);
+        soapCodec_copyValue(response, end, "NewProtocol", protocol, 4);
+        soapCodec_copyValue(response, end, "NewPortMappingDescription", desc, 80);
+        soapCodec_copyValue(response, end, "NewLeaseDuration", duration, 16);
+    }
+    free(response);
+    return r;
+}
+
+int upnpSoap_getListOfPortMappings(SoapTransport_t *transport, const SoapCodec_t *codec,
+                                   const char *startPort, const char *endPort, const char *proto,
+                                   const char *numberOfPorts, portMappingHandler handler, void *arg,
+                                   int *count)
+{
+    int r;
+    int len;
+    int status;
+    char *listing;
+    char *listing_end;
+    const char *const values[] = {startPort, endPort, proto, "1", numberOfPorts};
+    char *response = soap_call(transport, codec, SOAP_GET_LIST_OF_PORT_MAPPINGS, values,
+                               &len, &status);
+    *count = 0;
+    if (response == NULL)
+    {
+        return UPNPCOMMAND_HTTP_ERROR;
+    }
+
+    listing = get_port_listing(response, len, &listing_end);
+    if (listing != NULL)
+    {
+        const char *entry;
+        const char *entry_end;
+        const char *p = listing;
+        while (soapCodec_findElement(p, listing_end, "PortMappingEntry", &entry, &entry_end) == 0)
+        {
+            SoapPortMapping_t pm;
+            soapCodec_copyValue(entry, entry_end, "NewExternalPort", pm.extPort, sizeof(pm.extPort));
+            soapCodec_copyValue(entry, entry_end, "NewInternalClient", pm.intClient, sizeof(pm.intClient));
+            soapCodec_copyValue(entry, entry_end, "NewInternalPort", pm.intPort, sizeof(pm.intPort));
+            soapCodec_copyValue(entry, entry_end, "NewProtocol", pm.protocol, sizeof(pm.protocol));
+            soapCodec_copyValue(entry, entry_end, "NewDescription", pm.desc, sizeof(pm.desc));
+            soapCodec_copyValue(entry, entry_end, "NewLeaseTime", pm.duration, sizeof(pm.duration));
+            handler(&pm, arg);
+            (*count)++;
+            p = entry_end;
+        }
+        r = UPNPCOMMAND_SUCCESS;
+    }
+    else
+    {
+        r = get_result(response, len, status);
+        if (r == UPNPCOMMAND_SUCCESS)
+        {
+            r = UPNPCOMMAND_INVALID_RESPONSE;
+        }
+    }
+    free(response);
+    return r;
+}
+
+int upnpSoap_getExternalIPAddress(SoapTransport_t *transport, const SoapCodec_t *codec,
+                                  char *extIpAdd)
+{
+    int r;
+    int len;
+    int status;
+    char *response = soap_call(transport, codec, SOAP_GET_EXTERNAL_IP_ADDRESS, NULL,
+                               &len, &status);
+    if (response == NULL)
+    {
+        return UPNPCOMMAND_HTTP_ERROR;
+    }
+    r = get_result(response, len, status);
+    if (r == UPNPCOMMAND_SUCCESS)
+    {
+        soapCodec_copyValue(response, response + len, "NewExternalIPAddress", extIpAdd, 40);
+    }
+    free(response);
+    return r;
+}
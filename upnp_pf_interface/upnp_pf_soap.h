@@ -0,0 +1,132 @@
+/**
+ * @file upnp_pf_soap.h
+ * @brief SOAP commands of WAN connection service
+ * @details Port mapping commands sent through a ::SoapTransport_t so they reuse
+ * keep-alive connections. Envelopes are filled from ::SoapCodec_t templates on
+ * the stack. Return codes are the same as miniupnpc commands:
+ * UPNPCOMMAND_SUCCESS, a UPnP error code (> 0) or UPNPCOMMAND_* error (< 0).
+ *
+ * @author Pham Ngoc Thang (thangdc94)
+ * @bug No known bug
+ */
+
+#ifndef __UPNP_PF_SOAP_H_
+#define __UPNP_PF_SOAP_H_
+
+#include <miniupnpc/upnpcommands.h>
+
+#include "upnp_pf_transport.h"
+#include "upnp_pf_soapcodec.h"
+
+/** Port mapping entry returned by GetListOfPortMappings */
+typedef struct _SoapPortMapping_t
+{
+    char extPort[6];    /**< external port */
+    char intClient[40]; /**< internal client ip address */
+    char intPort[6];    /**< internal port */
+    char protocol[4];   /**< protocol */
+    char desc[80];      /**< port mapping description */
+    char duration[16];  /**< remaining lease duration */
+} SoapPortMapping_t;
+
+/**
+ * @brief Handle an entry of port listing
+ *
+ * @param[in] entry port mapping entry
+ * @param[in] arg user argument
+ */
+typedef void (*portMappingHandler)(const SoapPortMapping_t *entry, void *arg);
+
+/**
+ * @brief AddPortMapping
+ *
+ * @param[in] transport transport to control URL
+ * @param[in] codec envelope templates of WAN connection service
+ * @param[in] extPort external port
+ * @param[in] inPort internal port
+ * @param[in] inClient internal client ip address
+ * @param[in] desc port mapping description
+ * @param[in] proto protocol "TCP" or "UDP"
+ * @param[in] leaseDuration lease duration in seconds
+ * @return UPNPCOMMAND_SUCCESS or error code
+ */
+int upnpSoap_addPortMapping(SoapTransport_t *transport, const SoapCodec_t *codec,
+                            const char *extPort, const char *inPort, const char *inClient,
+                            const char *desc, const char *proto, const char *leaseDuration);
+
+/**
+ * @brief DeletePortMapping
+ *
+ * @param[in] transport transport to control URL
+ * @param[in] codec envelope templates of WAN connection service
+ * @param[in] extPort external port
+ * @param[in] proto protocol "TCP" or "UDP"
+ * @return UPNPCOMMAND_SUCCESS or error code
+ */
+int upnpSoap_deletePortMapping(SoapTransport_t *transport, const SoapCodec_t *codec,
+                               const char *extPort, const char *proto);
+
+/**
+ * @brief DeletePortMappingRange (IGDv2)
+ *
+ * @param[in] transport transport to control URL
+ * @param[in] codec envelope templates of WAN connection service
+ * @param[in] startPort first external port of range
+ * @param[in] endPort last external port of range
+ * @param[in] proto protocol "TCP" or "UDP"
+ * @param[in] manage "1" to remove entries of other clients too, "0" if not
+ * @return UPNPCOMMAND_SUCCESS or error code
+ */
+int upnpSoap_deletePortMappingRange(SoapTransport_t *transport, const SoapCodec_t *codec,
+                                    const char *startPort, const char *endPort,
+                                    const char *proto, const char *manage);
+
+/**
+ * @brief GetGenericPortMappingEntry
+ *
+ * @param[in] transport transport to control URL
+ * @param[in] codec envelope templates of WAN connection service
+ * @param[in] index index of entry in port mapping table
+ * @param[out] extPort external port, 6 bytes
+ * @param[out] intClient internal client ip address, 40 bytes
+ * @param[out] intPort internal port, 6 bytes
+ * @param[out] protocol protocol, 4 bytes
+ * @param[out] desc port mapping description, 80 bytes
+ * @param[out] duration remaining lease duration, 16 bytes
+ * @return UPNPCOMMAND_SUCCESS or error code
+ */
+int upnpSoap_getGenericPortMappingEntry(SoapTransport_t *transport, const SoapCodec_t *codec,
+                                        const char *index, char *extPort, char *intClient,
+                                        char *intPort, char *protocol, char *desc, char *duration);
+
+/**
+ * @brief GetListOfPortMappings (IGDv2)
+ *
+ * @param[in] transport transport to control URL
+ * @param[in] codec envelope templates of WAN connection service
+ * @param[in] startPort first external port of range
+ * @param[in] endPort last external port of range
+ * @param[in] proto protocol "TCP" or "UDP"
+ * @param[in] numberOfPorts max number of entries to return
+ * @param[in] handler called for each entry of listing
+ * @param[in] arg user argument of @p handler
+ * @param[out] count number of entries in listing
+ * @return UPNPCOMMAND_SUCCESS or error code
+ */
+int upnpSoap_getListOfPortMappings(SoapTransport_t *transport, const SoapCodec_t *codec,
+                                   const char *startPort, const char *endPort, const char *proto,
+                                   const char *numberOfPorts, portMappingHandler handler, void *arg,
+                                   int *count);
+
+/**
+ * @brief GetExternalIPAddress
+ *
+ * @param[in] transport transport to control URL
+ * @param[in] codec envelope templates of WAN connection service
+ * @param[out] extIpAdd external ip address, 40 bytes
+ * @return UPNPCOMMAND_SUCCESS or error code
+ */
+int upnpSoap_getExternalIPAddress(SoapTransport_t *transport, const SoapCodec_t *codec,
+                                  char *extIpAdd);
+
+#endif //__UPNP_PF_SOAP_H_
@@ -0,0 +1,375 @@
+/**
+ * @file upnp_pf_soapcodec.c
+ * @brief Implement SOAP envelope templates and response scanner
+ *
+ * @author Pham Ngoc Thang (thangdc94)
+ * @bug No known bug
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "upnp_pf_soapcodec.h"
+
+/** Number of elements of an array */
+#define ARRAY_SIZE(a) ((int)(sizeof(a) / sizeof((a)[0])))
+
+/** SOAP envelope before action element */
+#define SOAP_PREFIX                                                      \
+    "<?xml version=\"1.0\"?>\r\n"                                        \
+    "<s:Envelope xmlns:s=\"http://schemas.xmlsoap.org/soap/envelope/\" " \
+    "s:encodingStyle=\"http://schemas.xmlsoap.org/soap/encoding/\">"     \
+    "<s:Body>"
+
+/** SOAP envelope after action element */
+#define SOAP_SUFFIX "</s:Body></s:Envelope>\r\n"
+
+/** Name and arguments of an action */
+typedef struct _ActionDef_t
+{
+    const char *name;                    /**< action name */
+    const char *args[SOAP_MAX_ARGS + 1]; /**< argument names, NULL terminated */
+} ActionDef_t;
+
+/** Definition of each ::SoapAction_t */
+static const ActionDef_t g_actions[SOAP_NUM_OF_ACTIONS] = {
+    [SOAP_ADD_PORT_MAPPING] = {"AddPortMapping",
+                               {"NewRemoteHost", "NewExternalPort", "NewProtocol",
+                                "NewInternalPort", "NewInternalClient", "NewEnabled",
+                                "NewPortMappingDescription", "NewLeaseDuration"}},
+    [SOAP_DELETE_PORT_MAPPING] = {"DeletePortMapping",
+                                  {"NewRemoteHost", "NewExternalPort", "NewProtocol"}},
+    [SOAP_DELETE_PORT_MAPPING_RANGE] = {"DeletePortMappingRange",
+                                        {"NewStartPort", "NewEndPort", "NewProtocol",
+                                         "NewManage"}},
+    [SOAP_GET_GENERIC_PORT_MAPPING_ENTRY] = {"GetGenericPortMappingEntry",
+                                             {"NewPortMappingIndex"}},
+    [SOAP_GET_LIST_OF_PORT_MAPPINGS] = {"GetListOfPortMappings",
+                                        {"NewStartPort", "NewEndPort", "NewProtocol",
+                                         "NewManage", "NewNumberOfPorts"}},
+    [SOAP_GET_EXTERNAL_IP_ADDRESS] = {"GetExternalIPAddress", {NULL}},
+};
+
+/**
+ * @brief Append formatted text to template storage
+ * @details If @p storage is NULL nothing is written, only length is computed
+ *
+ * @param[out] storage template storage, can be NULL
+ * @param[in] used number of bytes already used in storage
+ * @param[in] fmt format string
+ * @return number of appended bytes without terminating null
+ */
+static int append(char *storage, int used, const char *fmt, ...)
+{
+    int n;
+    va_list ap;
+    va_start(ap, fmt);
+    if (storage == NULL)
+    {
+        n = vsnprintf(NULL, 0, fmt, ap);
+    }
+    else
+    {
+        n = vsprintf(storage + used, fmt, ap);
+    }
+    va_end(ap);
+    return n;
+}
+
+/**
+ * @brief Compile template of an action
+ * @details Write SOAPAction value and fixed parts of envelope into @p storage.
+ * Part 0 opens action and first argument, part i closes argument i - 1 and
+ * opens argument i, last part closes action. If @p storage is NULL only the
+ * needed size is computed.
+ *
+ * @param[in] def action definition
+ * @param[in] servicetype service type
+ * @param[out] tpl template, can be NULL when computing size
+ * @param[out] storage memory of template, can be NULL
+ * @return number of bytes used in storage
+ */
+static int compile_template(const ActionDef_t *def, const char *servicetype,
+                            SoapTemplate_t *tpl, char *storage)
+{
+    int i;
+    int used = 0;
+    int part_start;
+    int fixed_len = 0;
+
+    used += append(storage, used, "%s#%s", servicetype, def->name) + 1;
+
+    part_start = used;
+    used += append(storage, used, SOAP_PREFIX "<u:%s xmlns:u=\"%s\">", def->name, servicetype);
+    for (i = 0; def->args[i] != NULL; i++)
+    {
+        if (i > 0)
+        {
+            used += append(storage, used, "</%s>", def->args[i - 1]);
+        }
+        used += append(storage, used, "<%s>", def->args[i]);
+        if (tpl)
+        {
+            tpl->parts[i] = storage + part_start;
+            tpl->part_len[i] = used - part_start;
+        }
+        fixed_len += used - part_start;
+        part_start = used;
+    }
+    if (i > 0)
+    {
+        used += append(storage, used, "</%s>", def->args[i - 1]);
+    }
+    used += append(storage, used, "</u:%s>" SOAP_SUFFIX, def->name);
+    fixed_len += used - part_start;
+
+    if (tpl)
+    {
+        tpl->soap_action = storage;
+        tpl->parts[i] = storage + part_start;
+        tpl->part_len[i] = used - part_start;
+        tpl->num_of_args = i;
+        tpl->fixed_len = fixed_len;
+    }
+    // room for null written by last vsprintf()
+    return used + 1;
+}
+
+int soapCodec_init(SoapCodec_t *codec, const char *servicetype)
+{
+    int i;
+    int size = 0;
+    int used = 0;
+
+    memset(codec, 0, sizeof(SoapCodec_t));
+    for (i = 0; i < SOAP_NUM_OF_ACTIONS; i++)
+    {
+        size += compile_template(&g_actions[i], servicetype, NULL, NULL);
+    }
+    codec->storage = malloc(size);
+    if (codec->storage == NULL)
+    {
+        return -1;
+    }
+    for (i = 0; i < SOAP_NUM_OF_ACTIONS; i++)
+    {
+        used += compile_template(&g_actions[i], servicetype, &codec->templates[i],
+                                 codec->storage + used);
+    }
+    return 0;
+}
+
+void soapCodec_destroy(SoapCodec_t *codec)
+{
+    free(codec->storage);
+    memset(codec, 0, sizeof(SoapCodec_t));
+}
+
+int soapCodec_fill(const SoapCodec_t *codec, SoapAction_t action, const char *const values[],
+                   char *buf, int size)
+{
+    const SoapTemplate_t *tpl = &codec->templates[action];
+    int i;
+    int len = 0;
+    int fixed_left = tpl->fixed_len; /* fixed bytes not copied yet */
+
+    if (fixed_left >= size)
+    {
+        return -1;
+    }
+    for (i = 0; i <= tpl->num_of_args; i++)
+    {
+        memcpy(buf + len, tpl->parts[i], tpl->part_len[i]);
+        len += tpl->part_len[i];
+        fixed_left -= tpl->part_len[i];
+        if (i < tpl->num_of_args)
+        {
+            int n = strlen(values[i]);
+            if (len + n + fixed_left >= size)
+            {
+                return -1;
+            }
+            memcpy(buf + len, values[i], n);
+            len += n;
+        }
+    }
+    buf[len] = '\0';
+    return len;
+}
+
+const char *soapCodec_soapAction(const SoapCodec_t *codec, SoapAction_t action)
+{
+    return codec->templates[action].soap_action;
+}
+
+int soapCodec_findAction(const char *name)
+{
+    int i;
+    for (i = 0; i < SOAP_NUM_OF_ACTIONS; i++)
+    {
+        if (strcmp(g_actions[i].name, name) == 0)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Check local name of a tag
+ * @details @p tag points after '<' or "</". Namespace prefix is skipped.
+ *
+ * @param[in] tag start of tag name
+ * @param[in] end end of buffer
+ * @param[in] name local name
+ * @param[in] name_len length of local name
+ * @return pointer after tag name if it matches or NULL if not
+ */
+static const char *match_tag(const char *tag, const char *end, const char *name, int name_len)
+{
+    const char *p = tag;
+    const char *local = tag;
+
+    while (p < end && *p != '>' && *p != '/' && *p != ' ' && *p != '\t' && *p != '\r' &&
+           *p != '\n')
+    {
+        if (*p == ':')
+        {
+            local = p + 1;
+        }
+        p++;
+    }
+    if (p - local == name_len && memcmp(local, name, name_len) == 0)
+    {
+        return p;
+    }
+    return NULL;
+}
+
+int soapCodec_findElement(const char *begin, const char *end, const char *name,
+                          const char **value, const char **value_end)
+{
+    int name_len = strlen(name);
+    const char *p = begin;
+
+    while (p < end && (p = memchr(p, '<', end - p)) != NULL)
+    {
+        const char *after;
+        const char *gt;
+        int depth = 0;
+
+        p++;
+        after = match_tag(p, end, name, name_len);
+        if (after == NULL)
+        {
+            continue;
+        }
+        gt = memchr(after, '>', end - after);
+        if (gt == NULL)
+        {
+            return -1;
+        }
+        if (gt[-1] == '/')
+        {
+            // <name/> is an empty element
+            *value = gt + 1;
+            *value_end = gt + 1;
+            return 0;
+        }
+
+        // find matching close tag, same name can be nested
+        *value = gt + 1;
+        p = gt + 1;
+        while (p < end && (p = memchr(p, '<', end - p)) != NULL)
+        {
+            p++;
+            if (p < end && *p == '/')
+            {
+                if (match_tag(p + 1, end, name, name_len) != NULL)
+                {
+                    if (depth == 0)
+                    {
+                        *value_end = p - 1;
+                        return 0;
+                    }
+                    depth--;
+                }
+            }
+            else if ((after = match_tag(p, end, name, name_len)) != NULL)
+            {
+                gt = memchr(after, '>', end - after);
+                if (gt != NULL && gt[-1] != '/')
+                {
+                    depth++;
+                }
+            }
+        }
+        return -1;
+    }
+    return -1;
+}
+
+int soapCodec_copyValue(const char *begin, const char *end, const char *name, char *dst, int size)
+{
+    const char *value;
+    const char *value_end;
+    int n;
+
+    dst[0] = '\0';
+    if (soapCodec_findElement(begin, end, name, &value, &value_end) != 0)
+    {
+        return -1;
+    }
+    n = value_end - value;
+    if (n > size - 1)
+    {
+        n = size - 1;
+    }
+    memcpy(dst, value, n);
+    dst[n] = '\0';
+    return 0;
+}
+
+int soapCodec_getErrorCode(const char *begin, const char *end)
+{
+    char error_code[16];
+    if (soapCodec_copyValue(begin, end, "errorCode", error_code, sizeof(error_code)) != 0)
+    {
+        return 0;
+    }
+    return atoi(error_code);
+}
+
+char *soapCodec_unescape(char *begin, char *end)
+{
+    static const char *entities[][2] = {
+        {"&lt;", "<"}, {"&gt;", ">"}, {"&amp;", "&"}, {"&quot;", "\""}, {"&apos;", "'"}};
+    const char *src = begin;
+    char *dst = begin;
+
+    while (src < end)
+    {
+        if (*src == '&')
+        {
+            int i;
+            for (i = 0; i < ARRAY_SIZE(entities); i++)
+            {
+                int n = strlen(entities[i][0]);
+                if (end - src >= n && memcmp(src, entities[i][0], n) == 0)
+                {
+                    *dst++ = entities[i][1][0];
+                    src += n;
+                    break;
+                }
+            }
+            if (i < ARRAY_SIZE(entities))
+            {
+                continue;
+            }
+        }
+        *dst++ = *src++;
+    }
+    return dst;
+}
@@ -0,0 +1,146 @@
+/**
+ * @file upnp_pf_soapcodec.h
+ * @brief SOAP envelope templates and response scanner
+ * @details Envelopes of each action are compiled once per service type into
+ * templates which are filled in place into a caller buffer. Response fields
+ * are read straight from the receive buffer without building a DOM or a
+ * name/value list.
+ *
+ * @author Pham Ngoc Thang (thangdc94)
+ * @bug No known bug
+ */
+
+#ifndef __UPNP_PF_SOAPCODEC_H_
+#define __UPNP_PF_SOAPCODEC_H_
+
+/** Max number of arguments of an action */
+#define SOAP_MAX_ARGS 8
+
+/** Supported SOAP actions of WAN connection service */
+typedef enum _SoapAction_t
+{
+    SOAP_ADD_PORT_MAPPING,               /**< AddPortMapping */
+    SOAP_DELETE_PORT_MAPPING,            /**< DeletePortMapping */
+    SOAP_DELETE_PORT_MAPPING_RANGE,      /**< DeletePortMappingRange (IGDv2) */
+    SOAP_GET_GENERIC_PORT_MAPPING_ENTRY, /**< GetGenericPortMappingEntry */
+    SOAP_GET_LIST_OF_PORT_MAPPINGS,      /**< GetListOfPortMappings (IGDv2) */
+    SOAP_GET_EXTERNAL_IP_ADDRESS,        /**< GetExternalIPAddress */
+    SOAP_NUM_OF_ACTIONS                  /**< number of actions */
+} SoapAction_t;
+
+/** Precompiled envelope of an action */
+typedef struct _SoapTemplate_t
+{
+    char *soap_action;                    /**< value of SOAPAction header */
+    const char *parts[SOAP_MAX_ARGS + 1]; /**< fixed text around argument values */
+    int part_len[SOAP_MAX_ARGS + 1];      /**< length of each fixed part */
+    int num_of_args;                      /**< number of arguments */
+    int fixed_len;                        /**< total length of fixed parts */
+} SoapTemplate_t;
+
+/** Templates of all actions for one service type */
+typedef struct _SoapCodec_t
+{
+    SoapTemplate_t templates[SOAP_NUM_OF_ACTIONS]; /**< template of each action */
+    char *storage;                                 /**< memory of all templates */
+} SoapCodec_t;
+
+/**
+ * @brief Compile templates
+ * @details Build envelope templates of all actions for a service type
+ * @warning Need to call ::soapCodec_destroy()
+ *
+ * @param[out] codec codec
+ * @param[in] servicetype service type of WAN connection service
+ * @return 0 if OK and -1 if failed
+ */
+int soapCodec_init(SoapCodec_t *codec, const char *servicetype);
+
+/**
+ * @brief Destroy codec
+ * @details free memory of ::soapCodec_init()
+ *
+ * @param[in] codec codec
+ */
+void soapCodec_destroy(SoapCodec_t *codec);
+
+/**
+ * @brief Fill an envelope
+ * @details Copy template of @p action with argument values into @p buf
+ *
+ * @param[in] codec codec
+ * @param[in] action action
+ * @param[in] values argument values in the order of action arguments
+ * @param[out] buf output buffer
+ * @param[in] size size of output buffer
+ * @return length of envelope or -1 if buffer is too small
+ */
+int soapCodec_fill(const SoapCodec_t *codec, SoapAction_t action, const char *const values[],
+                   char *buf, int size);
+
+/**
+ * @brief Get SOAPAction header value
+ *
+ * @param[in] codec codec
+ * @param[in] action action
+ * @return value of SOAPAction header
+ */
+const char *soapCodec_soapAction(const SoapCodec_t *codec, SoapAction_t action);
+
+/**
+ * @brief Find an action by name
+ *
+ * @param[in] name action name such as "AddPortMapping"
+ * @return ::SoapAction_t or -1 if not found
+ */
+int soapCodec_findAction(const char *name);
+
+/**
+ * @brief Find an element
+ * @details Find first element named @p name in [@p begin, @p end), ignoring
+ * namespace prefix. Returned value points into the searched buffer.
+ *
+ * @param[in] begin start of buffer
+ * @param[in] end end of buffer
+ * @param[in] name local name of element
+ * @param[out] value start of element content
+ * @param[out] value_end end of element content
+ * @return 0 if found and -1 if not
+ */
+int soapCodec_findElement(const char *begin, const char *end, const char *name,
+                          const char **value, const char **value_end);
+
+/**
+ * @brief Copy content of an element
+ * @details Copy content of first element named @p name into @p dst. It's
+ * truncated if it doesn't fit. @p dst is empty if element is not found.
+ *
+ * @param[in] begin start of buffer
+ * @param[in] end end of buffer
+ * @param[in] name local name of element
+ * @param[out] dst destination buffer
+ * @param[in] size size of destination buffer
+ * @return 0 if found and -1 if not
+ */
+int soapCodec_copyValue(const char *begin, const char *end, const char *name, char *dst, int size);
+
+/**
+ * @brief Get UPnP error code of a response
+ *
+ * @param[in] begin start of response body
+ * @param[in] end end of response body
+ * @return UPnP error code or 0 if response has no error code
+ */
+int soapCodec_getErrorCode(const char *begin, const char *end);
+
+/**
+ * @brief Unescape XML text in place
+ * @details Replace predefined XML entities by their characters
+ *
+ * @param[in,out] begin start of text
+ * @param[in] end end of text
+ * @return new end of text
+ */
+char *soapCodec_unescape(char *begin, char *end);
+
+#endif //__UPNP_PF_SOAPCODEC_H_
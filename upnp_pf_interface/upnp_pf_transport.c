@@ -0,0 +1,660 @@
+/**
+ * @file upnp_pf_transport.c
+ * @brief Implement HTTP transport for SOAP requests
+ * @details Minimal HTTP/1.1 client with a pool of keep-alive connections.
+ * Responses with Content-Length, chunked encoding or ended by closing the
+ * connection are supported.
+ *
+ * @author Pham Ngoc Thang (thangdc94)
+ * @bug No known bug
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <errno.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "upnp_pf_transport.h"
+#include "logutil.h"
+
+#ifdef LOG_LEVEL
+#undef LOG_LEVEL
+#define LOG_LEVEL LOG_INFO
+#endif //LOG_LEVEL
+
+/** Initial size of receive buffer */
+#define RECV_BUFFER_SIZE 2048
+
+/**
+ * @brief Parse http URL
+ * @details Split URL into host, port and path
+ *
+ * @param[in] url http URL
+ * @param[out] host host, ::TRANSPORT_HOST_SIZE bytes
+ * @param[out] port port, ::TRANSPORT_PORT_SIZE bytes
+ * @param[out] path path, ::TRANSPORT_PATH_SIZE bytes
+ * @return 0 if OK and -1 if URL is not valid
+ */
+static int parse_url(const char *url, char *host, char *port, char *path)
+{
+    const char *p;
+    size_t n;
+
+    if (url == NULL || strncmp(url, "http://", 7) != 0)
+    {
+        return -1;
+    }
+    p = url + 7;
+    if (*p == '[') // IPv6 address
+    {
+        const char *end = strchr(p, ']');
+        if (end == NULL)
+        {
+            return -1;
+        }
+        p++;
+        n = end - p;
+        end++;
+        if (n >= TRANSPORT_HOST_SIZE)
+        {
+            return -1;
+        }
+        memcpy(host, p, n);
+        host[n] = '\0';
+        p = end;
+    }
+    else
+    {
+        n = strcspn(p, ":/");
+        if (n == 0 || n >= TRANSPORT_HOST_SIZE)
+        {
+            return -1;
+        }
+        memcpy(host, p, n);
+        host[n] = '\0';
+        p += n;
+    }
+
+    strcpy(port, "80");
+    if (*p == ':')
+    {
+        p++;
+        n = strspn(p, "0123456789");
+        if (n == 0 || n >= TRANSPORT_PORT_SIZE)
+        {
+            return -1;
+        }
+        memcpy(port, p, n);
+        port[n] = '\0';
+        p += n;
+    }
+
+    if (*p == '\0')
+    {
+        p = "/";
+    }
+    if (strlen(p) >= TRANSPORT_PATH_SIZE)
+    {
+        return -1;
+    }
+    strcpy(path, p);
+    return 0;
+}
+
+/**
+ * @brief Open a new connection
+ * @details Connect to host and port of transport
+ *
+ * @param[in] transport transport
+ * @return socket or -1 if failed
+ */
+static int open_connection(SoapTransport_t *transport)
+{
+    struct addrinfo hints;
+    struct addrinfo *res, *ai;
+    struct timeval timeout = {TRANSPORT_TIMEOUT, 0};
+    int one = 1;
+    int fd = -1;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(transport->host, transport->port, &hints, &res) != 0)
+    {
+        LOG(LOG_ERR, "getaddrinfo(%s, %s) failed", transport->host, transport->port);
+        return -1;
+    }
+    for (ai = res; ai != NULL; ai = ai->ai_next)
+    {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0)
+        {
+            continue;
+        }
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0)
+        {
+            break;
+        }
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    if (fd < 0)
+    {
+        LOG(LOG_ERR, "connect(%s, %s) failed: %s", transport->host, transport->port, strerror(errno));
+    }
+    return fd;
+}
+
+/**
+ * @brief Send all data
+ *
+ * @param[in] fd socket
+ * @param[in] data data to send
+ * @param[in] len size of data
+ * @return 0 if OK and -1 if failed
+ */
+static int send_all(int fd, const char *data, int len)
+{
+    while (len > 0)
+    {
+        ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/**
+ * @brief Find value of a header
+ * @details Case insensitive search of a header in response header block
+ *
+ * @param[in] headers header block, terminated by an empty line
+ * @param[in] headers_len size of header block
+ * @param[in] name header name without ':'
+ * @return pointer to header value or NULL if not found
+ */
+static const char *find_header(const char *headers, int headers_len, const char *name)
+{
+    const char *line = strstr(headers, "\r\n");
+    const char *end = headers + headers_len;
+    size_t name_len = strlen(name);
+
+    while (line != NULL && line + 2 < end)
+    {
+        line += 2;
+        if (strncasecmp(line, name, name_len) == 0 && line[name_len] == ':')
+        {
+            const char *value = line + name_len + 1;
+            while (*value == ' ' || *value == '\t')
+            {
+                value++;
+            }
+            return value;
+        }
+        line = strstr(line, "\r\n");
+    }
+    return NULL;
+}
+
+/**
+ * @brief Check if a header value contains a token
+ *
+ * @param[in] value header value
+ * @param[in] token token to search, case insensitive
+ * @return 1 (true) if found and 0 if not
+ */
+static int header_has_token(const char *value, const char *token)
+{
+    size_t len = strlen(token);
+    if (value == NULL)
+    {
+        return 0;
+    }
+    for (; *value != '\0' && *value != '\r'; value++)
+    {
+        if (strncasecmp(value, token, len) == 0)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Decode chunked body
+ * @details Check if chunked body is complete, then decode it in place
+ *
+ * @param[in,out] data chunked body
+ * @param[in] len size of received data
+ * @param[out] body_len size of decoded body
+ * @return 1 if body is complete and decoded, 0 if more data is needed and -1
+ * if body is not valid
+ */
+static int decode_chunked(char *data, int len, int *body_len)
+{
+    int pass;
+    for (pass = 0; pass < 2; pass++)
+    {
+        int pos = 0;
+        int out = 0;
+        while (1)
+        {
+            char *line_end;
+            long size;
+            if (pos >= len)
+            {
+                return 0;
+            }
+            line_end = memchr(data + pos, '\n', len - pos);
+            if (line_end == NULL)
+            {
+                return 0;
+            }
+            size = strtol(data + pos, NULL, 16);
+            if (size < 0)
+            {
+                return -1;
+            }
+            pos = line_end - data + 1;
+            if (size == 0)
+            {
+                // skip trailers until the empty line which ends the body
+                do
+                {
+                    line_end = memchr(data + pos, '\n', len - pos);
+                    if (line_end == NULL)
+                    {
+                        return 0;
+                    }
+                    size = line_end - (data + pos);
+                    pos = line_end - data + 1;
+                } while (size > 1);
+                break;
+            }
+            if (pos + size + 2 > len)
+            {
+                return 0;
+            }
+            if (pass == 1)
+            {
+                memmove(data + out, data + pos, size);
+            }
+            out += size;
+            pos += size + 2; // skip CRLF after chunk data
+        }
+        *body_len = out;
+    }
+    return 1;
+}
+
+/**
+ * @brief Parse a HTTP response
+ * @details Check if received data hold a whole response. Responses with
+ * Content-Length, chunked encoding or ended by closing the connection are
+ * supported. A complete chunked body is decoded in place.
+ *
+ * @param[in,out] buf received data, terminated by '\0'
+ * @param[in] len size of received data
+ * @param[in] eof 1 if peer has closed the connection
+ * @param[out] body_offset offset of body in @p buf
+ * @param[out] body_len size of body
+ * @param[out] status HTTP status code
+ * @param[out] keep_alive 1 if connection can be used again
+ * @return 1 if response is complete, 0 if more data is needed and -1 if
+ * response is not valid
+ */
+static int parse_response(char *buf, int len, int eof, int *body_offset, int *body_len,
+                          int *status, int *keep_alive)
+{
+    const char *value;
+    char *p = strstr(buf, "\r\n\r\n");
+    int header_len;
+    int content_length = -1;
+    int chunked;
+
+    if (p == NULL)
+    {
+        return eof ? -1 : 0;
+    }
+    header_len = p - buf + 4;
+    if (sscanf(buf, "HTTP/%*d.%*d %d", status) != 1)
+    {
+        return -1;
+    }
+    *body_offset = header_len;
+    *keep_alive = strncmp(buf, "HTTP/1.0", 8) != 0;
+    value = find_header(buf, header_len, "Connection");
+    if (header_has_token(value, "close"))
+    {
+        *keep_alive = 0;
+    }
+    else if (header_has_token(value, "keep-alive"))
+    {
+        *keep_alive = 1;
+    }
+    value = find_header(buf, header_len, "Transfer-Encoding");
+    chunked = header_has_token(value, "chunked");
+    value = find_header(buf, header_len, "Content-Length");
+    if (!chunked && value != NULL)
+    {
+        content_length = atoi(value);
+    }
+
+    if (chunked)
+    {
+        int r = decode_chunked(buf + header_len, len - header_len, body_len);
+        return (r == 0 && eof) ? -1 : r;
+    }
+    if (content_length >= 0)
+    {
+        if (len - header_len >= content_length)
+        {
+            *body_len = content_length;
+            return 1;
+        }
+        return eof ? -1 : 0;
+    }
+    // body ends when peer closes the connection
+    *keep_alive = 0;
+    if (eof)
+    {
+        *body_len = len - header_len;
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Read HTTP response
+ * @details Read status line, headers and body from a connection
+ *
+ * @param[in] fd socket
+ * @param[out] response response body
+ * @param[out] response_len size of response body
+ * @param[out] status HTTP status code
+ * @param[out] keep_alive 1 if connection can be used again
+ * @param[out] received number of bytes received, 0 means peer closed the
+ * connection before answering
+ * @return 0 if OK and -1 if failed
+ */
+static int read_response(int fd, char **response, int *response_len, int *status,
+                         int *keep_alive, int *received)
+{
+    int cap = RECV_BUFFER_SIZE;
+    int len = 0;
+    int body_offset = 0;
+    int body_len = 0;
+    int r = 0;
+    char *buf = malloc(cap);
+
+    *received = 0;
+    *keep_alive = 0;
+    while (buf != NULL)
+    {
+        ssize_t n;
+        if (len + 1 >= cap)
+        {
+            char *tmp = realloc(buf, cap * 2);
+            if (tmp == NULL)
+            {
+                break;
+            }
+            buf = tmp;
+            cap *= 2;
+        }
+        n = recv(fd, buf + len, cap - len - 1, 0);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n < 0)
+        {
+            break;
+        }
+        len += n;
+        *received = len;
+        buf[len] = '\0';
+        r = parse_response(buf, len, n == 0, &body_offset, &body_len, status, keep_alive);
+        if (r != 0 || n == 0)
+        {
+            break;
+        }
+    }
+
+    if (buf == NULL || r <= 0)
+    {
+        free(buf);
+        *keep_alive = 0;
+        return -1;
+    }
+    memmove(buf, buf + body_offset, body_len);
+    buf[body_len] = '\0';
+    *response = buf;
+    *response_len = body_len;
+    return 0;
+}
+
+/**
+ * @brief Take a connection from pool
+ * @details Prefer an idle connected one. Wait if all connections are busy.
+ *
+ * @param[in] transport transport
+ * @return index of connection in pool
+ */
+static int acquire_connection(SoapTransport_t *transport)
+{
+    int i;
+    int slot;
+    pthread_mutex_lock(&transport->mutex);
+    while (1)
+    {
+        slot = -1;
+        for (i = 0; i < transport->pool_size; i++)
+        {
+            if (!transport->busy[i])
+            {
+                if (transport->fds[i] >= 0)
+                {
+                    slot = i;
+                    break;
+                }
+                if (slot < 0)
+                {
+                    slot = i;
+                }
+            }
+        }
+        if (slot >= 0)
+        {
+            break;
+        }
+        pthread_cond_wait(&transport->cond, &transport->mutex);
+    }
+    transport->busy[slot] = 1;
+    pthread_mutex_unlock(&transport->mutex);
+    return slot;
+}
+
+/**
+ * @brief Give a connection back to pool
+ *
+ * @param[in] transport transport
+ * @param[in] slot index of connection in pool
+ */
+static void release_connection(SoapTransport_t *transport, int slot)
+{
+    pthread_mutex_lock(&transport->mutex);
+    if (slot >= transport->pool_size && transport->fds[slot] >= 0)
+    {
+        close(transport->fds[slot]);
+        transport->fds[slot] = -1;
+    }
+    transport->busy[slot] = 0;
+    pthread_cond_broadcast(&transport->cond);
+    pthread_mutex_unlock(&transport->mutex);
+}
+
+int soapTransport_init(SoapTransport_t *transport, const char *url, int pool_size)
+{
+    int i;
+    memset(transport, 0, sizeof(SoapTransport_t));
+    for (i = 0; i < TRANSPORT_MAX_CONNECTIONS; i++)
+    {
+        transport->fds[i] = -1;
+    }
+    pthread_mutex_init(&transport->mutex, NULL);
+    pthread_cond_init(&transport->cond, NULL);
+    transport->pool_size = 1;
+    soapTransport_setPoolSize(transport, pool_size);
+    if (parse_url(url, transport->host, transport->port, transport->path) != 0)
+    {
+        LOG(LOG_ERR, "Invalid URL: %s", url ? url : "(null)");
+        return -1;
+    }
+    return 0;
+}
+
+void soapTransport_destroy(SoapTransport_t *transport)
+{
+    int i;
+    if (transport->pool_size == 0)
+    {
+        return; // not initialized or already destroyed
+    }
+    for (i = 0; i < TRANSPORT_MAX_CONNECTIONS; i++)
+    {
+        if (transport->fds[i] >= 0)
+        {
+            close(transport->fds[i]);
+            transport->fds[i] = -1;
+        }
+    }
+    pthread_mutex_destroy(&transport->mutex);
+    pthread_cond_destroy(&transport->cond);
+    transport->pool_size = 0;
+}
+
+void soapTransport_setPoolSize(SoapTransport_t *transport, int pool_size)
+{
+    int i;
+    if (transport->pool_size == 0)
+    {
+        return; // not initialized, size is given to soapTransport_init()
+    }
+    if (pool_size < 1)
+    {
+        pool_size = 1;
+    }
+    if (pool_size > TRANSPORT_MAX_CONNECTIONS)
+    {
+        pool_size = TRANSPORT_MAX_CONNECTIONS;
+    }
+    pthread_mutex_lock(&transport->mutex);
+    transport->pool_size = pool_size;
+    for (i = pool_size; i < TRANSPORT_MAX_CONNECTIONS; i++)
+    {
+        if (!transport->busy[i] && transport->fds[i] >= 0)
+        {
+            close(transport->fds[i]);
+            transport->fds[i] = -1;
+        }
+    }
+    pthread_cond_broadcast(&transport->cond);
+    pthread_mutex_unlock(&transport->mutex);
+}
+
+int soapTransport_post(SoapTransport_t *transport, const char *soap_action,
+                       const char *body, int body_len,
+                       char **response, int *response_len, int *status)
+{
+    char header[512];
+    int header_len;
+    int attempt;
+    int ret = -1;
+    int slot = acquire_connection(transport);
+    int *fd = &transport->fds[slot];
+
+    *response = NULL;
+    *response_len = 0;
+    header_len = snprintf(header, sizeof(header),
+                          "POST %s HTTP/1.1\r\n"
+                          "Host: %s%s%s:%s\r\n"
+                          "Content-Type: text/xml; charset=\"utf-8\"\r\n"
+                          "SOAPAction: \"%s\"\r\n"
+                          "Content-Length: %d\r\n"
+                          "Connection: keep-alive\r\n"
+                          "\r\n",
+                          transport->path,
+                          strchr(transport->host, ':') ? "[" : "", transport->host,
+                          strchr(transport->host, ':') ? "]" : "", transport->port,
+                          soap_action, body_len);
+    if (header_len >= (int)sizeof(header))
+    {
+        release_connection(transport, slot);
+        return -1;
+    }
+
+    for (attempt = 0; attempt < 2; attempt++)
+    {
+        int keep_alive = 0;
+        int received = 0;
+        int reused = (*fd >= 0);
+
+        if (!reused)
+        {
+            *fd = open_connection(transport);
+            if (*fd < 0)
+            {
+                break;
+            }
+            pthread_mutex_lock(&transport->mutex);
+            transport->num_of_connects++;
+            pthread_mutex_unlock(&transport->mutex);
+        }
+
+        if (send_all(*fd, header, header_len) == 0 && send_all(*fd, body, body_len) == 0 &&
+            read_response(*fd, response, response_len, status, &keep_alive, &received) == 0)
+        {
+            if (!keep_alive)
+            {
+                close(*fd);
+                *fd = -1;
+            }
+            ret = 0;
+            break;
+        }
+
+        close(*fd);
+        *fd = -1;
+        // only a kept-alive connection closed by peer before answering is retried
+        if (!reused || received > 0)
+        {
+            LOG(LOG_ERR, "POST %s to %s:%s failed", soap_action, transport->host, transport->port);
+            break;
+        }
+        LOG(LOG_DBG, "Connection closed by peer. Reconnecting...");
+    }
+
+    release_connection(transport, slot);
+    return ret;
+}
@@ -0,0 +1,99 @@
+/**
+ * @file upnp_pf_transport.h
+ * @brief HTTP transport for SOAP requests
+ * @details Keep a small pool of HTTP/1.1 keep-alive connections to the
+ * control URL of gateway, so each SOAP request doesn't pay for a new TCP
+ * handshake and teardown. Pool is thread safe.
+ *
+ * @author Pham Ngoc Thang (thangdc94)
+ * @bug No known bug
+ */
+
+#ifndef __UPNP_PF_TRANSPORT_H_
+#define __UPNP_PF_TRANSPORT_H_
+
+#include <pthread.h>
+
+/** Max number of connections in a pool */
+#define TRANSPORT_MAX_CONNECTIONS 16
+
+/** Send and receive timeout of a connection in seconds */
+#define TRANSPORT_TIMEOUT 3
+
+/** Size of host of an URL */
+#define TRANSPORT_HOST_SIZE 64
+
+/** Size of port of an URL */
+#define TRANSPORT_PORT_SIZE 6
+
+/** Size of path of an URL */
+#define TRANSPORT_PATH_SIZE 256
+
+/** Keep-alive connection pool to one HTTP URL */
+typedef struct _SoapTransport_t
+{
+    char host[TRANSPORT_HOST_SIZE];       /**< host name or ip address of URL */
+    char port[TRANSPORT_PORT_SIZE];       /**< port of URL */
+    char path[TRANSPORT_PATH_SIZE];       /**< path of URL */
+    int fds[TRANSPORT_MAX_CONNECTIONS];   /**< socket of each connection, -1 if not connected */
+    int busy[TRANSPORT_MAX_CONNECTIONS];  /**< 1 if connection is used by a request */
+    int pool_size;                        /**< max number of connections */
+    int num_of_connects;                  /**< number of TCP connections opened so far */
+    pthread_mutex_t mutex;                /**< protect pool */
+    pthread_cond_t cond;                  /**< signaled when a connection is released */
+} SoapTransport_t;
+
+/**
+ * @brief Init transport
+ * @details Parse URL and init an empty connection pool. Connections are opened
+ * when they are needed.
+ * @warning Need to call ::soapTransport_destroy()
+ *
+ * @param[out] transport transport
+ * @param[in] url http URL such as control URL of gateway
+ * @param[in] pool_size max number of connections
+ * @return 0 if OK and -1 if URL is not valid
+ */
+int soapTransport_init(SoapTransport_t *transport, const char *url, int pool_size);
+
+/**
+ * @brief Destroy transport
+ * @details Close all connections. It does nothing if @p transport is zeroed
+ * or already destroyed.
+ *
+ * @param[in] transport transport
+ */
+void soapTransport_destroy(SoapTransport_t *transport);
+
+/**
+ * @brief Set pool size
+ * @details Change max number of connections. Extra connections are closed
+ * when they are released.
+ *
+ * @param[in] transport transport
+ * @param[in] pool_size max number of connections
+ */
+void soapTransport_setPoolSize(SoapTransport_t *transport, int pool_size);
+
+/**
+ * @brief Send a SOAP request
+ * @details POST @p body to URL of transport using an idle connection of the
+ * pool and wait for response. If all connections are busy, wait until one
+ * is released. If the peer has closed a kept-alive connection, reconnect and
+ * send again.
+ *
+ * @param[in] transport transport
+ * @param[in] soap_action value of SOAPAction header
+ * @param[in] body request body
+ * @param[in] body_len size of request body
+ * @param[out] response response body, NULL if failed
+ * @warning You need to free() @p response after use it
+ * @param[out] response_len size of response body
+ * @param[out] status HTTP status code
+ * @return 0 if OK and -1 if failed
+ */
+int soapTransport_post(SoapTransport_t *transport, const char *soap_action,
+                       const char *body, int body_len,
+                       char **response, int *response_len, int *status);
+
+#endif //__UPNP_PF_TRANSPORT_H_
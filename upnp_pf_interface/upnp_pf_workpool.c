@@ -0,0 +1,101 @@
+/**
+ * @file upnp_pf_workpool.c
+ * @brief Implement bounded pool of worker threads
+ * @details Workers take the next job index from a shared counter until all
+ * jobs are taken, so a slow job never blocks other jobs from starting.
+ *
+ * @author Pham Ngoc Thang (thangdc94)
+ * @bug No known bug
+ */
+
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "upnp_pf_workpool.h"
+#include "logutil.h"
+
+/** Shared state of a batch of jobs */
+typedef struct _WorkBatch_t
+{
+    char *jobs;            /**< array of job elements */
+    int num_of_jobs;       /**< number of job elements */
+    int job_size;          /**< size of each job element */
+    workJob fn;            /**< job function */
+    void *arg;             /**< argument of job function */
+    int *results;          /**< results in job order */
+    int next;              /**< index of next job to take */
+    pthread_mutex_t mutex; /**< protect ::WorkBatch_t::next */
+} WorkBatch_t;
+
+/**
+ * @brief Worker thread function
+ * @details Take jobs one by one and save results until no job is left
+ *
+ * @param arg pointer to ::WorkBatch_t
+ * @return void*
+ */
+static void *worker_function(void *arg)
+{
+    WorkBatch_t *batch = arg;
+    int i;
+    while (1)
+    {
+        pthread_mutex_lock(&batch->mutex);
+        i = batch->next++;
+        pthread_mutex_unlock(&batch->mutex);
+        if (i >= batch->num_of_jobs)
+        {
+            break;
+        }
+        batch->results[i] = batch->fn(batch->jobs + (size_t)i * batch->job_size, batch->arg);
+    }
+    return NULL;
+}
+
+void workPool_run(void *jobs, int num_of_jobs, int job_size, workJob fn, void *arg,
+                  int max_workers, int results[])
+{
+    WorkBatch_t batch;
+    pthread_t *threads;
+    int num_of_threads = 0;
+    int i;
+
+    batch.jobs = jobs;
+    batch.num_of_jobs = num_of_jobs;
+    batch.job_size = job_size;
+    batch.fn = fn;
+    batch.arg = arg;
+    batch.results = results;
+    batch.next = 0;
+    pthread_mutex_init(&batch.mutex, NULL);
+
+    if (max_workers > num_of_jobs)
+    {
+        max_workers = num_of_jobs;
+    }
+
+    // calling thread is one of the workers so with only one worker there's
+    // no need to create threads
+    threads = (max_workers > 1) ? malloc((max_workers - 1) * sizeof(pthread_t)) : NULL;
+    if (threads != NULL)
+    {
+        for (i = 0; i < max_workers - 1; i++)
+        {
+            if (pthread_create(&threads[num_of_threads], NULL, worker_function, &batch) != 0)
+            {
+                LOG(LOG_WARN, "Create worker thread failed. Run with %d workers", num_of_threads + 1);
+                break;
+            }
+            num_of_threads++;
+        }
+    }
+
+    worker_function(&batch);
+
+    for (i = 0; i < num_of_threads; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+    pthread_mutex_destroy(&batch.mutex);
+}
@@ -0,0 +1,43 @@
+/**
+ * @file upnp_pf_workpool.h
+ * @brief Bounded pool of worker threads
+ * @details Run independent jobs such as UPnP commands in parallel with a
+ * limited number of threads. Job results are returned in the original order.
+ *
+ * @author Pham Ngoc Thang (thangdc94)
+ * @bug No known bug
+ */
+
+#ifndef __UPNP_PF_WORKPOOL_H_
+#define __UPNP_PF_WORKPOOL_H_
+
+/**
+ * @brief Job function pointer
+ * @details This function is called from a worker thread with a pointer to
+ * one job element. It must not touch data shared with other jobs.
+ *
+ * @param[in] job pointer to job element
+ * @param[in] arg argument shared by all jobs of a batch
+ * @return result of the job
+ */
+typedef int (*workJob)(void *job, void *arg);
+
+/**
+ * @brief Run jobs in parallel
+ * @details Run @p fn for each element of @p jobs using at most @p max_workers
+ * threads and wait until all jobs are done. If threads can't be created
+ * jobs are run in the calling thread.
+ *
+ * @param[in] jobs array of job elements
+ * @param[in] num_of_jobs number of job elements
+ * @param[in] job_size size of each job element
+ * @param[in] fn job function
+ * @param[in] arg argument passed to each call of @p fn
+ * @param[in] max_workers max number of jobs run at the same time
+ * @param[out] results array of @p num_of_jobs results. results[i] is the
+ * result of job i
+ */
+void workPool_run(void *jobs, int num_of_jobs, int job_size, workJob fn, void *arg,
+                  int max_workers, int results[]);
+
+#endif //__UPNP_PF_WORKPOOL_H_
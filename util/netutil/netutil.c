@@ -63,4 +63,35 @@ char *getmac_from_ip(const char *ip)
     }
     freeifaddrs(addrs);
     return macaddr;
-}
\ No newline at end of file
+}
+
+char *get_default_gateway()
+{
+    char line[256];
+    char *gateway = NULL;
+    FILE *fp = fopen("/proc/net/route", "r");
+
+    if (fp == NULL)
+    {
+        return NULL;
+    }
+    while (gateway == NULL && fgets(line, sizeof(line), fp) != NULL)
+    {
+        char iface[IFNAMSIZ + 1];
+        unsigned int dest, gw, flags;
+        struct in_addr addr;
+        // Iface Destination Gateway Flags ..., addresses in network byte order
+        if (sscanf(line, "%16s %x %x %x", iface, &dest, &gw, &flags) == 4 &&
+            dest == 0 && (flags & 0x2 /* RTF_GATEWAY */))
+        {
+            addr.s_addr = gw;
+            gateway = malloc(INET_ADDRSTRLEN);
+            if (gateway != NULL)
+            {
+                inet_ntop(AF_INET, &addr, gateway, INET_ADDRSTRLEN);
+            }
+        }
+    }
+    fclose(fp);
+    return gateway;
+}
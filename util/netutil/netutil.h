@@ -30,4 +30,13 @@ char *getmac_from_ifname(char *iface);
  */
 char *getmac_from_ip(const char *ip);
 
+/**
+ * @brief Get IPv4 Address of default gateway
+ * @details Read default route from routing table
+ * 
+ * @return IP Address or NULL if there is no default route
+ * @warning You need to free() IP Address after use it
+ */
+char *get_default_gateway();
+
 #endif //__NET_UTIL_H_
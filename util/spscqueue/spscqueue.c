@@ -0,0 +1,92 @@
+/**
+ * @file spscqueue.c
+ * @brief Implement bounded lock-free single producer single consumer queue
+ * @details Indexes run freely and wrap around, slot of an index is
+ * index & mask. Producer publishes an element by a release store of tail
+ * after writing the slot, consumer frees a slot by a release store of head
+ * after reading it. Each side reads the index of the other side only when
+ * its cached copy says the queue is full or empty.
+ *
+ * @author Pham Ngoc Thang (thangdc94)
+ * @bug No known bug
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "spscqueue.h"
+
+int spscQueue_init(SpscQueue_t *queue, unsigned int capacity, size_t elem_size)
+{
+    unsigned int size = 1;
+
+    memset(queue, 0, sizeof(SpscQueue_t));
+    if (capacity == 0 || capacity > (1U << 30) || elem_size == 0)
+    {
+        return -1;
+    }
+    while (size < capacity)
+    {
+        size <<= 1;
+    }
+    queue->slots = malloc(size * elem_size);
+    if (queue->slots == NULL)
+    {
+        return -1;
+    }
+    queue->elem_size = elem_size;
+    queue->mask = size - 1;
+    return 0;
+}
+
+void spscQueue_destroy(SpscQueue_t *queue)
+{
+    free(queue->slots);
+    queue->slots = NULL;
+}
+
+int spscQueue_push(SpscQueue_t *queue, const void *elem)
+{
+    unsigned int tail = queue->tail; // only written by this thread
+
+    if (tail - queue->cached_head > queue->mask)
+    {
+        queue->cached_head = __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+        if (tail - queue->cached_head > queue->mask)
+        {
+            return -1;
+        }
+    }
+    memcpy(queue->slots + (tail & queue->mask) * queue->elem_size, elem, queue->elem_size);
+    __atomic_store_n(&queue->tail, tail + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+int spscQueue_pop(SpscQueue_t *queue, void *elem)
+{
+    unsigned int head = queue->head; // only written by this thread
+
+    if (head == queue->cached_tail)
+    {
+        queue->cached_tail = __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE);
+        if (head == queue->cached_tail)
+        {
+            return -1;
+        }
+    }
+    memcpy(elem, queue->slots + (head & queue->mask) * queue->elem_size, queue->elem_size);
+    __atomic_store_n(&queue->head, head + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+unsigned int spscQueue_size(SpscQueue_t *queue)
+{
+    unsigned int tail = __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE);
+    unsigned int head = __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+    return tail - head;
+}
+
+unsigned int spscQueue_capacity(const SpscQueue_t *queue)
+{
+    return queue->mask + 1;
+}
@@ -0,0 +1,91 @@
+/**
+ * @file spscqueue.h
+ * @brief Bounded lock-free single producer single consumer queue
+ * @details Ring buffer of fixed size elements shared by exactly one producer
+ * thread and one consumer thread. Push and pop never block and never take a
+ * lock: each side only writes its own index and reads the other with
+ * acquire/release ordering. Indexes live on separate cache lines so the two
+ * threads don't bounce a line on every operation.
+ *
+ * @author Pham Ngoc Thang (thangdc94)
+ * @bug No known bug
+ */
+
+#ifndef __SPSC_QUEUE_H_
+#define __SPSC_QUEUE_H_
+
+#include <stddef.h>
+
+/** Size of a cache line, indexes of both sides are kept this far apart */
+#define SPSC_CACHE_LINE 64
+
+/** Bounded single producer single consumer queue */
+typedef struct _SpscQueue_t
+{
+    char *slots;                                          /**< elements */
+    size_t elem_size;                                     /**< size of an element */
+    unsigned int mask;                                    /**< capacity - 1, capacity is a power of 2 */
+    unsigned int head __attribute__((aligned(SPSC_CACHE_LINE))); /**< next element to pop, written by consumer */
+    unsigned int cached_tail;                             /**< last tail seen by consumer */
+    unsigned int tail __attribute__((aligned(SPSC_CACHE_LINE))); /**< next slot to push, written by producer */
+    unsigned int cached_head;                             /**< last head seen by producer */
+} SpscQueue_t;
+
+/**
+ * @brief Init queue
+ * @warning Need to call ::spscQueue_destroy()
+ *
+ * @param[out] queue queue
+ * @param[in] capacity max number of elements, rounded up to a power of 2
+ * @param[in] elem_size size of an element
+ * @return 0 if OK and -1 if failed
+ */
+int spscQueue_init(SpscQueue_t *queue, unsigned int capacity, size_t elem_size);
+
+/**
+ * @brief Destroy queue
+ * @details Elements left in queue are dropped
+ *
+ * @param[in] queue queue
+ */
+void spscQueue_destroy(SpscQueue_t *queue);
+
+/**
+ * @brief Push an element
+ * @details Only called by producer thread
+ *
+ * @param[in] queue queue
+ * @param[in] elem element, copied
+ * @return 0 if OK and -1 if queue is full
+ */
+int spscQueue_push(SpscQueue_t *queue, const void *elem);
+
+/**
+ * @brief Pop oldest element
+ * @details Only called by consumer thread
+ *
+ * @param[in] queue queue
+ * @param[out] elem element
+ * @return 0 if OK and -1 if queue is empty
+ */
+int spscQueue_pop(SpscQueue_t *queue, void *elem);
+
+/**
+ * @brief Get number of elements
+ * @details Exact when called by one of both sides while the other is idle,
+ * otherwise a snapshot
+ *
+ * @param[in] queue queue
+ * @return number of elements in queue
+ */
+unsigned int spscQueue_size(SpscQueue_t *queue);
+
+/**
+ * @brief Get capacity
+ *
+ * @param[in] queue queue
+ * @return max number of elements
+ */
+unsigned int spscQueue_capacity(const SpscQueue_t *queue);
+
+#endif //__SPSC_QUEUE_H_